@@ -29,10 +29,10 @@
 	defined(CONFIG_ACORN_PARTITION_ADFS)
 static struct adfs_discrecord *
 adfs_partition(struct parsed_partitions *state, char *name, char *data,
-	       unsigned long first_sector, int slot)
+	       sector_t first_sector, int slot)
 {
 	struct adfs_discrecord *dr;
-	unsigned int nr_sects;
+	sector_t nr_sects;
 
 	if (adfs_checkbblk(data))
 		return NULL;
@@ -42,7 +42,7 @@ adfs_partition(struct parsed_partitions *state, char *name, char *data,
 	if (dr->disc_size == 0 && dr->disc_size_high == 0)
 		return NULL;
 
-	nr_sects = (le32_to_cpu(dr->disc_size_high) << 23) |
+	nr_sects = ((sector_t) le32_to_cpu(dr->disc_size_high) << 23) |
 		   (le32_to_cpu(dr->disc_size) >> 9);
 
 	if (name) {
@@ -74,8 +74,8 @@ struct riscix_record {
 #if defined(CONFIG_ACORN_PARTITION_CUMANA) || \
 	defined(CONFIG_ACORN_PARTITION_ADFS)
 static int riscix_partition(struct parsed_partitions *state,
-			    unsigned long first_sect, int slot,
-			    unsigned long nr_sects)
+			    sector_t first_sect, int slot,
+			    sector_t nr_sects)
 {
 	Sector sect;
 	struct riscix_record *rr;
@@ -88,7 +88,7 @@ static int riscix_partition(struct parsed_partitions *state,
 
 
 	if (rr->magic == RISCIX_MAGIC) {
-		unsigned long size = nr_sects > 2 ? 2 : nr_sects;
+		sector_t size = nr_sects > 2 ? 2 : nr_sects;
 		int part;
 
 		strlcat(state->pp_buf, " <", PAGE_SIZE);
@@ -129,12 +129,12 @@ struct linux_part {
 #if defined(CONFIG_ACORN_PARTITION_CUMANA) || \
 	defined(CONFIG_ACORN_PARTITION_ADFS)
 static int linux_partition(struct parsed_partitions *state,
-			   unsigned long first_sect, int slot,
-			   unsigned long nr_sects)
+			   sector_t first_sect, int slot,
+			   sector_t nr_sects)
 {
 	Sector sect;
 	struct linux_part *linuxp;
-	unsigned long size = nr_sects > 2 ? 2 : nr_sects;
+	sector_t size = nr_sects > 2 ? 2 : nr_sects;
 
 	strlcat(state->pp_buf, " [Linux]", PAGE_SIZE);
 
@@ -164,8 +164,8 @@ static int linux_partition(struct parsed_partitions *state,
 #ifdef CONFIG_ACORN_PARTITION_CUMANA
 int adfspart_check_CUMANA(struct parsed_partitions *state)
 {
-	unsigned long first_sector = 0;
-	unsigned int start_blk = 0;
+	sector_t first_sector = 0;
+	sector_t start_blk = 0;
 	Sector sect;
 	unsigned char *data;
 	char *name = "CUMANA/ADFS";
@@ -187,7 +187,7 @@ int adfspart_check_CUMANA(struct parsed_partitions *state)
 	 */
 	do {
 		struct adfs_discrecord *dr;
-		unsigned int nr_sects;
+		sector_t nr_sects;
 
 		data = read_part_sector(state, start_blk * 2 + 6, &sect);
 		if (!data)
@@ -255,7 +255,8 @@ int adfspart_check_CUMANA(struct parsed_partitions *state)
  */
 int adfspart_check_ADFS(struct parsed_partitions *state)
 {
-	unsigned long start_sect, nr_sects, sectscyl, heads;
+	sector_t start_sect, nr_sects;
+	unsigned int sectscyl, heads;
 	Sector sect;
 	unsigned char *data;
 	struct adfs_discrecord *dr;
@@ -274,7 +275,7 @@ int adfspart_check_ADFS(struct parsed_partitions *state)
 
 	heads = dr->heads + ((dr->lowsector >> 6) & 1);
 	sectscyl = dr->secspertrack * heads;
-	start_sect = ((data[0x1fe] << 8) + data[0x1fd]) * sectscyl;
+	start_sect = (sector_t) ((data[0x1fe] << 8) + data[0x1fd]) * sectscyl;
 	id = data[0x1fc] & 15;
 	put_dev_sector(sect);
 
@@ -312,7 +313,7 @@ struct ics_part {
 };
 
 static int adfspart_check_ICSLinux(struct parsed_partitions *state,
-				   unsigned long block)
+				   sector_t block)
 {
 	Sector sect;
 	unsigned char *data = read_part_sector(state, block, &sect);
@@ -0,0 +1,584 @@
+/*
+ *  fs/partitions/cache.c
+ *  Cache of the probe results
+ *
+ *  check_partition() results are kept per device and probe options,
+ *  together with a fingerprint of the metadata they were parsed from:
+ *  the capacity, sectors 0 and 1, the LDM database sequence number, the
+ *  LVM2 metadata checksum of a whole disk PV, and a checksum of every
+ *  other sector the formats tried read (EBR chains, the Mac map, the
+ *  Amiga RDB, the Acorn boot block, Atari XGM chains, nested tables read
+ *  with nested=flat...), recorded by probe_cache_read().  LDM and LVM2
+ *  are covered by their sequence numbers instead: their reads are not
+ *  recorded, so a big database doesn't fill the set.
+ *  A probe with a matching fingerprint copies the cached partitions
+ *  instead of running the parsers: the table sectors are read again but
+ *  not parsed, and an LDM database is not read at all.
+ *
+ *  A result is only cached if the fingerprint covers all the sectors it
+ *  depends on: not after a recover=scan, a failed read or too many
+ *  sectors, or if an LDM database or LVM2 PV that didn't give the result
+ *  is found.  So a device can't get the result of another one: a dev_t
+ *  reused by another disk, or a loop device bound to another image (also
+ *  told apart by the identity of their backing file), only hits if every
+ *  sector the result was read from is the same.
+ *
+ *  The cache is bounded (PROBE_CACHE_MAX_ENTRIES) and shrinkable,
+ *  and listed in <debugfs>/partsfs/probe_cache.
+ */
+
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/kref.h>
+#include <linux/spinlock.h>
+#include <linux/crc32.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+#include <linux/major.h>
+#include <linux/loop.h>
+
+#include "check.h"
+#include "cache.h"
+#include "ldm.h"
+#include "lvm.h"
+
+#define PROBE_CACHE_MAX_ENTRIES		256
+/* Size of the set of the sectors read by a probe, at most half full */
+#define PROBE_CACHE_SECTORS		4096
+
+struct probe_cache_entry {
+	struct list_head lru;		/* most recently used first */
+	struct kref ref;
+	struct partition_check_options opts;
+	struct probe_fingerprint fp;
+	sector_t *sectors;		/* read by the probe, sorted */
+	unsigned int nr_sectors;
+	u32 sectors_crc;		/* see probe_sector_crc() */
+	struct parsed_partition *parts;	/* slots 0 .. nr_slots-1 */
+	int nr_slots;
+	backup_verifier_t verify;
+	unsigned long hits;
+	unsigned long time;		/* jiffies, when inserted */
+};
+
+static LIST_HEAD(probe_cache);
+static DEFINE_SPINLOCK(probe_cache_lock);
+static int probe_cache_entries;
+static unsigned long probe_cache_hits, probe_cache_misses;
+static struct dentry *probe_cache_debugfs;
+
+/*
+ * Identify the device: for a loop device, the file it is bound to
+ * (set with LOOP_SET_FD, or replaced by LOOP_CHANGE_FD, under
+ * lo_ctl_mutex)
+ */
+static void probe_device_id(struct block_device *bdev,
+			    struct probe_fingerprint *fp)
+{
+	fp->id.dev = bdev->bd_dev;
+	if (MAJOR(bdev->bd_dev) == LOOP_MAJOR) {
+		struct loop_device *lo = bdev->bd_disk->private_data;
+		struct inode *inode;
+
+		mutex_lock(&lo->lo_ctl_mutex);
+		if (lo->lo_backing_file) {
+			inode = lo->lo_backing_file->f_mapping->host;
+			fp->id.file_dev = inode->i_sb->s_dev;
+			fp->id.ino = inode->i_ino;
+			fp->id.generation = inode->i_generation;
+			fp->mtime = inode->i_mtime;
+		}
+		mutex_unlock(&lo->lo_ctl_mutex);
+	}
+}
+
+static bool probe_device_id_equal(const struct probe_device_id *a,
+				  const struct probe_device_id *b)
+{
+	return a->dev == b->dev &&
+	       a->file_dev == b->file_dev &&
+	       a->ino == b->ino &&
+	       a->generation == b->generation;
+}
+
+/*
+ * Compute the fingerprint of the device metadata
+ * (the first two logical blocks: the MBR and the GPT header, the LDM and
+ * LVM2 sequence numbers; the other sectors are checked by the lookup)
+ * Returns 0, or -1 if the first sectors can't be read
+ */
+int probe_fingerprint(struct parsed_partitions *state,
+		      struct probe_fingerprint *fp)
+{
+	unsigned int ssz = bdev_logical_block_size(state->bdev);
+	Sector sect;
+	unsigned char *data;
+	int i;
+
+	memset(fp, 0, sizeof(*fp));
+	probe_device_id(state->bdev, fp);
+	fp->capacity = get_capacity(state->bdev->bd_disk);
+	fp->crc = ~0;
+	for (i = 0; i < 2; i++) {
+		data = read_part_lba(state, i, &sect);
+		if (!data)
+			return -1;
+		fp->crc = crc32(fp->crc, data, ssz);
+		put_dev_sector(sect);
+	}
+#ifdef CONFIG_LDM_PARTITION
+	if (!ldm_fingerprint(state, &fp->ldm_seq))
+		fp->ldm_seq = 0;
+#endif
+	if (!lvm2_fingerprint(state, &fp->lvm_seq))
+		fp->lvm_seq = 0;
+	return 0;
+}
+
+static bool probe_options_equal(const struct partition_check_options *a,
+				const struct partition_check_options *b)
+{
+	int i;
+
+	if (a->flat_nested != b->flat_nested ||
+	    a->primary_only != b->primary_only ||
+	    a->defer_verify != b->defer_verify ||
+	    a->probe_fast != b->probe_fast ||
+	    a->ldm_volumes != b->ldm_volumes ||
+	    a->ldm_all_disks != b->ldm_all_disks ||
+	    a->recover_scan != b->recover_scan ||
+	    a->nr_probes != b->nr_probes)
+		return false;
+	for (i = 0; i < a->nr_probes; i++)
+		if (a->probes[i] != b->probes[i])
+			return false;
+	return true;
+}
+
+static bool probe_fingerprint_equal(const struct probe_fingerprint *a,
+				    const struct probe_fingerprint *b)
+{
+	return timespec_equal(&a->mtime, &b->mtime) &&
+	       a->capacity == b->capacity &&
+	       a->crc == b->crc &&
+	       a->ldm_seq == b->ldm_seq &&
+	       a->lvm_seq == b->lvm_seq;
+}
+
+/*
+ * Formats with their own fingerprint (the LDM database sequence number,
+ * the LVM2 metadata checksum), their reads are not recorded
+ */
+bool probe_cache_tracks(int format)
+{
+	return format != partition_format_find("ldm") &&
+	       format != partition_format_find("lvm2");
+}
+
+/*
+ * Checksum of a 512-byte sector, with its position: the checksum of a
+ * set of sectors is the xor of theirs, whatever order they are read in
+ */
+static u32 probe_sector_crc(sector_t n, const u8 *data)
+{
+	u64 pos = n;
+
+	return crc32(crc32(~0, (const u8 *) &pos, sizeof(pos)), data, 512);
+}
+
+/*
+ * Record nr 512-byte sectors at n read by a probe (read_part_sector(),
+ * read_part_lba()), data is NULL if the read failed
+ * The sectors are kept in an open addressing set, as n + 1 (0 is free)
+ */
+void probe_cache_read(struct parsed_partitions *state, sector_t n,
+		      unsigned int nr, const void *data)
+{
+	unsigned int i, j;
+
+	if (state->table_untracked)
+		return;
+	if (!data)
+		goto untracked;
+	if (!state->table_sectors) {
+		state->table_sectors = kzalloc(PROBE_CACHE_SECTORS *
+					       sizeof(sector_t), GFP_KERNEL);
+		if (!state->table_sectors)
+			goto untracked;
+	}
+	for (i = 0; i < nr; i++) {
+		j = hash_64((u64) (n + i), ilog2(PROBE_CACHE_SECTORS));
+		while (state->table_sectors[j] &&
+		       state->table_sectors[j] != n + i + 1)
+			j = (j + 1) & (PROBE_CACHE_SECTORS - 1);
+		if (state->table_sectors[j])
+			continue;	/* Read again */
+		if (state->nr_table_sectors >= PROBE_CACHE_SECTORS / 2)
+			goto untracked;
+		state->table_sectors[j] = n + i + 1;
+		state->nr_table_sectors++;
+		state->table_crc ^= probe_sector_crc(n + i, data + (i << 9));
+	}
+	return;
+
+untracked:
+	/* The fingerprint would miss sectors, don't cache the result */
+	state->table_untracked = true;
+}
+
+/*
+ * Read the sectors a cached result was parsed from again
+ * Returns true if none of them changed
+ */
+static bool probe_sectors_unchanged(struct parsed_partitions *state,
+				    const struct probe_cache_entry *e)
+{
+	Sector sect;
+	unsigned char *data;
+	u32 crc = 0;
+	unsigned int i;
+
+	for (i = 0; i < e->nr_sectors; i++) {
+		data = read_part_sector(state, e->sectors[i], &sect);
+		if (!data)
+			return false;
+		crc ^= probe_sector_crc(e->sectors[i], data);
+		put_dev_sector(sect);
+	}
+	return crc == e->sectors_crc;
+}
+
+static int cmp_sector(const void *a, const void *b)
+{
+	sector_t sa = *(const sector_t *) a;
+	sector_t sb = *(const sector_t *) b;
+
+	if (sa != sb)
+		return sa < sb ? -1 : 1;
+	return 0;
+}
+
+static void probe_cache_release(struct kref *ref)
+{
+	struct probe_cache_entry *e =
+		container_of(ref, struct probe_cache_entry, ref);
+	int i;
+
+	for (i = 0; e->parts && i < e->nr_slots; i++) {
+		kfree(e->parts[i].info);
+		kfree(e->parts[i].extents);
+	}
+	kfree(e->parts);
+	kfree(e->sectors);
+	kfree(e);
+}
+
+static void probe_cache_put(struct probe_cache_entry *e)
+{
+	kref_put(&e->ref, probe_cache_release);
+}
+
+/* Called with probe_cache_lock held */
+static struct probe_cache_entry *
+probe_cache_find(const struct probe_device_id *id,
+		 const struct partition_check_options *opts)
+{
+	struct probe_cache_entry *e;
+
+	list_for_each_entry(e, &probe_cache, lru)
+		if (probe_device_id_equal(&e->fp.id, id) &&
+		    probe_options_equal(&e->opts, opts))
+			return e;
+	return NULL;
+}
+
+/* Called with probe_cache_lock held, the caller puts the entry */
+static void probe_cache_unlink(struct probe_cache_entry *e)
+{
+	list_del(&e->lru);
+	probe_cache_entries--;
+}
+
+/*
+ * Fill @state from the cache
+ * Returns true on a hit, false if the device must be probed
+ */
+bool probe_cache_lookup(struct parsed_partitions *state,
+			const struct probe_fingerprint *fp)
+{
+	struct probe_cache_entry *e, *stale = NULL;
+	bool hit;
+	int i;
+
+	spin_lock(&probe_cache_lock);
+	e = probe_cache_find(&fp->id, &state->opts);
+	if (e && !probe_fingerprint_equal(&e->fp, fp)) {
+		/* The metadata changed, forget the old result */
+		probe_cache_unlink(e);
+		stale = e;
+		e = NULL;
+	}
+	if (e)
+		kref_get(&e->ref);
+	spin_unlock(&probe_cache_lock);
+
+	if (stale)
+		probe_cache_put(stale);
+	stale = NULL;
+
+	/* Not under the lock: this reads the disk */
+	hit = e && probe_sectors_unchanged(state, e);
+
+	spin_lock(&probe_cache_lock);
+	/* Unless another probe replaced or dropped it meanwhile */
+	if (e && probe_cache_find(&fp->id, &state->opts) == e) {
+		if (hit) {
+			list_move(&e->lru, &probe_cache);
+			e->hits++;
+		} else {
+			probe_cache_unlink(e);
+			stale = e;
+		}
+	}
+	if (hit)
+		probe_cache_hits++;
+	else
+		probe_cache_misses++;
+	spin_unlock(&probe_cache_lock);
+
+	if (stale)
+		probe_cache_put(stale);
+	if (!hit) {
+		if (e)
+			probe_cache_put(e);
+		return false;
+	}
+
+	free_partition_slots(state);
+	if (e->nr_slots && reserve_partition_slot(state, e->nr_slots - 1))
+		goto fail;
+	for (i = 0; i < e->nr_slots; i++) {
+		state->parts[i].from = e->parts[i].from;
+		state->parts[i].size = e->parts[i].size;
+		state->parts[i].flags = e->parts[i].flags;
+		state->parts[i].nested = e->parts[i].nested;
+		if (e->parts[i].info) {
+			if (!alloc_partition_info(state, i))
+				goto fail;
+			*state->parts[i].info = *e->parts[i].info;
+		}
+		if (e->parts[i].extents) {
+			state->parts[i].extents = kmemdup(e->parts[i].extents,
+					e->parts[i].nr_extents *
+					sizeof(*e->parts[i].extents), GFP_KERNEL);
+			if (!state->parts[i].extents)
+				goto fail;
+			state->parts[i].nr_extents = e->parts[i].nr_extents;
+			state->parts[i].stripe_columns = e->parts[i].stripe_columns;
+			state->parts[i].stripe_chunk = e->parts[i].stripe_chunk;
+		}
+	}
+	state->verify = e->verify;
+	probe_cache_put(e);
+	return true;
+
+fail:
+	free_partition_slots(state);
+	probe_cache_put(e);
+	return false;
+}
+
+/*
+ * Add the result of a successful probe, found by format, to the cache
+ * (nothing is cached if the fingerprint doesn't cover all the sectors it
+ * depends on, see the top of this file, or if the copy can't be allocated)
+ */
+void probe_cache_insert(struct parsed_partitions *state,
+			const struct probe_fingerprint *fp, int format)
+{
+	struct probe_cache_entry *e, *old, *evicted = NULL;
+	unsigned int j;
+	int i;
+
+	if (state->table_untracked)
+		return;
+	/* Parsed without recording the reads, and not the result */
+	if (fp->ldm_seq && format != partition_format_find("ldm"))
+		return;
+	if (fp->lvm_seq && format != partition_format_find("lvm2"))
+		return;
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return;
+	kref_init(&e->ref);
+	e->opts = state->opts;
+	e->fp = *fp;
+	e->verify = state->verify;
+	e->time = jiffies;
+	if (state->nr_table_sectors) {
+		e->sectors = kmalloc(state->nr_table_sectors * sizeof(sector_t),
+				     GFP_KERNEL);
+		if (!e->sectors)
+			goto fail;
+		for (j = 0; j < PROBE_CACHE_SECTORS; j++)
+			if (state->table_sectors[j])
+				e->sectors[e->nr_sectors++] =
+					state->table_sectors[j] - 1;
+		/* Read again in disk order by the lookups */
+		sort(e->sectors, e->nr_sectors, sizeof(sector_t),
+		     cmp_sector, NULL);
+		e->sectors_crc = state->table_crc;
+	}
+	/* Only up to the last used slot */
+	for (i = state->nr_slots - 1; i > 0 && !state->parts[i].size; i--)
+		;
+	e->nr_slots = state->nr_slots ? i + 1 : 0;
+	if (e->nr_slots) {
+		e->parts = kcalloc(e->nr_slots, sizeof(*e->parts), GFP_KERNEL);
+		if (!e->parts)
+			goto fail;
+	}
+	for (i = 0; i < e->nr_slots; i++) {
+		e->parts[i] = state->parts[i];
+		e->parts[i].info = NULL;
+		e->parts[i].extents = NULL;
+		if (state->parts[i].info) {
+			e->parts[i].info = kmemdup(state->parts[i].info,
+					sizeof(*state->parts[i].info), GFP_KERNEL);
+			if (!e->parts[i].info)
+				goto fail;
+		}
+		if (state->parts[i].extents) {
+			e->parts[i].extents = kmemdup(state->parts[i].extents,
+					state->parts[i].nr_extents *
+					sizeof(*state->parts[i].extents), GFP_KERNEL);
+			if (!e->parts[i].extents)
+				goto fail;
+		}
+	}
+
+	spin_lock(&probe_cache_lock);
+	old = probe_cache_find(&e->fp.id, &e->opts);
+	if (old)
+		probe_cache_unlink(old);
+	list_add(&e->lru, &probe_cache);
+	probe_cache_entries++;
+	if (probe_cache_entries > PROBE_CACHE_MAX_ENTRIES) {
+		evicted = list_entry(probe_cache.prev,
+				     struct probe_cache_entry, lru);
+		probe_cache_unlink(evicted);
+	}
+	spin_unlock(&probe_cache_lock);
+
+	if (old)
+		probe_cache_put(old);
+	if (evicted)
+		probe_cache_put(evicted);
+	return;
+
+fail:
+	probe_cache_put(e);
+}
+
+/*
+ * Shrinker: drop the least recently used entries
+ */
+static int probe_cache_shrink(struct shrinker *shrink,
+			      struct shrink_control *sc)
+{
+	struct probe_cache_entry *e, *tmp;
+	unsigned long nr = sc->nr_to_scan;
+	LIST_HEAD(dispose);
+	int remaining;
+
+	spin_lock(&probe_cache_lock);
+	while (nr-- && !list_empty(&probe_cache)) {
+		e = list_entry(probe_cache.prev, struct probe_cache_entry, lru);
+		probe_cache_unlink(e);
+		list_add(&e->lru, &dispose);
+	}
+	remaining = probe_cache_entries;
+	spin_unlock(&probe_cache_lock);
+
+	list_for_each_entry_safe(e, tmp, &dispose, lru)
+		probe_cache_put(e);
+	return remaining;
+}
+
+static struct shrinker probe_cache_shrinker = {
+	.shrink = probe_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/*
+ * <debugfs>/partsfs/probe_cache
+ */
+static int probe_cache_show(struct seq_file *m, void *v)
+{
+	struct probe_cache_entry *e;
+	int i, n;
+
+	spin_lock(&probe_cache_lock);
+	seq_printf(m, "entries %d hits %lu misses %lu\n",
+		   probe_cache_entries, probe_cache_hits, probe_cache_misses);
+	list_for_each_entry(e, &probe_cache, lru) {
+		for (i = 1, n = 0; i < e->nr_slots; i++)
+			if (e->parts[i].size)
+				n++;
+		seq_printf(m, "%u:%u", MAJOR(e->fp.id.dev), MINOR(e->fp.id.dev));
+		if (e->fp.id.ino)
+			seq_printf(m, " file %u:%u:%lu",
+				   MAJOR(e->fp.id.file_dev),
+				   MINOR(e->fp.id.file_dev), e->fp.id.ino);
+		seq_printf(m, " capacity %llu crc %08x ldm_seq %llu "
+			   "sectors %u partitions %d hits %lu age %us%s%s%s%s\n",
+			   (unsigned long long)e->fp.capacity, e->fp.crc,
+			   (unsigned long long)e->fp.ldm_seq, e->nr_sectors,
+			   n, e->hits,
+			   jiffies_to_msecs(jiffies - e->time) / 1000,
+			   e->opts.flat_nested ? " flat" : "",
+			   e->opts.primary_only ? " primary" : "",
+			   e->opts.ldm_volumes ? " ldm_volumes" : "",
+			   e->opts.defer_verify ? " deferred" : "");
+	}
+	spin_unlock(&probe_cache_lock);
+	return 0;
+}
+
+static int probe_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, probe_cache_show, NULL);
+}
+
+static const struct file_operations probe_cache_fops = {
+	.owner		= THIS_MODULE,
+	.open		= probe_cache_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void probe_cache_init(struct dentry *debugfs_dir)
+{
+	register_shrinker(&probe_cache_shrinker);
+	if (!IS_ERR_OR_NULL(debugfs_dir))
+		probe_cache_debugfs = debugfs_create_file("probe_cache", 0400,
+				debugfs_dir, NULL, &probe_cache_fops);
+}
+
+void probe_cache_exit(void)
+{
+	struct probe_cache_entry *e, *tmp;
+
+	debugfs_remove(probe_cache_debugfs);
+	unregister_shrinker(&probe_cache_shrinker);
+	list_for_each_entry_safe(e, tmp, &probe_cache, lru) {
+		probe_cache_unlink(e);
+		probe_cache_put(e);
+	}
+}
@@ -0,0 +1,38 @@
+/*
+ *  fs/partitions/cache.h
+ *  Cache of the probe results, see cache.c
+ */
+
+/*
+ * The device a probe result is cached for
+ */
+struct probe_device_id {
+	dev_t dev;
+	dev_t file_dev;		/* a loop device's backing file: its */
+	unsigned long ino;	/* filesystem, inode number and generation, */
+	u32 generation;		/* all 0 for other devices */
+};
+
+/*
+ * What a cached probe result depends on: if any of these change,
+ * the partition tables are parsed again
+ */
+struct probe_fingerprint {
+	struct probe_device_id id;
+	struct timespec mtime;	/* of the loop device's backing file */
+	sector_t capacity;
+	u32 crc;		/* crc32 of sectors 0 and 1 (MBR, GPT header) */
+	u64 ldm_seq;		/* LDM database sequence number, 0 if not LDM */
+	u64 lvm_seq;		/* LVM2 metadata location and checksum, 0 if
+				   not a whole disk PV */
+};
+
+int probe_fingerprint(struct parsed_partitions *state,
+		      struct probe_fingerprint *fp);
+bool probe_cache_tracks(int format);
+bool probe_cache_lookup(struct parsed_partitions *state,
+			const struct probe_fingerprint *fp);
+void probe_cache_insert(struct parsed_partitions *state,
+			const struct probe_fingerprint *fp, int format);
+void probe_cache_init(struct dentry *debugfs_dir);
+void probe_cache_exit(void);
@@ -17,20 +17,27 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/kmod.h>
 #include <linux/ctype.h>
 #include <linux/genhd.h>
 #include <linux/blktrace_api.h>
+#include <linux/ktime.h>
 
 #include "check.h"
+#include "cache.h"
+#include "profile.h"
 
 #include "acorn.h"
 #include "amiga.h"
 #include "atari.h"
 #include "ldm.h"
+#include "lvm.h"
 #include "mac.h"
+#include "md.h"
 #include "msdos.h"
 #include "osf.h"
+#include "scan.h"
 #include "sgi.h"
 #include "sun.h"
 #include "ultrix.h"
@@ -38,21 +45,34 @@
 #include "karma.h"
 #include "sysv68.h"
 
+#include "../partsfs_trace.h"
+
 int warn_no_part = 1; /*This is ugly: should make genhd removable media aware*/
 
-static int (*check_part[])(struct parsed_partitions *) = {
+typedef int (*partition_parser_t)(struct parsed_partitions *);
+
+struct partition_format {
+	const char *name;
+	partition_parser_t parse;
+};
+
+/*
+ * The partition formats, in probing order.  The names are the ones
+ * accepted by the probe= mount option.
+ */
+static const struct partition_format partition_formats[] = {
 	/*
 	 * Probe partition formats with tables at disk address 0
 	 * that also have an ADFS boot block at 0xdc0.
 	 */
 #ifdef CONFIG_ACORN_PARTITION_ICS
-	adfspart_check_ICS,
+	{ "ics", adfspart_check_ICS },
 #endif
 #ifdef CONFIG_ACORN_PARTITION_POWERTEC
-	adfspart_check_POWERTEC,
+	{ "powertec", adfspart_check_POWERTEC },
 #endif
 #ifdef CONFIG_ACORN_PARTITION_EESOX
-	adfspart_check_EESOX,
+	{ "eesox", adfspart_check_EESOX },
 #endif
 
 	/*
@@ -62,50 +82,242 @@ static int (*check_part[])(struct parsed_partitions *) = {
 	 * the msdos entry.
 	 */
 #ifdef CONFIG_ACORN_PARTITION_CUMANA
-	adfspart_check_CUMANA,
+	{ "cumana", adfspart_check_CUMANA },
 #endif
 #ifdef CONFIG_ACORN_PARTITION_ADFS
-	adfspart_check_ADFS,
+	{ "adfs", adfspart_check_ADFS },
 #endif
 
 #ifdef CONFIG_EFI_PARTITION
-	efi_partition,		/* this must come before msdos */
+	{ "gpt", efi_partition },		/* this must come before msdos */
 #endif
 #ifdef CONFIG_SGI_PARTITION
-	sgi_partition,
+	{ "sgi", sgi_partition },
 #endif
 #ifdef CONFIG_LDM_PARTITION
-	ldm_partition,		/* this must come before msdos */
+	{ "ldm", ldm_partition },		/* this must come before msdos */
 #endif
+	{ "lvm2", lvm2_partition },		/* whole disk PV, no MBR */
 #ifdef CONFIG_MSDOS_PARTITION
-	msdos_partition,
+	{ "msdos", msdos_partition },
 #endif
 #ifdef CONFIG_OSF_PARTITION
-	osf_partition,
+	{ "osf", osf_partition },
 #endif
 #ifdef CONFIG_SUN_PARTITION
-	sun_partition,
+	{ "sun", sun_partition },
 #endif
 #ifdef CONFIG_AMIGA_PARTITION
-	amiga_partition,
+	{ "amiga", amiga_partition },
 #endif
 #ifdef CONFIG_ATARI_PARTITION
-	atari_partition,
+	{ "atari", atari_partition },
 #endif
 #ifdef CONFIG_MAC_PARTITION
-	mac_partition,
+	{ "mac", mac_partition },
 #endif
 #ifdef CONFIG_ULTRIX_PARTITION
-	ultrix_partition,
+	{ "ultrix", ultrix_partition },
 #endif
 #ifdef CONFIG_KARMA_PARTITION
-	karma_partition,
+	{ "karma", karma_partition },
 #endif
 #ifdef CONFIG_SYSV68_PARTITION
-	sysv68_partition,
+	{ "sysv68", sysv68_partition },
 #endif
-	NULL
+	{ NULL, NULL }
 };
+
+#define NR_PARTITION_FORMATS	(ARRAY_SIZE(partition_formats) - 1)
+
+/*
+ * Find a partition format by name, returns its index or -1
+ */
+int partition_format_find(const char *name)
+{
+	int i;
+
+	for (i = 0; partition_formats[i].name; i++)
+		if (!strcmp(partition_formats[i].name, name))
+			return i;
+	return -1;
+}
+
+const char *partition_format_name(int index)
+{
+	if (index < 0 || index >= NR_PARTITION_FORMATS)
+		return NULL;
+	return partition_formats[index].name;
+}
+
+/*
+ * Fast path (probe=fast): recognize the common formats from the first
+ * two sectors, so that the other parsers (and their speculative reads)
+ * don't run at all.  Returns the format index, or -1 if unsure.
+ */
+static int sniff_partition_format(struct parsed_partitions *state)
+{
+	bool native = bdev_logical_block_size(state->bdev) > 512;
+	struct partition *p;
+	Sector sect;
+	unsigned char *data;
+	int i, res = -1;
+
+	/*
+	 * The GPT header is in logical block 1, the LVM label in the
+	 * second 512 bytes: in block 0 of a disk with bigger sectors
+	 */
+	data = read_part_lba(state, 1, &sect);
+	if (data) {
+		if (!memcmp(data, "EFI PART", 8))
+			res = partition_format_find("gpt");
+		else if (!native && !memcmp(data, LVM_LABEL_ID, 8))
+			res = partition_format_find("lvm2");
+		put_dev_sector(sect);
+		if (res >= 0)
+			return res;
+	}
+
+	data = read_part_lba(state, 0, &sect);
+	if (!data)
+		return -1;
+	if (native && !memcmp(data + 512, LVM_LABEL_ID, 8))
+		res = partition_format_find("lvm2");
+	else if (data[510] == 0x55 && data[511] == 0xaa) {
+		res = partition_format_find("msdos");
+		p = (struct partition *) (data + 0x1be);
+		for (i = 0; i < 4; i++, p++) {
+			if (p->sys_ind == 0xee)		/* protective MBR */
+				res = partition_format_find("gpt");
+			else if (p->sys_ind == 0x42)	/* LDM dynamic disk */
+				res = partition_format_find("ldm");
+			else
+				continue;
+			break;
+		}
+	}
+	put_dev_sector(sect);
+	return res;
+}
+
+/*
+ * Is the format one of the probe= list (any format without a list)?
+ */
+static bool probe_format_allowed(const struct partition_check_options *opts,
+				 int format)
+{
+	int i;
+
+	if (!opts->nr_probes)
+		return true;
+	for (i = 0; i < opts->nr_probes; i++)
+		if (opts->probes[i] == format)
+			return true;
+	return false;
+}
+
+/*
+ * Build the list of the formats to try, in order, from the probe options
+ * (parsers must have room for NR_PARTITION_FORMATS + 1 entries)
+ */
+static void select_parsers(struct parsed_partitions *state,
+			   const struct partition_format **parsers)
+{
+	const struct partition_check_options *opts = &state->opts;
+	int i, n = 0, first = -1;
+
+	if (opts->primary_only) {
+		/*
+		 * Quick probe: only the four primary DOS entries, used to
+		 * mount before the full probe is done.  Only for a disk that
+		 * looks like a plain DOS one (no GPT protective entry, LDM
+		 * or LVM2 label) when msdos is one of the formats to try,
+		 * otherwise nothing: the full probe decides.
+		 */
+		i = partition_format_find("msdos");
+		if (i >= 0 && probe_format_allowed(opts, i) &&
+		    sniff_partition_format(state) == i)
+			parsers[n++] = &partition_formats[i];
+		parsers[n] = NULL;
+		return;
+	}
+
+	if (opts->probe_fast) {
+		first = sniff_partition_format(state);
+		/* With a probe list, only a format of the list goes first */
+		if (first >= 0 && !probe_format_allowed(opts, first))
+			first = -1;
+		if (first >= 0)
+			parsers[n++] = &partition_formats[first];
+	}
+
+	if (opts->nr_probes) {
+		for (i = 0; i < opts->nr_probes; i++)
+			if (opts->probes[i] != first)
+				parsers[n++] = &partition_formats[opts->probes[i]];
+	} else {
+		for (i = 0; i < NR_PARTITION_FORMATS; i++)
+			if (i != first)
+				parsers[n++] = &partition_formats[i];
+	}
+	parsers[n] = NULL;
+}
+
+/*
+ * Run a parser, recording its profile (result, duration, reads, memory)
+ */
+static int run_parser(struct parsed_partitions *state, int format,
+		      partition_parser_t parse)
+{
+	struct probe_profile p;
+	unsigned int reads = state->nr_reads;
+	unsigned int sectors = state->nr_distinct;
+	unsigned long alloc_bytes = state->alloc_bytes;
+	ktime_t start;
+
+	probe_profile_start(state);
+	state->track_table = state->opts.use_cache && probe_cache_tracks(format);
+	start = ktime_get();
+	p.res = parse(state);
+	state->track_table = false;
+	p.ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	p.format = format;
+	p.reads = state->nr_reads - reads;
+	p.sectors = state->nr_distinct - sectors;
+	p.alloc_bytes = state->alloc_bytes - alloc_bytes;
+
+	trace_partsfs_probe_format(state->bdev->bd_dev, probe_profile_name(format),
+				   p.res, p.ns, p.reads, p.sectors, p.alloc_bytes);
+	probe_profile_add(&p);
+	if (state->nr_profile < ARRAY_SIZE(state->profile))
+		state->profile[state->nr_profile++] = p;
+	return p.res;
+}
+
+/*
+ * Add the md arrays made of the RAID partitions found (md=arrays option)
+ * They are not cached: the superblocks of the members change whenever
+ * their arrays do, so they are read on every probe
+ */
+static void check_md_arrays(struct parsed_partitions *state)
+{
+	if (state->opts.md_arrays && !state->opts.primary_only)
+		md_assemble_arrays(state);
+}
+
+/*
+ * Look for the filesystems of a disk without a recognized partition
+ * table (recover=scan), this reads the whole disk
+ */
+static int check_recover_scan(struct parsed_partitions *state)
+{
+	if (!state->opts.recover_scan || state->opts.primary_only)
+		return 0;
+	free_partition_slots(state);
+	state->verify = NULL;
+	return run_parser(state, PROBE_PROFILE_SCAN, scan_partitions);
+}
+
 /*
  * disk_name() is used by partition check code and the genhd driver.
  * It formats the devicename of the indicated disk into
@@ -125,10 +337,205 @@ char *disk_name(struct gendisk *hd, int partno, char *buf)
 	return buf;
 }
 
+/*
+ * Make sure parts[n] exists.  The array grows geometrically and new slots
+ * are zeroed, so a table with a few partitions only costs a few entries
+ * while a big GPT or a long chain of logical partitions can still be
+ * described in full.
+ */
+int reserve_partition_slot(struct parsed_partitions *p, int n)
+{
+	struct parsed_partition *parts;
+	int nr;
+
+	if (n < p->nr_slots)
+		return 0;
+	if (n < 0 || n >= p->limit)
+		return -ENOSPC;
+
+	nr = max(p->nr_slots * 2, 8);
+	while (nr <= n)
+		nr *= 2;
+	nr = min(nr, p->limit);
+
+	parts = krealloc(p->parts, nr * sizeof(*parts), GFP_KERNEL);
+	if (!parts)
+		return -ENOMEM;
+	probe_alloc_charge(p, (nr - p->nr_slots) * sizeof(*parts));
+	memset(parts + p->nr_slots, 0, (nr - p->nr_slots) * sizeof(*parts));
+	p->parts = parts;
+	p->nr_slots = nr;
+	return 0;
+}
+
+/*
+ * Meta info (uuid, volume name) is only provided by a few formats,
+ * so it is allocated on demand for the slots that have it.
+ */
+struct partition_meta_info *
+alloc_partition_info(struct parsed_partitions *p, int n)
+{
+	if (n >= p->nr_slots)
+		return NULL;
+	if (!p->parts[n].info) {
+		p->parts[n].info = kzalloc(sizeof(struct partition_meta_info),
+					   GFP_KERNEL);
+		probe_alloc_charge(p, sizeof(struct partition_meta_info));
+	}
+	return p->parts[n].info;
+}
+
+/*
+ * Add a partition made of several extents, sorted by column and offset
+ * and without holes.  The slot's from is the start of the first extent
+ * (as for a contiguous partition) and its size the sum of the extents.
+ * A single extent on the probed disk is added as a plain partition.
+ */
+int put_partition_extents(struct parsed_partitions *p, int n,
+			  const struct partition_extent *extents, int nr)
+{
+	static const u8 local[16];
+	sector_t size = 0;
+	int i;
+
+	if (nr == 1 && !memcmp(extents[0].disk_guid, local, sizeof(local))) {
+		put_partition(p, n, extents[0].from, extents[0].size);
+		return 0;
+	}
+	for (i = 0; i < nr; i++)
+		size += extents[i].size;
+	put_partition(p, n, extents[0].from, size);
+	if (n >= p->nr_slots)
+		return -ENOSPC;
+	p->parts[n].extents = kmemdup(extents, nr * sizeof(*extents),
+				      GFP_KERNEL);
+	if (!p->parts[n].extents) {
+		p->parts[n].size = 0;
+		return -ENOMEM;
+	}
+	p->parts[n].nr_extents = nr;
+	probe_alloc_charge(p, nr * sizeof(*extents));
+	return 0;
+}
+
+/*
+ * Start reading sectors n to n + nr - 1 into the page cache, without
+ * waiting: the read_part_sector() calls that follow find them there, or
+ * wait for the large read in flight instead of doing one read each.
+ * Pages already cached are skipped.  Not charged to the probe budget,
+ * only the sectors actually looked at are.
+ */
+void readahead_part_sectors(struct parsed_partitions *state,
+			    sector_t n, sector_t nr)
+{
+	struct address_space *mapping = state->bdev->bd_inode->i_mapping;
+	sector_t capacity = get_capacity(state->bdev->bd_disk);
+	struct file_ra_state ra;
+	pgoff_t first, last;
+
+	if (n >= capacity || !nr || state->budget_exceeded)
+		return;
+#ifdef CONFIG_PARTSFS_SELFTEST
+	if (state->image)
+		return;
+#endif
+	nr = min(nr, capacity - n);
+	first = n >> (PAGE_CACHE_SHIFT - 9);
+	last = (n + nr - 1) >> (PAGE_CACHE_SHIFT - 9);
+	file_ra_state_init(&ra, mapping);
+	ra.ra_pages = last - first + 1;
+	page_cache_sync_readahead(mapping, &ra, NULL, first, last - first + 1);
+}
+
+void free_partition_slots(struct parsed_partitions *p)
+{
+	int i;
+
+	for (i = 0; i < p->nr_slots; i++) {
+		kfree(p->parts[i].info);
+		kfree(p->parts[i].extents);
+	}
+	kfree(p->parts);
+	p->parts = NULL;
+	p->nr_slots = 0;
+}
+
+void free_parsed_partitions(struct parsed_partitions *p)
+{
+	if (!p)
+		return;
+	free_partition_slots(p);
+	kfree(p->seen);
+	kfree(p->table_sectors);
+	kfree(p);
+}
+
+/*
+ * Parse a nested partition table that msdos_partition() (or any other
+ * parser) recorded with set_partition_nested().  The partitions found
+ * are numbered from 1, in the order the nested table lists them.
+ */
+struct parsed_partitions *
+check_nested_partition(struct block_device *bdev, nested_parser_t parse,
+		       sector_t from, sector_t size, int origin)
+{
+	struct parsed_partitions *state;
+
+	state = kzalloc(sizeof(struct parsed_partitions), GFP_KERNEL);
+	if (!state)
+		return ERR_PTR(-ENOMEM);
+	state->pp_buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!state->pp_buf) {
+		kfree(state);
+		return ERR_PTR(-ENOMEM);
+	}
+	state->pp_buf[0] = '\0';
+
+	state->bdev = bdev;
+	disk_name(bdev->bd_disk, 0, state->name);
+	if (isdigit(state->name[strlen(state->name)-1]))
+		sprintf(state->name, "p");
+
+	state->limit = NESTED_PARTITIONS_LIMIT;
+	state->next = 1;
+	parse(state, from, size, origin);
+	if (state->pp_buf[0])
+		printk(KERN_INFO "%s", state->pp_buf);
+
+	free_page((unsigned long)state->pp_buf);
+	state->pp_buf = NULL;
+	return state;
+}
+
+/*
+ * Run the verification deferred by a defer_verify probe (the parser
+ * left it in state->verify).  Returns 1 if the backup copies match,
+ * 0 if they don't, -ENOMEM.
+ */
+int verify_partition_backups(struct block_device *bdev,
+			     backup_verifier_t verify)
+{
+	struct parsed_partitions *state;
+	int res;
+
+	state = kzalloc(sizeof(struct parsed_partitions), GFP_KERNEL);
+	if (!state)
+		return -ENOMEM;
+	state->bdev = bdev;
+	disk_name(bdev->bd_disk, 0, state->name);
+	res = verify(state);
+	kfree(state);
+	return res;
+}
+
 struct parsed_partitions *
-check_partition(struct gendisk *hd, struct block_device *bdev)
+check_partition(struct gendisk *hd, struct block_device *bdev,
+		const struct partition_check_options *opts)
 {
+	const struct partition_format *parsers[NR_PARTITION_FORMATS + 1];
 	struct parsed_partitions *state;
+	struct probe_fingerprint fp;
+	bool cacheable = false;
 	int i, res, err;
 
 	state = kzalloc(sizeof(struct parsed_partitions), GFP_KERNEL);
@@ -142,17 +549,41 @@ check_partition(struct gendisk *hd, struct block_device *bdev)
 	state->pp_buf[0] = '\0';
 
 	state->bdev = bdev;
+	if (opts)
+		state->opts = *opts;
 	disk_name(hd, 0, state->name);
 	snprintf(state->pp_buf, PAGE_SIZE, " %s:", state->name);
 	if (isdigit(state->name[strlen(state->name)-1]))
 		sprintf(state->name, "p");
 
-	state->limit = DISK_MAX_PARTS;
+	state->limit = PARSED_PARTITIONS_LIMIT;
+	trace_partsfs_probe_start(bdev->bd_dev);
+	if (state->opts.max_msecs)
+		state->deadline = jiffies +
+				  msecs_to_jiffies(state->opts.max_msecs);
+
+	if (state->opts.use_cache && !probe_fingerprint(state, &fp)) {
+		cacheable = true;
+		if (probe_cache_lookup(state, &fp)) {
+			strlcat(state->pp_buf, " (cached)\n", PAGE_SIZE);
+			state->cached = true;
+			check_md_arrays(state);
+			trace_partsfs_probe_end(bdev->bd_dev, 1, state->sectors_read, 1);
+			printk(KERN_INFO "%s", state->pp_buf);
+			free_page((unsigned long)state->pp_buf);
+			return state;
+		}
+	}
+
+	select_parsers(state, parsers);
 
 	i = res = err = 0;
-	while (!res && check_part[i]) {
-		memset(&state->parts, 0, sizeof(state->parts));
-		res = check_part[i++](state);
+	while (!res && parsers[i] && !state->budget_exceeded) {
+		free_partition_slots(state);
+		state->verify = NULL;
+		res = run_parser(state, parsers[i] - partition_formats,
+				 parsers[i]->parse);
+		i++;
 		if (res < 0) {
 			/* We have hit an I/O error which we don't report now.
 		 	* But record it, and let the others do their job.
@@ -162,7 +593,33 @@ check_partition(struct gendisk *hd, struct block_device *bdev)
 		}
 
 	}
+	if (!res && !state->budget_exceeded) {
+		/*
+		 * Not cached: the fingerprint only covers the first sectors,
+		 * the scan result depends on the whole disk
+		 */
+		cacheable = false;
+		res = check_recover_scan(state);
+		if (res < 0) {
+			err = res;
+			res = 0;
+		}
+	}
+	if (state->budget_exceeded) {
+		/* Don't trust a partial result */
+		strlcat(state->pp_buf, " probe I/O budget exceeded\n", PAGE_SIZE);
+		trace_partsfs_probe_end(bdev->bd_dev, -E2BIG, state->sectors_read, 0);
+		printk(KERN_WARNING "%s", state->pp_buf);
+		free_page((unsigned long)state->pp_buf);
+		free_parsed_partitions(state);
+		return ERR_PTR(-E2BIG);
+	}
 	if (res > 0) {
+		if (cacheable)
+			probe_cache_insert(state, &fp,
+					   parsers[i - 1] - partition_formats);
+		check_md_arrays(state);
+		trace_partsfs_probe_end(bdev->bd_dev, res, state->sectors_read, 0);
 		printk(KERN_INFO "%s", state->pp_buf);
 
 		free_page((unsigned long)state->pp_buf);
@@ -178,9 +635,10 @@ check_partition(struct gendisk *hd, struct block_device *bdev)
 	else
 		strlcat(state->pp_buf, " unable to read partition table\n", PAGE_SIZE);
 
+	trace_partsfs_probe_end(bdev->bd_dev, res, state->sectors_read, 0);
 	printk(KERN_INFO "%s", state->pp_buf);
 
 	free_page((unsigned long)state->pp_buf);
-	kfree(state);
+	free_parsed_partitions(state);
 	return ERR_PTR(res);
 }
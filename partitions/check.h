@@ -1,6 +1,111 @@
 #include <linux/pagemap.h>
 #include <linux/blkdev.h>
 #include <linux/genhd.h>
+#ifdef CONFIG_PARTSFS_SELFTEST
+#include <linux/vmalloc.h>
+#endif
+
+/*
+ * Upper bound on the number of partition slots a single probe may fill.
+ * The parts[] array only grows as far as the highest slot actually used,
+ * this is just a sanity cap against corrupted or hostile tables.
+ */
+#define PARSED_PARTITIONS_LIMIT		65536
+
+/* Nested tables (BSD, Solaris, ...) have at most this many slots */
+#define NESTED_PARTITIONS_LIMIT		256
+
+/* At least the number of entries in partition_formats[] */
+#define PARTITION_FORMATS_MAX		24
+
+struct parsed_partitions;
+
+/*
+ * Parser for a partition table nested inside a partition
+ * (offset and size of the container, origin is its slot number).
+ * Found partitions are added starting from slot state->next.
+ */
+typedef void (*nested_parser_t)(struct parsed_partitions *state,
+				sector_t offset, sector_t size, int origin);
+
+/*
+ * Deferred check of the redundant copies of the metadata (backup GPT,
+ * LDM PRIVHEADs and TOCBLOCKs), skipped by a defer_verify probe.
+ * Returns 1 if the copies match, 0 if not.
+ */
+typedef int (*backup_verifier_t)(struct parsed_partitions *state);
+
+/*
+ * Options for check_partition()
+ */
+struct partition_check_options {
+	bool flat_nested;	/* parse nested tables now, into the same slots */
+	bool primary_only;	/* quick probe: the primary DOS table only */
+	bool defer_verify;	/* trust the primary metadata, set verify */
+	bool use_cache;		/* reuse the last result, see cache.c */
+	bool probe_fast;	/* try the format found by its signature first */
+	bool ldm_volumes;	/* LDM: one slot per volume, not per partition */
+	bool ldm_all_disks;	/* LDM volumes: also those on other disks */
+	bool md_arrays;		/* add the md arrays of the RAID partitions */
+	bool recover_scan;	/* no table found: scan for filesystems */
+	int nr_probes;		/* formats to try, 0 for all of them */
+	u8 probes[PARTITION_FORMATS_MAX]; /* (partition_format_find()) */
+	unsigned int max_sectors;	/* probe I/O budget, 0 for no limit */
+	unsigned int max_msecs;		/* probe time budget, 0 for no limit */
+};
+
+/*
+ * A piece of a partition made of several non-contiguous extents
+ * (an LDM volume extended several times, spanned or striped)
+ */
+struct partition_extent {
+	sector_t offset;	/* in the partition, in the column if striped */
+	sector_t from;		/* on the disk (its data area, if not this one) */
+	sector_t size;
+	int column;		/* stripe column, 0 if not striped */
+	u8 disk_guid[16];	/* the disk, all zero for the probed one */
+};
+
+/* parsed_partition flags, besides the ADDPART_FLAG_* ones */
+#define PARTITION_FLAG_RECOVERED	0x100	/* found by the signature scan */
+#define PARTITION_FLAG_MD_ARRAY		0x200	/* an md array, over its members */
+
+struct parsed_partition {
+	sector_t from;
+	sector_t size;
+	int flags;
+	struct partition_meta_info *info;	/* NULL if the format has none */
+	nested_parser_t nested;		/* deferred nested table, if any */
+	struct partition_extent *extents; /* sorted by column and offset,
+					   NULL if contiguous */
+	int nr_extents;
+	int stripe_columns;		/* 0 if not striped */
+	sector_t stripe_chunk;		/* stripe size, in sectors */
+	int mirrors;			/* copies (columns), 0 if not mirrored */
+};
+
+/*
+ * Cost of a format tried by check_partition(), see profile.c
+ */
+struct probe_profile {
+	int format;		/* partition_format_find(), or PROBE_PROFILE_SCAN */
+	int res;		/* what the parser returned */
+	u64 ns;			/* wall time */
+	unsigned int reads;	/* read_part_sector() and read_part_lba() calls */
+	unsigned int sectors;	/* distinct 512-byte sectors read */
+	unsigned long alloc_bytes; /* memory allocated (probe_alloc_charge()) */
+};
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+/*
+ * In-memory disk of the parser self-test (selftest.c), read instead of
+ * the block device
+ */
+struct partition_image {
+	u8 *data;		/* vmalloc()ed */
+	sector_t sectors;
+};
+#endif
 
 /*
  * add_gd_partition adds a partitions details to the devices partition
@@ -9,33 +114,157 @@
 struct parsed_partitions {
 	struct block_device *bdev;
 	char name[BDEVNAME_SIZE];
-	struct {
-		sector_t from;
-		sector_t size;
-		int flags;
-		bool has_info;
-		struct partition_meta_info info;
-	} parts[DISK_MAX_PARTS];
+	struct parsed_partition *parts;		/* slot n is parts[n] */
+	int nr_slots;				/* allocated entries in parts[] */
 	int next;
 	int limit;
 	bool access_beyond_eod;
 	char *pp_buf;
+	struct partition_check_options opts;
+	backup_verifier_t verify;		/* backups still to be checked */
+	unsigned int sectors_read;		/* by the probe */
+	unsigned long deadline;			/* jiffies, if max_msecs */
+	bool budget_exceeded;
+	bool cached;				/* copied from the probe cache */
+	/* Probe profile (profile.c) */
+	struct probe_profile profile[PARTITION_FORMATS_MAX + 1]; /* in order */
+	int nr_profile;
+	unsigned int nr_reads;			/* running totals */
+	unsigned int nr_distinct;
+	unsigned long alloc_bytes;
+	sector_t *seen;				/* sectors read by this format */
+	unsigned int nr_seen;
+	/* Probe cache fingerprint (cache.c) */
+	bool track_table;			/* record the reads */
+	bool table_untracked;			/* some were not recorded */
+	sector_t *table_sectors;		/* sectors read by the formats */
+	unsigned int nr_table_sectors;
+	u32 table_crc;				/* and their checksum */
+#ifdef CONFIG_PARTSFS_SELFTEST
+	struct partition_image *image;		/* selftest.c, NULL otherwise */
+#endif
 };
 
+extern int partition_format_find(const char *name);
+extern const char *partition_format_name(int index);
+extern int reserve_partition_slot(struct parsed_partitions *p, int n);
+extern struct partition_meta_info *
+alloc_partition_info(struct parsed_partitions *p, int n);
+extern int put_partition_extents(struct parsed_partitions *p, int n,
+				 const struct partition_extent *extents, int nr);
+extern void free_partition_slots(struct parsed_partitions *p);
+extern void free_parsed_partitions(struct parsed_partitions *p);
+extern int verify_partition_backups(struct block_device *bdev,
+				    backup_verifier_t verify);
+extern void readahead_part_sectors(struct parsed_partitions *state,
+				   sector_t n, sector_t nr);
+extern struct parsed_partitions *
+check_nested_partition(struct block_device *bdev, nested_parser_t parse,
+		       sector_t from, sector_t size, int origin);
+extern void probe_profile_read(struct parsed_partitions *state, sector_t n,
+			       unsigned int nr);
+extern void probe_cache_read(struct parsed_partitions *state, sector_t n,
+			     unsigned int nr, const void *data);
+
+/*
+ * Account memory allocated by a parser to the probe profile
+ */
+static inline void probe_alloc_charge(struct parsed_partitions *state,
+				      size_t bytes)
+{
+	state->alloc_bytes += bytes;
+}
+
+/*
+ * Charge nr sectors read to the probe budget (max_sectors, max_msecs)
+ * Once the budget is exceeded, all the reads fail
+ */
+static inline bool probe_budget_charge(struct parsed_partitions *state,
+				       unsigned int nr)
+{
+	state->sectors_read += nr;
+	if (state->opts.max_sectors &&
+	    state->sectors_read > state->opts.max_sectors)
+		state->budget_exceeded = true;
+	if (state->opts.max_msecs && time_after(jiffies, state->deadline))
+		state->budget_exceeded = true;
+	return state->budget_exceeded;
+}
+
+static inline bool probe_budget_exceeded(struct parsed_partitions *state)
+{
+	return probe_budget_charge(state, 1);
+}
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+static inline void *read_image_sector(struct partition_image *image,
+				      sector_t n, Sector *p)
+{
+	u8 *data = image->data + (n << 9);
+
+	/* Dropped by put_dev_sector() */
+	p->v = vmalloc_to_page(data);
+	page_cache_get(p->v);
+	return data;
+}
+#endif
+
 static inline void *read_part_sector(struct parsed_partitions *state,
 				     sector_t n, Sector *p)
 {
+	void *data;
+
 	if (n >= get_capacity(state->bdev->bd_disk)) {
 		state->access_beyond_eod = true;
 		return NULL;
 	}
-	return read_dev_sector(state->bdev, n, p);
+	if (probe_budget_exceeded(state))
+		return NULL;
+	probe_profile_read(state, n, 1);
+#ifdef CONFIG_PARTSFS_SELFTEST
+	if (state->image)
+		data = read_image_sector(state->image, n, p);
+	else
+#endif
+		data = read_dev_sector(state->bdev, n, p);
+	if (state->track_table)
+		probe_cache_read(state, n, 1, data);
+	return data;
+}
+
+/*
+ * Read logical block lba of the disk, bdev_logical_block_size() bytes
+ * (a 4096-byte sector of a 4Kn disk is one call, not eight)
+ */
+static inline void *read_part_lba(struct parsed_partitions *state,
+				  u64 lba, Sector *p)
+{
+	unsigned int ssz = bdev_logical_block_size(state->bdev) >> 9;
+	sector_t n = lba * ssz;
+	void *data;
+
+	if (lba >= get_capacity(state->bdev->bd_disk) / ssz) {
+		state->access_beyond_eod = true;
+		return NULL;
+	}
+	if (probe_budget_charge(state, ssz))
+		return NULL;
+	probe_profile_read(state, n, ssz);
+#ifdef CONFIG_PARTSFS_SELFTEST
+	if (state->image)
+		data = read_image_sector(state->image, n, p);
+	else
+#endif
+		data = read_dev_sector(state->bdev, n, p);
+	if (state->track_table)
+		probe_cache_read(state, n, ssz, data);
+	return data;
 }
 
 static inline void
 put_partition(struct parsed_partitions *p, int n, sector_t from, sector_t size)
 {
-	if (n < p->limit) {
+	if (n < p->limit && !reserve_partition_slot(p, n)) {
 		char tmp[1 + BDEVNAME_SIZE + 10 + 1];
 
 		p->parts[n].from = from;
@@ -45,5 +274,52 @@ put_partition(struct parsed_partitions *p, int n, sector_t from, sector_t size)
 	}
 }
 
+static inline void
+set_partition_flags(struct parsed_partitions *p, int n, int flags)
+{
+	if (n < p->nr_slots)
+		p->parts[n].flags = flags;
+}
+
+/*
+ * Record that a partition added by put_partition_extents() is striped:
+ * chunk n is in column n % columns
+ */
+static inline void
+set_partition_stripes(struct parsed_partitions *p, int n, int columns,
+		      sector_t chunk)
+{
+	if (n < p->nr_slots && p->parts[n].extents) {
+		p->parts[n].stripe_columns = columns;
+		p->parts[n].stripe_chunk = chunk;
+	}
+}
+
+/*
+ * Record that a partition added by put_partition_extents() is mirrored:
+ * each column is a whole copy of its size sectors (a single copy is a
+ * plain partition, still mirrors 1)
+ */
+static inline void
+set_partition_mirrors(struct parsed_partitions *p, int n, int mirrors,
+		      sector_t size)
+{
+	if (n < p->nr_slots && p->parts[n].size) {
+		p->parts[n].mirrors = mirrors;
+		p->parts[n].size = size;
+	}
+}
+
+/*
+ * Record that slot n contains a nested table, to be parsed on demand
+ * by check_nested_partition()
+ */
+static inline void
+set_partition_nested(struct parsed_partitions *p, int n, nested_parser_t parse)
+{
+	if (n < p->nr_slots)
+		p->parts[n].nested = parse;
+}
+
 extern int warn_no_part;
 
@@ -99,6 +99,7 @@
 #include <linux/slab.h>
 #include "check.h"
 #include "efi.h"
+#include "lvm.h"
 
 /* This allows a kernel command line option 'gpt' to override
  * the test for invalid PMBR.  Not __initdata because reloading
@@ -194,15 +195,14 @@ static size_t read_lba(struct parsed_partitions *state,
 {
 	size_t totalreadcount = 0;
 	struct block_device *bdev = state->bdev;
-	sector_t n = lba * (bdev_logical_block_size(bdev) / 512);
 
 	if (!buffer || lba > last_lba(bdev))
                 return 0;
 
 	while (count) {
-		int copied = 512;
+		size_t copied = bdev_logical_block_size(bdev);
 		Sector sect;
-		unsigned char *data = read_part_sector(state, n++, &sect);
+		unsigned char *data = read_part_lba(state, lba++, &sect);
 		if (!data)
 			break;
 		if (copied > count)
@@ -241,6 +241,7 @@ static gpt_entry *alloc_read_gpt_entries(struct parsed_partitions *state,
 	pte = kzalloc(count, GFP_KERNEL);
 	if (!pte)
 		return NULL;
+	probe_alloc_charge(state, count);
 
 	if (read_lba(state, le64_to_cpu(gpt->partition_entry_lba),
                      (u8 *) pte,
@@ -270,6 +271,7 @@ static gpt_header *alloc_read_gpt_header(struct parsed_partitions *state,
 	gpt = kzalloc(ssz, GFP_KERNEL);
 	if (!gpt)
 		return NULL;
+	probe_alloc_charge(state, ssz);
 
 	if (read_lba(state, lba, (u8 *) gpt, ssz) < ssz) {
 		kfree(gpt);
@@ -410,16 +412,16 @@ is_pte_valid(const gpt_entry *pte, const u64 lastlba)
  * @pgpt is the primary GPT header
  * @agpt is the alternate GPT header
  * @lastlba is the last LBA number
- * Description: Returns nothing.  Sanity checks pgpt and agpt fields
- * and prints warnings on discrepancies.
+ * Description: Returns the number of discrepancies.  Sanity checks
+ * pgpt and agpt fields and prints warnings on discrepancies.
  * 
  */
-static void
+static int
 compare_gpts(gpt_header *pgpt, gpt_header *agpt, u64 lastlba)
 {
 	int error_found = 0;
 	if (!pgpt || !agpt)
-		return;
+		return 0;
 	if (le64_to_cpu(pgpt->my_lba) != le64_to_cpu(agpt->alternate_lba)) {
 		printk(KERN_WARNING
 		       "GPT:Primary header LBA != Alt. header alternate_lba\n");
@@ -503,7 +505,42 @@ compare_gpts(gpt_header *pgpt, gpt_header *agpt, u64 lastlba)
 	if (error_found)
 		printk(KERN_WARNING
 		       "GPT: Use GNU Parted to correct GPT errors.\n");
-	return;
+	return error_found;
+}
+
+/**
+ * efi_verify_backup() - Check the alternate GPT against the primary
+ * @state
+ *
+ * Description: the part of find_valid_gpt() skipped by a probe with
+ * deferred verification: read both GPTs again and compare them.
+ * Returns:
+ * 1 if the alternate GPT is valid and matches the primary one
+ * 0 if it doesn't (or the primary GPT is no longer valid)
+ */
+int efi_verify_backup(struct parsed_partitions *state)
+{
+	gpt_header *pgpt = NULL, *agpt = NULL;
+	gpt_entry *pptes = NULL, *aptes = NULL;
+	int ret = 0;
+
+	if (!is_gpt_valid(state, GPT_PRIMARY_PARTITION_TABLE_LBA,
+			  &pgpt, &pptes)) {
+		printk(KERN_WARNING "GPT: Primary GPT is no longer valid.\n");
+		goto out;
+	}
+	if (!is_gpt_valid(state, le64_to_cpu(pgpt->alternate_lba),
+			  &agpt, &aptes)) {
+		printk(KERN_WARNING "Alternate GPT is invalid.\n");
+		goto out;
+	}
+	ret = !compare_gpts(pgpt, agpt, last_lba(state->bdev));
+out:
+	kfree(pgpt);
+	kfree(agpt);
+	kfree(pptes);
+	kfree(aptes);
+	return ret;
 }
 
 /**
@@ -549,6 +586,19 @@ static int find_valid_gpt(struct parsed_partitions *state, gpt_header **gpt,
 
 	good_pgpt = is_gpt_valid(state, GPT_PRIMARY_PARTITION_TABLE_LBA,
 				 &pgpt, &pptes);
+
+	/*
+	 * Deferred verification: the primary passed its CRCs, use it now
+	 * and leave the alternate (at the end of the disk) to
+	 * efi_verify_backup()
+	 */
+	if (good_pgpt && state->opts.defer_verify) {
+		state->verify = efi_verify_backup;
+		*gpt  = pgpt;
+		*ptes = pptes;
+		return 1;
+	}
+
         if (good_pgpt)
 		good_agpt = is_gpt_valid(state,
 					 le64_to_cpu(pgpt->alternate_lba),
@@ -630,6 +680,10 @@ int efi_partition(struct parsed_partitions *state)
 
 	pr_debug("GUID Partition Table is valid!  Yea!\n");
 
+	if (le32_to_cpu(gpt->num_partition_entries) > state->limit - 1)
+		printk(KERN_WARNING "GPT: only the first %d of %u entries are used\n",
+		       state->limit - 1, le32_to_cpu(gpt->num_partition_entries));
+
 	for (i = 0; i < le32_to_cpu(gpt->num_partition_entries) && i < state->limit-1; i++) {
 		struct partition_meta_info *info;
 		unsigned label_count = 0;
@@ -646,9 +700,17 @@ int efi_partition(struct parsed_partitions *state)
 		/* If this is a RAID volume, tell md */
 		if (!efi_guidcmp(ptes[i].partition_type_guid,
 				 PARTITION_LINUX_RAID_GUID))
-			state->parts[i + 1].flags = ADDPART_FLAG_RAID;
+			set_partition_flags(state, i + 1, ADDPART_FLAG_RAID);
 
-		info = &state->parts[i + 1].info;
+		/* LVM2 volumes: parsed on demand, or after the table if flat */
+		if (!efi_guidcmp(ptes[i].partition_type_guid,
+				 PARTITION_LINUX_LVM_GUID) &&
+		    !state->opts.flat_nested)
+			set_partition_nested(state, i + 1, lvm2_nested_partition);
+
+		info = alloc_partition_info(state, i + 1);
+		if (!info)
+			continue;
 		/* Instead of doing a manual swap to big endian, reuse the
 		 * common ASCII hex format as the interim.
 		 */
@@ -656,8 +718,8 @@ int efi_partition(struct parsed_partitions *state)
 		part_pack_uuid(unparsed_guid, info->uuid);
 
 		/* Naively convert UTF16-LE to 7 bits. */
-		label_max = min(sizeof(info->volname) - 1,
-				sizeof(ptes[i].partition_name));
+		label_max = min(ARRAY_SIZE(info->volname) - 1,
+				ARRAY_SIZE(ptes[i].partition_name));
 		info->volname[label_max] = 0;
 		while (label_count < label_max) {
 			u8 c = ptes[i].partition_name[label_count] & 0xff;
@@ -666,10 +728,23 @@ int efi_partition(struct parsed_partitions *state)
 			info->volname[label_count] = c;
 			label_count++;
 		}
-		state->parts[i + 1].has_info = true;
+	}
+	strlcat(state->pp_buf, "\n", PAGE_SIZE);
+
+	if (state->opts.flat_nested) {
+		state->next = min_t(int, state->limit,
+				    le32_to_cpu(gpt->num_partition_entries) + 1);
+		for (i = 0; i < state->next - 1; i++)
+			if (is_pte_valid(&ptes[i], last_lba(state->bdev)) &&
+			    !efi_guidcmp(ptes[i].partition_type_guid,
+					 PARTITION_LINUX_LVM_GUID))
+				lvm2_nested_partition(state,
+					le64_to_cpu(ptes[i].starting_lba) * ssz,
+					(le64_to_cpu(ptes[i].ending_lba) -
+					 le64_to_cpu(ptes[i].starting_lba) + 1) * ssz,
+					i + 1);
 	}
 	kfree(ptes);
 	kfree(gpt);
-	strlcat(state->pp_buf, "\n", PAGE_SIZE);
 	return 1;
 }
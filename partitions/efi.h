@@ -111,6 +111,7 @@ typedef struct _legacy_mbr {
 
 /* Functions */
 extern int efi_partition(struct parsed_partitions *state);
+extern int efi_verify_backup(struct parsed_partitions *state);
 
 #endif
 
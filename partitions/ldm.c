@@ -27,6 +27,9 @@
 #include <linux/pagemap.h>
 #include <linux/stringify.h>
 #include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/list_sort.h>
+#include <linux/sort.h>
 #include "ldm.h"
 #include "check.h"
 #include "msdos.h"
@@ -65,6 +68,106 @@ void _ldm_printk(const char *level, const char *function, const char *fmt, ...)
 	va_end(args);
 }
 
+/**
+ * ldm_arena_alloc - Allocate memory from an arena
+ * @arena:  Arena to allocate from
+ * @size:   Number of bytes
+ *
+ * The memory is not zeroed and is only released by ldm_arena_free().
+ * Large requests get a chunk of their own, so they don't waste the
+ * rest of the current one.
+ *
+ * Return:  Pointer, or NULL if out of memory
+ */
+static void *ldm_arena_alloc (struct ldm_arena *arena, size_t size)
+{
+	struct ldm_arena_chunk *c = arena->chunks;
+	size_t csize;
+
+	size = ALIGN (size, sizeof (u64));
+	if (!c || c->used + size > c->size) {
+		csize = LDM_ARENA_CHUNK - sizeof (*c);
+		if (size > csize / 4)
+			csize = size;
+		c = kmalloc (sizeof (*c) + csize, GFP_KERNEL);
+		if (!c)
+			return NULL;
+		arena->allocated += sizeof (*c) + csize;
+		c->size = csize;
+		c->used = 0;
+		if (csize == size && arena->chunks) {
+			/* Dedicated chunk: keep filling the current one */
+			c->next = arena->chunks->next;
+			arena->chunks->next = c;
+		} else {
+			c->next = arena->chunks;
+			arena->chunks = c;
+		}
+	}
+	c->used += size;
+	return c->data + c->used - size;
+}
+
+/**
+ * ldm_arena_free - Free all the memory allocated from an arena
+ * @arena:  Arena to free
+ *
+ * Return:  none
+ */
+static void ldm_arena_free (struct ldm_arena *arena)
+{
+	struct ldm_arena_chunk *c, *next;
+
+	for (c = arena->chunks; c; c = next) {
+		next = c->next;
+		kfree (c);
+	}
+	arena->chunks = NULL;
+}
+
+/**
+ * ldm_alloc_hash - Allocate an empty hash table from an arena
+ * @arena:    Arena to allocate from
+ * @entries:  Expected number of entries
+ * @bits:     Returns the hash size, in bits
+ *
+ * Return:  Pointer, or NULL if out of memory
+ */
+static struct hlist_head *ldm_alloc_hash (struct ldm_arena *arena,
+					  unsigned int entries,
+					  unsigned int *bits)
+{
+	struct hlist_head *hash;
+	unsigned int i;
+
+	*bits = clamp (fls (entries), 4, 16);	/* half to one entry a bucket */
+	hash = ldm_arena_alloc (arena, sizeof (*hash) << *bits);
+	if (hash)
+		for (i = 0; i < (1U << *bits); i++)
+			INIT_HLIST_HEAD (&hash[i]);
+	return hash;
+}
+
+/**
+ * ldm_find_vblk - Find a VBLK by object id
+ * @ldb:     Cache of the database structures
+ * @obj_id:  Object id to look for
+ *
+ * Return:  Pointer, A matching vblk was found
+ *          NULL,    No match
+ */
+static struct vblk *ldm_find_vblk (const struct ldmdb *ldb, u64 obj_id)
+{
+	struct hlist_node *node;
+	struct vblk *v;
+
+	hlist_for_each_entry (v, node,
+			&ldb->obj_hash[hash_64 (obj_id, ldb->obj_hash_bits)], hash)
+		if (v->obj_id == obj_id)
+			return v;
+	return NULL;
+}
+
 /**
  * ldm_parse_hexbyte - Convert a ASCII hex number to a byte
  * @src:  Pointer to at least 2 characters to convert.
@@ -319,7 +422,8 @@ static bool ldm_compare_tocblocks (const struct tocblock *toc1,
  * @state: Partition check state including device holding the LDM Database
  * @ph1:   Memory struct to fill with ph contents
  *
- * Read and compare all three privheads from disk.
+ * Read and compare all three privheads from disk (only the first one
+ * if @state->opts.defer_verify is set, see ldm_verify_backups()).
  *
  * The privheads on disk show the size and location of the main disk area and
  * the configuration area (the database).  The values are range-checked against
@@ -337,6 +441,7 @@ static bool ldm_validate_privheads(struct parsed_partitions *state,
 	u8 *data;
 	bool result = false;
 	long num_sects;
+	int nr_phs = state->opts.defer_verify ? 1 : 3;
 	int i;
 
 	BUG_ON (!state || !ph1);
@@ -352,7 +457,7 @@ static bool ldm_validate_privheads(struct parsed_partitions *state,
 	ph[0]->config_start = 0;
 
 	/* Read and parse privheads */
-	for (i = 0; i < 3; i++) {
+	for (i = 0; i < nr_phs; i++) {
 		data = read_part_sector(state, ph[0]->config_start + off[i],
 					&sect);
 		if (!data) {
@@ -385,6 +490,12 @@ static bool ldm_validate_privheads(struct parsed_partitions *state,
 		goto out;
 	}
 
+	if (nr_phs == 1) {
+		ldm_debug ("Validated PRIVHEAD 1, backups not checked.");
+		result = true;
+		goto out;
+	}
+
 	if (!ldm_compare_privheads (ph[0], ph[1])) {
 		ldm_crit ("Primary and backup PRIVHEADs don't match.");
 		goto out;
@@ -412,12 +523,13 @@ out:
  * @state->bdev and return the parsed information into @toc1.
  *
  * The offsets and sizes of the configs are range-checked against a privhead.
+ * If @state->opts.defer_verify is set, stop at the first valid TOCBLOCK.
  *
  * Return:  'true'   @toc1 contains validated TOCBLOCK info
  *          'false'  @toc1 contents are undefined
  */
 static bool ldm_validate_tocblocks(struct parsed_partitions *state,
-				   unsigned long base, struct ldmdb *ldb)
+				   sector_t base, struct ldmdb *ldb)
 {
 	static const int off[4] = { OFF_TOCB1, OFF_TOCB2, OFF_TOCB3, OFF_TOCB4};
 	struct tocblock *tb[4];
@@ -452,6 +564,8 @@ static bool ldm_validate_tocblocks(struct parsed_partitions *state,
 		if (ldm_parse_tocblock(data, tb[nr_tbs]))
 			nr_tbs++;
 		put_dev_sector(sect);
+		if (nr_tbs && state->opts.defer_verify)
+			break;
 	}
 	if (!nr_tbs) {
 		ldm_crit("Failed to find a valid TOCBLOCK.");
@@ -478,6 +592,33 @@ err:
 	return result;
 }
 
+/**
+ * ldm_verify_backups - Compare the PRIVHEADs and TOCBLOCKs with their backups
+ * @state: Partition check state including device holding the LDM Database
+ *
+ * The part of ldm_partition() skipped by a probe with deferred verification:
+ * read all the copies again and compare them.
+ *
+ * Return:  1 The backups match
+ *          0 They don't, or can't be read
+ */
+int ldm_verify_backups(struct parsed_partitions *state)
+{
+	struct ldmdb *ldb;
+	bool result;
+
+	ldb = kmalloc (sizeof (*ldb), GFP_KERNEL);
+	if (!ldb) {
+		ldm_crit ("Out of memory.");
+		return 0;
+	}
+	state->opts.defer_verify = false;
+	result = ldm_validate_privheads(state, &ldb->ph) &&
+		 ldm_validate_tocblocks(state, ldb->ph.config_start, ldb);
+	kfree (ldb);
+	return result ? 1 : 0;
+}
+
 /**
  * ldm_validate_vmdb - Read the VMDB and validate it
  * @state: Partition check state including device holding the LDM Database
@@ -491,7 +632,7 @@ err:
  *          'false'  @ldb contents are undefined
  */
 static bool ldm_validate_vmdb(struct parsed_partitions *state,
-			      unsigned long base, struct ldmdb *ldb)
+			      sector_t base, struct ldmdb *ldb)
 {
 	Sector sect;
 	u8 *data;
@@ -589,6 +730,78 @@ out:
 	return result;
 }
 
+/**
+ * ldm_fingerprint - Get the sequence number of the LDM Database
+ * @state: Partition check state including device holding the LDM Database
+ * @seq:   Filled with the VMDB sequence number
+ *
+ * A cheap check for the probe cache (PRIVHEAD 1 and the VMDB, no backups,
+ * no VBLKs): the sequence number changes with every database update.
+ *
+ * Return:  'true'   @state->bdev is a dynamic disk, @seq is valid
+ *          'false'  Not a dynamic disk, or the database can't be read
+ */
+bool ldm_fingerprint(struct parsed_partitions *state, u64 *seq)
+{
+	struct privhead ph;
+	struct vmdb vm;
+	Sector sect;
+	u8 *data;
+	bool result;
+
+	if (!ldm_validate_partition_table(state))
+		return false;
+
+	data = read_part_sector(state, OFF_PRIV1, &sect);
+	if (!data)
+		return false;
+	result = ldm_parse_privhead(data, &ph);
+	put_dev_sector(sect);
+	if (!result)
+		return false;
+
+	data = read_part_sector(state, ph.config_start + OFF_VMDB, &sect);
+	if (!data)
+		return false;
+	result = ldm_parse_vmdb(data, &vm);
+	put_dev_sector(sect);
+	if (result)
+		*seq = vm.last_vblk_seq;
+	return result;
+}
+
+/**
+ * ldm_member_disk - Read the identity of a dynamic disk
+ * @bdev:        Device of the disk
+ * @guid:        Filled with the disk GUID (16 bytes)
+ * @data_start:  Filled with the start of its data area, in sectors
+ *
+ * Used to find the other disks of spanned and striped volumes: the database
+ * identifies them by their GUID, and their partitions start at offsets
+ * relative to their data area (logical disk).
+ *
+ * Return:  'true'   @bdev is a dynamic disk, @guid and @data_start are valid
+ *          'false'  Not a dynamic disk, or the PRIVHEAD can't be read
+ */
+bool ldm_member_disk(struct block_device *bdev, u8 *guid, u64 *data_start)
+{
+	struct privhead ph;
+	Sector sect;
+	u8 *data;
+	bool result;
+
+	data = read_dev_sector(bdev, OFF_PRIV1, &sect);
+	if (!data)
+		return false;
+	result = ldm_parse_privhead(data, &ph);
+	put_dev_sector(sect);
+	if (result) {
+		memcpy(guid, ph.disk_id, GUID_SIZE);
+		*data_start = ph.logical_disk_start;
+	}
+	return result;
+}
+
 /**
  * ldm_get_disk_objid - Search a linked list of vblk's for a given Disk Id
  * @ldb:  Cache of the database structures
@@ -616,6 +829,277 @@ static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb)
 	return NULL;
 }
 
+/**
+ * ldm_get_volume - Find the volume a partition belongs to
+ * @ldb:   Cache of the database structures
+ * @part:  Partition VBLK
+ * @comp:  Returns the component between the partition and the volume
+ *
+ * A partition belongs to a component, which belongs to a volume: follow the
+ * parent ids through the object hash.
+ *
+ * Return:  Pointer, The volume VBLK
+ *          NULL,    The chain is broken
+ */
+static struct vblk *ldm_get_volume (const struct ldmdb *ldb,
+				    const struct vblk_part *part,
+				    struct vblk **comp)
+{
+	struct vblk *volu;
+
+	*comp = ldm_find_vblk (ldb, part->parent_id);
+	if (!*comp || (*comp)->type != VBLK_CMP3)
+		return NULL;
+	volu = ldm_find_vblk (ldb, (*comp)->vblk.comp.parent_id);
+	if (!volu || volu->type != VBLK_VOL5)
+		return NULL;
+	return volu;
+}
+
+/**
+ * ldm_set_volume_info - Name a partition after its volume
+ * @pp:    List of the partitions parsed so far
+ * @n:     Slot of the partition
+ * @volu:  Volume VBLK
+ *
+ * Copy the volume's name and GUID into the partition's meta info.
+ *
+ * Return:  none
+ */
+static void ldm_set_volume_info (struct parsed_partitions *pp, int n,
+				 const struct vblk *volu)
+{
+	struct partition_meta_info *info;
+
+	info = alloc_partition_info (pp, n);
+	if (!info)
+		return;
+	BUILD_BUG_ON (sizeof (info->uuid) != sizeof (volu->vblk.volu.guid));
+	memcpy (info->uuid, volu->vblk.volu.guid, sizeof (info->uuid));
+	strlcpy (info->volname, volu->name, sizeof (info->volname));
+}
+
+struct ldm_volume_extent {		/* A partition, seen from its volume */
+	const struct vblk *volu;
+	const struct vblk *comp;
+	struct partition_extent extent;
+};
+
+/**
+ * ldm_cmp_volume_extent - Order extents by volume object id, column, offset
+ * @a:  First extent
+ * @b:  Second extent
+ *
+ * Return:  <0, 0, >0 as for memcmp
+ */
+static int ldm_cmp_volume_extent (const void *a, const void *b)
+{
+	const struct ldm_volume_extent *ea = a;
+	const struct ldm_volume_extent *eb = b;
+
+	if (ea->volu->obj_id != eb->volu->obj_id)
+		return ea->volu->obj_id < eb->volu->obj_id ? -1 : 1;
+	if (ea->extent.column != eb->extent.column)
+		return ea->extent.column - eb->extent.column;
+	if (ea->extent.offset != eb->extent.offset)
+		return ea->extent.offset < eb->extent.offset ? -1 : 1;
+	return 0;
+}
+
+/**
+ * ldm_volume_extent - Describe a partition as a piece of its volume
+ * @ldb:   Cache of the database structures
+ * @disk:  Disk VBLK of this device
+ * @vb:    Partition VBLK
+ * @ve:    Filled with the volume, component and extent
+ *
+ * Simple and spanned volumes have a basic component, their partitions are
+ * concatenated.  Striped volumes have a stripe component, and each partition
+ * is (a piece of) a column, numbered by its index.  Partitions on other
+ * disks are identified by the GUID of their disk.
+ *
+ * Return:  'true'   @ve is valid
+ *          'false'  The partition is not usable, already logged
+ */
+static bool ldm_volume_extent (const struct ldmdb *ldb,
+			       const struct vblk *disk,
+			       const struct vblk *vb,
+			       struct ldm_volume_extent *ve)
+{
+	const struct vblk_part *part = &vb->vblk.part;
+	struct vblk *comp, *volu, *member;
+
+	volu = ldm_get_volume (ldb, part, &comp);
+	if (!volu) {
+		ldm_info ("Partition %s has no volume, skipped.", vb->name);
+		return false;
+	}
+	memset (&ve->extent, 0, sizeof (ve->extent));
+	switch (comp->vblk.comp.type) {
+	case COMP_BASIC:
+		break;
+	case COMP_STRIPE:
+		if (!(vb->flags & VBLK_FLAG_PART_INDEX) ||
+		    !comp->vblk.comp.chunksize) {
+			ldm_info ("Striped volume %s has no layout, skipped.",
+				  volu->name);
+			return false;
+		}
+		ve->extent.column = part->partnum;
+		break;
+	default:
+		ldm_info ("Volume %s is RAID, skipped.", volu->name);
+		return false;
+	}
+
+	ve->volu = volu;
+	ve->comp = comp;
+	ve->extent.offset = part->volume_offset;
+	ve->extent.size = part->size;
+	if (part->disk_id == disk->obj_id) {
+		ve->extent.from = ldb->ph.logical_disk_start + part->start;
+		return true;
+	}
+	member = ldm_find_vblk (ldb, part->disk_id);
+	if (!member || (member->type != VBLK_DSK3 &&
+			member->type != VBLK_DSK4)) {
+		ldm_info ("Partition %s has no disk, skipped.", vb->name);
+		return false;
+	}
+	BUILD_BUG_ON (sizeof (ve->extent.disk_guid) != GUID_SIZE);
+	memcpy (ve->extent.disk_guid, member->vblk.disk.disk_id, GUID_SIZE);
+	ve->extent.from = part->start;
+	return true;
+}
+
+/**
+ * ldm_check_volume - Check that the extents of a volume cover it
+ * @ve:       Extents of the volume, sorted by column and offset
+ * @nr:       Number of extents
+ * @columns:  Filled with the number of stripe columns (1 if not striped)
+ *
+ * Each column must start at 0 and have no holes, the columns of a striped
+ * volume must have the same size (a multiple of the chunk size), and the
+ * columns must add up to the size of the volume.
+ *
+ * Return:  'true'   The volume can be assembled from @ve
+ *          'false'  Some pieces are missing
+ */
+static bool ldm_check_volume (const struct ldm_volume_extent *ve, int nr,
+			      int *columns)
+{
+	const struct vblk *volu = ve[0].volu;
+	const struct vblk *comp = ve[0].comp;
+	sector_t end = 0, column_size = 0, total = 0;
+	int i, column = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (ve[i].extent.column != column) {
+			if (ve[i].extent.column != column + 1)
+				return false;	/* A missing column */
+			if (column_size && end != column_size)
+				return false;	/* Columns of different sizes */
+			column_size = end;
+			column++;
+			end = 0;
+		}
+		if (ve[i].extent.offset != end)
+			return false;		/* A hole, or an overlap */
+		end += ve[i].extent.size;
+		total += ve[i].extent.size;
+	}
+	if (column_size && end != column_size)
+		return false;
+	*columns = column + 1;
+	if (comp->vblk.comp.type == COMP_STRIPE) {
+		if (comp->vblk.comp.children &&
+		    *columns != comp->vblk.comp.children)
+			return false;
+		if (sector_div (end, comp->vblk.comp.chunksize))
+			return false;		/* A partial row of chunks */
+	}
+	return total && (!volu->vblk.volu.size || total == volu->vblk.volu.size);
+}
+
+/**
+ * ldm_create_volumes - Create one partition per volume
+ * @pp:    List of the partitions parsed so far
+ * @ldb:   Cache of the database structures
+ * @disk:  Disk VBLK of this device
+ *
+ * A simple volume that has been extended is made of several partitions, not
+ * necessarily in order on the disk, a spanned volume of partitions on several
+ * disks, a striped volume of one column per disk.  Group the partitions by
+ * volume, sort them by column and offset in the volume and add each volume as
+ * a single partition made of several extents.  The volumes are numbered from
+ * 1, in the order of their object ids (the order they were created in).
+ *
+ * Only the partitions of this disk are used, unless @pp->opts.ldm_all_disks
+ * is set: then all the volumes of the disk group are added, the caller finds
+ * the other disks by their GUIDs.  RAID volumes, and volumes with missing
+ * pieces, are skipped.
+ *
+ * Return:  'true'   Volumes created
+ *          'false'  Error, out of memory
+ */
+static bool ldm_create_volumes (struct parsed_partitions *pp,
+				const struct ldmdb *ldb,
+				const struct vblk *disk)
+{
+	bool all_disks = pp->opts.ldm_all_disks;
+	struct ldm_volume_extent *ve;
+	struct partition_extent *extents;
+	const struct vblk *volu, *comp;
+	struct vblk *vb;
+	int i, j, columns, n = 0, vol_num = 1;
+
+	list_for_each_entry (vb, &ldb->v_part, list)
+		if (all_disks || vb->vblk.part.disk_id == disk->obj_id)
+			n++;
+	if (!n)
+		return true;
+
+	ve = kmalloc (n * sizeof (*ve), GFP_KERNEL);
+	extents = kmalloc (n * sizeof (*extents), GFP_KERNEL);
+	if (!ve || !extents) {
+		ldm_crit ("Out of memory.");
+		kfree (ve);
+		kfree (extents);
+		return false;
+	}
+
+	n = 0;
+	list_for_each_entry (vb, &ldb->v_part, list)
+		if ((all_disks || vb->vblk.part.disk_id == disk->obj_id) &&
+		    ldm_volume_extent (ldb, disk, vb, &ve[n]))
+			n++;
+	sort (ve, n, sizeof (*ve), ldm_cmp_volume_extent, NULL);
+
+	for (i = 0; i < n; i = j) {
+		volu = ve[i].volu;
+		comp = ve[i].comp;
+		for (j = i; j < n && ve[j].volu == volu; j++)
+			extents[j - i] = ve[j].extent;
+		if (!ldm_check_volume (&ve[i], j - i, &columns)) {
+			ldm_info ("Volume %s is incomplete%s, skipped.",
+				  volu->name, all_disks ? "" :
+				  " (or not entirely on this disk)");
+			continue;
+		}
+		if (put_partition_extents (pp, vol_num, extents, j - i))
+			continue;			/* Out of slots or memory */
+		if (comp->vblk.comp.type == COMP_STRIPE)
+			set_partition_stripes (pp, vol_num, columns,
+					       comp->vblk.comp.chunksize);
+		ldm_set_volume_info (pp, vol_num, volu);
+		vol_num++;
+	}
+
+	kfree (ve);
+	kfree (extents);
+	return true;
+}
+
 /**
  * ldm_create_data_partitions - Create data partitions for this device
  * @pp:   List of the partitions parsed so far
@@ -626,6 +1110,7 @@ static struct vblk * ldm_get_disk_objid (const struct ldmdb *ldb)
  * the partitions in the database that belong to this disk.
  *
  * Add each partition in our database, to the parsed_partitions structure.
+ * With the ldm_volumes option, add each volume instead (ldm_create_volumes).
  *
  * N.B.  This function creates the partitions in the order it finds partition
  *       objects in the linked list.
@@ -638,7 +1123,7 @@ static bool ldm_create_data_partitions (struct parsed_partitions *pp,
 {
 	struct list_head *item;
 	struct vblk *vb;
-	struct vblk *disk;
+	struct vblk *disk, *comp, *volu;
 	struct vblk_part *part;
 	int part_num = 1;
 
@@ -652,6 +1137,13 @@ static bool ldm_create_data_partitions (struct parsed_partitions *pp,
 
 	strlcat(pp->pp_buf, " [LDM]", PAGE_SIZE);
 
+	if (pp->opts.ldm_volumes) {
+		if (!ldm_create_volumes (pp, ldb, disk))
+			return false;
+		strlcat(pp->pp_buf, "\n", PAGE_SIZE);
+		return true;
+	}
+
 	/* Create the data partitions */
 	list_for_each (item, &ldb->v_part) {
 		vb = list_entry (item, struct vblk, list);
@@ -662,6 +1154,9 @@ static bool ldm_create_data_partitions (struct parsed_partitions *pp,
 
 		put_partition (pp, part_num, ldb->ph.logical_disk_start +
 				part->start, part->size);
+		volu = ldm_get_volume (ldb, part, &comp);
+		if (volu)
+			ldm_set_volume_info (pp, part_num, volu);
 		part_num++;
 	}
 
@@ -1224,7 +1719,8 @@ static bool ldm_parse_vblk (const u8 *buf, int len, struct vblk *vb)
  * @len:   Size of the raw VBLK
  * @ldb:   Cache of the database structures
  *
- * The VBLKs are sorted into categories.  Partitions are also sorted by offset.
+ * The VBLKs are sorted into categories and hashed by object id.  Partitions
+ * are sorted by offset once the whole database has been read.
  *
  * N.B.  This function does not check the validity of the VBLKs.
  *
@@ -1234,20 +1730,17 @@ static bool ldm_parse_vblk (const u8 *buf, int len, struct vblk *vb)
 static bool ldm_ldmdb_add (u8 *data, int len, struct ldmdb *ldb)
 {
 	struct vblk *vb;
-	struct list_head *item;
 
 	BUG_ON (!data || !ldb);
 
-	vb = kmalloc (sizeof (*vb), GFP_KERNEL);
+	vb = ldm_arena_alloc (&ldb->arena, sizeof (*vb));
 	if (!vb) {
 		ldm_crit ("Out of memory.");
 		return false;
 	}
 
-	if (!ldm_parse_vblk (data, len, vb)) {
-		kfree(vb);
+	if (!ldm_parse_vblk (data, len, vb))
 		return false;			/* Already logged */
-	}
 
 	/* Put vblk into the correct list. */
 	switch (vb->type) {
@@ -1266,40 +1759,58 @@ static bool ldm_ldmdb_add (u8 *data, int len, struct ldmdb *ldb)
 		list_add (&vb->list, &ldb->v_comp);
 		break;
 	case VBLK_PRT3:
-		/* Sort by the partition's start sector. */
-		list_for_each (item, &ldb->v_part) {
-			struct vblk *v = list_entry (item, struct vblk, list);
-			if ((v->vblk.part.disk_id == vb->vblk.part.disk_id) &&
-			    (v->vblk.part.start > vb->vblk.part.start)) {
-				list_add_tail (&vb->list, &v->list);
-				return true;
-			}
-		}
 		list_add_tail (&vb->list, &ldb->v_part);
 		break;
+	default:
+		return true;			/* Not referenced, not hashed */
 	}
+	hlist_add_head (&vb->hash,
+		&ldb->obj_hash[hash_64 (vb->obj_id, ldb->obj_hash_bits)]);
 	return true;
 }
 
+/**
+ * ldm_cmp_part - Order two partition VBLKs by disk and start sector
+ * @priv:  Unused
+ * @a:     First partition
+ * @b:     Second partition
+ *
+ * Return:  <0, 0, >0 as for memcmp
+ */
+static int ldm_cmp_part (void *priv, struct list_head *a, struct list_head *b)
+{
+	const struct vblk_part *pa = &list_entry (a, struct vblk, list)->vblk.part;
+	const struct vblk_part *pb = &list_entry (b, struct vblk, list)->vblk.part;
+
+	if (pa->disk_id != pb->disk_id)
+		return pa->disk_id < pb->disk_id ? -1 : 1;
+	if (pa->start != pb->start)
+		return pa->start < pb->start ? -1 : 1;
+	return 0;
+}
+
 /**
  * ldm_frag_add - Add a VBLK fragment to a list
  * @data:   Raw fragment to be added to the list
  * @size:   Size of the raw fragment
- * @frags:  Linked list of VBLK fragments
+ * @frags:  VBLK fragments collected so far
+ * @ldb:    Cache of the database structures (for the arena)
  *
  * Fragmented VBLKs may not be consecutive in the database, so they are placed
- * in a list so they can be pieced together later.
+ * in a list, and hashed by group, so they can be pieced together later.
  *
  * Return:  'true'   Success, the VBLK was added to the list
  *          'false'  Error, a problem occurred
  */
-static bool ldm_frag_add (const u8 *data, int size, struct list_head *frags)
+static bool ldm_frag_add (const u8 *data, int size, struct ldm_frags *frags,
+			  struct ldmdb *ldb)
 {
 	struct frag *f;
-	struct list_head *item;
+	struct hlist_node *node;
+	struct hlist_head *bucket;
 	int rec, num, group;
 
-	BUG_ON (!data || !frags);
+	BUG_ON (!data || !frags || !ldb);
 
 	if (size < 2 * VBLK_SIZE_HEAD) {
 		ldm_error("Value of size is to small.");
@@ -1318,13 +1829,12 @@ static bool ldm_frag_add (const u8 *data, int size, struct list_head *frags)
 		return false;
 	}
 
-	list_for_each (item, frags) {
-		f = list_entry (item, struct frag, list);
+	bucket = &frags->hash[hash_32 (group, frags->hash_bits)];
+	hlist_for_each_entry (f, node, bucket, hash)
 		if (f->group == group)
 			goto found;
-	}
 
-	f = kmalloc (sizeof (*f) + size*num, GFP_KERNEL);
+	f = ldm_arena_alloc (&ldb->arena, sizeof (*f) + size*num);
 	if (!f) {
 		ldm_crit ("Out of memory.");
 		return false;
@@ -1335,7 +1845,8 @@ static bool ldm_frag_add (const u8 *data, int size, struct list_head *frags)
 	f->rec   = rec;
 	f->map   = 0xFF << num;
 
-	list_add_tail (&f->list, frags);
+	list_add_tail (&f->list, &frags->list);
+	hlist_add_head (&f->hash, bucket);
 found:
 	if (rec >= f->num) {
 		ldm_error("REC value (%d) exceeds NUM value (%d)", rec, f->num);
@@ -1358,27 +1869,9 @@ found:
 	return true;
 }
 
-/**
- * ldm_frag_free - Free a linked list of VBLK fragments
- * @list:  Linked list of fragments
- *
- * Free a linked list of VBLK fragments
- *
- * Return:  none
- */
-static void ldm_frag_free (struct list_head *list)
-{
-	struct list_head *item, *tmp;
-
-	BUG_ON (!list);
-
-	list_for_each_safe (item, tmp, list)
-		kfree (list_entry (item, struct frag, list));
-}
-
 /**
  * ldm_frag_commit - Validate fragmented VBLKs and add them to the database
- * @frags:  Linked list of VBLK fragments
+ * @frags:  VBLK fragments
  * @ldb:    Cache of the database structures
  *
  * Now that all the fragmented VBLKs have been collected, they must be added to
@@ -1387,16 +1880,13 @@ static void ldm_frag_free (struct list_head *list)
  * Return:  'true'   All the fragments we added successfully
  *          'false'  One or more of the fragments we invalid
  */
-static bool ldm_frag_commit (struct list_head *frags, struct ldmdb *ldb)
+static bool ldm_frag_commit (struct ldm_frags *frags, struct ldmdb *ldb)
 {
 	struct frag *f;
-	struct list_head *item;
 
 	BUG_ON (!frags || !ldb);
 
-	list_for_each (item, frags) {
-		f = list_entry (item, struct frag, list);
-
+	list_for_each_entry (f, &frags->list, list) {
 		if (f->map != 0xFF) {
 			ldm_error ("VBLK group %d is incomplete (0x%02x).",
 				f->group, f->map);
@@ -1421,14 +1911,14 @@ static bool ldm_frag_commit (struct list_head *frags, struct ldmdb *ldb)
  * Return:  'true'   All the VBLKs were read successfully
  *          'false'  An error occurred
  */
-static bool ldm_get_vblks(struct parsed_partitions *state, unsigned long base,
+static bool ldm_get_vblks(struct parsed_partitions *state, sector_t base,
 			  struct ldmdb *ldb)
 {
 	int size, perbuf, skip, finish, s, v, recs;
 	u8 *data = NULL;
 	Sector sect;
 	bool result = false;
-	LIST_HEAD (frags);
+	struct ldm_frags frags;
 
 	BUG_ON(!state || !ldb);
 
@@ -1437,6 +1927,17 @@ static bool ldm_get_vblks(struct parsed_partitions *state, unsigned long base,
 	skip   = ldb->vm.vblk_offset >> 9;		/* Bytes to sectors */
 	finish = (size * ldb->vm.last_vblk_seq) >> 9;
 
+	/* A fragmented VBLK uses at least two records */
+	INIT_LIST_HEAD (&frags.list);
+	ldb->obj_hash = ldm_alloc_hash (&ldb->arena, ldb->vm.last_vblk_seq,
+					&ldb->obj_hash_bits);
+	frags.hash = ldm_alloc_hash (&ldb->arena, ldb->vm.last_vblk_seq / 2,
+				     &frags.hash_bits);
+	if (!ldb->obj_hash || !frags.hash) {
+		ldm_crit ("Out of memory.");
+		return false;
+	}
+
 	for (s = skip; s < finish; s++) {		/* For each sector */
 		data = read_part_sector(state, base + OFF_VMDB + s, &sect);
 		if (!data) {
@@ -1455,7 +1956,7 @@ static bool ldm_get_vblks(struct parsed_partitions *state, unsigned long base,
 				if (!ldm_ldmdb_add (data, size, ldb))
 					goto out;	/* Already logged */
 			} else if (recs > 1) {
-				if (!ldm_frag_add (data, size, &frags))
+				if (!ldm_frag_add (data, size, &frags, ldb))
 					goto out;	/* Already logged */
 			}
 			/* else Record is not in use, ignore it. */
@@ -1465,33 +1966,16 @@ static bool ldm_get_vblks(struct parsed_partitions *state, unsigned long base,
 	}
 
 	result = ldm_frag_commit (&frags, ldb);	/* Failures, already logged */
+
+	/* Sort the partitions by disk and start sector (list_sort is stable) */
+	list_sort (NULL, &ldb->v_part, ldm_cmp_part);
 out:
 	if (data)
 		put_dev_sector (sect);
-	ldm_frag_free (&frags);
 
 	return result;
 }
 
-/**
- * ldm_free_vblks - Free a linked list of vblk's
- * @lh:  Head of a linked list of struct vblk
- *
- * Free a list of vblk's and free the memory used to maintain the list.
- *
- * Return:  none
- */
-static void ldm_free_vblks (struct list_head *lh)
-{
-	struct list_head *item, *tmp;
-
-	BUG_ON (!lh);
-
-	list_for_each_safe (item, tmp, lh)
-		kfree (list_entry (item, struct vblk, list));
-}
-
-
 /**
  * ldm_partition - Find out whether a device is a dynamic disk and handle it
  * @state: Partition check state including device holding the LDM Database
@@ -1512,7 +1996,7 @@ static void ldm_free_vblks (struct list_head *lh)
 int ldm_partition(struct parsed_partitions *state)
 {
 	struct ldmdb  *ldb;
-	unsigned long base;
+	sector_t base;
 	int result = -1;
 
 	BUG_ON(!state);
@@ -1526,6 +2010,7 @@ int ldm_partition(struct parsed_partitions *state)
 		ldm_crit ("Out of memory.");
 		goto out;
 	}
+	probe_alloc_charge(state, sizeof (*ldb));
 
 	/* Parse and check privheads. */
 	if (!ldm_validate_privheads(state, &ldb->ph))
@@ -1540,6 +2025,9 @@ int ldm_partition(struct parsed_partitions *state)
 	    	goto out;		/* Already logged */
 
 	/* Initialize vblk lists in ldmdb struct */
+	ldb->arena.chunks = NULL;
+	ldb->arena.allocated = 0;
+	ldb->obj_hash = NULL;
 	INIT_LIST_HEAD (&ldb->v_dgrp);
 	INIT_LIST_HEAD (&ldb->v_disk);
 	INIT_LIST_HEAD (&ldb->v_volu);
@@ -1554,16 +2042,15 @@ int ldm_partition(struct parsed_partitions *state)
 	/* Finally, create the data partition devices. */
 	if (ldm_create_data_partitions(state, ldb)) {
 		ldm_debug ("Parsed LDM database successfully.");
+		if (state->opts.defer_verify)
+			state->verify = ldm_verify_backups;
 		result = 1;
 	}
 	/* else Already logged */
 
 cleanup:
-	ldm_free_vblks (&ldb->v_dgrp);
-	ldm_free_vblks (&ldb->v_disk);
-	ldm_free_vblks (&ldb->v_volu);
-	ldm_free_vblks (&ldb->v_comp);
-	ldm_free_vblks (&ldb->v_part);
+	probe_alloc_charge(state, ldb->arena.allocated);
+	ldm_arena_free (&ldb->arena);
 out:
 	kfree (ldb);
 	return result;
@@ -103,6 +103,7 @@ struct parsed_partitions;
 
 struct frag {				/* VBLK Fragment handling */
 	struct list_head list;
+	struct hlist_node hash;		/* in ldm_frags.hash, by group */
 	u32		group;
 	u8		num;		/* Total number of records */
 	u8		rec;		/* This is record number n */
@@ -196,6 +197,31 @@ struct vblk {				/* Generalised VBLK */
 		struct vblk_volu volu;
 	} vblk;
 	struct list_head list;
+	struct hlist_node hash;		/* in ldmdb.obj_hash, by obj_id */
+};
+
+/*
+ * All the in-memory database objects (VBLKs, fragments, hash tables)
+ * are carved out of a few large chunks, freed at once.
+ */
+#define LDM_ARENA_CHUNK		(32 * 1024)
+
+struct ldm_arena_chunk {
+	struct ldm_arena_chunk *next;
+	size_t	size;
+	size_t	used;
+	u8	data[0];
+};
+
+struct ldm_arena {
+	struct ldm_arena_chunk *chunks;	/* current chunk first */
+	size_t allocated;		/* bytes in the chunks */
+};
+
+struct ldm_frags {			/* Fragmented VBLKs being collected */
+	struct list_head list;		/* in database order */
+	struct hlist_head *hash;	/* by group */
+	unsigned int hash_bits;
 };
 
 struct ldmdb {				/* Cache of the database */
@@ -207,9 +233,15 @@ struct ldmdb {				/* Cache of the database */
 	struct list_head v_volu;
 	struct list_head v_comp;
 	struct list_head v_part;
+	struct hlist_head *obj_hash;	/* all the VBLKs, by obj_id */
+	unsigned int obj_hash_bits;
+	struct ldm_arena arena;
 };
 
 int ldm_partition(struct parsed_partitions *state);
+int ldm_verify_backups(struct parsed_partitions *state);
+bool ldm_fingerprint(struct parsed_partitions *state, u64 *seq);
+bool ldm_member_disk(struct block_device *bdev, u8 *guid, u64 *data_start);
 
 #endif /* _FS_PT_LDM_H_ */
 
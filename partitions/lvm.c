@@ -0,0 +1,733 @@
+/*
+ *  fs/partitions/lvm.c
+ *
+ *  LVM2 physical volumes: the logical volumes of the volume group are
+ *  added as the partitions of the PV (a whole disk, or a partition with a
+ *  nested table).
+ *
+ *  The metadata is the text of the current copy in the first metadata area
+ *  of the PV, and only the few keys needed to map the volumes are looked
+ *  at.  Only linear volumes (segments of type "striped" with one stripe)
+ *  that are entirely on this PV are added: each segment becomes an extent of
+ *  the partition, sorted by logical extent, so mapping a block of a volume
+ *  is a binary search.  Snapshots, RAID, thin and mirrored volumes, and the
+ *  hidden volumes they are made of, are skipped.
+ */
+
+#include <linux/ctype.h>
+#include <linux/crc32.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+
+#include "check.h"
+#include "lvm.h"
+
+/* Sections of the metadata text the parser cares about */
+enum lvm_section {
+	LVM_SEC_ROOT,			/* the file itself */
+	LVM_SEC_VG,			/* vgname { ... } */
+	LVM_SEC_PVS,			/* physical_volumes { ... } */
+	LVM_SEC_PV,			/* pv0 { ... } */
+	LVM_SEC_LVS,			/* logical_volumes { ... } */
+	LVM_SEC_LV,			/* lvname { ... } */
+	LVM_SEC_SEGMENT,		/* segment1 { ... } */
+	LVM_SEC_OTHER,			/* anything else, skipped */
+};
+
+#define LVM_MAX_DEPTH		8	/* nested sections */
+
+enum lvm_token_type {
+	LVM_TOK_END,
+	LVM_TOK_WORD,			/* key, number */
+	LVM_TOK_STRING,			/* "..." (without the quotes) */
+	LVM_TOK_PUNCT,			/* = { } [ ] , */
+	LVM_TOK_ERROR,
+};
+
+struct lvm_token {
+	enum lvm_token_type type;
+	const char *s;
+	int len;
+};
+
+struct lvm_lexer {
+	const char *p;
+	const char *end;
+};
+
+struct lvm_segment {
+	u64 start_extent;		/* first logical extent */
+	u64 extent_count;
+	u64 pe;				/* first physical extent */
+	char pv[LVM_NAME_LEN];		/* the PV, as named in the metadata */
+	bool linear;
+};
+
+struct lvm_lv {
+	char name[LVM_NAME_LEN];
+	int first_segment;		/* in lvm_vg.segments */
+	int nr_segments;
+	bool visible;
+};
+
+struct lvm_vg {
+	char name[LVM_NAME_LEN];
+	u64 extent_size;		/* in sectors */
+	const u8 *pv_uuid;		/* of this PV, from its label */
+	char pv[LVM_NAME_LEN];		/* this PV, as named in the metadata */
+	u64 pe_start;			/* its first physical extent, sectors */
+	bool pv_found;
+	bool pv_match;			/* the PV being parsed is this one */
+	u64 pv_pe_start;		/* its pe_start */
+	struct lvm_lv *lvs;
+	int nr_lvs, max_lvs;
+	struct lvm_segment *segments;
+	int nr_segments, max_segments;
+};
+
+/*
+ * Read bytes of the PV starting at offset (in sectors), from pos (in bytes)
+ * Returns 0, or -1 if a sector can't be read
+ */
+static int lvm_read_bytes(struct parsed_partitions *state, sector_t offset,
+			  u64 pos, u8 *buf, size_t len)
+{
+	Sector sect;
+	unsigned char *data;
+
+	while (len) {
+		unsigned int skip = pos & 511;
+		size_t chunk = min_t(size_t, len, 512 - skip);
+
+		data = read_part_sector(state, offset + (pos >> 9), &sect);
+		if (!data)
+			return -1;
+		memcpy(buf, data + skip, chunk);
+		put_dev_sector(sect);
+		buf += chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Find the label of a PV in its first sectors: returns the PV uuid and
+ * its first metadata area (mda->size is 0 if it has none)
+ * Returns 1 if found, 0 if not a PV, -1 on read error
+ */
+static int lvm_read_label(struct parsed_partitions *state, sector_t offset,
+			  sector_t size, u8 *pv_uuid, struct lvm_disk_locn *mda)
+{
+	struct lvm_label_header *label;
+	struct lvm_pv_header *pvh;
+	struct lvm_disk_locn *area, *last;
+	Sector sect;
+	unsigned char *data;
+	u32 pvh_offset;
+	int s, list;
+
+	for (s = 0; s < LVM_LABEL_SCAN_SECTORS && s < size; s++) {
+		data = read_part_sector(state, offset + s, &sect);
+		if (!data)
+			return s ? 0 : -1;
+		label = (struct lvm_label_header *) data;
+		pvh_offset = le32_to_cpu(label->offset_xl);
+		if (memcmp(label->id, LVM_LABEL_ID, sizeof(label->id)) ||
+		    memcmp(label->type, LVM_LABEL_TYPE, sizeof(label->type)) ||
+		    le64_to_cpu(label->sector_xl) != s ||
+		    pvh_offset < sizeof(*label) ||
+		    pvh_offset > 512 - sizeof(*pvh) - 2 * sizeof(*area) ||
+		    crc32_le(LVM_INITIAL_CRC, data + 20, 512 - 20) !=
+		    le32_to_cpu(label->crc_xl)) {
+			put_dev_sector(sect);
+			continue;
+		}
+
+		pvh = (struct lvm_pv_header *) (data + pvh_offset);
+		memcpy(pv_uuid, pvh->pv_uuid, LVM_ID_LEN);
+		memset(mda, 0, sizeof(*mda));
+		/* Skip the data areas, keep the first metadata area */
+		area = pvh->disk_areas_xl;
+		last = (struct lvm_disk_locn *) (data + 512) - 1;
+		for (list = 0; list < 2 && area <= last; area++) {
+			if (!area->offset && !area->size)
+				list++;
+			else if (list == 1 && !mda->size)
+				*mda = *area;
+		}
+		put_dev_sector(sect);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Read the header of a metadata area, and the location of the current
+ * metadata in its ring buffer
+ * Returns 1 if there is metadata, 0 if not (or the header is invalid),
+ * -1 on read error
+ */
+static int lvm_read_mda_header(struct parsed_partitions *state,
+			       sector_t offset, sector_t psize,
+			       const struct lvm_disk_locn *mda,
+			       struct lvm_raw_locn *rlocn)
+{
+	struct lvm_mda_header *mdah;
+	Sector sect;
+	unsigned char *data;
+	u64 start = le64_to_cpu(mda->offset);
+	u64 size = le64_to_cpu(mda->size);
+	int res = 0;
+
+	if ((start & 511) || size <= LVM_MDA_HEADER_SIZE ||
+	    start + size > (u64) psize << 9)
+		return 0;
+	data = read_part_sector(state, offset + (start >> 9), &sect);
+	if (!data)
+		return -1;
+	mdah = (struct lvm_mda_header *) data;
+	if (crc32_le(LVM_INITIAL_CRC, data + 4, LVM_MDA_HEADER_SIZE - 4) ==
+	    le32_to_cpu(mdah->checksum_xl) &&
+	    !memcmp(mdah->magic, LVM_FMTT_MAGIC, sizeof(mdah->magic)) &&
+	    le32_to_cpu(mdah->version) == LVM_FMTT_VERSION &&
+	    le64_to_cpu(mdah->start) == start &&
+	    le64_to_cpu(mdah->size) == size) {
+		*rlocn = mdah->raw_locns[0];
+		res = rlocn->offset && !(le32_to_cpu(rlocn->flags) &
+					 LVM_RAW_LOCN_IGNORED);
+	}
+	put_dev_sector(sect);
+	return res;
+}
+
+/*
+ * Read the current metadata text, which can wrap around the end of the
+ * ring buffer (back to the first byte after the header)
+ * Returns the text (NUL terminated, to be freed), NULL if it can't be read
+ */
+static char *lvm_read_metadata(struct parsed_partitions *state, sector_t offset,
+			       const struct lvm_disk_locn *mda,
+			       const struct lvm_raw_locn *rlocn)
+{
+	u64 start = le64_to_cpu(mda->offset);
+	u64 size = le64_to_cpu(mda->size);
+	u64 pos = le64_to_cpu(rlocn->offset);
+	u64 len = le64_to_cpu(rlocn->size);
+	size_t first;
+	char *text;
+	u32 crc;
+
+	if (pos < LVM_MDA_HEADER_SIZE || pos >= size || !len ||
+	    len > LVM_METADATA_MAX || len > size - LVM_MDA_HEADER_SIZE) {
+		printk(KERN_WARNING "%s: LVM2 metadata too big or invalid\n",
+		       state->name);
+		return NULL;
+	}
+	text = kmalloc(len + 1, GFP_KERNEL);
+	if (!text)
+		return NULL;
+	probe_alloc_charge(state, len + 1);
+	first = min(len, size - pos);
+	if (lvm_read_bytes(state, offset, start + pos, text, first) ||
+	    lvm_read_bytes(state, offset, start + LVM_MDA_HEADER_SIZE,
+			   text + first, len - first))
+		goto fail;
+	crc = crc32_le(LVM_INITIAL_CRC, text, len);
+	if (crc != le32_to_cpu(rlocn->checksum)) {
+		printk(KERN_WARNING "%s: LVM2 metadata checksum mismatch\n",
+		       state->name);
+		goto fail;
+	}
+	text[len] = '\0';
+	return text;
+fail:
+	kfree(text);
+	return NULL;
+}
+
+/*
+ * Metadata text tokenizer: skips blanks and comments
+ */
+static void lvm_next_token(struct lvm_lexer *lx, struct lvm_token *tok)
+{
+	const char *p = lx->p;
+
+	while (p < lx->end) {
+		if (*p == '#')
+			while (p < lx->end && *p != '\n')
+				p++;
+		else if (isspace(*p))
+			p++;
+		else
+			break;
+	}
+	tok->s = p;
+	tok->len = 0;
+	if (p == lx->end || *p == '\0') {
+		tok->type = LVM_TOK_END;
+	} else if (*p == '"') {
+		tok->s = ++p;
+		while (p < lx->end && *p != '"') {
+			if (*p == '\\' && p + 1 < lx->end)
+				p++;
+			p++;
+		}
+		tok->type = p < lx->end ? LVM_TOK_STRING : LVM_TOK_ERROR;
+		tok->len = p - tok->s;
+		p++;
+	} else if (strchr("={}[],", *p)) {
+		tok->type = LVM_TOK_PUNCT;
+		tok->len = 1;
+		p++;
+	} else {
+		while (p < lx->end && (isalnum(*p) || strchr("_.+-", *p)))
+			p++;
+		tok->len = p - tok->s;
+		tok->type = tok->len ? LVM_TOK_WORD : LVM_TOK_ERROR;
+	}
+	lx->p = min(p, lx->end);
+}
+
+static bool lvm_tok_is(const struct lvm_token *tok, const char *s)
+{
+	return tok->len == strlen(s) && !memcmp(tok->s, s, tok->len);
+}
+
+static bool lvm_tok_punct(const struct lvm_token *tok, char c)
+{
+	return tok->type == LVM_TOK_PUNCT && tok->s[0] == c;
+}
+
+static int lvm_tok_u64(const struct lvm_token *tok, u64 *value)
+{
+	int i;
+
+	if (tok->type != LVM_TOK_WORD || tok->len > 19)
+		return -EINVAL;
+	*value = 0;
+	for (i = 0; i < tok->len; i++) {
+		if (!isdigit(tok->s[i]))
+			return -EINVAL;
+		*value = *value * 10 + (tok->s[i] - '0');
+	}
+	return 0;
+}
+
+static void lvm_tok_copy(const struct lvm_token *tok, char *buf, size_t size)
+{
+	size_t len = min_t(size_t, tok->len, size - 1);
+
+	memcpy(buf, tok->s, len);
+	buf[len] = '\0';
+}
+
+/*
+ * Compare a PV id of the metadata (with dashes) with the one of the label
+ */
+static bool lvm_id_equal(const struct lvm_token *tok, const u8 *uuid)
+{
+	int i, n = 0;
+
+	for (i = 0; i < tok->len; i++) {
+		if (tok->s[i] == '-')
+			continue;
+		if (n == LVM_ID_LEN || tok->s[i] != uuid[n])
+			return false;
+		n++;
+	}
+	return n == LVM_ID_LEN;
+}
+
+/*
+ * Make room for one more entry in a growing array
+ */
+static int lvm_grow(void **array, int *max, int nr, size_t size)
+{
+	void *p;
+	int n;
+
+	if (nr < *max)
+		return 0;
+	n = max(*max * 2, 16);
+	p = krealloc(*array, n * size, GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+	*array = p;
+	*max = n;
+	return 0;
+}
+
+/*
+ * Apply a value (element index of a list, 0 if not a list) to the section
+ */
+static int lvm_set_value(struct lvm_vg *vg, enum lvm_section sec,
+			 const struct lvm_token *key, int index,
+			 const struct lvm_token *val)
+{
+	struct lvm_segment *seg;
+	u64 n;
+
+	if (val->type != LVM_TOK_WORD && val->type != LVM_TOK_STRING)
+		return -EINVAL;
+
+	switch (sec) {
+	case LVM_SEC_VG:
+		if (lvm_tok_is(key, "extent_size"))
+			return lvm_tok_u64(val, &vg->extent_size);
+		break;
+	case LVM_SEC_PV:
+		if (lvm_tok_is(key, "id"))
+			vg->pv_match = lvm_id_equal(val, vg->pv_uuid);
+		else if (lvm_tok_is(key, "pe_start"))
+			return lvm_tok_u64(val, &vg->pv_pe_start);
+		break;
+	case LVM_SEC_LV:
+		if (lvm_tok_is(key, "status") && lvm_tok_is(val, "VISIBLE"))
+			vg->lvs[vg->nr_lvs - 1].visible = true;
+		break;
+	case LVM_SEC_SEGMENT:
+		seg = &vg->segments[vg->nr_segments - 1];
+		if (lvm_tok_is(key, "start_extent"))
+			return lvm_tok_u64(val, &seg->start_extent);
+		if (lvm_tok_is(key, "extent_count"))
+			return lvm_tok_u64(val, &seg->extent_count);
+		if (lvm_tok_is(key, "type")) {
+			if (!lvm_tok_is(val, "striped"))
+				seg->linear = false;
+		} else if (lvm_tok_is(key, "stripe_count")) {
+			if (lvm_tok_u64(val, &n) || n != 1)
+				seg->linear = false;
+		} else if (lvm_tok_is(key, "stripes")) {
+			if (index == 0)
+				lvm_tok_copy(val, seg->pv, sizeof(seg->pv));
+			else if (index == 1)
+				return lvm_tok_u64(val, &seg->pe);
+			else
+				seg->linear = false;
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Parse the value of key (after the '='): a word, a string or a list
+ */
+static int lvm_parse_value(struct lvm_lexer *lx, struct lvm_vg *vg,
+			   enum lvm_section sec, const struct lvm_token *key)
+{
+	struct lvm_token tok;
+	int i, ret;
+
+	lvm_next_token(lx, &tok);
+	if (!lvm_tok_punct(&tok, '['))
+		return lvm_set_value(vg, sec, key, 0, &tok);
+	for (i = 0; ; i++) {
+		lvm_next_token(lx, &tok);
+		if (i == 0 && lvm_tok_punct(&tok, ']'))
+			return 0;		/* empty list */
+		ret = lvm_set_value(vg, sec, key, i, &tok);
+		if (ret)
+			return ret;
+		lvm_next_token(lx, &tok);
+		if (lvm_tok_punct(&tok, ']'))
+			return 0;
+		if (!lvm_tok_punct(&tok, ','))
+			return -EINVAL;
+	}
+}
+
+static int lvm_parse_section(struct lvm_lexer *lx, struct lvm_vg *vg,
+			     enum lvm_section sec, int depth);
+
+/*
+ * Parse the section named key (after the '{'), in the parent section
+ */
+static int lvm_parse_subsection(struct lvm_lexer *lx, struct lvm_vg *vg,
+				enum lvm_section parent,
+				const struct lvm_token *key, int depth)
+{
+	enum lvm_section sec = LVM_SEC_OTHER;
+	struct lvm_lv *lv;
+	int ret;
+
+	if (depth > LVM_MAX_DEPTH)
+		return -EINVAL;
+
+	switch (parent) {
+	case LVM_SEC_ROOT:
+		if (!vg->name[0]) {
+			lvm_tok_copy(key, vg->name, sizeof(vg->name));
+			sec = LVM_SEC_VG;
+		}
+		break;
+	case LVM_SEC_VG:
+		if (lvm_tok_is(key, "physical_volumes"))
+			sec = LVM_SEC_PVS;
+		else if (lvm_tok_is(key, "logical_volumes"))
+			sec = LVM_SEC_LVS;
+		break;
+	case LVM_SEC_PVS:
+		vg->pv_match = false;
+		vg->pv_pe_start = 0;
+		sec = LVM_SEC_PV;
+		break;
+	case LVM_SEC_LVS:
+		if (lvm_grow((void **) &vg->lvs, &vg->max_lvs, vg->nr_lvs,
+			     sizeof(*vg->lvs)))
+			return -ENOMEM;
+		lv = &vg->lvs[vg->nr_lvs++];
+		memset(lv, 0, sizeof(*lv));
+		lvm_tok_copy(key, lv->name, sizeof(lv->name));
+		lv->first_segment = vg->nr_segments;
+		sec = LVM_SEC_LV;
+		break;
+	case LVM_SEC_LV:
+		if (key->len <= 7 || memcmp(key->s, "segment", 7))
+			break;
+		if (lvm_grow((void **) &vg->segments, &vg->max_segments,
+			     vg->nr_segments, sizeof(*vg->segments)))
+			return -ENOMEM;
+		memset(&vg->segments[vg->nr_segments], 0,
+		       sizeof(*vg->segments));
+		vg->segments[vg->nr_segments++].linear = true;
+		vg->lvs[vg->nr_lvs - 1].nr_segments++;
+		sec = LVM_SEC_SEGMENT;
+		break;
+	default:
+		break;
+	}
+
+	ret = lvm_parse_section(lx, vg, sec, depth);
+	if (!ret && sec == LVM_SEC_PV && vg->pv_match && !vg->pv_found) {
+		lvm_tok_copy(key, vg->pv, sizeof(vg->pv));
+		vg->pe_start = vg->pv_pe_start;
+		vg->pv_found = true;
+	}
+	return ret;
+}
+
+/*
+ * Parse the keys and subsections of a section, up to its closing '}'
+ * (or the end of the text for the root)
+ */
+static int lvm_parse_section(struct lvm_lexer *lx, struct lvm_vg *vg,
+			     enum lvm_section sec, int depth)
+{
+	struct lvm_token key, tok;
+	int ret;
+
+	for (;;) {
+		lvm_next_token(lx, &key);
+		if (key.type == LVM_TOK_END)
+			return sec == LVM_SEC_ROOT ? 0 : -EINVAL;
+		if (lvm_tok_punct(&key, '}'))
+			return sec == LVM_SEC_ROOT ? -EINVAL : 0;
+		if (key.type != LVM_TOK_WORD)
+			return -EINVAL;
+		lvm_next_token(lx, &tok);
+		if (lvm_tok_punct(&tok, '{'))
+			ret = lvm_parse_subsection(lx, vg, sec, &key, depth + 1);
+		else if (lvm_tok_punct(&tok, '='))
+			ret = lvm_parse_value(lx, vg, sec, &key);
+		else
+			ret = -EINVAL;
+		if (ret)
+			return ret;
+	}
+}
+
+static int lvm_cmp_segment(const void *a, const void *b)
+{
+	const struct lvm_segment *sa = a;
+	const struct lvm_segment *sb = b;
+
+	if (sa->start_extent != sb->start_extent)
+		return sa->start_extent < sb->start_extent ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Map the segments of a logical volume to extents of this PV, sorted by
+ * logical extent and without holes.  Segments that are also contiguous on
+ * the PV (a volume extended in place) are merged.
+ * Returns the number of extents, 0 if the volume can't be mapped
+ */
+static int lvm_map_volume(struct lvm_vg *vg, struct lvm_lv *lv,
+			  sector_t offset, u64 pe_count,
+			  struct partition_extent *extents)
+{
+	struct lvm_segment *seg = &vg->segments[lv->first_segment];
+	u64 le = 0;
+	int i, nr = 0;
+
+	sort(seg, lv->nr_segments, sizeof(*seg), lvm_cmp_segment, NULL);
+	for (i = 0; i < lv->nr_segments; i++, seg++) {
+		sector_t from, size;
+
+		if (!seg->linear || strcmp(seg->pv, vg->pv) ||
+		    seg->start_extent != le || !seg->extent_count ||
+		    seg->pe > pe_count || seg->extent_count > pe_count - seg->pe)
+			return 0;
+		from = offset + vg->pe_start + seg->pe * vg->extent_size;
+		size = seg->extent_count * vg->extent_size;
+		if (nr && extents[nr - 1].from + extents[nr - 1].size == from) {
+			extents[nr - 1].size += size;
+		} else {
+			memset(&extents[nr], 0, sizeof(extents[nr]));
+			extents[nr].offset = le * vg->extent_size;
+			extents[nr].from = from;
+			extents[nr].size = size;
+			nr++;
+		}
+		le += seg->extent_count;
+	}
+	return nr;
+}
+
+/*
+ * Add the linear volumes of this PV as partitions, from state->next
+ */
+static void lvm_add_volumes(struct parsed_partitions *state,
+			    struct lvm_vg *vg, sector_t offset, sector_t size)
+{
+	struct partition_extent *extents;
+	struct partition_meta_info *info;
+	sector_t pe_count;
+	int i, nr;
+
+	if (!vg->pv_found || !vg->extent_size || vg->extent_size > UINT_MAX ||
+	    vg->pe_start >= size) {
+		printk(KERN_WARNING "%s: LVM2 metadata doesn't describe this PV\n",
+		       state->name);
+		return;
+	}
+	pe_count = size - vg->pe_start;
+	sector_div(pe_count, vg->extent_size);
+
+	extents = kmalloc(max(vg->nr_segments, 1) * sizeof(*extents),
+			  GFP_KERNEL);
+	if (!extents)
+		return;
+	for (i = 0; i < vg->nr_lvs && state->next < state->limit; i++) {
+		struct lvm_lv *lv = &vg->lvs[i];
+
+		if (!lv->visible)
+			continue;	/* a piece of another volume */
+		nr = lvm_map_volume(vg, lv, offset, pe_count, extents);
+		if (!nr) {
+			printk(KERN_INFO "%s: LVM2 volume %s/%s is not linear on this PV, skipped\n",
+			       state->name, vg->name, lv->name);
+			continue;
+		}
+		if (put_partition_extents(state, state->next, extents, nr))
+			continue;
+		info = alloc_partition_info(state, state->next);
+		if (info)
+			snprintf(info->volname, sizeof(info->volname), "%s/%s",
+				 vg->name, lv->name);
+		state->next++;
+	}
+	kfree(extents);
+}
+
+/*
+ * Parse the PV starting at offset (a whole disk, or a partition)
+ * Returns 1 if it is a PV, 0 if not, -1 on read error
+ */
+static int lvm_parse_pv(struct parsed_partitions *state, sector_t offset,
+			sector_t size, const char *prefix)
+{
+	u8 pv_uuid[LVM_ID_LEN];
+	struct lvm_disk_locn mda;
+	struct lvm_raw_locn rlocn;
+	struct lvm_lexer lx;
+	struct lvm_vg *vg;
+	char *text;
+	int res;
+
+	res = lvm_read_label(state, offset, size, pv_uuid, &mda);
+	if (res <= 0)
+		return res;
+	strlcat(state->pp_buf, prefix, PAGE_SIZE);
+	if (!mda.size) {
+		strlcat(state->pp_buf, " (no metadata) >\n", PAGE_SIZE);
+		return 1;
+	}
+	res = lvm_read_mda_header(state, offset, size, &mda, &rlocn);
+	if (res <= 0) {
+		strlcat(state->pp_buf, " (no metadata) >\n", PAGE_SIZE);
+		return res < 0 ? -1 : 1;
+	}
+	text = lvm_read_metadata(state, offset, &mda, &rlocn);
+	if (!text) {
+		strlcat(state->pp_buf, " >\n", PAGE_SIZE);
+		return 1;
+	}
+
+	vg = kzalloc(sizeof(*vg), GFP_KERNEL);
+	if (vg) {
+		vg->pv_uuid = pv_uuid;
+		lx.p = text;
+		lx.end = text + le64_to_cpu(rlocn.size);
+		if (lvm_parse_section(&lx, vg, LVM_SEC_ROOT, 0))
+			printk(KERN_WARNING "%s: invalid LVM2 metadata\n",
+			       state->name);
+		else
+			lvm_add_volumes(state, vg, offset, size);
+		kfree(vg->lvs);
+		kfree(vg->segments);
+		kfree(vg);
+	}
+	kfree(text);
+	strlcat(state->pp_buf, " >\n", PAGE_SIZE);
+	return 1;
+}
+
+/*
+ * A whole disk LVM2 PV
+ */
+int lvm2_partition(struct parsed_partitions *state)
+{
+	state->next = 1;
+	return lvm_parse_pv(state, 0, get_capacity(state->bdev->bd_disk),
+			    " <lvm2:");
+}
+
+/*
+ * An LVM2 PV in a partition (see check_nested_partition)
+ */
+void lvm2_nested_partition(struct parsed_partitions *state,
+			   sector_t offset, sector_t size, int origin)
+{
+	char tmp[1 + BDEVNAME_SIZE + 10 + 8 + 1];
+
+	snprintf(tmp, sizeof(tmp), " %s%d: <lvm2:", state->name, origin);
+	lvm_parse_pv(state, offset, size, tmp);
+}
+
+/*
+ * Get the location and checksum of the current metadata of a whole disk
+ * PV, for the probe cache: they change whenever the metadata does
+ *
+ * Return:  'true'   @seq is valid
+ *          'false'  Not a PV, or it has no metadata
+ */
+bool lvm2_fingerprint(struct parsed_partitions *state, u64 *seq)
+{
+	sector_t size = get_capacity(state->bdev->bd_disk);
+	u8 pv_uuid[LVM_ID_LEN];
+	struct lvm_disk_locn mda;
+	struct lvm_raw_locn rlocn;
+
+	if (lvm_read_label(state, 0, size, pv_uuid, &mda) <= 0 || !mda.size)
+		return false;
+	if (lvm_read_mda_header(state, 0, size, &mda, &rlocn) <= 0)
+		return false;
+	*seq = le64_to_cpu(rlocn.offset) ^
+	       ((u64) le32_to_cpu(rlocn.checksum) << 32);
+	return true;
+}
@@ -0,0 +1,65 @@
+/*
+ *  fs/partitions/lvm.h
+ *
+ *  LVM2 physical volume label and metadata area, see lvm.c
+ */
+
+#ifndef _FS_PT_LVM_H_
+#define _FS_PT_LVM_H_
+
+#include <linux/types.h>
+
+#define LVM_LABEL_ID		"LABELONE"
+#define LVM_LABEL_TYPE		"LVM2 001"
+#define LVM_LABEL_SCAN_SECTORS	4	/* the label is in one of these */
+#define LVM_FMTT_MAGIC		" LVM2 x[5A%r0N*>"
+#define LVM_FMTT_VERSION	1
+#define LVM_MDA_HEADER_SIZE	512
+#define LVM_INITIAL_CRC		0xf597a6cf
+#define LVM_RAW_LOCN_IGNORED	0x00000001
+#define LVM_ID_LEN		32	/* without the dashes */
+#define LVM_NAME_LEN		64
+#define LVM_METADATA_MAX	(256 * 1024)	/* bigger metadata is not read */
+
+struct lvm_label_header {
+	u8	id[8];			/* LABELONE */
+	__le64	sector_xl;		/* sector of this label */
+	__le32	crc_xl;			/* from offset_xl to the end of the sector */
+	__le32	offset_xl;		/* of the pv_header, in the sector */
+	u8	type[8];		/* LVM2 001 */
+} __attribute__ ((packed));
+
+struct lvm_disk_locn {
+	__le64	offset;			/* in bytes, from the start of the PV */
+	__le64	size;			/* in bytes */
+} __attribute__ ((packed));
+
+struct lvm_pv_header {
+	u8	pv_uuid[LVM_ID_LEN];
+	__le64	device_size_xl;		/* in bytes */
+	/* data areas, then metadata areas, each list ends with a zero entry */
+	struct lvm_disk_locn disk_areas_xl[0];
+} __attribute__ ((packed));
+
+struct lvm_raw_locn {
+	__le64	offset;			/* from the start of the metadata area */
+	__le64	size;
+	__le32	checksum;
+	__le32	flags;
+} __attribute__ ((packed));
+
+struct lvm_mda_header {
+	__le32	checksum_xl;		/* of the rest of the header */
+	u8	magic[16];		/* LVM_FMTT_MAGIC */
+	__le32	version;
+	__le64	start;			/* of this metadata area */
+	__le64	size;
+	struct lvm_raw_locn raw_locns[0];	/* the current metadata first */
+} __attribute__ ((packed));
+
+int lvm2_partition(struct parsed_partitions *state);
+void lvm2_nested_partition(struct parsed_partitions *state,
+			   sector_t offset, sector_t size, int origin);
+bool lvm2_fingerprint(struct parsed_partitions *state, u64 *seq);
+
+#endif /* _FS_PT_LVM_H_ */
@@ -59,26 +59,26 @@ int mac_partition(struct parsed_partitions *state)
 		return 0;		/* not a MacOS disk */
 	}
 	blocks_in_map = be32_to_cpu(part->map_count);
-	if (blocks_in_map < 0 || blocks_in_map >= DISK_MAX_PARTS) {
+	if (blocks_in_map < 0 || blocks_in_map >= state->limit) {
 		put_dev_sector(sect);
 		return 0;
 	}
 	strlcat(state->pp_buf, " [mac]", PAGE_SIZE);
 	for (slot = 1; slot <= blocks_in_map; ++slot) {
-		int pos = slot * secsize;
+		sector_t pos = (sector_t) slot * secsize;
 		put_dev_sector(sect);
-		data = read_part_sector(state, pos/512, &sect);
+		data = read_part_sector(state, pos >> 9, &sect);
 		if (!data)
 			return -1;
-		part = (struct mac_partition *) (data + pos%512);
+		part = (struct mac_partition *) (data + (pos & 511));
 		if (be16_to_cpu(part->signature) != MAC_PARTITION_MAGIC)
 			break;
 		put_partition(state, slot,
-			be32_to_cpu(part->start_block) * (secsize/512),
-			be32_to_cpu(part->block_count) * (secsize/512));
+			(sector_t) be32_to_cpu(part->start_block) * (secsize/512),
+			(sector_t) be32_to_cpu(part->block_count) * (secsize/512));
 
 		if (!strnicmp(part->type, "Linux_RAID", 10))
-			state->parts[slot].flags = ADDPART_FLAG_RAID;
+			set_partition_flags(state, slot, ADDPART_FLAG_RAID);
 #ifdef CONFIG_PPC_PMAC
 		/*
 		 * If this is the first bootable partition, tell the
@@ -0,0 +1,342 @@
+/*
+ *  fs/partitions/md.c
+ *
+ *  Linux software RAID (md) arrays: the partitions flagged ADDPART_FLAG_RAID
+ *  by the parsers (DOS 0xfd, GPT Linux RAID, ...) are md members, and the
+ *  RAID-0 and RAID-1 arrays they make up are added as partitions after the
+ *  last one, so the arrays of an image can be read without mdadm.
+ *
+ *  Superblocks 0.90 and 1.x (1.0, 1.1 and 1.2) are read.  As md does, only
+ *  the in-sync members with the latest event count make up an array, and
+ *  the others are left out.
+ *
+ *  A RAID-0 array is a striped partition: the member with role n is column
+ *  n.  With members of different sizes only the first zone (the size of
+ *  the smallest member on every member) is added.  A RAID-1 array has one
+ *  extent per mirror, each of them the whole array: reads are spread over
+ *  the mirrors.  The arrays are read-only: a write to a RAID-1 array would
+ *  only reach one mirror, and the members stay exposed, so a write to any
+ *  array would go through another page cache than theirs.
+ */
+
+#include <linux/slab.h>
+
+#include "check.h"
+#include "md.h"
+
+struct md_member {
+	int slot;			/* the partition */
+	bool assembled;			/* already looked at */
+	u8 uuid[16];			/* of the array */
+	int level;
+	int raid_disks;
+	int role;			/* -1 if not an in-sync member */
+	u64 events;
+	sector_t data_offset;		/* in the partition */
+	sector_t data_size;		/* usable by the array */
+	sector_t dev_size;		/* used by a RAID-1 array */
+	sector_t chunk;			/* RAID-0 stripe size, in sectors */
+};
+
+/*
+ * Read nr sectors of the disk, from sector n
+ * Returns 0, or -1 if a sector can't be read
+ */
+static int md_read_sectors(struct parsed_partitions *state, sector_t n,
+			   u8 *buf, int nr)
+{
+	Sector sect;
+	unsigned char *data;
+
+	for (; nr > 0; nr--, n++, buf += 512) {
+		data = read_part_sector(state, n, &sect);
+		if (!data)
+			return -1;
+		memcpy(buf, data, 512);
+		put_dev_sector(sect);
+	}
+	return 0;
+}
+
+/*
+ * Superblock 0.90, in the last 64 KiB aligned block of the member
+ * (in the CPU byte order, as md reads it)
+ * Returns 1 if found, 0 if not, -1 on read error
+ */
+static int md_load_sb0(struct parsed_partitions *state, sector_t from,
+		       sector_t size, u8 *buf, struct md_member *m)
+{
+	mdp_super_t *sb = (mdp_super_t *) buf;
+	u32 *words = (u32 *) buf;
+	sector_t sb_start;
+	u32 disk_csum, state_bits;
+	u64 csum = 0;
+	int i;
+
+	if (size < 2 * MD_RESERVED_SECTORS)
+		return 0;
+	sb_start = MD_NEW_SIZE_SECTORS(size);
+	if (md_read_sectors(state, from + sb_start, buf, 1))
+		return -1;
+	if (sb->md_magic != MD_SB_MAGIC)
+		return 0;
+	if (md_read_sectors(state, from + sb_start + 1, buf + 512,
+			    MD_SB_BYTES / 512 - 1))
+		return -1;
+	if (sb->major_version != 0 || sb->minor_version != 90)
+		return 0;	/* 0.91 is a reshape in progress */
+
+	disk_csum = sb->sb_csum;
+	sb->sb_csum = 0;
+	for (i = 0; i < MD_SB_WORDS; i++)
+		csum += words[i];
+	if ((u32) ((csum & 0xffffffff) + (csum >> 32)) != disk_csum)
+		return 0;
+
+	memcpy(m->uuid, &sb->set_uuid0, 4);
+	memcpy(m->uuid + 4, &sb->set_uuid1, 4);
+	memcpy(m->uuid + 8, &sb->set_uuid2, 4);
+	memcpy(m->uuid + 12, &sb->set_uuid3, 4);
+	m->level = sb->level;
+	m->raid_disks = sb->raid_disks;
+	m->events = md_event(sb);
+	m->data_offset = 0;
+	m->data_size = sb_start;
+	m->dev_size = (sector_t) sb->size * 2;	/* KiB */
+	m->chunk = sb->chunk_size >> 9;
+	state_bits = sb->this_disk.state;
+	m->role = -1;
+	if ((state_bits & (1 << MD_DISK_SYNC)) &&
+	    !(state_bits & (1 << MD_DISK_FAULTY)) &&
+	    sb->this_disk.raid_disk < sb->raid_disks)
+		m->role = sb->this_disk.raid_disk;
+	return 1;
+}
+
+/*
+ * Superblock 1.x at sb_start of the member
+ * Returns 1 if found, 0 if not, -1 on read error
+ */
+static int md_load_sb1(struct parsed_partitions *state, sector_t from,
+		       sector_t size, sector_t sb_start, u8 *buf,
+		       struct md_member *m)
+{
+	struct mdp_superblock_1 *sb = (struct mdp_superblock_1 *) buf;
+	__le32 *words = (__le32 *) buf;
+	__le32 disk_csum;
+	u64 csum = 0;
+	u32 features, dev, role, max_dev;
+	int sb_size, i;
+
+	if (sb_start + MD_SB_BYTES / 512 > size)
+		return 0;
+	if (md_read_sectors(state, from + sb_start, buf, 1))
+		return -1;
+	max_dev = le32_to_cpu(sb->max_dev);
+	if (le32_to_cpu(sb->magic) != MD_SB_MAGIC ||
+	    le32_to_cpu(sb->major_version) != 1 ||
+	    le64_to_cpu(sb->super_offset) != sb_start ||
+	    max_dev > (MD_SB_BYTES - 256) / 2)
+		return 0;
+	sb_size = 256 + max_dev * 2;
+	if (md_read_sectors(state, from + sb_start + 1, buf + 512,
+			    (sb_size - 1) / 512))
+		return -1;
+
+	disk_csum = sb->sb_csum;
+	sb->sb_csum = 0;
+	for (i = 0; i + 4 <= sb_size; i += 4)
+		csum += le32_to_cpu(words[i / 4]);
+	if (sb_size & 2)
+		csum += le16_to_cpu(*(__le16 *) (buf + i));
+	if ((u32) ((csum & 0xffffffff) + (csum >> 32)) != le32_to_cpu(disk_csum))
+		return 0;
+
+	features = le32_to_cpu(sb->feature_map);
+	if (features & MD_FEATURE_RESHAPE_ACTIVE)
+		return 0;
+	memcpy(m->uuid, sb->set_uuid, sizeof(m->uuid));
+	m->level = (int) le32_to_cpu(sb->level);
+	m->raid_disks = le32_to_cpu(sb->raid_disks);
+	m->events = le64_to_cpu(sb->events);
+	m->data_offset = le64_to_cpu(sb->data_offset);
+	m->data_size = le64_to_cpu(sb->data_size);
+	m->dev_size = le64_to_cpu(sb->size);
+	m->chunk = le32_to_cpu(sb->chunksize);
+	if (m->data_offset > size || m->data_size > size - m->data_offset)
+		return 0;
+	dev = le32_to_cpu(sb->dev_number);
+	role = dev < max_dev ? le16_to_cpu(sb->dev_roles[dev]) :
+			       MD_SB1_ROLE_SPARE;
+	m->role = -1;
+	if ((int) role < m->raid_disks &&
+	    !(features & MD_FEATURE_RECOVERY_OFFSET))
+		m->role = role;	/* not spare, faulty, or being rebuilt */
+	return 1;
+}
+
+/*
+ * Read the superblock of a member: 1.2, 1.1, 1.0, then 0.90
+ * Returns 1 if found, 0 if not, -1 on read error
+ */
+static int md_load_member(struct parsed_partitions *state, int slot,
+			  u8 *buf, struct md_member *m)
+{
+	sector_t from = state->parts[slot].from;
+	sector_t size = state->parts[slot].size;
+	int res;
+
+	m->slot = slot;
+	res = md_load_sb1(state, from, size, MD_SB1_OFFSET_1_2, buf, m);
+	if (!res)
+		res = md_load_sb1(state, from, size, MD_SB1_OFFSET_1_1, buf, m);
+	if (!res && size > 8 * 2)
+		res = md_load_sb1(state, from, size, MD_SB1_OFFSET_1_0(size),
+				  buf, m);
+	if (!res)
+		res = md_load_sb0(state, from, size, buf, m);
+	return res;
+}
+
+/*
+ * Add the array of the member first (and of the members after it with the
+ * same uuid) in slot n
+ * Returns 1 if added, 0 if it can't be assembled
+ */
+static int md_add_array(struct parsed_partitions *state, int n,
+			struct md_member *members, int nr, int first)
+{
+	struct md_member *ref = &members[first];
+	struct partition_extent *extents;
+	struct md_member **by_role;
+	char tmp[1 + BDEVNAME_SIZE + 10 + 1];
+	sector_t size = 0;
+	size_t len;
+	int i, nr_extents = 0, res = 0;
+
+	for (i = first; i < nr; i++)
+		if (!memcmp(members[i].uuid, ref->uuid, sizeof(ref->uuid))) {
+			members[i].assembled = true;
+			if (members[i].events > ref->events)
+				ref = &members[i];
+		}
+	if ((ref->level != MD_LEVEL_RAID0 && ref->level != MD_LEVEL_RAID1) ||
+	    ref->raid_disks < 1 || ref->raid_disks > MD_MAX_RAID_DISKS ||
+	    (ref->level == MD_LEVEL_RAID0 && !ref->chunk))
+		return 0;
+
+	extents = kcalloc(ref->raid_disks, sizeof(*extents), GFP_KERNEL);
+	by_role = kcalloc(ref->raid_disks, sizeof(*by_role), GFP_KERNEL);
+	if (!extents || !by_role)
+		goto out;
+	for (i = first; i < nr; i++) {
+		struct md_member *m = &members[i];
+
+		if (!memcmp(m->uuid, ref->uuid, sizeof(ref->uuid)) &&
+		    m->events == ref->events && m->level == ref->level &&
+		    m->raid_disks == ref->raid_disks && m->role >= 0 &&
+		    !by_role[m->role])
+			by_role[m->role] = m;
+	}
+
+	/* The members, in role order */
+	for (i = 0; i < ref->raid_disks; i++) {
+		struct md_member *m = by_role[i];
+
+		if (m == NULL) {
+			if (ref->level == MD_LEVEL_RAID0)
+				goto out;	/* no redundancy */
+			continue;	/* degraded mirror */
+		}
+		if (ref->level == MD_LEVEL_RAID1 && m->data_size < m->dev_size)
+			goto out;
+		extents[nr_extents].from = state->parts[m->slot].from +
+					   m->data_offset;
+		extents[nr_extents].size = m->data_size;
+		extents[nr_extents].column = nr_extents;
+		if (!size || m->data_size < size)
+			size = m->data_size;
+		nr_extents++;
+	}
+	if (!nr_extents)
+		goto out;
+
+	/* " <md raid1 sda1 sda2: sda5 >", put_partition() adds the array */
+	len = strlen(state->pp_buf);
+	snprintf(tmp, sizeof(tmp), " <md raid%d", ref->level);
+	strlcat(state->pp_buf, tmp, PAGE_SIZE);
+	for (i = 0; i < ref->raid_disks; i++) {
+		if (!by_role[i])
+			continue;
+		snprintf(tmp, sizeof(tmp), " %s%d", state->name,
+			 by_role[i]->slot);
+		strlcat(state->pp_buf, tmp, PAGE_SIZE);
+	}
+	strlcat(state->pp_buf, ":", PAGE_SIZE);
+
+	if (ref->level == MD_LEVEL_RAID0) {
+		sector_div(size, ref->chunk);
+		size *= ref->chunk;	/* md drops the partial chunks */
+		for (i = 0; i < nr_extents; i++)
+			extents[i].size = size;
+		if (size && !put_partition_extents(state, n, extents, nr_extents))
+			set_partition_stripes(state, n, nr_extents, ref->chunk);
+	} else {
+		size = ref->dev_size;
+		for (i = 0; i < nr_extents; i++)
+			extents[i].size = size;
+		if (size && !put_partition_extents(state, n, extents, nr_extents))
+			set_partition_mirrors(state, n, nr_extents, size);
+	}
+	if (n >= state->nr_slots || !state->parts[n].size) {
+		state->pp_buf[len] = '\0';
+		goto out;
+	}
+	set_partition_flags(state, n, PARTITION_FLAG_MD_ARRAY);
+	strlcat(state->pp_buf, " >\n", PAGE_SIZE);
+	res = 1;
+out:
+	kfree(by_role);
+	kfree(extents);
+	return res;
+}
+
+/*
+ * Assemble the arrays made of the RAID partitions found by the parser,
+ * and add them after the last partition, in the order of their first
+ * member
+ */
+void md_assemble_arrays(struct parsed_partitions *state)
+{
+	struct md_member *members;
+	u8 *buf;
+	int p, n, nr = 0, last = 0;
+
+	for (p = 1; p < state->nr_slots; p++) {
+		if (!state->parts[p].size)
+			continue;
+		last = p;
+		if (state->parts[p].flags & ADDPART_FLAG_RAID)
+			nr++;
+	}
+	if (!nr)
+		return;
+
+	members = kcalloc(nr, sizeof(*members), GFP_KERNEL);
+	buf = kmalloc(MD_SB_BYTES, GFP_KERNEL);
+	if (!members || !buf)
+		goto out;
+	for (p = 1, nr = 0; p <= last; p++)
+		if (state->parts[p].size &&
+		    (state->parts[p].flags & ADDPART_FLAG_RAID) &&
+		    md_load_member(state, p, buf, &members[nr]) > 0)
+			nr++;
+
+	for (p = 0, n = last + 1; p < nr && n < state->limit; p++)
+		if (!members[p].assembled &&
+		    md_add_array(state, n, members, nr, p))
+			n++;
+out:
+	kfree(buf);
+	kfree(members);
+}
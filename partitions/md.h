@@ -0,0 +1,27 @@
+/*
+ *  fs/partitions/md.h
+ *
+ *  Linux software RAID (md) arrays of partitions, see md.c
+ */
+
+#ifndef _FS_PT_MD_H_
+#define _FS_PT_MD_H_
+
+#include <linux/types.h>
+#include <linux/raid/md_p.h>
+
+#define MD_LEVEL_RAID0		0
+#define MD_LEVEL_RAID1		1
+#define MD_MAX_RAID_DISKS	64	/* bigger arrays are not assembled */
+
+/* Superblock 1.x position, in sectors from the start of the member */
+#define MD_SB1_OFFSET_1_1	0
+#define MD_SB1_OFFSET_1_2	8
+#define MD_SB1_OFFSET_1_0(size)	(((size) - 8 * 2) & ~(sector_t) (4 * 2 - 1))
+
+#define MD_SB1_ROLE_SPARE	0xffff
+#define MD_SB1_ROLE_FAULTY	0xfffe
+
+void md_assemble_arrays(struct parsed_partitions *state);
+
+#endif /* _FS_PT_MD_H_ */
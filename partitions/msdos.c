@@ -19,10 +19,14 @@
  *  Re-organised Feb 1998 Russell King
  */
 #include <linux/msdos_fs.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
 
 #include "check.h"
 #include "msdos.h"
 #include "efi.h"
+#include "ldm.h"
+#include "lvm.h"
 
 /*
  * Many architectures don't like unaligned accesses, while
@@ -94,6 +98,93 @@ static int aix_magic_present(struct parsed_partitions *state, unsigned char *p)
 	return ret;
 }
 
+/*
+ * Extended partition chains: the EBRs are read ahead in windows that double
+ * while the chain stays inside them (small logical partitions, EBRs close
+ * together), and start again small when a link jumps out of the window.
+ */
+#define EBR_READAHEAD_MIN	128		/* sectors, 64 KiB */
+#define EBR_READAHEAD_MAX	8192		/* sectors, 4 MiB */
+
+struct ebr_readahead {
+	sector_t start, end;	/* sectors requested so far */
+	sector_t size;		/* of the last window */
+	sector_t limit;		/* end of the extended partition */
+};
+
+/*
+ * About to read the EBR at sector: start reading the next window once the
+ * chain is halfway through the current one
+ */
+static void ebr_readahead(struct parsed_partitions *state,
+			  struct ebr_readahead *ra, sector_t sector)
+{
+	sector_t nr;
+
+	if (sector < ra->start || sector >= ra->end) {
+		ra->start = ra->end = sector;
+		ra->size = EBR_READAHEAD_MIN / 2;
+	}
+	if (sector + ra->size / 2 < ra->end || ra->end >= ra->limit)
+		return;
+	ra->size = min_t(sector_t, ra->size * 2, EBR_READAHEAD_MAX);
+	nr = min(ra->size, ra->limit - ra->end);
+	readahead_part_sectors(state, ra->end, nr);
+	ra->end += nr;
+}
+
+/*
+ * The EBRs already read (open addressing on the sector + 1, 0 is a free
+ * slot), to stop at the first link back into the chain
+ */
+struct ebr_visited {
+	sector_t *slots;
+	unsigned int bits;
+	unsigned int count;
+};
+
+#define EBR_VISITED_MIN_BITS	6
+
+static bool ebr_visited_insert(struct ebr_visited *v, sector_t key)
+{
+	unsigned int mask = (1U << v->bits) - 1;
+	unsigned int i = hash_64(key, v->bits);
+
+	while (v->slots[i]) {
+		if (v->slots[i] == key)
+			return false;
+		i = (i + 1) & mask;
+	}
+	v->slots[i] = key;
+	v->count++;
+	return true;
+}
+
+/*
+ * Record that the EBR at sector has been read
+ * Returns 1 if it had been already (a loop), 0 if not, -ENOMEM
+ */
+static int ebr_visit(struct ebr_visited *v, sector_t sector)
+{
+	if (v->count >= (1U << v->bits) / 2) {	/* keep it half empty */
+		struct ebr_visited bigger = { .bits = v->bits + 1 };
+		unsigned int i;
+
+		if (!v->slots)
+			bigger.bits = EBR_VISITED_MIN_BITS;
+		bigger.slots = kcalloc(1U << bigger.bits, sizeof(sector_t),
+				       GFP_KERNEL);
+		if (!bigger.slots)
+			return -ENOMEM;
+		for (i = 0; v->slots && i < (1U << v->bits); i++)
+			if (v->slots[i])
+				ebr_visited_insert(&bigger, v->slots[i]);
+		kfree(v->slots);
+		*v = bigger;
+	}
+	return ebr_visited_insert(v, sector + 1) ? 0 : 1;
+}
+
 /*
  * Create devices for each logical partition in an extended partition.
  * The logical partitions form a linked list, with each entry being
@@ -103,6 +194,9 @@ static int aix_magic_present(struct parsed_partitions *state, unsigned char *p)
  * (with a start relative to the entire extended partition).
  * We do not create a Linux partition for the partition tables, but
  * only for the actual data partitions.
+ *
+ * The chain ends at the first EBR read twice.  A chain that goes on
+ * without data partitions is still cut after 100 links.
  */
 
 static void parse_extended(struct parsed_partitions *state,
@@ -113,6 +207,8 @@ static void parse_extended(struct parsed_partitions *state,
 	unsigned char *data;
 	sector_t this_sector, this_size;
 	sector_t sector_size = bdev_logical_block_size(state->bdev) / 512;
+	struct ebr_readahead ra = { .limit = first_sector + first_size };
+	struct ebr_visited visited = { .slots = NULL };
 	int loopct = 0;		/* number of links followed
 				   without finding a data partition */
 	int i;
@@ -122,12 +218,15 @@ static void parse_extended(struct parsed_partitions *state,
 
 	while (1) {
 		if (++loopct > 100)
-			return;
+			break;
 		if (state->next == state->limit)
-			return;
+			break;
+		if (ebr_visit(&visited, this_sector) == 1)
+			break;		/* a loop */
+		ebr_readahead(state, &ra, this_sector);
 		data = read_part_sector(state, this_sector, &sect);
 		if (!data)
-			return;
+			break;
 
 		if (!msdos_magic_present(data + 510))
 			goto done; 
@@ -167,7 +266,8 @@ static void parse_extended(struct parsed_partitions *state,
 
 			put_partition(state, state->next, next, size);
 			if (SYS_IND(p) == LINUX_RAID_PARTITION)
-				state->parts[state->next].flags = ADDPART_FLAG_RAID;
+				set_partition_flags(state, state->next,
+						    ADDPART_FLAG_RAID);
 			loopct = 0;
 			if (++state->next == state->limit)
 				goto done;
@@ -190,8 +290,11 @@ static void parse_extended(struct parsed_partitions *state,
 		this_size = nr_sects(p) * sector_size;
 		put_dev_sector(sect);
 	}
+	kfree(visited.slots);
+	return;
 done:
 	put_dev_sector(sect);
+	kfree(visited.slots);
 }
 
 /* james@bpgc.com: Solaris has a nasty indicator: 0x82 which also
@@ -426,6 +529,7 @@ static struct {
 	{UNIXWARE_PARTITION, parse_unixware},
 	{SOLARIS_X86_PARTITION, parse_solaris_x86},
 	{NEW_SOLARIS_X86_PARTITION, parse_solaris_x86},
+	{LINUX_LVM_PARTITION, lvm2_nested_partition},
 	{0, NULL},
 };
  
@@ -491,10 +595,44 @@ int msdos_partition(struct parsed_partitions *state)
 #endif
 	p = (struct partition *) (data + 0x1be);
 
+	/*
+	 * Quick probe: stop at the primary entries. Logical and nested
+	 * partitions are left to the full probe, and so are LDM disks,
+	 * where the DOS table does not describe the real partitions.
+	 */
+	if (state->opts.primary_only) {
+		for (slot = 1 ; slot <= 4 ; slot++, p++)
+			if (SYS_IND(p) == LDM_PARTITION) {
+				put_dev_sector(sect);
+				return 0;
+			}
+		p = (struct partition *) (data + 0x1be);
+		for (slot = 1 ; slot <= 4 ; slot++, p++) {
+			unsigned char id = SYS_IND(p);
+			int n;
+
+			if (!nr_sects(p) || is_extended_partition(p))
+				continue;
+			for (n = 0; subtypes[n].parse && id != subtypes[n].id; n++)
+				;
+			if (subtypes[n].parse)
+				continue;
+			put_partition(state, slot, start_sect(p) * sector_size,
+				      nr_sects(p) * sector_size);
+			if (id == LINUX_RAID_PARTITION)
+				set_partition_flags(state, slot, ADDPART_FLAG_RAID);
+		}
+		strlcat(state->pp_buf, " (primary)\n", PAGE_SIZE);
+		put_dev_sector(sect);
+		return 1;
+	}
+
 	/*
 	 * Look for partitions in two passes:
 	 * First find the primary and DOS-type extended partitions.
-	 * On the second pass look inside *BSD, Unixware and Solaris partitions.
+	 * On the second pass look inside *BSD, Unixware and Solaris partitions,
+	 * or just record them for check_nested_partition() unless the caller
+	 * asked for a flat namespace.
 	 */
 
 	state->next = 5;
@@ -521,7 +659,7 @@ int msdos_partition(struct parsed_partitions *state)
 		}
 		put_partition(state, slot, start, size);
 		if (SYS_IND(p) == LINUX_RAID_PARTITION)
-			state->parts[slot].flags = ADDPART_FLAG_RAID;
+			set_partition_flags(state, slot, ADDPART_FLAG_RAID);
 		if (SYS_IND(p) == DM6_PARTITION)
 			strlcat(state->pp_buf, "[DM]", PAGE_SIZE);
 		if (SYS_IND(p) == EZD_PARTITION)
@@ -544,6 +682,10 @@ int msdos_partition(struct parsed_partitions *state)
 
 		if (!subtypes[n].parse)
 			continue;
+		if (!state->opts.flat_nested) {
+			set_partition_nested(state, slot, subtypes[n].parse);
+			continue;
+		}
 		subtypes[n].parse(state, start_sect(p) * sector_size,
 				  nr_sects(p) * sector_size, slot);
 	}
@@ -0,0 +1,174 @@
+/*
+ *  fs/partitions/profile.c
+ *  Cost of the partition table probes
+ *
+ *  check_partition() records, for each format it tries, the wall time,
+ *  the read_part_sector() calls, the distinct sectors they read and the
+ *  memory allocated (struct probe_profile, in the parsed_partitions).
+ *  partsfs shows the profile of its last probe in
+ *  /sys/fs/partsfs/<device>/probe_profile, the totals of all the probes
+ *  since the module was loaded are in <debugfs>/partsfs/probe_profile.
+ *
+ *  The distinct 512-byte sectors are counted with a small open addressing
+ *  set, cleared for each format: once it is half full (a big LDM
+ *  database, the signature scan) every sector read counts.
+ */
+
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "check.h"
+#include "profile.h"
+
+struct probe_profile_total {
+	unsigned long probes;		/* times the format was tried */
+	unsigned long found;		/* ... and recognized the disk */
+	u64 ns;
+	u64 reads;
+	u64 sectors;
+	u64 alloc_bytes;
+};
+
+/* One per format, the scan last */
+static struct probe_profile_total probe_profile_totals[PARTITION_FORMATS_MAX + 1];
+static DEFINE_SPINLOCK(probe_profile_lock);
+static struct dentry *probe_profile_debugfs;
+
+static struct probe_profile_total *probe_profile_total(int format)
+{
+	if (format == PROBE_PROFILE_SCAN)
+		return &probe_profile_totals[PARTITION_FORMATS_MAX];
+	return &probe_profile_totals[format];
+}
+
+const char *probe_profile_name(int format)
+{
+	if (format == PROBE_PROFILE_SCAN)
+		return "scan";
+	return partition_format_name(format);
+}
+
+/*
+ * Start the profile of a format: forget the sectors read by the
+ * previous one
+ */
+void probe_profile_start(struct parsed_partitions *state)
+{
+	if (state->seen)
+		memset(state->seen, 0, PROBE_PROFILE_SEEN * sizeof(sector_t));
+	else
+		state->seen = kzalloc(PROBE_PROFILE_SEEN * sizeof(sector_t),
+				      GFP_KERNEL);
+	state->nr_seen = 0;
+}
+
+/*
+ * Remember a 512-byte sector read by the format
+ * Returns true the first time it is read (or once the set is full)
+ */
+static bool probe_profile_new_sector(struct parsed_partitions *state,
+				     sector_t n)
+{
+	unsigned int i;
+
+	if (!state->seen || state->nr_seen >= PROBE_PROFILE_SEEN / 2)
+		return true;	/* Not tracked any more, count it as distinct */
+	/* Stored as n + 1, 0 is a free entry */
+	i = hash_64((u64) n, ilog2(PROBE_PROFILE_SEEN));
+	while (state->seen[i]) {
+		if (state->seen[i] == n + 1)
+			return false;
+		i = (i + 1) & (PROBE_PROFILE_SEEN - 1);
+	}
+	state->seen[i] = n + 1;
+	state->nr_seen++;
+	return true;
+}
+
+/*
+ * Account a read of nr sectors at n (read_part_sector(), read_part_lba(),
+ * the signature scan): each of its 512-byte sectors is counted once, so
+ * a 4096-byte sector read after a read of its first 512 bytes adds 7
+ */
+void probe_profile_read(struct parsed_partitions *state, sector_t n,
+			unsigned int nr)
+{
+	unsigned int i;
+
+	state->nr_reads++;
+	for (i = 0; i < nr; i++)
+		if (probe_profile_new_sector(state, n + i))
+			state->nr_distinct++;
+}
+
+/*
+ * Add the profile of a format to the module totals
+ */
+void probe_profile_add(const struct probe_profile *p)
+{
+	struct probe_profile_total *t = probe_profile_total(p->format);
+
+	spin_lock(&probe_profile_lock);
+	t->probes++;
+	if (p->res > 0)
+		t->found++;
+	t->ns += p->ns;
+	t->reads += p->reads;
+	t->sectors += p->sectors;
+	t->alloc_bytes += p->alloc_bytes;
+	spin_unlock(&probe_profile_lock);
+}
+
+/*
+ * <debugfs>/partsfs/probe_profile
+ */
+static int probe_profile_show(struct seq_file *m, void *v)
+{
+	struct probe_profile_total t;
+	int i;
+
+	for (i = -1; i < PARTITION_FORMATS_MAX && probe_profile_name(i); i++) {
+		spin_lock(&probe_profile_lock);
+		t = *probe_profile_total(i);
+		spin_unlock(&probe_profile_lock);
+		if (!t.probes)
+			continue;
+		seq_printf(m, "%s probes %lu found %lu us %llu reads %llu "
+			   "sectors %llu alloc_bytes %llu\n",
+			   probe_profile_name(i), t.probes, t.found,
+			   (unsigned long long)t.ns / NSEC_PER_USEC,
+			   (unsigned long long)t.reads,
+			   (unsigned long long)t.sectors,
+			   (unsigned long long)t.alloc_bytes);
+	}
+	return 0;
+}
+
+static int probe_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, probe_profile_show, NULL);
+}
+
+static const struct file_operations probe_profile_fops = {
+	.owner		= THIS_MODULE,
+	.open		= probe_profile_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+void probe_profile_init(struct dentry *debugfs_dir)
+{
+	if (!IS_ERR_OR_NULL(debugfs_dir))
+		probe_profile_debugfs = debugfs_create_file("probe_profile",
+				0400, debugfs_dir, NULL, &probe_profile_fops);
+}
+
+void probe_profile_exit(void)
+{
+	debugfs_remove(probe_profile_debugfs);
+}
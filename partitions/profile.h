@@ -0,0 +1,16 @@
+/*
+ *  fs/partitions/profile.h
+ *  Cost of the partition table probes, see profile.c
+ */
+
+/* 512-byte sectors remembered per format to count the distinct ones */
+#define PROBE_PROFILE_SEEN	2048
+
+/* struct probe_profile format of the signature scan (recover=scan) */
+#define PROBE_PROFILE_SCAN	(-1)
+
+void probe_profile_start(struct parsed_partitions *state);
+void probe_profile_add(const struct probe_profile *p);
+const char *probe_profile_name(int format);
+void probe_profile_init(struct dentry *debugfs_dir);
+void probe_profile_exit(void);
@@ -0,0 +1,540 @@
+/*
+ *  fs/partitions/scan.c
+ *
+ *  Signature scan (recover=scan): when no partition table is recognized,
+ *  the whole disk is read and the filesystems and volumes found by their
+ *  superblocks are added as partitions, in disk order, so that what a
+ *  lost or overwritten table described can still be read.
+ *
+ *  The disk is streamed through the page cache by large windows: the next
+ *  window is read ahead while the current one is scanned, and the pages
+ *  scanned are dropped from the cache.  Each sector is matched against
+ *  all the signatures in one pass: a signature is the first four bytes of
+ *  a magic at a fixed offset of a sector, so a sector costs one load, mask
+ *  and compare per signature, and the scan keeps up with the disk.  The
+ *  few sectors that match are checked by the parser of the signature,
+ *  which finds the start and size of the filesystem (its superblock is
+ *  not always in its first sector) or rejects it.
+ *
+ *  The scan resumes after the end of each filesystem found, so that its
+ *  backup superblocks and the images it may contain are not reported.  A
+ *  valid GPT header (the backup one, at the end of the disk, when the
+ *  primary one is lost) adds the partitions of its table, which take
+ *  precedence over the filesystems found in them.
+ *
+ *  The partitions found are read-only (PARTITION_FLAG_RECOVERED), their
+ *  extent is only as good as the superblock it was read from.
+ */
+
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/crc32.h>
+#include <linux/msdos_fs.h>
+#include <asm/unaligned.h>
+
+#include "check.h"
+#include "efi.h"
+#include "lvm.h"
+#include "scan.h"
+
+#define SCAN_SECTORS_PER_PAGE	(PAGE_CACHE_SIZE >> 9)
+#define SCAN_WINDOW_PAGES	(SCAN_WINDOW_SIZE >> PAGE_CACHE_SHIFT)
+
+/* Four bytes of a magic, as loaded by get_unaligned_le32() */
+#define SCAN_MAGIC(a, b, c, d) \
+	((u32) (a) | (u32) (b) << 8 | (u32) (c) << 16 | (u32) (d) << 24)
+
+struct scan_candidate {
+	sector_t from;
+	sector_t size;
+	const char *type;
+	bool table;			/* from a partition table */
+	nested_parser_t nested;		/* its volumes, if any */
+	int slot;			/* 0 if left out */
+};
+
+struct scan_state {
+	struct parsed_partitions *state;
+	sector_t capacity;
+	sector_t resume;		/* end of the last filesystem found */
+	struct scan_candidate *found;
+	int nr_found;
+	int nr_slots;
+};
+
+struct scan_signature {
+	const char *type;
+	unsigned int offset;		/* of the magic in the sector */
+	u32 mask;
+	u32 magic;
+	/* data is the sector of the magic, n its number */
+	int (*check)(struct scan_state *scan, const u8 *data, sector_t n);
+};
+
+/*
+ * Record a partition found (a table entry, or a filesystem the scan
+ * then skips).  A filesystem bigger than the rest of the disk is kept,
+ * the disk may be a truncated image, but it is scanned: its size may
+ * just as well be wrong.  Returns 1 if added.
+ */
+static int scan_add(struct scan_state *scan, sector_t from, u64 size,
+		    const char *type, bool table, nested_parser_t nested)
+{
+	struct scan_candidate *found;
+	bool truncated = false;
+	int nr;
+
+	if (!size || from >= scan->capacity)
+		return 0;
+	if (!table && from < scan->resume)
+		return 0;
+	if (size > scan->capacity - from) {
+		size = scan->capacity - from;
+		truncated = true;
+	}
+
+	if (scan->nr_found == scan->nr_slots) {
+		if (scan->nr_found >= scan->state->limit - 1)
+			return 0;
+		nr = max(scan->nr_slots * 2, 16);
+		found = krealloc(scan->found, nr * sizeof(*found), GFP_KERNEL);
+		if (!found)
+			return 0;
+		probe_alloc_charge(scan->state,
+				   (nr - scan->nr_slots) * sizeof(*found));
+		scan->found = found;
+		scan->nr_slots = nr;
+	}
+	found = &scan->found[scan->nr_found++];
+	found->from = from;
+	found->size = size;
+	found->type = type;
+	found->table = table;
+	found->nested = nested;
+	found->slot = 0;
+
+	if (!table && !truncated)
+		scan->resume = from + size;
+	return 1;
+}
+
+static int scan_ext(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	unsigned int log;
+	u64 blocks;
+
+	/* The backup superblocks of the block groups are not filesystems */
+	if (n < EXT_SB_SECTOR ||
+	    get_unaligned_le16(data + EXT_SB_BLOCK_GROUP_NR) != 0)
+		return 0;
+	log = get_unaligned_le32(data + EXT_SB_LOG_BLOCK_SIZE);
+	if (log > 6 ||
+	    get_unaligned_le32(data + EXT_SB_FIRST_DATA_BLOCK) != (log == 0) ||
+	    !get_unaligned_le32(data + EXT_SB_BLOCKS_PER_GROUP))
+		return 0;
+
+	blocks = get_unaligned_le32(data + EXT_SB_BLOCKS_COUNT);
+	if (get_unaligned_le32(data + EXT_SB_FEATURE_INCOMPAT) &
+	    EXT_FEATURE_INCOMPAT_64BIT)
+		blocks |= (u64) get_unaligned_le32(data +
+					EXT_SB_BLOCKS_COUNT_HI) << 32;
+	return scan_add(scan, n - EXT_SB_SECTOR, blocks << (log + 1), "ext",
+			false, NULL);
+}
+
+static int scan_fat(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	const struct fat_boot_sector *fb = (const struct fat_boot_sector *) data;
+	unsigned int sector_size = get_unaligned_le16(fb->sector_size);
+	u32 total;
+
+	if (data[510] != 0x55 || data[511] != 0xaa)
+		return 0;
+	if (sector_size < 512 || sector_size > 4096 ||
+	    !is_power_of_2(sector_size) ||
+	    !fb->sec_per_clus || !is_power_of_2(fb->sec_per_clus) ||
+	    !fb->reserved || (fb->fats != 1 && fb->fats != 2) ||
+	    !fat_valid_media(fb->media))
+		return 0;
+
+	total = get_unaligned_le16(fb->sectors);
+	if (!total)
+		total = le32_to_cpu(fb->total_sect);
+	return scan_add(scan, n, (sector_t) total * (sector_size >> 9), "fat",
+			false, NULL);
+}
+
+static int scan_ntfs(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	unsigned int sector_size = get_unaligned_le16(data + 0x0b);
+	u64 total;
+
+	if (memcmp(data + 3, "NTFS    ", 8) ||
+	    data[510] != 0x55 || data[511] != 0xaa ||
+	    sector_size < 512 || sector_size > 4096 ||
+	    !is_power_of_2(sector_size))
+		return 0;
+
+	/* The backup boot sector follows the volume */
+	total = get_unaligned_le64(data + NTFS_BS_TOTAL_SECTORS) + 1;
+	return scan_add(scan, n, total * (sector_size >> 9), "ntfs",
+			false, NULL);
+}
+
+static int scan_exfat(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	unsigned int shift = data[EXFAT_BS_SECTOR_SHIFT];
+
+	if (memcmp(data + 3, "EXFAT   ", 8) ||
+	    data[510] != 0x55 || data[511] != 0xaa ||
+	    shift < 9 || shift > 12)
+		return 0;
+
+	return scan_add(scan, n,
+		get_unaligned_le64(data + EXFAT_BS_VOLUME_LENGTH) << (shift - 9),
+		"exfat", false, NULL);
+}
+
+static int scan_xfs(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	u32 blocksize = get_unaligned_be32(data + XFS_SB_BLOCKSIZE);
+
+	if (blocksize < 512 || blocksize > 65536 || !is_power_of_2(blocksize))
+		return 0;
+
+	return scan_add(scan, n,
+		get_unaligned_be64(data + XFS_SB_DBLOCKS) * (blocksize >> 9),
+		"xfs", false, NULL);
+}
+
+static int scan_btrfs(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	/* Only the primary superblock, not its mirrors (at 64 MiB, ...) */
+	if (n < BTRFS_SB_SECTOR ||
+	    memcmp(data + BTRFS_SB_MAGIC, BTRFS_MAGIC, 8) ||
+	    get_unaligned_le64(data + BTRFS_SB_BYTENR) != BTRFS_SB_SECTOR * 512)
+		return 0;
+
+	return scan_add(scan, n - BTRFS_SB_SECTOR,
+			get_unaligned_le64(data + BTRFS_SB_TOTAL_BYTES) >> 9,
+			"btrfs", false, NULL);
+}
+
+/*
+ * Swap space made with 4 KiB pages (the header is in the byte order of
+ * the machine that made it)
+ */
+static int scan_swap(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	sector_t from = n - SWAP_MAGIC_SECTOR;
+	Sector sect;
+	unsigned char *info;
+	u32 last_page;
+
+	if (n < SWAP_MAGIC_SECTOR ||
+	    memcmp(data + SWAP_MAGIC_OFFSET, SWAP_MAGIC, 10))
+		return 0;
+
+	info = read_part_sector(scan->state, from + SWAP_INFO_SECTOR, &sect);
+	if (!info)
+		return 0;
+	last_page = get_unaligned((u32 *) (info + 4));
+	if (get_unaligned((u32 *) info) != 1)
+		last_page = 0;
+	put_dev_sector(sect);
+
+	if (!last_page)
+		return 0;
+	return scan_add(scan, from, ((sector_t) last_page + 1) * 8, "swap",
+			false, NULL);
+}
+
+/*
+ * LVM2 physical volume: its logical volumes are a nested table, as for a
+ * PV partition
+ */
+static int scan_lvm2(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	const struct lvm_label_header *label =
+		(const struct lvm_label_header *) data;
+	const struct lvm_pv_header *pvh;
+	u64 sector = le64_to_cpu(label->sector_xl);
+	u32 offset = le32_to_cpu(label->offset_xl);
+
+	if (memcmp(label->id, LVM_LABEL_ID, 8) ||
+	    memcmp(label->type, LVM_LABEL_TYPE, 8) ||
+	    sector >= LVM_LABEL_SCAN_SECTORS || sector > n ||
+	    offset < sizeof(*label) || offset > 512 - sizeof(*pvh) ||
+	    crc32_le(LVM_INITIAL_CRC, data + 20, 512 - 20) !=
+	    le32_to_cpu(label->crc_xl))
+		return 0;
+
+	pvh = (const struct lvm_pv_header *) (data + offset);
+	return scan_add(scan, n - sector,
+			get_unaligned_le64(&pvh->device_size_xl) >> 9, "lvm2",
+			false, lvm2_nested_partition);
+}
+
+/* As efi_crc32() in efi.c */
+static u32 scan_efi_crc32(const void *buf, unsigned long len)
+{
+	return crc32(~0L, buf, len) ^ ~0L;
+}
+
+/*
+ * GPT header, with its partition entry array: my_lba tells where the
+ * disk (or the disk image) it belongs to starts.  LBAs are logical
+ * blocks of the disk, the header is at the start of one.
+ */
+static int scan_gpt(struct scan_state *scan, const u8 *data, sector_t n)
+{
+	struct parsed_partitions *state = scan->state;
+	unsigned int ssz = bdev_logical_block_size(state->bdev);
+	unsigned int shift = ilog2(ssz) - 9;
+	gpt_header *gpt;
+	gpt_entry *pte;
+	u8 *ptes = NULL;
+	Sector sect;
+	unsigned char *d;
+	u32 size, nr, entry_size, crc, len, i;
+	u64 my_lba, first, last, lba;
+	sector_t base;
+	int res = 0;
+
+	size = get_unaligned_le32(data + offsetof(gpt_header, header_size));
+	my_lba = get_unaligned_le64(data + offsetof(gpt_header, my_lba));
+	if (get_unaligned_le64(data) != GPT_HEADER_SIGNATURE ||
+	    size < sizeof(gpt_header) || size > 512 ||
+	    (n & ((1 << shift) - 1)) || my_lba > (n >> shift))
+		return 0;
+
+	gpt = kmemdup(data, 512, GFP_KERNEL);
+	if (!gpt)
+		return 0;
+	crc = le32_to_cpu(gpt->header_crc32);
+	gpt->header_crc32 = 0;
+	if (scan_efi_crc32(gpt, size) != crc)
+		goto out;
+
+	base = n - (my_lba << shift);
+	nr = le32_to_cpu(gpt->num_partition_entries);
+	entry_size = le32_to_cpu(gpt->sizeof_partition_entry);
+	if (!nr || entry_size < sizeof(gpt_entry) || entry_size % 8 ||
+	    nr > SCAN_GPT_ENTRIES_MAX / entry_size)
+		goto out;
+	len = nr * entry_size;
+	ptes = kmalloc(ALIGN(len, ssz), GFP_KERNEL);
+	if (!ptes)
+		goto out;
+	probe_alloc_charge(state, ALIGN(len, ssz));
+	lba = (base >> shift) + le64_to_cpu(gpt->partition_entry_lba);
+	for (i = 0; i < len; i += ssz, lba++) {
+		d = read_part_lba(state, lba, &sect);
+		if (!d)
+			goto out;
+		memcpy(ptes + i, d, ssz);
+		put_dev_sector(sect);
+	}
+	if (scan_efi_crc32(ptes, len) !=
+	    le32_to_cpu(gpt->partition_entry_array_crc32))
+		goto out;
+
+	for (i = 0; i < nr; i++) {
+		pte = (gpt_entry *) (ptes + i * entry_size);
+		first = le64_to_cpu(pte->starting_lba);
+		last = le64_to_cpu(pte->ending_lba);
+		if (!efi_guidcmp(pte->partition_type_guid, NULL_GUID) ||
+		    last < first)
+			continue;
+		res |= scan_add(scan, base + (first << shift),
+				(last - first + 1) << shift, "gpt", true, NULL);
+	}
+out:
+	kfree(ptes);
+	kfree(gpt);
+	return res;
+}
+
+/*
+ * The boot sectors of NTFS and exFAT also start with a FAT jump, their
+ * parsers come first (the FAT one rejects them anyway: no FATs, no BPB)
+ */
+static const struct scan_signature scan_signatures[] = {
+	{ "ext", EXT_SB_MAGIC, 0x0000ffff, EXT_MAGIC, scan_ext },
+	{ "ntfs", 3, 0xffffffff, SCAN_MAGIC('N', 'T', 'F', 'S'), scan_ntfs },
+	{ "exfat", 3, 0xffffffff, SCAN_MAGIC('E', 'X', 'F', 'A'), scan_exfat },
+	{ "fat", 0, 0x00ff00ff, SCAN_MAGIC(0xeb, 0, 0x90, 0), scan_fat },
+	{ "xfs", 0, 0xffffffff, SCAN_MAGIC('X', 'F', 'S', 'B'), scan_xfs },
+	{ "btrfs", BTRFS_SB_MAGIC, 0xffffffff,
+	  SCAN_MAGIC('_', 'B', 'H', 'R'), scan_btrfs },
+	{ "swap", SWAP_MAGIC_OFFSET, 0xffffffff,
+	  SCAN_MAGIC('S', 'W', 'A', 'P'), scan_swap },
+	{ "lvm2", 0, 0xffffffff, SCAN_MAGIC('L', 'A', 'B', 'E'), scan_lvm2 },
+	{ "gpt", 0, 0xffffffff, SCAN_MAGIC('E', 'F', 'I', ' '), scan_gpt },
+	{ NULL, 0, 0, 0, NULL }
+};
+
+/*
+ * Match the nr sectors of a page, from sector n, against all the
+ * signatures (but not the sectors of the filesystems already found)
+ */
+static void scan_page(struct scan_state *scan, const u8 *data, sector_t n,
+		      int nr)
+{
+	const struct scan_signature *sig;
+
+	for (; nr > 0; nr--, n++, data += 512) {
+		if (n < scan->resume)
+			continue;
+		for (sig = scan_signatures; sig->check; sig++)
+			if ((get_unaligned_le32(data + sig->offset) &
+			     sig->mask) == sig->magic &&
+			    sig->check(scan, data, n))
+				break;
+	}
+}
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+/*
+ * The same on the in-memory image of the self-test, which has no page
+ * cache to read ahead or drop
+ */
+static int scan_image(struct scan_state *scan)
+{
+	struct parsed_partitions *state = scan->state;
+	sector_t n = 0;
+
+	while (n < scan->capacity) {
+		if (probe_budget_charge(state, SCAN_SECTORS_PER_PAGE))
+			break;
+		probe_profile_read(state, n, SCAN_SECTORS_PER_PAGE);
+		scan_page(scan, state->image->data + (n << 9), n,
+			  min_t(sector_t, SCAN_SECTORS_PER_PAGE,
+				scan->capacity - n));
+		n = max_t(sector_t, n + SCAN_SECTORS_PER_PAGE,
+			  scan->resume & ~(sector_t) (SCAN_SECTORS_PER_PAGE - 1));
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Read and scan the whole disk, page by page
+ */
+static int scan_disk(struct scan_state *scan)
+{
+	struct parsed_partitions *state = scan->state;
+	struct address_space *mapping = state->bdev->bd_inode->i_mapping;
+	const int shift = PAGE_CACHE_SHIFT - 9;
+	pgoff_t index, nr_pages, ra_end, dropped;
+	struct page *page;
+	sector_t n;
+	int err = 0;
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+	if (state->image)
+		return scan_image(scan);
+#endif
+	nr_pages = (scan->capacity + SCAN_SECTORS_PER_PAGE - 1) >> shift;
+	index = ra_end = dropped = 0;
+	while (index < nr_pages) {
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		/* Keep half a window ahead in flight */
+		if (index + SCAN_WINDOW_PAGES / 2 >= ra_end) {
+			ra_end = max(ra_end, index);
+			readahead_part_sectors(state, (sector_t) ra_end << shift,
+					       SCAN_WINDOW_PAGES << shift);
+			ra_end += SCAN_WINDOW_PAGES;
+		}
+		if (index - dropped >= SCAN_WINDOW_PAGES) {
+			invalidate_mapping_pages(mapping, dropped, index - 1);
+			dropped = index;
+		}
+
+		n = (sector_t) index << shift;
+		if (probe_budget_charge(state, SCAN_SECTORS_PER_PAGE))
+			break;
+		probe_profile_read(state, n, SCAN_SECTORS_PER_PAGE);
+		page = read_mapping_page(mapping, index, NULL);
+		if (!IS_ERR(page)) {
+			scan_page(scan, kmap(page), n,
+				  min_t(sector_t, SCAN_SECTORS_PER_PAGE,
+					scan->capacity - n));
+			kunmap(page);
+			page_cache_release(page);
+		}
+		/* else: an unreadable page, the rest may still be fine */
+
+		index = max_t(pgoff_t, index + 1, scan->resume >> shift);
+		cond_resched();
+	}
+	invalidate_mapping_pages(mapping, dropped, -1);
+	return err;
+}
+
+/*
+ * Disk order; table entries first, they have the right size
+ */
+static int scan_candidate_cmp(const void *a, const void *b)
+{
+	const struct scan_candidate *x = a, *y = b;
+
+	if (x->from != y->from)
+		return x->from < y->from ? -1 : 1;
+	if (x->table != y->table)
+		return x->table ? -1 : 1;
+	return 0;
+}
+
+int scan_partitions(struct parsed_partitions *state)
+{
+	struct scan_state scan = { .state = state };
+	struct scan_candidate *c;
+	sector_t end = 0;
+	int i, slot = 0, err;
+
+	scan.capacity = get_capacity(state->bdev->bd_disk);
+	err = scan_disk(&scan);
+	if (err || state->budget_exceeded || !scan.nr_found)
+		goto out;
+
+	sort(scan.found, scan.nr_found, sizeof(*scan.found),
+	     scan_candidate_cmp, NULL);
+	strlcat(state->pp_buf, " [scan]", PAGE_SIZE);
+	for (i = 0; i < scan.nr_found; i++) {
+		c = &scan.found[i];
+		/* Overlapping: a filesystem in a table entry, a bad guess */
+		if (c->from < end)
+			continue;
+		end = c->from + c->size;
+		c->slot = ++slot;
+		put_partition(state, slot, c->from, c->size);
+		set_partition_flags(state, slot, PARTITION_FLAG_RECOVERED);
+		if (c->nested && !state->opts.flat_nested)
+			set_partition_nested(state, slot, c->nested);
+		strlcat(state->pp_buf, "(", PAGE_SIZE);
+		strlcat(state->pp_buf, c->type, PAGE_SIZE);
+		strlcat(state->pp_buf, ")", PAGE_SIZE);
+	}
+	strlcat(state->pp_buf, "\n", PAGE_SIZE);
+
+	if (state->opts.flat_nested) {
+		state->next = min(state->limit, slot + 1);
+		for (i = 0; i < scan.nr_found; i++) {
+			c = &scan.found[i];
+			if (c->slot && c->nested && c->slot < state->nr_slots &&
+			    state->parts[c->slot].size)
+				c->nested(state, c->from, c->size, c->slot);
+		}
+	}
+out:
+	kfree(scan.found);
+	if (err)
+		return err;
+	return slot > 0;
+}
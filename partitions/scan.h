@@ -0,0 +1,55 @@
+/*
+ *  fs/partitions/scan.h
+ *
+ *  Signature scan of a disk without a partition table, see scan.c
+ */
+
+#ifndef _FS_PT_SCAN_H_
+#define _FS_PT_SCAN_H_
+
+#include <linux/types.h>
+
+/* The disk is read ahead, scanned and dropped from the cache by windows */
+#define SCAN_WINDOW_SIZE	(4 * 1024 * 1024)
+
+/* Bigger GPT partition entry arrays are not read */
+#define SCAN_GPT_ENTRIES_MAX	(1024 * 1024)
+
+/* ext2/3/4: superblock at 1 KiB */
+#define EXT_SB_SECTOR		2
+#define EXT_SB_BLOCKS_COUNT	0x04
+#define EXT_SB_FIRST_DATA_BLOCK	0x14
+#define EXT_SB_LOG_BLOCK_SIZE	0x18
+#define EXT_SB_BLOCKS_PER_GROUP	0x20
+#define EXT_SB_MAGIC		0x38
+#define EXT_SB_BLOCK_GROUP_NR	0x5a
+#define EXT_SB_FEATURE_INCOMPAT	0x60
+#define EXT_SB_BLOCKS_COUNT_HI	0x150
+#define EXT_MAGIC		0xef53
+#define EXT_FEATURE_INCOMPAT_64BIT	0x80
+
+/* NTFS and exFAT boot sector */
+#define NTFS_BS_TOTAL_SECTORS	0x28
+#define EXFAT_BS_VOLUME_LENGTH	0x48
+#define EXFAT_BS_SECTOR_SHIFT	0x6c
+
+/* XFS: big endian superblock in the first sector */
+#define XFS_SB_BLOCKSIZE	0x04
+#define XFS_SB_DBLOCKS		0x08
+
+/* btrfs: superblock at 64 KiB */
+#define BTRFS_SB_SECTOR		128
+#define BTRFS_SB_BYTENR		0x30
+#define BTRFS_SB_MAGIC		0x40
+#define BTRFS_SB_TOTAL_BYTES	0x70
+#define BTRFS_MAGIC		"_BHRfS_M"
+
+/* Linux swap: magic at the end of the first 4 KiB page */
+#define SWAP_MAGIC_SECTOR	7
+#define SWAP_MAGIC_OFFSET	502
+#define SWAP_MAGIC		"SWAPSPACE2"
+#define SWAP_INFO_SECTOR	2	/* version, last_page */
+
+int scan_partitions(struct parsed_partitions *state);
+
+#endif /* _FS_PT_SCAN_H_ */
@@ -0,0 +1,1301 @@
+/*
+ *  fs/partitions/selftest.c
+ *  Self-test and microbenchmarks of the partition parsers
+ *
+ *  Built with "make SELFTEST=1", run by init_partsfs_fs() when the module
+ *  is loaded with selftest=1.  Each parser is given small in-memory
+ *  images of its format (the layouts of tools/mkimages.py and mkldm.py),
+ *  read through read_part_sector() and read_part_lba() as in a probe,
+ *  and the parts[] it fills are compared with the partitions written:
+ *  from, size and no other slot.  Every parser must also reject an
+ *  empty disk.  The load fails if a test fails.
+ *
+ *  Some cases probe with options: LVM2 PVs in DOS partitions are read
+ *  with nested=flat, and the md arrays of RAID partitions are assembled
+ *  after the parser, as check_partition() does with md=arrays.  The
+ *  recover=scan parser (scan.c) reads the image directly.
+ *
+ *  With selftest_bench=N, the parsers are then timed on bigger images,
+ *  N probes each: DOS with 250 logical partitions, an LDM database of a
+ *  thousand volumes (3001 VBLKs) and a GPT of 128 entries.
+ *
+ *  The images are vmalloc()ed, read_image_sector() (check.h) returns
+ *  their sectors.  The gendisk and the block device around them only
+ *  give the parsers a capacity, a logical block size and an i_size:
+ *  they are never registered.
+ */
+
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/crc32.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/affs_hardblocks.h>
+#include <asm/unaligned.h>
+
+#include "check.h"
+#include "selftest.h"
+
+#include "acorn.h"
+#include "amiga.h"
+#include "atari.h"
+#include "efi.h"
+#include "karma.h"
+#include "ldm.h"
+#include "lvm.h"
+#include "mac.h"
+#include "md.h"
+#include "msdos.h"
+#include "osf.h"
+#include "scan.h"
+#include "sgi.h"
+#include "sun.h"
+#include "sysv68.h"
+#include "ultrix.h"
+
+#define SELFTEST_FIRST		64	/* first partition, in blocks */
+#define SELFTEST_SIZE		8	/* size of the partitions, in blocks */
+#define SELFTEST_TAIL		64	/* free blocks after the last one */
+#define SELFTEST_GAP		2	/* chained tables: the table, a spare */
+
+/* Probe options of a case */
+#define SELFTEST_FLAT_NESTED	0x01	/* nested=flat */
+#define SELFTEST_MD_ARRAYS	0x02	/* md=arrays */
+
+struct selftest_part {
+	sector_t from;
+	sector_t size;
+};
+
+struct selftest_disk {
+	struct partition_image image;
+	unsigned int ssz;		/* logical block size */
+	struct gendisk *disk;
+	struct block_device bdev;
+	struct inode inode;
+	struct selftest_part *expect;	/* slot n is expect[n] */
+	int nr_expect;
+};
+
+struct selftest_case {
+	const char *name;
+	int (*parse)(struct parsed_partitions *state);
+	int (*build)(struct selftest_disk *d, int n);
+	int n;				/* partitions */
+	unsigned int ssz;
+	unsigned int flags;		/* SELFTEST_FLAT_NESTED, ... */
+};
+
+/*
+ * Allocate a zeroed image of blocks logical blocks, for partitions in
+ * slots 1 to slots
+ */
+static int selftest_disk_init(struct selftest_disk *d, sector_t blocks,
+			      int slots)
+{
+	sector_t sectors = blocks * (d->ssz >> 9);
+
+	d->image.sectors = sectors;
+	d->image.data = vzalloc(sectors << 9);
+	d->nr_expect = slots + 1;
+	d->expect = kcalloc(d->nr_expect, sizeof(*d->expect), GFP_KERNEL);
+	d->disk = alloc_disk(1);
+	if (!d->image.data || !d->expect || !d->disk)
+		return -ENOMEM;
+	d->disk->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!d->disk->queue)
+		return -ENOMEM;
+	blk_queue_logical_block_size(d->disk->queue, d->ssz);
+	strlcpy(d->disk->disk_name, "selftest", sizeof(d->disk->disk_name));
+	set_capacity(d->disk, sectors);
+	i_size_write(&d->inode, (loff_t)sectors << 9);
+
+	d->bdev.bd_disk = d->disk;
+	d->bdev.bd_part = &d->disk->part0;
+	d->bdev.bd_inode = &d->inode;
+	return 0;
+}
+
+static void selftest_disk_free(struct selftest_disk *d)
+{
+	if (d->disk) {
+		if (d->disk->queue)
+			blk_cleanup_queue(d->disk->queue);
+		put_disk(d->disk);
+	}
+	kfree(d->expect);
+	vfree(d->image.data);
+	kfree(d);
+}
+
+static u8 *image_block(struct selftest_disk *d, sector_t lba)
+{
+	return d->image.data + lba * d->ssz;
+}
+
+/* Disk of n partitions, gap blocks apart, and tail more blocks */
+static sector_t disk_blocks(int n, int gap, int tail)
+{
+	return SELFTEST_FIRST + n * (SELFTEST_SIZE + gap) + SELFTEST_TAIL + tail;
+}
+
+/* First block of partition i */
+static sector_t part_start(int i, int gap)
+{
+	return SELFTEST_FIRST + gap + i * (SELFTEST_SIZE + gap);
+}
+
+/* Slot should be blocks at lba */
+static void expect(struct selftest_disk *d, int slot, sector_t lba,
+		   sector_t blocks)
+{
+	d->expect[slot].from = lba * (d->ssz >> 9);
+	d->expect[slot].size = blocks * (d->ssz >> 9);
+}
+
+/*
+ * GPT: the protective MBR, both headers and both entry arrays
+ */
+static u32 selftest_crc32(const void *buf, unsigned long len)
+{
+	return crc32(~0L, buf, len) ^ ~0L;
+}
+
+static void put_gpt_header(struct selftest_disk *d, u64 lba, u64 alt,
+			   u64 entries_lba, int entries, int entry_blocks,
+			   u32 entries_crc)
+{
+	gpt_header *h = (gpt_header *)image_block(d, lba);
+	u64 last = max(lba, alt);
+
+	h->signature = cpu_to_le64(GPT_HEADER_SIGNATURE);
+	h->revision = cpu_to_le32(GPT_HEADER_REVISION_V1);
+	h->header_size = cpu_to_le32(sizeof(gpt_header));
+	h->my_lba = cpu_to_le64(lba);
+	h->alternate_lba = cpu_to_le64(alt);
+	h->first_usable_lba = cpu_to_le64(2 + entry_blocks);
+	h->last_usable_lba = cpu_to_le64(last - 1 - entry_blocks);
+	h->disk_guid = EFI_GUID(0x5e1f7e57, 0x0d15, 0x4b0c,
+				0x9a, 0x11, 0x2d, 0xb6, 0x3c, 0x8e, 0x40, 0x01);
+	h->partition_entry_lba = cpu_to_le64(entries_lba);
+	h->num_partition_entries = cpu_to_le32(entries);
+	h->sizeof_partition_entry = cpu_to_le32(sizeof(gpt_entry));
+	h->partition_entry_array_crc32 = cpu_to_le32(entries_crc);
+	h->header_crc32 = cpu_to_le32(selftest_crc32(h, sizeof(gpt_header)));
+}
+
+static int build_gpt(struct selftest_disk *d, int n)
+{
+	int entries = max(128, ALIGN(n, 4));
+	int entry_blocks = DIV_ROUND_UP(entries * sizeof(gpt_entry), d->ssz);
+	legacy_mbr *mbr;
+	gpt_entry *ptes;
+	u64 last;
+	u32 crc;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, entry_blocks + 1), n))
+		return -ENOMEM;
+	last = d->image.sectors / (d->ssz >> 9) - 1;
+
+	ptes = (gpt_entry *)image_block(d, 2);
+	for (i = 0; i < n; i++) {
+		ptes[i].partition_type_guid = PARTITION_BASIC_DATA_GUID;
+		ptes[i].unique_partition_guid = EFI_GUID(i + 1, 0, 0,
+					0, 0, 0, 0, 0, 0, 0, 0);
+		ptes[i].starting_lba = cpu_to_le64(part_start(i, 0));
+		ptes[i].ending_lba = cpu_to_le64(part_start(i, 0) +
+						 SELFTEST_SIZE - 1);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	crc = selftest_crc32(ptes, entries * sizeof(gpt_entry));
+	memcpy(image_block(d, last - entry_blocks), ptes,
+	       entries * sizeof(gpt_entry));
+	put_gpt_header(d, 1, last, 2, entries, entry_blocks, crc);
+	put_gpt_header(d, last, 1, last - entry_blocks, entries, entry_blocks,
+		       crc);
+
+	mbr = (legacy_mbr *)image_block(d, 0);
+	mbr->partition_record[0].sys_ind = EFI_PMBR_OSTYPE_EFI_GPT;
+	mbr->partition_record[0].start_sect = cpu_to_le32(1);
+	mbr->partition_record[0].nr_sects =
+		cpu_to_le32(min_t(u64, last, 0xffffffff));
+	mbr->signature = cpu_to_le16(MSDOS_MBR_SIGNATURE);
+	return 0;
+}
+
+/*
+ * DOS: three primaries and an extended partition past four, each EBR
+ * two blocks before its logical partition
+ */
+static void dos_entry(struct partition *p, u8 type, u32 start, u32 size)
+{
+	p->sys_ind = type;
+	p->start_sect = cpu_to_le32(start);
+	p->nr_sects = cpu_to_le32(size);
+}
+
+static int build_msdos(struct selftest_disk *d, int n)
+{
+	int primaries = n <= 4 ? n : 3;
+	int logicals = n - primaries;
+	int chain = SELFTEST_SIZE + SELFTEST_GAP;
+	struct partition *p;
+	sector_t ext;
+	u8 *ebr;
+	int i, k;
+
+	if (selftest_disk_init(d, disk_blocks(n, SELFTEST_GAP, 0),
+			       logicals ? n + 1 : n))
+		return -ENOMEM;
+	p = (struct partition *)(image_block(d, 0) + 0x1be);
+	for (i = 0; i < primaries; i++) {
+		dos_entry(&p[i], LINUX_DATA_PARTITION,
+			  part_start(i, SELFTEST_GAP), SELFTEST_SIZE);
+		expect(d, i + 1, part_start(i, SELFTEST_GAP), SELFTEST_SIZE);
+	}
+	put_unaligned_le16(MSDOS_LABEL_MAGIC, image_block(d, 0) + 510);
+	if (!logicals)
+		return 0;
+
+	/* The links are relative to the first EBR, the logicals to theirs */
+	ext = part_start(primaries, SELFTEST_GAP) - SELFTEST_GAP;
+	dos_entry(&p[3], DOS_EXTENDED_PARTITION, ext, logicals * chain);
+	expect(d, 4, ext, 0);
+	d->expect[4].size = max(d->ssz >> 9, 2U);
+	for (k = 0; k < logicals; k++) {
+		ebr = image_block(d, ext + k * chain);
+		p = (struct partition *)(ebr + 0x1be);
+		dos_entry(&p[0], LINUX_DATA_PARTITION, SELFTEST_GAP,
+			  SELFTEST_SIZE);
+		if (k + 1 < logicals)
+			dos_entry(&p[1], DOS_EXTENDED_PARTITION,
+				  (k + 1) * chain, chain);
+		put_unaligned_le16(MSDOS_LABEL_MAGIC, ebr + 510);
+		expect(d, 5 + k, part_start(primaries + k, SELFTEST_GAP),
+		       SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * LDM: the MBR with a 0x42 partition, the PRIVHEADs, the TOCBLOCKs and
+ * a VMDB with one disk and n simple volumes (VOL5, CMP3, PRT3), laid
+ * out as by tools/mkldm.py
+ */
+#define LDM_VBLK_SIZE		128
+#define LDM_VBLK_FIRST		4	/* after the VMDB header */
+#define LDM_DISK_START		63
+
+/* The disk, as in its DSK4 and in the PRIVHEADs */
+static const u8 ldm_disk_guid[16] = {
+	0x5e, 0x1f, 0x7e, 0x57, 0x0d, 0x15, 0x4b, 0x0c,
+	0x9a, 0x11, 0x2d, 0xb6, 0x3c, 0x8e, 0x40, 0x01
+};
+#define LDM_DISK_GUID		"5e1f7e57-0d15-4b0c-9a11-2db63c8e4001"
+
+/* Variable-width big endian number, with a length byte */
+static u8 *ldm_num(u8 *p, u64 n)
+{
+	int len = max(1, (fls64(n) + 7) / 8);
+
+	*p++ = len;
+	while (len--)
+		*p++ = n >> (8 * len);
+	return p;
+}
+
+/* String with a length byte */
+static u8 *ldm_str(u8 *p, const char *s)
+{
+	int len = strlen(s);
+
+	*p++ = len;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+/*
+ * Start the VBLK in record seq of the database, returns where its
+ * variable-width fields start
+ */
+static u8 *ldm_vblk(u8 *db, int seq, int group, int type, int flags)
+{
+	u8 *rec = db + seq * LDM_VBLK_SIZE;
+
+	put_unaligned_be32(seq, rec + 0x04);
+	put_unaligned_be32(group, rec + 0x08);
+	put_unaligned_be16(0, rec + 0x0C);		/* record 0 */
+	put_unaligned_be16(1, rec + 0x0E);		/* of 1 */
+	rec[0x12] = flags;
+	rec[0x13] = type;
+	return rec + 0x18;
+}
+
+/*
+ * The length of a VBLK: the end of its last field relative to a
+ * type-specific base, plus the type's fixed size
+ */
+static void ldm_vblk_length(u8 *db, int seq, u8 *end, int base, int size)
+{
+	u8 *rec = db + seq * LDM_VBLK_SIZE;
+
+	put_unaligned_be32(end - rec - base + size, rec + 0x14);
+}
+
+static void ldm_privhead(u8 *data, sector_t disk_size, sector_t config_start)
+{
+	memcpy(data, "PRIVHEAD", 8);
+	put_unaligned_be16(2, data + 0x0C);
+	put_unaligned_be16(11, data + 0x0E);
+	memcpy(data + 0x30, LDM_DISK_GUID, 36);
+	put_unaligned_be64(LDM_DISK_START, data + 0x11B);
+	put_unaligned_be64(disk_size, data + 0x123);
+	put_unaligned_be64(config_start, data + 0x12B);
+	put_unaligned_be64(LDM_DB_SIZE, data + 0x133);
+}
+
+static void ldm_tocblock(u8 *data, int vmdb_sectors)
+{
+	memcpy(data, "TOCBLOCK", 8);
+	memcpy(data + 0x24, TOC_BITMAP1, 6);
+	put_unaligned_be64(OFF_VMDB, data + 0x2E);
+	put_unaligned_be64(vmdb_sectors, data + 0x36);
+	memcpy(data + 0x46, TOC_BITMAP2, 3);
+	put_unaligned_be64(OFF_PRIV2 + 1, data + 0x50);
+	put_unaligned_be64(8, data + 0x58);
+}
+
+static int build_ldm(struct selftest_disk *d, int n)
+{
+	static const int tocs[] = { OFF_TOCB1, OFF_TOCB2, OFF_TOCB3, OFF_TOCB4 };
+	sector_t disk_size = n * SELFTEST_SIZE;
+	sector_t config = LDM_DISK_START + disk_size;
+	int last_seq = ALIGN(LDM_VBLK_FIRST + 1 + 3 * n, 512 / LDM_VBLK_SIZE);
+	int vmdb_sectors = last_seq * LDM_VBLK_SIZE / 512;
+	char name[16];
+	u8 *db, *p;
+	int i, seq, obj;
+
+	if (OFF_VMDB + vmdb_sectors > OFF_PRIV2)
+		return -EINVAL;		/* the database is full */
+	if (selftest_disk_init(d, config + LDM_DB_SIZE, n))
+		return -ENOMEM;
+
+	dos_entry((struct partition *)(image_block(d, 0) + 0x1be),
+		  LDM_PARTITION, 1, config + LDM_DB_SIZE - 1);
+	put_unaligned_le16(MSDOS_LABEL_MAGIC, image_block(d, 0) + 510);
+	ldm_privhead(image_block(d, OFF_PRIV1), disk_size, config);
+	ldm_privhead(image_block(d, config + OFF_PRIV2), disk_size, config);
+	ldm_privhead(image_block(d, config + OFF_PRIV3), disk_size, config);
+	for (i = 0; i < ARRAY_SIZE(tocs); i++)
+		ldm_tocblock(image_block(d, config + tocs[i]), vmdb_sectors);
+
+	/* Unused records still have the VBLK magic */
+	db = image_block(d, config + OFF_VMDB);
+	for (seq = 0; seq < last_seq; seq++)
+		memcpy(db + seq * LDM_VBLK_SIZE, "VBLK", 4);
+	memset(db, 0, LDM_VBLK_FIRST * LDM_VBLK_SIZE);
+	memcpy(db, "VMDB", 4);
+	put_unaligned_be32(last_seq, db + 0x04);
+	put_unaligned_be32(LDM_VBLK_SIZE, db + 0x08);
+	put_unaligned_be32(LDM_VBLK_FIRST * LDM_VBLK_SIZE, db + 0x0C);
+	put_unaligned_be16(1, db + 0x10);
+	put_unaligned_be16(4, db + 0x12);
+	put_unaligned_be16(10, db + 0x14);
+
+	/* Object 1 is the disk, then the volume, component and partition */
+	seq = LDM_VBLK_FIRST;
+	p = ldm_vblk(db, seq, 0, VBLK_DSK4, 0);
+	p = ldm_str(ldm_num(p, 1), "Disk1");
+	ldm_vblk_length(db, seq, p, 0x18, VBLK_SIZE_DSK4);
+	memcpy(p, ldm_disk_guid, sizeof(ldm_disk_guid));
+	seq++;
+
+	for (i = 0, obj = 2; i < n; i++, obj += 3) {
+		snprintf(name, sizeof(name), "Volume%d", i + 1);
+		p = ldm_vblk(db, seq, i + 1, VBLK_VOL5, 0);
+		p = ldm_str(ldm_str(ldm_num(p, obj), name), "gen");
+		p += 1;				/* no drive letter hint */
+		memcpy(p, "ACTIVE", 6);
+		p = ldm_num(p + 16 + 5, 1) + 16;	/* one component */
+		p = ldm_num(p, SELFTEST_SIZE);
+		ldm_vblk_length(db, seq, p, 0x3D, VBLK_SIZE_VOL5);
+		p[4] = 0x07;			/* partition type */
+		seq++;
+
+		snprintf(name, sizeof(name), "Volume%d-01", i + 1);
+		p = ldm_vblk(db, seq, 0, VBLK_CMP3, 0);
+		p = ldm_str(ldm_str(ldm_num(p, obj + 1), name), "ACTIVE");
+		*p = COMP_BASIC;
+		p = ldm_num(p + 5, 1) + 16;	/* one partition */
+		p = ldm_num(p, obj);		/* the volume */
+		ldm_vblk_length(db, seq, p, 0x2D, VBLK_SIZE_CMP3);
+		seq++;
+
+		snprintf(name, sizeof(name), "Disk1-%02d", i + 1);
+		p = ldm_vblk(db, seq, 0, VBLK_PRT3, 0);
+		p = ldm_str(ldm_num(p, obj + 2), name) + 12;
+		put_unaligned_be64(i * SELFTEST_SIZE, p);	/* on the disk */
+		put_unaligned_be64(0, p + 8);		/* in the volume */
+		p = ldm_num(p + 16, SELFTEST_SIZE);
+		p = ldm_num(ldm_num(p, obj + 1), 1);	/* component, disk */
+		ldm_vblk_length(db, seq, p, 0x34, VBLK_SIZE_PRT3);
+		seq++;
+
+		expect(d, i + 1, LDM_DISK_START + i * SELFTEST_SIZE,
+		       SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * Amiga: the RDB in block 0, the partition blocks from block 1
+ */
+static void rdb_checksum(__be32 *block, __be32 *chksum)
+{
+	u32 sum = 0;
+	int i;
+
+	*chksum = 0;
+	for (i = 0; i < 64; i++)
+		sum += be32_to_cpu(block[i]);
+	*chksum = cpu_to_be32(-sum);
+}
+
+static int build_amiga(struct selftest_disk *d, int n)
+{
+	struct RigidDiskBlock *rdb;
+	struct PartitionBlock *pb;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	rdb = (struct RigidDiskBlock *)image_block(d, 0);
+	rdb->rdb_ID = cpu_to_be32(IDNAME_RIGIDDISK);
+	rdb->rdb_SummedLongs = cpu_to_be32(64);
+	rdb->rdb_HostID = cpu_to_be32(7);
+	rdb->rdb_BlockBytes = cpu_to_be32(512);
+	rdb->rdb_BadBlockList = cpu_to_be32(0xffffffff);
+	rdb->rdb_PartitionList = cpu_to_be32(1);
+	rdb->rdb_FileSysHeaderList = cpu_to_be32(0xffffffff);
+	rdb_checksum((__be32 *)rdb, &rdb->rdb_ChkSum);
+
+	for (i = 0; i < n; i++) {
+		pb = (struct PartitionBlock *)image_block(d, 1 + i);
+		pb->pb_ID = cpu_to_be32(IDNAME_PARTITION);
+		pb->pb_SummedLongs = cpu_to_be32(64);
+		pb->pb_HostID = cpu_to_be32(7);
+		pb->pb_Next = cpu_to_be32(i + 1 < n ? i + 2 : 0xffffffff);
+		/* One head, one block per track: cylinders are blocks */
+		pb->pb_Environment[0] = cpu_to_be32(16);	/* table size */
+		pb->pb_Environment[1] = cpu_to_be32(128);	/* block size */
+		pb->pb_Environment[3] = cpu_to_be32(1);		/* heads */
+		pb->pb_Environment[4] = cpu_to_be32(1);		/* sectors/block */
+		pb->pb_Environment[5] = cpu_to_be32(1);		/* blocks/track */
+		pb->pb_Environment[9] = cpu_to_be32(part_start(i, 0));
+		pb->pb_Environment[10] =
+			cpu_to_be32(part_start(i, 0) + SELFTEST_SIZE - 1);
+		pb->pb_Environment[16] = cpu_to_be32(0x444f5303);  /* DOS\3 */
+		rdb_checksum((__be32 *)pb, &pb->pb_ChkSum);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * Mac: the driver descriptor in block 0, the map (its own first entry)
+ * from block 1
+ */
+static void mac_entry(struct mac_partition *e, int entries, u32 start,
+		      u32 count, const char *name, const char *type)
+{
+	e->signature = cpu_to_be16(MAC_PARTITION_MAGIC);
+	e->map_count = cpu_to_be32(entries);
+	e->start_block = cpu_to_be32(start);
+	e->block_count = cpu_to_be32(count);
+	strncpy(e->name, name, sizeof(e->name));
+	strncpy(e->type, type, sizeof(e->type));
+	e->data_count = cpu_to_be32(count);
+}
+
+static int build_mac(struct selftest_disk *d, int n)
+{
+	struct mac_driver_desc *md;
+	char name[16];
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, n + 1), n + 1))
+		return -ENOMEM;
+	md = (struct mac_driver_desc *)image_block(d, 0);
+	md->signature = cpu_to_be16(MAC_DRIVER_MAGIC);
+	md->block_size = cpu_to_be16(512);
+	md->block_count = cpu_to_be32(d->image.sectors);
+
+	mac_entry((struct mac_partition *)image_block(d, 1), n + 1, 1, n + 1,
+		  "Apple", "Apple_partition_map");
+	expect(d, 1, 1, n + 1);
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "part%d", i + 1);
+		mac_entry((struct mac_partition *)image_block(d, 2 + i), n + 1,
+			  part_start(i, 0), SELFTEST_SIZE, name, APPLE_AUX_TYPE);
+		expect(d, i + 2, part_start(i, 0), SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * Atari: three primaries and an XGM chain past four, each root sector
+ * two blocks before its partition
+ */
+static void atari_entry(struct partition_info *pi, const char *id,
+			u32 start, u32 size)
+{
+	pi->flg = 1;
+	memcpy(pi->id, id, 3);
+	pi->st = cpu_to_be32(start);
+	pi->siz = cpu_to_be32(size);
+}
+
+static int build_atari(struct selftest_disk *d, int n)
+{
+	int primaries = n <= 4 ? n : 3;
+	int logicals = n - primaries;
+	int chain = SELFTEST_SIZE + SELFTEST_GAP;
+	struct rootsector *rs;
+	sector_t ext;
+	int i, k;
+
+	if (selftest_disk_init(d, disk_blocks(n, SELFTEST_GAP, 0), n))
+		return -ENOMEM;
+	rs = (struct rootsector *)image_block(d, 0);
+	for (i = 0; i < primaries; i++) {
+		atari_entry(&rs->part[i], "LNX", part_start(i, SELFTEST_GAP),
+			    SELFTEST_SIZE);
+		expect(d, i + 1, part_start(i, SELFTEST_GAP), SELFTEST_SIZE);
+	}
+	if (!logicals)
+		return 0;
+
+	/* The partitions are relative to their root sector, the links to
+	 * the first one */
+	ext = part_start(primaries, SELFTEST_GAP) - SELFTEST_GAP;
+	atari_entry(&rs->part[primaries], "XGM", ext, logicals * chain);
+	for (k = 0; k < logicals; k++) {
+		rs = (struct rootsector *)image_block(d, ext + k * chain);
+		atari_entry(&rs->part[0], "LNX", SELFTEST_GAP, SELFTEST_SIZE);
+		if (k + 1 < logicals)
+			atari_entry(&rs->part[1], "XGM", (k + 1) * chain, chain);
+		expect(d, primaries + 1 + k,
+		       part_start(primaries + k, SELFTEST_GAP), SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * Sun: one sector per cylinder, so that the start cylinders are blocks
+ */
+static int build_sun(struct selftest_disk *d, int n)
+{
+	static const u16 geometry[] = { 3600, 0xffff, 0, 0, 0, 1, 0xffff,
+					0, 1, 1, 0, 0 };
+	u8 *label;
+	u16 csum = 0;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	label = image_block(d, 0);
+	memcpy(label, "partsfs selftest", 16);
+	put_unaligned_be32(1, label + 128);		/* VTOC version */
+	memcpy(label + 132, "selftest", 8);
+	put_unaligned_be16(8, label + 140);
+	for (i = 0; i < n; i++)
+		put_unaligned_be16(0x83, label + 142 + 4 * i);
+	put_unaligned_be32(SUN_VTOC_SANITY, label + 188);
+	for (i = 0; i < ARRAY_SIZE(geometry); i++)
+		put_unaligned_be16(geometry[i], label + 420 + 2 * i);
+	for (i = 0; i < n; i++) {
+		put_unaligned_be32(part_start(i, 0), label + 444 + 8 * i);
+		put_unaligned_be32(SELFTEST_SIZE, label + 448 + 8 * i);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	put_unaligned_be16(SUN_LABEL_MAGIC, label + 508);
+	for (i = 0; i < 510; i += 2)
+		csum ^= get_unaligned_be16(label + i);
+	put_unaligned_be16(csum, label + 510);
+	return 0;
+}
+
+/*
+ * SGI: the volume header, its words sum to 0
+ */
+static int build_sgi(struct selftest_disk *d, int n)
+{
+	u8 *label;
+	u32 sum = 0;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	label = image_block(d, 0);
+	put_unaligned_be32(SGI_LABEL_MAGIC, label);
+	put_unaligned_be16(1, label + 6);		/* swap partition */
+	for (i = 0; i < n; i++) {
+		put_unaligned_be32(SELFTEST_SIZE, label + 312 + 12 * i);
+		put_unaligned_be32(part_start(i, 0), label + 316 + 12 * i);
+		put_unaligned_be32(0x83, label + 320 + 12 * i);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	for (i = 0; i < 512; i += 4)
+		sum += get_unaligned_be32(label + i);
+	put_unaligned_be32(-sum, label + 504);
+	return 0;
+}
+
+/*
+ * OSF: the BSD disklabel at byte 64 of sector 0, little endian
+ */
+static int build_osf(struct selftest_disk *d, int n)
+{
+	u8 *label;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	label = image_block(d, 0) + 64;
+	put_unaligned_le32(DISKLABELMAGIC, label);
+	memcpy(label + 8, "selftest", 8);
+	memcpy(label + 24, "partsfs", 7);
+	put_unaligned_le32(512, label + 40);		/* geometry */
+	put_unaligned_le32(1, label + 44);
+	put_unaligned_le32(1, label + 48);
+	put_unaligned_le32(d->image.sectors, label + 52);
+	put_unaligned_le32(1, label + 56);
+	put_unaligned_le32(d->image.sectors, label + 60);
+	put_unaligned_le32(DISKLABELMAGIC, label + 132);
+	put_unaligned_le16(n, label + 138);
+	for (i = 0; i < n; i++) {
+		put_unaligned_le32(SELFTEST_SIZE, label + 148 + 16 * i);
+		put_unaligned_le32(part_start(i, 0), label + 152 + 16 * i);
+		label[148 + 16 * i + 12] = 8;		/* 4.2BSD */
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+/*
+ * Ultrix: the disklabel ends at byte 16384, in host order
+ */
+static int build_ultrix(struct selftest_disk *d, int n)
+{
+	u32 *label;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	label = (u32 *)(d->image.data + 16384 - 72);
+	label[0] = 0x032957;				/* magic */
+	label[1] = 1;					/* valid */
+	for (i = 0; i < n; i++) {
+		label[2 + 2 * i] = SELFTEST_SIZE;
+		label[3 + 2 * i] = part_start(i, 0);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	return 0;
+}
+
+static int build_karma(struct selftest_disk *d, int n)
+{
+	u8 *label;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	label = image_block(d, 0);
+	for (i = 0; i < n; i++) {
+		label[270 + 16 * i + 4] = 0x4d;		/* type */
+		put_unaligned_le32(part_start(i, 0), label + 278 + 16 * i);
+		put_unaligned_le32(SELFTEST_SIZE, label + 282 + 16 * i);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	put_unaligned_le16(KARMA_LABEL_MAGIC, label + 510);
+	return 0;
+}
+
+/*
+ * SysV68: the slice table in sector 1, the last slice is the whole disk
+ */
+static int build_sysv68(struct selftest_disk *d, int n)
+{
+	u8 *slices;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	memcpy(image_block(d, 0) + 248, "MOTOROLA", 8);
+	put_unaligned_be32(1, image_block(d, 0) + 384);
+	put_unaligned_be16(n + 1, image_block(d, 0) + 388);
+	slices = image_block(d, 1);
+	for (i = 0; i < n; i++) {
+		put_unaligned_be32(SELFTEST_SIZE, slices + 8 * i);
+		put_unaligned_be32(part_start(i, 0), slices + 8 * i + 4);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	put_unaligned_be32(d->image.sectors, slices + 8 * n);
+	return 0;
+}
+
+/*
+ * LVM2: a PV of size sectors at pv (a whole disk or a partition), its
+ * label in sector 1, the metadata area from 4 KiB to the first extent at
+ * SELFTEST_FIRST, and n linear volumes of one extent each, from slot, as
+ * by tools/mkimages.py.  512-byte sectors only.
+ */
+#define LVM_MDA_START		4096
+#define LVM_PV_ID		"se1fte5tSE1FTE5Tse1fte5tSE1FTE5T"
+
+static int lvm2_pv(struct selftest_disk *d, sector_t pv, sector_t size,
+		   int n, int slot)
+{
+	u8 *data = d->image.data + (pv << 9);
+	struct lvm_label_header *label;
+	struct lvm_pv_header *pvh;
+	struct lvm_mda_header *mdah;
+	u64 mda_size = SELFTEST_FIRST * 512 - LVM_MDA_START;
+	size_t max = mda_size - LVM_MDA_HEADER_SIZE;
+	char *text;
+	size_t len;
+	int i;
+
+	text = (char *)data + LVM_MDA_START + LVM_MDA_HEADER_SIZE;
+	len = scnprintf(text, max, "selftest {\nseqno = 1\n"
+			"extent_size = %d\nphysical_volumes {\npv0 {\n"
+			"id = \"%s\"\npe_start = %d\n}\n}\n"
+			"logical_volumes {\n", SELFTEST_SIZE, LVM_PV_ID,
+			SELFTEST_FIRST);
+	for (i = 0; i < n; i++) {
+		len += scnprintf(text + len, max - len, "lv%d {\n"
+				 "status = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+				 "segment1 {\nstart_extent = 0\n"
+				 "extent_count = 1\ntype = \"striped\"\n"
+				 "stripe_count = 1\nstripes = [\"pv0\", %d]\n"
+				 "}\n}\n", i + 1, i);
+		expect(d, slot + i, pv + part_start(i, 0), SELFTEST_SIZE);
+	}
+	len += scnprintf(text + len, max - len, "}\n}\n");
+	if (len >= max - 1)
+		return -EINVAL;		/* the metadata area is full */
+
+	/* One data area from the first extent, one metadata area */
+	label = (struct lvm_label_header *)(data + 512);
+	memcpy(label->id, LVM_LABEL_ID, sizeof(label->id));
+	label->sector_xl = cpu_to_le64(1);
+	label->offset_xl = cpu_to_le32(sizeof(*label));
+	memcpy(label->type, LVM_LABEL_TYPE, sizeof(label->type));
+	pvh = (struct lvm_pv_header *)(label + 1);
+	memcpy(pvh->pv_uuid, LVM_PV_ID, LVM_ID_LEN);
+	pvh->device_size_xl = cpu_to_le64(size << 9);
+	pvh->disk_areas_xl[0].offset = cpu_to_le64(SELFTEST_FIRST << 9);
+	pvh->disk_areas_xl[2].offset = cpu_to_le64(LVM_MDA_START);
+	pvh->disk_areas_xl[2].size = cpu_to_le64(mda_size);
+	label->crc_xl = cpu_to_le32(crc32_le(LVM_INITIAL_CRC, (u8 *)label + 20,
+					     512 - 20));
+
+	mdah = (struct lvm_mda_header *)(data + LVM_MDA_START);
+	memcpy(mdah->magic, LVM_FMTT_MAGIC, sizeof(mdah->magic));
+	mdah->version = cpu_to_le32(LVM_FMTT_VERSION);
+	mdah->start = cpu_to_le64(LVM_MDA_START);
+	mdah->size = cpu_to_le64(mda_size);
+	mdah->raw_locns[0].offset = cpu_to_le64(LVM_MDA_HEADER_SIZE);
+	mdah->raw_locns[0].size = cpu_to_le64(len);
+	mdah->raw_locns[0].checksum =
+		cpu_to_le32(crc32_le(LVM_INITIAL_CRC, text, len));
+	mdah->checksum_xl = cpu_to_le32(crc32_le(LVM_INITIAL_CRC,
+						 (u8 *)mdah + 4,
+						 LVM_MDA_HEADER_SIZE - 4));
+	return 0;
+}
+
+static int build_lvm2(struct selftest_disk *d, int n)
+{
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	return lvm2_pv(d, 0, d->image.sectors, n, 1);
+}
+
+/*
+ * The PV in a DOS 0x8e partition: with nested=flat, its volumes follow
+ * the primary slots
+ */
+static int build_lvm2_msdos(struct selftest_disk *d, int n)
+{
+	sector_t size = disk_blocks(n, 0, 0);
+
+	if (selftest_disk_init(d, SELFTEST_FIRST + size, 4 + n))
+		return -ENOMEM;
+	dos_entry((struct partition *)(image_block(d, 0) + 0x1be),
+		  LINUX_LVM_PARTITION, SELFTEST_FIRST, size);
+	put_unaligned_le16(MSDOS_LABEL_MAGIC, image_block(d, 0) + 510);
+	expect(d, 1, SELFTEST_FIRST, size);
+	return lvm2_pv(d, SELFTEST_FIRST, size, n, 5);
+}
+
+/*
+ * md: n DOS RAID partitions (0xfd), the members of a RAID-0 or RAID-1
+ * array with 0.90 or 1.2 superblocks, which md=arrays adds after them.
+ * 512-byte sectors only.
+ */
+#define MD_MEMBER_SIZE		256	/* sectors, 0.90 needs 128 */
+#define MD_CHUNK		8	/* sectors */
+#define MD_SB1_DATA_OFFSET	16	/* after the 1.2 superblock */
+
+static const u8 md_uuid[16] = {
+	0x5e, 0x1f, 0x7e, 0x57, 0x00, 0x0d, 0x4b, 0x0c,
+	0x9a, 0x11, 0x2d, 0xb6, 0x3c, 0x8e, 0x40, 0x02
+};
+
+/* In the CPU byte order, at the end of the member */
+static void md_sb0(u8 *buf, int level, int n, int role)
+{
+	mdp_super_t *sb = (mdp_super_t *)buf;
+	u32 *words = (u32 *)buf;
+	u64 csum = 0;
+	int i;
+
+	sb->md_magic = MD_SB_MAGIC;
+	sb->major_version = 0;
+	sb->minor_version = 90;
+	memcpy(&sb->set_uuid0, md_uuid, 4);
+	memcpy(&sb->set_uuid1, md_uuid + 4, 4);
+	memcpy(&sb->set_uuid2, md_uuid + 8, 4);
+	memcpy(&sb->set_uuid3, md_uuid + 12, 4);
+	sb->level = level;
+	sb->size = MD_NEW_SIZE_SECTORS(MD_MEMBER_SIZE) / 2;	/* KiB */
+	sb->nr_disks = n;
+	sb->raid_disks = n;
+	sb->chunk_size = MD_CHUNK << 9;
+	sb->events_lo = 1;
+	sb->this_disk.number = role;
+	sb->this_disk.raid_disk = role;
+	sb->this_disk.state = (1 << MD_DISK_ACTIVE) | (1 << MD_DISK_SYNC);
+	for (i = 0; i < MD_SB_WORDS; i++)
+		csum += words[i];
+	sb->sb_csum = (csum & 0xffffffff) + (csum >> 32);
+}
+
+/* Little endian, 4 KiB from the start of the member */
+static void md_sb1(u8 *buf, int level, int n, int role)
+{
+	struct mdp_superblock_1 *sb = (struct mdp_superblock_1 *)buf;
+	int sb_size = 256 + n * 2;
+	u64 csum = 0;
+	int i;
+
+	sb->magic = cpu_to_le32(MD_SB_MAGIC);
+	sb->major_version = cpu_to_le32(1);
+	memcpy(sb->set_uuid, md_uuid, sizeof(sb->set_uuid));
+	sb->level = cpu_to_le32(level);
+	sb->size = cpu_to_le64(MD_MEMBER_SIZE - MD_SB1_DATA_OFFSET);
+	sb->chunksize = cpu_to_le32(MD_CHUNK);
+	sb->raid_disks = cpu_to_le32(n);
+	sb->data_offset = cpu_to_le64(MD_SB1_DATA_OFFSET);
+	sb->data_size = cpu_to_le64(MD_MEMBER_SIZE - MD_SB1_DATA_OFFSET);
+	sb->super_offset = cpu_to_le64(MD_SB1_OFFSET_1_2);
+	sb->dev_number = cpu_to_le32(role);
+	sb->events = cpu_to_le64(1);
+	sb->max_dev = cpu_to_le32(n);
+	for (i = 0; i < n; i++)
+		sb->dev_roles[i] = cpu_to_le16(i);
+	for (i = 0; i + 4 <= sb_size; i += 4)
+		csum += get_unaligned_le32(buf + i);
+	if (sb_size & 2)
+		csum += get_unaligned_le16(buf + i);
+	sb->sb_csum = cpu_to_le32((csum & 0xffffffff) + (csum >> 32));
+}
+
+static int build_md(struct selftest_disk *d, int n, int level, bool sb1)
+{
+	struct partition *p;
+	sector_t from, data;
+	int i;
+
+	if (n > 4)
+		return -EINVAL;
+	if (selftest_disk_init(d, SELFTEST_FIRST + n * MD_MEMBER_SIZE +
+			       SELFTEST_TAIL, n + 1))
+		return -ENOMEM;
+	p = (struct partition *)(image_block(d, 0) + 0x1be);
+	for (i = 0; i < n; i++) {
+		from = SELFTEST_FIRST + i * MD_MEMBER_SIZE;
+		dos_entry(&p[i], LINUX_RAID_PARTITION, from, MD_MEMBER_SIZE);
+		expect(d, i + 1, from, MD_MEMBER_SIZE);
+		if (sb1)
+			md_sb1(image_block(d, from + MD_SB1_OFFSET_1_2),
+			       level, n, i);
+		else
+			md_sb0(image_block(d, from +
+					   MD_NEW_SIZE_SECTORS(MD_MEMBER_SIZE)),
+			       level, n, i);
+	}
+	put_unaligned_le16(MSDOS_LABEL_MAGIC, image_block(d, 0) + 510);
+
+	/* RAID-0: the members one after the other, RAID-1: one of them */
+	from = SELFTEST_FIRST + (sb1 ? MD_SB1_DATA_OFFSET : 0);
+	data = sb1 ? MD_MEMBER_SIZE - MD_SB1_DATA_OFFSET :
+		     MD_NEW_SIZE_SECTORS(MD_MEMBER_SIZE);
+	expect(d, n + 1, from, level == MD_LEVEL_RAID0 ? n * data : data);
+	return 0;
+}
+
+static int build_md0_raid0(struct selftest_disk *d, int n)
+{
+	return build_md(d, n, MD_LEVEL_RAID0, false);
+}
+
+static int build_md0_raid1(struct selftest_disk *d, int n)
+{
+	return build_md(d, n, MD_LEVEL_RAID1, false);
+}
+
+static int build_md1_raid0(struct selftest_disk *d, int n)
+{
+	return build_md(d, n, MD_LEVEL_RAID0, true);
+}
+
+static int build_md1_raid1(struct selftest_disk *d, int n)
+{
+	return build_md(d, n, MD_LEVEL_RAID1, true);
+}
+
+/*
+ * recover=scan: no table, an ext2 filesystem, a FAT one, and the backup
+ * GPT header of a lost table with the n - 2 other partitions.  512-byte
+ * sectors only.
+ */
+static int build_scan(struct selftest_disk *d, int n)
+{
+	int entries = 128;
+	int entry_blocks = entries * sizeof(gpt_entry) / 512;
+	gpt_entry *ptes;
+	u8 *sb, *bs;
+	u64 last;
+	int i;
+
+	if (n < 2)
+		return -EINVAL;
+	if (selftest_disk_init(d, disk_blocks(n, SELFTEST_GAP,
+					      entry_blocks + 1), n))
+		return -ENOMEM;
+	last = d->image.sectors - 1;
+
+	/* 1 KiB blocks, the superblock in the second one */
+	sb = image_block(d, part_start(0, SELFTEST_GAP) + EXT_SB_SECTOR);
+	put_unaligned_le32(SELFTEST_SIZE / 2, sb + EXT_SB_BLOCKS_COUNT);
+	put_unaligned_le32(1, sb + EXT_SB_FIRST_DATA_BLOCK);
+	put_unaligned_le32(8192, sb + EXT_SB_BLOCKS_PER_GROUP);
+	put_unaligned_le16(EXT_MAGIC, sb + EXT_SB_MAGIC);
+	expect(d, 1, part_start(0, SELFTEST_GAP), SELFTEST_SIZE);
+
+	bs = image_block(d, part_start(1, SELFTEST_GAP));
+	bs[0] = 0xeb;					/* jmp 0x3e; nop */
+	bs[1] = 0x3c;
+	bs[2] = 0x90;
+	memcpy(bs + 3, "MSWIN4.1", 8);
+	put_unaligned_le16(512, bs + 11);		/* sector size */
+	bs[13] = 1;					/* sectors/cluster */
+	put_unaligned_le16(1, bs + 14);			/* reserved */
+	bs[16] = 2;					/* FATs */
+	put_unaligned_le16(16, bs + 17);		/* root entries */
+	put_unaligned_le16(SELFTEST_SIZE, bs + 19);	/* sectors */
+	bs[21] = 0xf8;					/* media */
+	put_unaligned_le16(MSDOS_LABEL_MAGIC, bs + 510);
+	expect(d, 2, part_start(1, SELFTEST_GAP), SELFTEST_SIZE);
+
+	/* The primary header and entries are gone */
+	ptes = (gpt_entry *)image_block(d, last - entry_blocks);
+	for (i = 2; i < n; i++) {
+		ptes[i - 2].partition_type_guid = PARTITION_BASIC_DATA_GUID;
+		ptes[i - 2].unique_partition_guid = EFI_GUID(i + 1, 0, 0,
+						0, 0, 0, 0, 0, 0, 0, 0);
+		ptes[i - 2].starting_lba =
+			cpu_to_le64(part_start(i, SELFTEST_GAP));
+		ptes[i - 2].ending_lba =
+			cpu_to_le64(part_start(i, SELFTEST_GAP) +
+				    SELFTEST_SIZE - 1);
+		expect(d, i + 1, part_start(i, SELFTEST_GAP), SELFTEST_SIZE);
+	}
+	put_gpt_header(d, last, 1, last - entry_blocks, entries, entry_blocks,
+		       selftest_crc32(ptes, entries * sizeof(gpt_entry)));
+	return 0;
+}
+
+#ifdef CONFIG_ACORN_PARTITION_ICS
+static int build_ics(struct selftest_disk *d, int n)
+{
+	u8 *table;
+	u32 sum = 0x50617274;
+	int i;
+
+	if (selftest_disk_init(d, disk_blocks(n, 0, 0), n))
+		return -ENOMEM;
+	table = image_block(d, 0);
+	for (i = 0; i < n; i++) {
+		put_unaligned_le32(part_start(i, 0), table + 8 * i);
+		put_unaligned_le32(SELFTEST_SIZE, table + 8 * i + 4);
+		expect(d, i + 1, part_start(i, 0), SELFTEST_SIZE);
+	}
+	for (i = 0; i < 508; i++)
+		sum += table[i];
+	put_unaligned_le32(sum, table + 508);
+	return 0;
+}
+#endif
+
+static const struct selftest_case selftest_cases[] = {
+	{ "gpt", efi_partition, build_gpt, 5, 512 },
+	{ "gpt-4k", efi_partition, build_gpt, 5, 4096 },
+	{ "gpt-200", efi_partition, build_gpt, 200, 512 },
+	{ "msdos", msdos_partition, build_msdos, 4, 512 },
+	{ "msdos-logical", msdos_partition, build_msdos, 7, 512 },
+	{ "msdos-logical-4k", msdos_partition, build_msdos, 7, 4096 },
+	{ "msdos-lvm2", msdos_partition, build_lvm2_msdos, 3, 512,
+	  SELFTEST_FLAT_NESTED },
+	{ "md-0.90-raid0", msdos_partition, build_md0_raid0, 2, 512,
+	  SELFTEST_MD_ARRAYS },
+	{ "md-0.90-raid1", msdos_partition, build_md0_raid1, 2, 512,
+	  SELFTEST_MD_ARRAYS },
+	{ "md-1.2-raid0", msdos_partition, build_md1_raid0, 2, 512,
+	  SELFTEST_MD_ARRAYS },
+	{ "md-1.2-raid1", msdos_partition, build_md1_raid1, 2, 512,
+	  SELFTEST_MD_ARRAYS },
+	{ "ldm", ldm_partition, build_ldm, 4, 512 },
+	{ "lvm2", lvm2_partition, build_lvm2, 5, 512 },
+	{ "amiga", amiga_partition, build_amiga, 5, 512 },
+	{ "mac", mac_partition, build_mac, 5, 512 },
+	{ "atari", atari_partition, build_atari, 4, 512 },
+	{ "atari-xgm", atari_partition, build_atari, 7, 512 },
+	{ "sun", sun_partition, build_sun, 5, 512 },
+	{ "sgi", sgi_partition, build_sgi, 5, 512 },
+	{ "osf", osf_partition, build_osf, 5, 512 },
+	{ "ultrix", ultrix_partition, build_ultrix, 5, 512 },
+	{ "karma", karma_partition, build_karma, 2, 512 },
+	{ "sysv68", sysv68_partition, build_sysv68, 5, 512 },
+#ifdef CONFIG_ACORN_PARTITION_ICS
+	{ "ics", adfspart_check_ICS, build_ics, 5, 512 },
+#endif
+	{ "scan", scan_partitions, build_scan, 4, 512 },
+};
+
+static const struct selftest_case selftest_benches[] = {
+	{ "msdos-250-logicals", msdos_partition, build_msdos, 253, 512 },
+	{ "ldm-1000-volumes", ldm_partition, build_ldm, 1000, 512 },
+	{ "gpt-128", efi_partition, build_gpt, 128, 512 },
+};
+
+static struct selftest_disk *selftest_build(const struct selftest_case *c)
+{
+	struct selftest_disk *d;
+
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return NULL;
+	d->ssz = c->ssz;
+	if (c->build(d, c->n)) {
+		selftest_disk_free(d);
+		return NULL;
+	}
+	return d;
+}
+
+/*
+ * Probe the disk with one parser, as check_partition() does (but
+ * without logging the partitions found)
+ */
+static struct parsed_partitions *
+selftest_probe(struct selftest_disk *d, const struct selftest_case *c,
+	       int *res)
+{
+	struct parsed_partitions *state;
+
+	state = kzalloc(sizeof(struct parsed_partitions), GFP_KERNEL);
+	if (!state)
+		return NULL;
+	state->pp_buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!state->pp_buf) {
+		kfree(state);
+		return NULL;
+	}
+	state->pp_buf[0] = '\0';
+	state->bdev = &d->bdev;
+	state->image = &d->image;
+	strlcpy(state->name, "selftest", sizeof(state->name));
+	state->limit = PARSED_PARTITIONS_LIMIT;
+	state->opts.flat_nested = c->flags & SELFTEST_FLAT_NESTED;
+	state->opts.md_arrays = c->flags & SELFTEST_MD_ARRAYS;
+
+	*res = c->parse(state);
+	if (*res > 0 && state->opts.md_arrays)
+		md_assemble_arrays(state);
+	free_page((unsigned long)state->pp_buf);
+	state->pp_buf = NULL;
+	return state;
+}
+
+static int selftest_check(const struct selftest_case *c,
+			  struct selftest_disk *d,
+			  struct parsed_partitions *state, int res)
+{
+	struct selftest_part none = { 0, 0 };
+	struct selftest_part *want;
+	int slot, nr = max(d->nr_expect, state->nr_slots);
+
+	if (res != 1) {
+		printk(KERN_ERR "partsfs selftest: %s: the parser returned %d\n",
+		       c->name, res);
+		return -EINVAL;
+	}
+	for (slot = 1; slot < nr; slot++) {
+		want = slot < d->nr_expect ? &d->expect[slot] : &none;
+		if (slot < state->nr_slots &&
+		    state->parts[slot].from == want->from &&
+		    state->parts[slot].size == want->size)
+			continue;
+		if (slot >= state->nr_slots && !want->size)
+			continue;
+		printk(KERN_ERR "partsfs selftest: %s: slot %d is %llu+%llu, "
+		       "expected %llu+%llu\n", c->name, slot,
+		       slot < state->nr_slots ?
+		       (unsigned long long)state->parts[slot].from : 0,
+		       slot < state->nr_slots ?
+		       (unsigned long long)state->parts[slot].size : 0,
+		       (unsigned long long)want->from,
+		       (unsigned long long)want->size);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int selftest_run(const struct selftest_case *c)
+{
+	struct parsed_partitions *state;
+	struct selftest_disk *d;
+	int res, err = -ENOMEM;
+
+	d = selftest_build(c);
+	if (d) {
+		state = selftest_probe(d, c, &res);
+		if (state) {
+			err = selftest_check(c, d, state, res);
+			free_parsed_partitions(state);
+		}
+		selftest_disk_free(d);
+	}
+	if (err == -ENOMEM)
+		printk(KERN_ERR "partsfs selftest: %s: out of memory\n",
+		       c->name);
+	return err;
+}
+
+/*
+ * No parser may find partitions on a zeroed disk
+ */
+static int selftest_empty(const struct selftest_case *c)
+{
+	struct parsed_partitions *state;
+	struct selftest_disk *d;
+	int res, err = -ENOMEM;
+
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return -ENOMEM;
+	d->ssz = 512;
+	if (!selftest_disk_init(d, disk_blocks(0, 0, 0), 0)) {
+		state = selftest_probe(d, c, &res);
+		if (state) {
+			err = 0;
+			if (res) {
+				printk(KERN_ERR "partsfs selftest: %s: the "
+				       "parser returned %d on an empty disk\n",
+				       c->name, res);
+				err = -EINVAL;
+			}
+			free_parsed_partitions(state);
+		}
+	}
+	selftest_disk_free(d);
+	return err;
+}
+
+static int selftest_bench(const struct selftest_case *c, unsigned int rounds)
+{
+	struct parsed_partitions *state;
+	struct selftest_disk *d;
+	u64 ns, total = 0, best = ~0ULL;
+	unsigned int i, reads = 0;
+	ktime_t start;
+	int res, err = 0;
+
+	d = selftest_build(c);
+	if (!d)
+		return -ENOMEM;
+	for (i = 0; i < rounds && !err; i++) {
+		start = ktime_get();
+		state = selftest_probe(d, c, &res);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (!state) {
+			err = -ENOMEM;
+			break;
+		}
+		if (!i)
+			err = selftest_check(c, d, state, res);
+		reads = state->nr_reads;
+		free_parsed_partitions(state);
+		total += ns;
+		best = min(best, ns);
+		cond_resched();
+	}
+	selftest_disk_free(d);
+	if (err)
+		return err;
+	printk(KERN_INFO "partsfs selftest: bench %s: %u reads, %llu ns per "
+	       "probe, best %llu ns (%u probes)\n", c->name, reads,
+	       (unsigned long long)div64_u64(total, rounds),
+	       (unsigned long long)best, rounds);
+	return 0;
+}
+
+/*
+ * Run the tests, then bench_rounds probes of each benchmark image.
+ * Returns 0 if all the tests passed.
+ */
+int partitions_selftest(unsigned int bench_rounds)
+{
+	int i, failed = 0, total = 0;
+
+	for (i = 0; i < ARRAY_SIZE(selftest_cases); i++) {
+		total++;
+		if (selftest_run(&selftest_cases[i]))
+			failed++;
+		/* The cases of a format follow each other */
+		if (i && selftest_cases[i].parse == selftest_cases[i - 1].parse)
+			continue;
+		total++;
+		if (selftest_empty(&selftest_cases[i]))
+			failed++;
+	}
+	if (failed) {
+		printk(KERN_ERR "partsfs selftest: %d of %d tests failed\n",
+		       failed, total);
+		return -EINVAL;
+	}
+	printk(KERN_INFO "partsfs selftest: all %d tests passed\n", total);
+
+	for (i = 0; bench_rounds && i < ARRAY_SIZE(selftest_benches); i++)
+		if (selftest_bench(&selftest_benches[i], bench_rounds))
+			return -EINVAL;
+	return 0;
+}
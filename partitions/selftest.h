@@ -0,0 +1,6 @@
+/*
+ *  fs/partitions/selftest.h
+ *  Self-test and microbenchmarks of the partition parsers, see selftest.c
+ */
+
+int partitions_selftest(unsigned int bench_rounds);
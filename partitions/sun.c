@@ -99,20 +99,22 @@ int sun_partition(struct parsed_partitions *state)
 				 label->vtoc.version || label->vtoc.nparts);
 	spc = be16_to_cpu(label->ntrks) * be16_to_cpu(label->nsect);
 	for (i = 0; i < nparts; i++, p++) {
-		unsigned long st_sector;
+		sector_t st_sector;
 		unsigned int num_sectors;
 
-		st_sector = be32_to_cpu(p->start_cylinder) * spc;
+		st_sector = (sector_t) be32_to_cpu(p->start_cylinder) * spc;
 		num_sectors = be32_to_cpu(p->num_sectors);
 		if (num_sectors) {
+			int flags = 0;
+
 			put_partition(state, slot, st_sector, num_sectors);
-			state->parts[slot].flags = 0;
 			if (use_vtoc) {
 				if (be16_to_cpu(label->vtoc.infos[i].id) == LINUX_RAID_PARTITION)
-					state->parts[slot].flags |= ADDPART_FLAG_RAID;
+					flags |= ADDPART_FLAG_RAID;
 				else if (be16_to_cpu(label->vtoc.infos[i].id) == SUN_WHOLE_DISK)
-					state->parts[slot].flags |= ADDPART_FLAG_WHOLEDISK;
+					flags |= ADDPART_FLAG_WHOLEDISK;
 			}
+			set_partition_flags(state, slot, flags);
 		}
 		slot++;
 	}
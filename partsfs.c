@@ -33,34 +33,159 @@
 #include <linux/namei.h>
 #include <linux/statfs.h>
 #include <linux/pagemap.h>
+#include <linux/pagevec.h>
 #include <linux/blkdev.h>
 #include <linux/genhd.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/rcupdate.h>
+#include <linux/rwsem.h>
+#include <linux/dcache.h>
+#include <linux/capability.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 
 #include "partitions/check.h"
+#include "partitions/cache.h"
+#include "partitions/profile.h"
+#include "partitions/ldm.h"
+#ifdef CONFIG_PARTSFS_SELFTEST
+#include "partitions/selftest.h"
+#endif
 #include "partsfs.h"
+#include "partsfs_ioctl.h"
 
-// TODO: check overlapping partitions
+#define CREATE_TRACE_POINTS
+#include "partsfs_trace.h"
+
+/* Background probes (scan=async) and verifications (verify=deferred) */
+static struct workqueue_struct *partsfs_probe_wq;
+
+/* /sys/fs/partsfs */
+static struct kset *partsfs_kset;
+
+/* <debugfs>/partsfs */
+static struct dentry *partsfs_debugfs;
+
+/* Serializes the open of a stats file with the umount, see partsfs_stats_open */
+static DEFINE_MUTEX(partsfs_stats_mutex);
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+/* Parser self-test at load time (make SELFTEST=1), see selftest.c */
+static bool selftest;
+module_param(selftest, bool, 0444);
+MODULE_PARM_DESC(selftest, "test the partition parsers before registering");
+static unsigned int selftest_bench;
+module_param(selftest_bench, uint, 0444);
+MODULE_PARM_DESC(selftest_bench, "with selftest, time N probes of each benchmark image");
+#endif
 
 /**
- * Check if the partition number correspond to a valid partition
+ * Returns the current partitions table
+ * The caller holds rescan_sem, or is mounting/unmounting the filesystem
  */
-static inline int check_partition_number(int partition_number, struct super_block *sb) {
+static inline struct partsfs_table *partsfs_table(struct super_block *sb) {
         struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
-        return (partition_number > 0) &&
-               (partition_number <= state->last_partition) &&
-               (state->parts[partition_number].size != 0);
+        return rcu_dereference_protected(state->table, 1);
 }
 
 /**
- * Convert a inode number into a partition number
- * Returns -1 in the inode_number does not correspond to a partition
+ * Wait until the full partitions table is available
+ * (immediately with scan=sync). Returns -EINTR if killed while waiting.
  */
-static inline int inode_number_to_partition(ino_t inode_number, struct super_block *sb) {
-        int partition_number = inode_number - PARTSFS_FIRST_PARTITION_INODE;
-        if (check_partition_number(partition_number, sb))
-                return partition_number;
-        else
-                return -1;
+static int partsfs_wait_probe(struct super_block *sb) {
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        return wait_for_completion_killable(&state->probe_done);
+}
+
+/**
+ * The error of the background probe (scan=async) if it failed and left
+ * no partitions: with scan=sync, the mount itself would have failed
+ * The caller holds rescan_sem, after partsfs_wait_probe
+ */
+static int partsfs_probe_error(struct super_block *sb) {
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        if (partsfs_table(sb)->number_of_partitions)
+                return 0;
+        return state->probe_status;
+}
+
+/**
+ * Find a partition by number (binary search on the by_number index)
+ * Returns NULL if the partition does not exist
+ */
+static struct partsfs_partition *find_partition(struct partsfs_table *table, int partition_number) {
+        int lo = 0;
+        int hi = table->number_of_partitions;
+
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                struct partsfs_partition *part = table->by_number[mid];
+                if (part->number == partition_number)
+                        return part;
+                if (part->number < partition_number)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return NULL;
+}
+
+/*
+ * Check if a partition must be exposed read-only
+ * (md arrays always are: their members are exposed too, with their own
+ * page cache, and a write to a RAID-1 array would only reach one copy;
+ * and so are the partitions guessed by the signature scan)
+ */
+static inline int partition_is_readonly(struct partsfs_state *state, struct partsfs_partition *part)
+{
+        if (part->md_array || part->recovered)
+                return 1;
+        return (part->overlap_group != 0) &&
+               (state->option_overlap == PARTSFS_OVERLAP_READONLY);
+}
+
+/**
+ * Find a nested partition by number (binary search on the children)
+ * Returns NULL if the nested partition does not exist
+ */
+static struct partsfs_partition *find_nested_partition(struct partsfs_partition *parent, int partition_number) {
+        int lo = 0;
+        int hi = parent->number_of_children;
+
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                struct partsfs_partition *part = &parent->children[mid];
+                if (part->number == partition_number)
+                        return part;
+                if (part->number < partition_number)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return NULL;
+}
+
+/**
+ * Convert a inode number into a partition descriptor
+ * Returns NULL if the inode_number does not correspond to a partition
+ */
+static struct partsfs_partition *inode_number_to_partition(ino_t inode_number, struct super_block *sb) {
+        struct partsfs_partition *parent;
+
+        if (inode_number < PARTSFS_FIRST_NESTED_INODE)
+                return find_partition(partsfs_table(sb), inode_number - PARTSFS_FIRST_PARTITION_INODE);
+
+        inode_number -= PARTSFS_FIRST_NESTED_INODE;
+        parent = find_partition(partsfs_table(sb), inode_number >> PARTSFS_NESTED_INODE_SHIFT);
+        if (parent == NULL || parent->children == NULL)
+                return NULL;
+        return find_nested_partition(parent,
+                        inode_number & ((1 << PARTSFS_NESTED_INODE_SHIFT) - 1));
 }
 
 /**
@@ -70,26 +195,218 @@ static inline int partition_to_inode_number(int partition_number, struct super_b
         return partition_number + PARTSFS_FIRST_PARTITION_INODE;
 }
 
-/* 
+/**
+ * Convert a nested partition number into an inode number
+ */
+static inline ino_t nested_partition_to_inode_number(struct partsfs_partition *parent, int partition_number) {
+        return PARTSFS_FIRST_NESTED_INODE +
+               (parent->number << PARTSFS_NESTED_INODE_SHIFT) + partition_number;
+}
+
+/**
+ * Returns the directory entry type of a partition
+ * (unknown until its nested table, if any, has been parsed)
+ */
+static inline unsigned char partition_d_type(struct partsfs_partition *part) {
+        if (ACCESS_ONCE(part->nested) != NULL)
+                return DT_UNKNOWN;
+        return part->children ? DT_DIR : DT_REG;
+}
+
+/*
+ * Apply the overlap policy to the nested partitions of part (children[0] is
+ * the whole partition, so they all overlap it): the overlapping ones get a
+ * group, are removed with overlap=hide, and the table is refused with
+ * overlap=reject. Their groups are numbered within the directory, but the
+ * children of an overlapping partition are all in its group.
+ * Returns the number of children left, or a negative error
+ */
+static int nested_overlap_policy(struct partsfs_state *state, struct partsfs_partition *part,
+                                 struct partsfs_partition *children, int n)
+{
+        struct partsfs_partition **sorted;
+        int groups;
+        int p, m;
+
+        sorted = kmalloc(n * sizeof(struct partsfs_partition *), GFP_KERNEL);
+        if (sorted == NULL)
+                return -ENOMEM;
+        for (p = 0; p < n; p++)
+                sorted[p] = &children[p];
+        sort(sorted, n, sizeof(struct partsfs_partition *), cmp_partition_from_ref, NULL);
+        groups = mark_overlap_groups(sorted, n, 0);
+        kfree(sorted);
+
+        /* The multi-extent ones (LVM2 volumes) are pieces of the whole partition */
+        for (p = 1; p < n; p++) {
+                if ((children[p].extents == NULL) && (children[p].mirrors == 0))
+                        continue;
+                if (children[0].overlap_group == 0)
+                        children[0].overlap_group = ++groups;
+                children[p].overlap_group = children[0].overlap_group;
+        }
+        if (part->overlap_group != 0) {
+                for (p = 0; p < n; p++)
+                        children[p].overlap_group = part->overlap_group;
+                groups = 1;
+        }
+        if (groups == 0)
+                return n;
+
+        if (state->option_overlap == PARTSFS_OVERLAP_REJECT) {
+                printk(KERN_ERR "PARTSFS: Partition %d: overlapping nested partitions, not shown (overlap=reject)\n",
+                       part->number);
+                return -EINVAL;
+        }
+        if (state->option_overlap != PARTSFS_OVERLAP_HIDE)
+                return n;
+        for (p = 0, m = 0; p < n; p++) {
+                if (children[p].overlap_group != 0)
+                        kfree(children[p].extents);
+                else
+                        children[m++] = children[p];
+        }
+        return m;
+}
+
+/*
+ * Parse the nested partition table of a partition, the first time it is needed
+ * If a table is found the partition becomes a directory, containing the whole
+ * partition (0) and the nested partitions (1...), otherwise it stays a file.
+ * The overlap policy applies to them as to the partitions of the table.
+ */
+static int partsfs_parse_nested(struct super_block *sb, struct partsfs_partition *part)
+{
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct parsed_partitions *partitions;
+        struct partsfs_partition *children;
+        int n = 0;
+        int p;
+        int ret = 0;
+
+        if (ACCESS_ONCE(part->nested) == NULL)
+                return 0;
+
+        mutex_lock(&state->nested_mutex);
+        if (part->nested == NULL) /* parsed in the meantime */
+                goto out;
+
+        partitions = check_nested_partition(sb->s_bdev, part->nested,
+                                            part->from, part->size, part->number);
+        if (IS_ERR(partitions)) {
+                ret = PTR_ERR(partitions); /* try again on the next lookup */
+                goto out;
+        }
+
+        for (p = 1; p < partitions->nr_slots; p++)
+                if (partitions->parts[p].size != 0)
+                        n++;
+
+        if (n != 0) {
+                children = kcalloc(n + 1, sizeof(struct partsfs_partition), GFP_KERNEL);
+                if (children == NULL) {
+                        free_parsed_partitions(partitions);
+                        ret = -ENOMEM;
+                        goto out;
+                }
+                /* 0 is the whole partition */
+                children[0].from = part->from;
+                children[0].size = part->size;
+                for (p = 1, n = 1; p < partitions->nr_slots; p++) {
+                        if (partitions->parts[p].size != 0) {
+                                /* LVM2 volumes are made of extents */
+                                if ((partitions->parts[p].extents != NULL) &&
+                                    map_partition_extents(state, &children[n], &partitions->parts[p])) {
+                                        free_children(children, n);
+                                        free_parsed_partitions(partitions);
+                                        ret = -ENOMEM;
+                                        goto out;
+                                }
+                                children[n].from = partitions->parts[p].from;
+                                children[n].size = partitions->parts[p].size;
+                                children[n].number = p;
+                                n++;
+                        }
+                }
+                ret = nested_overlap_policy(state, part, children, n);
+                if (ret < 0) {
+                        free_children(children, n);
+                        free_parsed_partitions(partitions);
+                        goto out; /* overlap=reject: refused on every lookup */
+                }
+                n = ret;
+                ret = 0;
+                for (p = 0; p < n; p++) {
+                        children[p].stats = alloc_percpu(struct partsfs_stats);
+                        if (children[p].stats == NULL) {
+                                free_children(children, n);
+                                free_parsed_partitions(partitions);
+                                ret = -ENOMEM;
+                                goto out;
+                        }
+                }
+                part->number_of_children = n;
+                smp_wmb(); /* children are complete before being published */
+                part->children = children;
+        }
+        free_parsed_partitions(partitions);
+        smp_wmb();
+        part->nested = NULL;
+out:
+        mutex_unlock(&state->nested_mutex);
+        return ret;
+}
+
+/*
  * Returns the root directory files entries
+ * f_pos 2 is the first partition in the by_number index, so resuming
+ * a listing does not need to rescan the partitions already returned
  */
 static void partsfs_readdir_fill_files(struct file *filp, void *dirent,
                         filldir_t filldir) {
         struct partsfs_state *state = (struct partsfs_state *)
                         filp->f_path.dentry->d_sb->s_fs_info;
-        int part;
-        int pos = 0;
+        struct partsfs_table *table;
+        loff_t i;
         char name[PARTSFS_MAX_NAME_LENGTH];
 
-        for (part=1; part<=state->last_partition; part++) {
-                if ((state->parts[part].size != 0) && (++pos >= filp->f_pos-1)) {
-                        snprintf(name, sizeof(name), "%d", part);
-                        if (filldir(dirent, name, strlen(name), filp->f_pos,
-                                part+PARTSFS_FIRST_PARTITION_INODE, DT_REG) < 0)
-                                return;
-                        filp->f_pos++;
-                }
+        down_read(&state->rescan_sem);
+        table = partsfs_table(filp->f_path.dentry->d_sb);
+        for (i = filp->f_pos - 2; i < table->number_of_partitions; i++) {
+                struct partsfs_partition *part = table->by_number[i];
+                int len = snprintf(name, sizeof(name), "%d", part->number);
+                if (filldir(dirent, name, len, filp->f_pos,
+                        part->number+PARTSFS_FIRST_PARTITION_INODE,
+                        partition_d_type(part)) < 0)
+                        break;
+                filp->f_pos++;
+        }
+        up_read(&state->rescan_sem);
+}
+
+/*
+ * Returns the nested partitions entries of a partition directory
+ */
+static void partsfs_readdir_fill_nested(struct file *filp, void *dirent,
+                        filldir_t filldir) {
+        struct partsfs_state *state = (struct partsfs_state *)
+                        filp->f_path.dentry->d_sb->s_fs_info;
+        struct partsfs_partition *parent;
+        loff_t i;
+        char name[PARTSFS_MAX_NAME_LENGTH];
+
+        down_read(&state->rescan_sem);
+        parent = filp->f_path.dentry->d_inode->i_private;
+        for (i = filp->f_pos - 2; parent && (i < parent->number_of_children); i++) {
+                struct partsfs_partition *part = &parent->children[i];
+                int len = snprintf(name, sizeof(name), "%d", part->number);
+                if (filldir(dirent, name, len, filp->f_pos,
+                        nested_partition_to_inode_number(parent, part->number),
+                        DT_REG) < 0)
+                        break;
+                filp->f_pos++;
         }
+        up_read(&state->rescan_sem);
 }
 
 /*
@@ -98,6 +415,17 @@ static void partsfs_readdir_fill_files(struct file *filp, void *dirent,
 static int partsfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 {
         struct dentry *dentry = filp->f_path.dentry;
+        struct partsfs_state *state = (struct partsfs_state *) dentry->d_sb->s_fs_info;
+        int ret;
+
+        /* Before any entry, getdents() drops the error once it has some */
+        if (partsfs_wait_probe(dentry->d_sb))
+                return -EINTR;
+        down_read(&state->rescan_sem);
+        ret = partsfs_probe_error(dentry->d_sb);
+        up_read(&state->rescan_sem);
+        if (ret)
+                return ret;
 
         switch (filp->f_pos) {
                 case 0:
@@ -117,182 +445,1538 @@ static int partsfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 }
 
 /*
- * Look up an entry in the root directory
+ * Returns a partition directory entries
+ */
+static int partsfs_nested_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+        struct dentry *dentry = filp->f_path.dentry;
+
+        switch (filp->f_pos) {
+                case 0:
+                        if (filldir(dirent, ".", 1, filp->f_pos,
+                                    dentry->d_inode->i_ino, DT_DIR) < 0)
+                                return 0;
+                        filp->f_pos++;
+                case 1:
+                        if (filldir(dirent, "..", 2, filp->f_pos,
+                                    parent_ino(dentry), DT_DIR) < 0)
+                                return 0;
+                        filp->f_pos++;
+                default:
+                        partsfs_readdir_fill_nested(filp, dirent, filldir);
+        }
+        return 0;
+}
+
+/*
+ * Convert a file name into a partition number
+ * Only the canonical decimal form is accepted ("1", not "01", "0x1" or "1abc"),
+ * 0 is valid only inside partition directories (the whole partition),
+ * so each partition has exactly one name in the dcache.
+ * Returns -1 if the name is not a canonical partition number
+ */
+static int name_to_partition_number(const struct qstr *name)
+{
+        unsigned int i;
+        int partition_number = 0;
+
+        if (name->len == 0 || name->len >= PARTSFS_MAX_NAME_LENGTH)
+                return -1;
+        if (name->name[0] == '0' && name->len > 1)
+                return -1;
+        for (i = 0; i < name->len; i++) {
+                unsigned char c = name->name[i];
+                if (c < '0' || c > '9')
+                        return -1;
+                if (partition_number > (INT_MAX - (c - '0')) / 10)
+                        return -1;
+                partition_number = partition_number * 10 + (c - '0');
+        }
+        return partition_number;
+}
+
+/*
+ * Look up an entry in the root directory
+ * Misses are cached as negative dentries, a rescan that adds partitions
+ * drops them (see partsfs_rescan)
+ */
+static struct dentry *partsfs_lookup(struct inode *dir, struct dentry *dentry,
+                                 struct nameidata *nd)
+{
+        struct super_block *sb = dentry->d_sb;
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct inode *inode = NULL;
+        struct partsfs_partition *part;
+        int partition_number = name_to_partition_number(&dentry->d_name);
+
+        down_read(&state->rescan_sem);
+        part = find_partition(partsfs_table(sb), partition_number);
+        if (part == NULL && !completion_done(&state->probe_done)) {
+                /* Not in the primary table, wait for the background probe */
+                up_read(&state->rescan_sem);
+                if (partsfs_wait_probe(sb))
+                        return ERR_PTR(-EINTR);
+                down_read(&state->rescan_sem);
+                part = find_partition(partsfs_table(sb), partition_number);
+        }
+        if (part == NULL && completion_done(&state->probe_done)) {
+                int ret = partsfs_probe_error(sb);
+                if (ret) {
+                        up_read(&state->rescan_sem);
+                        return ERR_PTR(ret);
+                }
+        }
+        if (part != NULL) {
+                int inode_number = partition_to_inode_number(partition_number, sb);
+                int ret = partsfs_parse_nested(sb, part);
+                if (!ret)
+                        inode = partsfs_get_inode(sb, inode_number);
+                if (!inode) {
+                        up_read(&state->rescan_sem);
+                        return ERR_PTR(ret ? ret : -ENOMEM);
+                }
+        }
+        trace_partsfs_lookup(dir, dentry, inode);
+        d_add(dentry, inode);
+        up_read(&state->rescan_sem);
+        return NULL;
+}
+
+/*
+ * Look up an entry in a partition directory
+ */
+static struct dentry *partsfs_nested_lookup(struct inode *dir, struct dentry *dentry,
+                                 struct nameidata *nd)
+{
+        struct partsfs_state *state = (struct partsfs_state *) dentry->d_sb->s_fs_info;
+        struct partsfs_partition *parent;
+        struct inode *inode = NULL;
+        int partition_number = name_to_partition_number(&dentry->d_name);
+
+        down_read(&state->rescan_sem);
+        parent = dir->i_private;
+        if (parent == NULL) { /* the partition was removed by a rescan */
+                up_read(&state->rescan_sem);
+                return ERR_PTR(-ENOENT);
+        }
+        if (find_nested_partition(parent, partition_number) != NULL) {
+                inode = partsfs_get_inode(dentry->d_sb,
+                                nested_partition_to_inode_number(parent, partition_number));
+                if (!inode) {
+                        up_read(&state->rescan_sem);
+                        return ERR_PTR(-ENOMEM);
+                }
+        }
+        trace_partsfs_lookup(dir, dentry, inode);
+        d_add(dentry, inode);
+        up_read(&state->rescan_sem);
+        return NULL;
+}
+
+/*
+ * Add a dentry and an inode for every partition to the dcache,
+ * so lookups of existing partitions never reach partsfs_lookup
+ * (after a rescan: for the partitions not already there)
+ */
+static void partsfs_populate_root(struct super_block *sb)
+{
+        struct partsfs_table *table = partsfs_table(sb);
+        char name[PARTSFS_MAX_NAME_LENGTH];
+        struct qstr qname;
+        int i;
+
+        for (i = 0; i < table->number_of_partitions; i++) {
+                int partition_number = table->by_number[i]->number;
+                struct dentry *dentry;
+                struct inode *inode;
+
+                if (table->by_number[i]->nested != NULL)
+                        continue; /* file or directory: decided on lookup */
+
+                snprintf(name, sizeof(name), "%d", partition_number);
+                qname.name = name;
+                qname.len = strlen(name);
+                dentry = d_hash_and_lookup(sb->s_root, &qname);
+                if (dentry) {
+                        dput(dentry);
+                        continue;
+                }
+                dentry = d_alloc_name(sb->s_root, name);
+                if (!dentry)
+                        return;
+                inode = partsfs_get_inode(sb, partition_to_inode_number(partition_number, sb));
+                if (!inode) {
+                        dput(dentry);
+                        return;
+                }
+                d_add(dentry, inode);
+                dput(dentry); /* unused, but hashed: stays in the dcache LRU */
+        }
+}
+
+/*
+ * Map a block of a partition (< size) to a disk sector, and its disk
+ * (bdev is only changed for the extents on the other disks of a LDM volume)
+ * Multi-extent partitions binary search their extents, which have no holes.
+ * Striped ones first find the column of the block: chunk n of the partition
+ * is in row n / columns of column n % columns.
+ * Mirrored ones (RAID-1 arrays) have a whole copy in every column, and the
+ * reads go round-robin to the copies every 2^PARTSFS_MIRROR_SHIFT blocks:
+ * a readahead window stays on one copy, sequential windows are spread.
+ */
+static sector_t partition_block_to_sector(struct partsfs_partition *part, sector_t iblock,
+                                          struct block_device **bdev)
+{
+        struct partsfs_extent *extent;
+        int column = 0;
+        int lo = 0;
+        int hi = part->nr_extents;
+
+        if (part->extents == NULL)
+                return part->from + iblock;
+        if (part->stripe_columns > 1) {
+                sector_t chunk = iblock;
+                u32 in_chunk = sector_div(chunk, part->stripe_chunk);
+
+                column = sector_div(chunk, part->stripe_columns);
+                iblock = chunk * part->stripe_chunk + in_chunk;
+        } else if (part->mirrors > 1) {
+                sector_t window = iblock >> PARTSFS_MIRROR_SHIFT;
+
+                column = sector_div(window, part->mirrors);
+        }
+        /* Find the first extent (of the column) ending after the block */
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if ((part->extents[mid].column < column) ||
+                    ((part->extents[mid].column == column) &&
+                     (part->extents[mid].offset + part->extents[mid].size <= iblock)))
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        extent = &part->extents[lo];
+        *bdev = extent->bdev;
+        return extent->from + (iblock - extent->offset);
+}
+
+/*
+ * Map a file position (iblock, in device blocks) to a disk offset (passed back in bh_result)
+ * The partitions are described in 512-byte sectors, whatever the logical block size
+ */
+static int get_block(struct inode *inode, sector_t iblock,
+                     struct buffer_head *bh_result, int create)
+{
+        struct partsfs_state *state = (struct partsfs_state *) inode->i_sb->s_fs_info;
+        struct partsfs_partition *part;
+        struct block_device *bdev = inode->i_sb->s_bdev;
+        sector_t sector = iblock << state->sector_shift;
+        sector_t size;
+        int readonly;
+        sector_t disk_offset = 0;
+        int ret = 0;
+
+        /* Get the partition (lockless, a rescan can replace the descriptor) */
+        rcu_read_lock();
+        part = rcu_dereference(inode->i_private);
+        if (part == NULL) {
+                rcu_read_unlock();
+                trace_partsfs_get_block(inode, iblock, 0, create, -ENOENT);
+                return -ENOENT; /* Removed by a rescan */
+        }
+        this_cpu_inc(part->stats->count[PARTSFS_STAT_MAP_CALLS]);
+        size = part->size;
+        readonly = partition_is_readonly(state, part);
+        if (sector < size)
+                disk_offset = partition_block_to_sector(part, sector, &bdev);
+        rcu_read_unlock();
+
+        if (create && readonly)
+                ret = -EROFS; /* Overlapping partition, exposed read-only */
+        else if (create && (sector >= size))
+                ret = -ENOSPC; /* No space left on device */
+        else if (sector >= size)
+                ret = -ESPIPE; /* Illegal seek */
+        trace_partsfs_get_block(inode, iblock, disk_offset, create, ret);
+        if (ret)
+                return ret;
+
+        map_bh(bh_result, inode->i_sb, disk_offset >> state->sector_shift);
+        bh_result->b_bdev = bdev; /* Another disk, for LDM volumes (ldm_members=) */
+        return 0;
+}
+
+/*
+ * Add n to a counter of the partition of an inode
+ * (per-CPU, no lock, no atomic operation: cheap enough to be always on)
+ */
+static void partsfs_stat_add(struct inode *inode, int item, u64 n)
+{
+        struct partsfs_partition *part;
+
+        rcu_read_lock();
+        part = rcu_dereference(inode->i_private);
+        if (part != NULL)
+                this_cpu_add(part->stats->count[item], n);
+        rcu_read_unlock();
+}
+
+/*
+ * Account a read() or write() call, started at start, that returned ret
+ */
+static void partsfs_stat_io(struct inode *inode, int rw, loff_t pos, ssize_t ret, ktime_t start)
+{
+        struct partsfs_partition *part;
+        s64 us = ktime_us_delta(ktime_get(), start);
+        int bucket = (us > 0) ? min(fls64(us), PARTSFS_LATENCY_BUCKETS - 1) : 0;
+
+        rcu_read_lock();
+        part = rcu_dereference(inode->i_private);
+        if (part != NULL) {
+                this_cpu_inc(part->stats->latency[bucket]);
+                if (rw == WRITE) {
+                        this_cpu_inc(part->stats->count[PARTSFS_STAT_WRITE_OPS]);
+                        if (ret > 0)
+                                this_cpu_add(part->stats->count[PARTSFS_STAT_WRITE_BYTES], ret);
+                } else {
+                        this_cpu_inc(part->stats->count[PARTSFS_STAT_READ_OPS]);
+                        if (ret > 0)
+                                this_cpu_add(part->stats->count[PARTSFS_STAT_READ_BYTES], ret);
+                }
+        }
+        rcu_read_unlock();
+}
+
+static int partsfs_writepage(struct page *page, struct writeback_control *wbc)
+{
+        trace_partsfs_writepage(page);
+        partsfs_stat_add(page->mapping->host, PARTSFS_STAT_WRITEBACK_PAGES, 1);
+        return block_write_full_page(page, get_block, wbc);
+}
+
+static int partsfs_readpage(struct file *file, struct page *page)
+{
+        trace_partsfs_readpage(page);
+        partsfs_stat_add(page->mapping->host, PARTSFS_STAT_CACHE_MISSES, 1);
+        return block_read_full_page(page, get_block);
+}
+
+/*
+ * Count the pages from index to end that are up to date in the page cache
+ * (one gang lookup per PAGEVEC_SIZE pages, the holes cost nothing)
+ */
+static unsigned long partsfs_cached_pages(struct address_space *mapping,
+                                          pgoff_t index, pgoff_t end)
+{
+        struct page *pages[PAGEVEC_SIZE];
+        unsigned long cached = 0;
+        unsigned int nr, i;
+
+        while (index <= end) {
+                nr = find_get_pages(mapping, index, PAGEVEC_SIZE, pages);
+                if (nr == 0)
+                        break;
+                for (i = 0; i < nr; i++) {
+                        if (pages[i]->index <= end && PageUptodate(pages[i]))
+                                cached++;
+                        page_cache_release(pages[i]);
+                }
+                index = pages[nr - 1]->index + 1;
+        }
+        return cached;
+}
+
+static ssize_t partsfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
+                           unsigned long nr_segs, loff_t pos)
+{
+        struct address_space *mapping = iocb->ki_filp->f_mapping;
+        loff_t end = min_t(loff_t, pos + iov_length(iov, nr_segs),
+                           i_size_read(mapping->host));
+        ktime_t start = ktime_get();
+        ssize_t ret;
+
+        /* The hits: the pages read() finds in the cache, before it reads any */
+        if (end > pos)
+                partsfs_stat_add(mapping->host, PARTSFS_STAT_CACHE_HITS,
+                                 partsfs_cached_pages(mapping, pos >> PAGE_CACHE_SHIFT,
+                                                      (end - 1) >> PAGE_CACHE_SHIFT));
+        ret = generic_file_aio_read(iocb, iov, nr_segs, pos);
+        partsfs_stat_io(mapping->host, READ, pos, ret, start);
+        return ret;
+}
+
+static ssize_t partsfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                            unsigned long nr_segs, loff_t pos)
+{
+        ktime_t start = ktime_get();
+        ssize_t ret = generic_file_aio_write(iocb, iov, nr_segs, pos);
+
+        partsfs_stat_io(iocb->ki_filp->f_mapping->host, WRITE, pos, ret, start);
+        return ret;
+}
+
+static sector_t partsfs_bmap(struct address_space *mapping, sector_t block)
+{
+        return generic_block_bmap(mapping, block, get_block);
+}
+
+static int partsfs_write_begin(struct file *file, struct address_space *mapping,
+                           loff_t pos, unsigned len, unsigned flags,
+                           struct page **pagep, void **fsdata)
+{
+        int ret = block_write_begin(mapping, pos, len, flags, pagep, get_block);
+        trace_partsfs_write_begin(mapping->host, pos, len, ret);
+        if (unlikely(ret)) {
+                loff_t isize = mapping->host->i_size;
+                if (pos + len > isize)
+                        vmtruncate(mapping->host, isize);
+        }
+        return ret;
+}
+
+static void partsfs_init_inode(struct inode *inode, struct super_block *sb, ino_t inode_number)
+{
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct partsfs_partition *part;
+        inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
+        inode->i_uid = state->option_uid;
+        inode->i_gid = state->option_gid;
+
+        if (inode_number == PARTSFS_ROOT_DIR_INODE) { /* root directory */
+                /* set_nlink(inode, partsfs_table(sb)->number_of_partitions + 1); */
+                inode->i_nlink = partsfs_table(sb)->number_of_partitions + 1;
+                inode->i_size = 0;
+                inode->i_mode = S_IFDIR | PARTSFS_DEFAULT_DIR_MODE;
+                inode->i_op = &partsfs_dir_inode_operations;
+                inode->i_fop = &partsfs_dir_operations;
+        } else if ((part = inode_number_to_partition(inode_number, sb))->children) { /* partition directory */
+                /* set_nlink(inode, 2); */
+                inode->i_nlink = 2;
+                inode->i_private = part;
+                inode->i_size = 0;
+                inode->i_mode = S_IFDIR | PARTSFS_DEFAULT_DIR_MODE;
+                inode->i_op = &partsfs_nested_dir_inode_operations;
+                inode->i_fop = &partsfs_nested_dir_operations;
+        } else { /* partition file */
+                /* set_nlink(inode, 1); */
+                inode->i_nlink = 1;
+                inode->i_private = part;
+                inode->i_size = (loff_t) part->size << 9;
+                inode->i_mode = S_IFREG | state->option_mode;
+                if (partition_is_readonly(state, part)) {
+                        inode->i_mode &= ~S_IWUGO;
+                        inode->i_flags |= S_IMMUTABLE;
+                }
+                inode->i_fop = &partsfs_file_operations;
+                inode->i_data.a_ops = &partsfs_file_aops;
+        }
+
+        unlock_new_inode(inode);
+}
+
+static struct inode *partsfs_get_inode(struct super_block *sb, ino_t inode_number)
+{
+        struct inode *inode = iget_locked(sb, inode_number);
+        if (inode && (inode->i_state & I_NEW))
+                partsfs_init_inode(inode, sb, inode_number);
+        return inode;
+}
+
+/*
+ * Get filesystem statistics
+ */
+static int partsfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+        struct super_block *sb = dentry->d_sb;
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        u64 id = huge_encode_dev(sb->s_bdev->bd_dev);
+
+        buf->f_type = PARTSFS_MAGIC;
+        buf->f_namelen = PARTSFS_MAX_NAME_LENGTH;
+        buf->f_bsize = state->sector_size;
+        buf->f_bfree = buf->f_bavail = buf->f_ffree = 0;
+        down_read(&state->rescan_sem);
+        buf->f_blocks = partsfs_table(sb)->capacity >> state->sector_shift;
+        buf->f_files = partsfs_table(sb)->number_of_partitions + 1;
+        up_read(&state->rescan_sem);
+        buf->f_fsid.val[0] = (u32)id;
+        buf->f_fsid.val[1] = (u32)(id >> 32);
+        return 0;
+}
+
+/*
+ * Sort helpers for the partition descriptors
+ */
+static int cmp_partition_from(const void *a, const void *b)
+{
+        const struct partsfs_partition *pa = a;
+        const struct partsfs_partition *pb = b;
+        if (pa->from != pb->from)
+                return pa->from < pb->from ? -1 : 1;
+        return pa->number - pb->number;
+}
+
+static int cmp_partition_from_ref(const void *a, const void *b)
+{
+        return cmp_partition_from(*(struct partsfs_partition * const *) a,
+                                  *(struct partsfs_partition * const *) b);
+}
+
+static int cmp_partition_number(const void *a, const void *b)
+{
+        const struct partsfs_partition *pa = *(struct partsfs_partition * const *) a;
+        const struct partsfs_partition *pb = *(struct partsfs_partition * const *) b;
+        return pa->number - pb->number;
+}
+
+/*
+ * Find the overlap groups of n partitions, sorted by starting sector:
+ * a partition overlaps the preceding ones if it starts before the highest
+ * end seen so far, and every overlapping run of partitions becomes a group,
+ * numbered after groups.
+ * Multi-extent partitions (LDM volumes, made of partitions that don't overlap)
+ * and md arrays (over their member partitions) are left out of the sweep,
+ * they just carry the max_end of the preceding ones.
+ * Returns the number of groups, groups included
+ */
+static int mark_overlap_groups(struct partsfs_partition **sorted, int n, int groups)
+{
+        struct partsfs_partition *prev = NULL;
+        int i;
+
+        for (i = 0; i < n; i++) {
+                struct partsfs_partition *part = sorted[i];
+                sector_t end = part->from + part->size;
+
+                part->overlap_group = 0;
+                part->max_end = prev ? prev->max_end : 0;
+                if ((part->extents != NULL) || (part->mirrors != 0))
+                        continue;
+                if (prev && part->from < prev->max_end) {
+                        if (prev->overlap_group == 0)
+                                prev->overlap_group = ++groups;
+                        part->overlap_group = prev->overlap_group;
+                }
+                if (end > part->max_end)
+                        part->max_end = end;
+                prev = part;
+        }
+        return groups;
+}
+
+/*
+ * Build the overlap groups and the by-number index of the exposed partitions
+ * (parts is sorted by starting sector)
+ * Returns -EINVAL if overlapping partitions are found and the policy is reject
+ */
+static int build_partitions_index(struct partsfs_table *table, struct partsfs_state *state, int silent)
+{
+        int i;
+
+        /* by_number is the sweep order for now */
+        for (i = 0; i < table->number_of_extents; i++)
+                table->by_number[i] = &table->parts[i];
+        table->number_of_overlap_groups = mark_overlap_groups(table->by_number,
+                                                              table->number_of_extents, 0);
+
+        if (table->number_of_overlap_groups != 0) {
+                if (!silent)
+                        for (i = 0; i < table->number_of_extents; i++)
+                                if (table->parts[i].overlap_group != 0)
+                                        printk(KERN_WARNING "PARTSFS: Partition %d overlaps (group %d)\n",
+                                               table->parts[i].number,
+                                               table->parts[i].overlap_group);
+                if (state->option_overlap == PARTSFS_OVERLAP_REJECT) {
+                        printk(KERN_ERR "PARTSFS: overlapping partitions found, not mounting (overlap=reject)\n");
+                        return -EINVAL;
+                }
+        }
+
+        table->number_of_partitions = 0;
+        for (i = 0; i < table->number_of_extents; i++) {
+                if ((table->parts[i].overlap_group != 0) &&
+                    (state->option_overlap == PARTSFS_OVERLAP_HIDE))
+                        continue;
+                table->by_number[table->number_of_partitions++] = &table->parts[i];
+        }
+        sort(table->by_number, table->number_of_partitions,
+             sizeof(struct partsfs_partition *), cmp_partition_number, NULL);
+        return 0;
+}
+
+static int cmp_interval_from(const void *a, const void *b)
+{
+        const struct partsfs_interval *ia = a;
+        const struct partsfs_interval *ib = b;
+
+        if (ia->from != ib->from)
+                return (ia->from < ib->from) ? -1 : 1;
+        return 0;
+}
+
+/*
+ * Set the max_end of the node of index[lo, hi) and of the nodes below it
+ * Returns the highest end in index[lo, hi), 0 if the range is empty
+ */
+static sector_t build_interval_node(struct partsfs_interval *index, int lo, int hi)
+{
+        int mid = lo + (hi - lo) / 2;
+        sector_t left;
+        sector_t right;
+
+        if (lo >= hi)
+                return 0;
+        left = build_interval_node(index, lo, mid);
+        right = build_interval_node(index, mid + 1, hi);
+        index[mid].max_end = index[mid].end;
+        if (left > index[mid].max_end)
+                index[mid].max_end = left;
+        if (right > index[mid].max_end)
+                index[mid].max_end = right;
+        return index[mid].max_end;
+}
+
+/*
+ * Build the sector indexes of the table (parts is sorted by starting sector):
+ * one of the contiguous partitions, md arrays and mirrors included,
+ * and one of the pieces on bdev of the multi-extent partitions (LDM volumes,
+ * LVM2 logical volumes)
+ */
+static int build_sector_index(struct partsfs_table *table, struct block_device *bdev)
+{
+        int n = 0;
+        int m = 0;
+        int i;
+        int j;
+
+        for (i = 0; i < table->number_of_extents; i++) {
+                struct partsfs_partition *part = &table->parts[i];
+
+                if (part->extents == NULL) {
+                        n++;
+                        continue;
+                }
+                for (j = 0; j < part->nr_extents; j++)
+                        if (part->extents[j].bdev == bdev)
+                                m++;
+        }
+        if (n != 0) {
+                table->index = kcalloc(n, sizeof(struct partsfs_interval), GFP_KERNEL);
+                if (table->index == NULL)
+                        return -ENOMEM;
+        }
+        if (m != 0) {
+                table->extents_index = kcalloc(m, sizeof(struct partsfs_interval), GFP_KERNEL);
+                if (table->extents_index == NULL)
+                        return -ENOMEM;
+        }
+
+        for (i = 0; i < table->number_of_extents; i++) {
+                struct partsfs_partition *part = &table->parts[i];
+                struct partsfs_interval *interval;
+
+                if (part->extents == NULL) {
+                        interval = &table->index[table->index_size++];
+                        interval->from = part->from;
+                        interval->end = part->from + part->size;
+                        interval->part = part;
+                        continue;
+                }
+                for (j = 0; j < part->nr_extents; j++) {
+                        if (part->extents[j].bdev != bdev)
+                                continue;
+                        interval = &table->extents_index[table->extents_index_size++];
+                        interval->from = part->extents[j].from;
+                        interval->end = part->extents[j].from + part->extents[j].size;
+                        interval->part = part;
+                }
+        }
+        /* The pieces are in volume order, not in disk order */
+        sort(table->extents_index, table->extents_index_size,
+             sizeof(struct partsfs_interval), cmp_interval_from, NULL);
+
+        build_interval_node(table->index, 0, table->index_size);
+        build_interval_node(table->extents_index, 0, table->extents_index_size);
+        return 0;
+}
+
+/*
+ * Find the last interval of index[lo, hi) containing sector, among the
+ * ones before index[first] (all of them start at or before the sector,
+ * so they contain it if they end after it)
+ * A range entirely before first is only walked if its max_end says it has
+ * such an interval, so the search follows at most two paths of the tree
+ */
+static struct partsfs_interval *find_interval(struct partsfs_interval *index, int lo, int hi,
+                                              int first, sector_t sector)
+{
+        int mid = lo + (hi - lo) / 2;
+        struct partsfs_interval *found;
+
+        if ((lo >= hi) || (lo >= first))
+                return NULL;
+        if ((hi <= first) && (index[mid].max_end <= sector))
+                return NULL;
+        found = find_interval(index, mid + 1, hi, first, sector);
+        if (found)
+                return found;
+        if ((mid < first) && (index[mid].end > sector))
+                return &index[mid];
+        return find_interval(index, lo, mid, first, sector);
+}
+
+/*
+ * Find the interval of a sector index containing a sector, the one
+ * starting last if more do, in O(log n)
+ */
+static struct partsfs_interval *lookup_sector_index(struct partsfs_interval *index, int size,
+                                                    sector_t sector)
+{
+        int lo = 0;
+        int hi = size;
+
+        /* Find the first interval starting after the sector */
+        while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (index[mid].from <= sector)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return find_interval(index, 0, size, lo, sector);
+}
+
+/*
+ * Find the partition containing a (512-byte) sector of the mounted disk,
+ * in O(log n) (see build_sector_index)
+ * If more partitions contain the sector, returns the one starting last
+ * (multi-extent partitions are only checked if no other partition does)
+ * Returns NULL if no partition contains the sector
+ */
+static struct partsfs_partition *find_sector_owner(struct partsfs_table *table, sector_t sector)
+{
+        struct partsfs_interval *interval;
+
+        interval = lookup_sector_index(table->index, table->index_size, sector);
+        if (interval == NULL)
+                interval = lookup_sector_index(table->extents_index,
+                                               table->extents_index_size, sector);
+        return interval ? interval->part : NULL;
+}
+
+/*
+ * Release the nested partitions of a partition
+ */
+static void free_children(struct partsfs_partition *children, int number_of_children)
+{
+        int i;
+
+        for (i = 0; children && (i < number_of_children); i++) {
+                kfree(children[i].extents);
+                free_percpu(children[i].stats);
+        }
+        kfree(children);
+}
+
+/*
+ * Release a partitions table
+ */
+static void free_table(struct partsfs_table *table)
+{
+        int i;
+
+        if (table == NULL)
+                return;
+        for (i = 0; table->parts && (i < table->number_of_extents); i++) {
+                free_children(table->parts[i].children, table->parts[i].number_of_children);
+                kfree(table->parts[i].extents);
+                free_percpu(table->parts[i].stats);
+        }
+        kfree(table->extents_index);
+        kfree(table->index);
+        kfree(table->by_number);
+        kfree(table->parts);
+        kfree(table);
+}
+
+/*
+ * Free the state, once the superblock and the open stats files are done with it
+ */
+static void partsfs_release_state(struct kref *kref)
+{
+        kfree(container_of(kref, struct partsfs_state, kref));
+}
+
+/*
+ * Release the partitioning information (the state itself is freed
+ * when the last open stats file is closed)
+ */
+static void free_state(struct partsfs_state *state)
+{
+        struct partsfs_table *table;
+        int i;
+
+        if (state == NULL)
+                return;
+        /* The stats files see no table after this */
+        down_write(&state->rescan_sem);
+        table = rcu_dereference_protected(state->table, 1);
+        RCU_INIT_POINTER(state->table, NULL);
+        up_write(&state->rescan_sem);
+        free_table(table);
+        for (i = 0; i < state->number_of_members; i++)
+                blkdev_put(state->members[i], state->member_mode);
+        kfree(state->option_members);
+        kref_put(&state->kref, partsfs_release_state);
+}
+
+/*
+ * Open the other disks of the LDM disk group (ldm_members= option), with
+ * the mode of the mounted one. The volumes find them by the disk GUID in
+ * their PRIVHEAD, the disks can be listed in any order.
+ */
+static int open_member_disks(struct super_block *sb, struct partsfs_state *state)
+{
+#ifdef CONFIG_LDM_PARTITION
+        char *list, *rest, *path;
+        int ret = 0;
+
+        if (state->option_members == NULL)
+                return 0;
+        list = rest = kstrdup(state->option_members, GFP_KERNEL);
+        if (list == NULL)
+                return -ENOMEM;
+        state->member_mode = FMODE_READ | FMODE_EXCL;
+        if (!(sb->s_flags & MS_RDONLY))
+                state->member_mode |= FMODE_WRITE;
+
+        while ((path = strsep(&rest, ":")) != NULL) {
+                int m = state->number_of_members;
+                struct block_device *bdev;
+                u64 start;
+
+                if (*path == '\0')
+                        continue;
+                if (m == PARTSFS_MAX_MEMBERS) {
+                        printk(KERN_ERR "PARTSFS: too many LDM member disks (max %d)\n", PARTSFS_MAX_MEMBERS);
+                        ret = -EINVAL;
+                        break;
+                }
+                bdev = blkdev_get_by_path(path, state->member_mode, &partsfs_fs_type);
+                if (IS_ERR(bdev)) {
+                        printk(KERN_ERR "PARTSFS: can't open LDM member disk %s\n", path);
+                        ret = PTR_ERR(bdev);
+                        break;
+                }
+                state->members[m] = bdev;
+                state->number_of_members++;
+                if (set_blocksize(bdev, state->sector_size) ||
+                    !ldm_member_disk(bdev, state->member_guid[m], &start)) {
+                        printk(KERN_ERR "PARTSFS: %s is not a dynamic disk\n", path);
+                        ret = -EINVAL;
+                        break;
+                }
+                state->member_start[m] = start;
+        }
+        kfree(list);
+        return ret;
+#else
+        if (state->option_members == NULL)
+                return 0;
+        printk(KERN_ERR "PARTSFS: ldm_members= needs LDM support\n");
+        return -EINVAL;
+#endif
+}
+
+/*
+ * Copy the extents of a multi-extent partition (LDM volume) into the table,
+ * with their disk: the mounted one, or the member disk with their GUID
+ * Returns -ENODEV if a member disk is missing
+ */
+static int map_partition_extents(struct partsfs_state *state, struct partsfs_partition *part,
+                                 const struct parsed_partition *parsed)
+{
+        static const u8 local_guid[16]; /* The parsers leave it all zero for the probed disk */
+        struct partsfs_extent *extents;
+        int i, m;
+
+        extents = kcalloc(parsed->nr_extents, sizeof(struct partsfs_extent), GFP_KERNEL);
+        if (extents == NULL)
+                return -ENOMEM;
+        for (i = 0; i < parsed->nr_extents; i++) {
+                const struct partition_extent *extent = &parsed->extents[i];
+
+                extents[i].offset = extent->offset;
+                extents[i].size = extent->size;
+                extents[i].column = extent->column;
+                if (!memcmp(extent->disk_guid, local_guid, sizeof(local_guid))) {
+                        extents[i].from = extent->from;
+                        extents[i].bdev = state->sb->s_bdev;
+                        continue;
+                }
+                for (m = 0; m < state->number_of_members; m++)
+                        if (!memcmp(extent->disk_guid, state->member_guid[m], sizeof(local_guid)))
+                                break;
+                if (m == state->number_of_members) {
+                        kfree(extents);
+                        return -ENODEV;
+                }
+                extents[i].from = state->member_start[m] + extent->from;
+                extents[i].bdev = state->members[m];
+        }
+        part->extents = extents;
+        part->nr_extents = parsed->nr_extents;
+        part->stripe_columns = parsed->stripe_columns;
+        part->stripe_chunk = parsed->stripe_chunk;
+        return 0;
+}
+
+/*
+ * Read the partitions table
+ */
+static struct partsfs_table *read_partitions_table(struct super_block *sb, struct partsfs_state *state,
+                        const struct partition_check_options *opts, int silent) {
+        struct parsed_partitions *partitions;
+        struct partsfs_table *table;
+        struct gendisk *disk;
+        int partno;
+        int p;
+        int i;
+        int ret;
+
+        disk = get_gendisk(sb->s_bdev->bd_dev, &partno);
+        if (!disk) {
+                if (!silent)
+                        printk(KERN_WARNING "PARTSFS: Error getting partition information (get_gendisk failed)\n");
+                return ERR_PTR(-EINVAL);
+        }
+
+        partitions = check_partition(disk, sb->s_bdev, opts);
+        if (IS_ERR(partitions) || partitions == NULL) {
+                if (!silent)
+                        printk(KERN_WARNING "PARTSFS: Error getting partition information (check_partition failed)\n");
+                put_disk(disk);
+                return ERR_PTR(-EINVAL);
+        }
+
+        table = kzalloc(sizeof(struct partsfs_table), GFP_KERNEL);
+        if (!table)
+                goto out_nomem;
+        table->capacity = get_capacity(disk);
+
+        /* Count the partitions */
+        for (p = 1; p < partitions->nr_slots; p++)
+                if (partitions->parts[p].size != 0)
+                        table->number_of_extents++;
+
+        /* Pack the partitions into a dense array, sized to fit */
+        if (table->number_of_extents != 0) {
+                table->parts = kcalloc(table->number_of_extents,
+                                sizeof(struct partsfs_partition), GFP_KERNEL);
+                table->by_number = kcalloc(table->number_of_extents,
+                                sizeof(struct partsfs_partition *), GFP_KERNEL);
+                if (!table->parts || !table->by_number)
+                        goto out_nomem;
+        }
+
+        for (p = 1, i = 0; p < partitions->nr_slots; p++) {
+                if (partitions->parts[p].size != 0) {
+                        if (partitions->parts[p].extents != NULL) {
+                                ret = map_partition_extents(state, &table->parts[i],
+                                                            &partitions->parts[p]);
+                                if (ret == -ENOMEM)
+                                        goto out_nomem;
+                                if (ret) {
+                                        if (!silent)
+                                                printk(KERN_WARNING "PARTSFS: Partition %d is on missing disks, skipped\n", p);
+                                        continue;
+                                }
+                        }
+                        trace_partsfs_partition(sb, p, partitions->parts[p].from,
+                                                partitions->parts[p].size);
+                        table->parts[i].from = partitions->parts[p].from;
+                        table->parts[i].size = partitions->parts[p].size;
+                        table->parts[i].number = p;
+                        table->parts[i].nested = partitions->parts[p].nested;
+                        table->parts[i].nested_type = partitions->parts[p].nested;
+                        table->parts[i].mirrors = partitions->parts[p].mirrors;
+                        table->parts[i].recovered =
+                                (partitions->parts[p].flags & PARTITION_FLAG_RECOVERED) != 0;
+                        table->parts[i].md_array =
+                                (partitions->parts[p].flags & PARTITION_FLAG_MD_ARRAY) != 0;
+                        table->parts[i].stats = alloc_percpu(struct partsfs_stats);
+                        if (table->parts[i].stats == NULL)
+                                goto out_nomem;
+                        table->last_partition = p;
+                        i++;
+                }
+        }
+        table->number_of_extents = i;
+        table->verify = partitions->verify;
+        table->nr_profile = partitions->nr_profile;
+        memcpy(table->profile, partitions->profile,
+               partitions->nr_profile * sizeof(struct probe_profile));
+        table->probe_cached = partitions->cached;
+        put_disk(disk);
+        free_parsed_partitions(partitions);
+
+        /* Sort by starting sector, for the overlap sweep and the sector index */
+        sort(table->parts, table->number_of_extents,
+             sizeof(struct partsfs_partition), cmp_partition_from, NULL);
+
+        /* Build the overlap groups and the partitions index */
+        ret = build_partitions_index(table, state, silent);
+        if (ret) {
+                free_table(table);
+                return ERR_PTR(ret);
+        }
+        if (build_sector_index(table, sb->s_bdev)) {
+                if (!silent)
+                        printk(KERN_WARNING "PARTSFS: Error getting partition information (out of memory)\n");
+                free_table(table);
+                return ERR_PTR(-ENOMEM);
+        }
+        return table;
+
+out_nomem:
+        if (!silent)
+                printk(KERN_WARNING "PARTSFS: Error getting partition information (out of memory)\n");
+        put_disk(disk);
+        free_parsed_partitions(partitions);
+        free_table(table);
+        return ERR_PTR(-ENOMEM);
+}
+
+/*
+ * Deferred verification (verify=deferred): compare the backup copies
+ * of the partition table metadata with the primary ones, the mount
+ * used the primary copies without reading the backups
+ */
+static void partsfs_verify_work(struct work_struct *work)
+{
+        struct partsfs_state *state = container_of(work, struct partsfs_state, verify_work);
+        struct super_block *sb = state->sb;
+        backup_verifier_t verify;
+        int ret;
+
+        down_read(&state->rescan_sem);
+        verify = partsfs_table(sb)->verify;
+        up_read(&state->rescan_sem);
+        if (verify == NULL)
+                return;
+
+        ret = verify_partition_backups(sb->s_bdev, verify);
+        if (ret > 0) {
+                state->verify_status = PARTSFS_VERIFY_OK;
+                printk(KERN_INFO "PARTSFS: %s: backup partition table verified\n", sb->s_id);
+        } else if (ret == 0) {
+                state->verify_status = PARTSFS_VERIFY_MISMATCH;
+                printk(KERN_ERR "PARTSFS: %s: backup partition table doesn't match the primary one\n", sb->s_id);
+        } else {
+                state->verify_status = PARTSFS_VERIFY_ERROR;
+                printk(KERN_ERR "PARTSFS: %s: can't verify the backup partition table (error %d)\n", sb->s_id, ret);
+        }
+}
+
+/*
+ * Start the deferred verification of a (just published) partitions table
+ */
+static void partsfs_queue_verify(struct partsfs_state *state, struct partsfs_table *table)
+{
+        if (table->verify == NULL) {
+                state->verify_status = PARTSFS_VERIFY_NONE;
+                return;
+        }
+        state->verify_status = PARTSFS_VERIFY_PENDING;
+        queue_work(partsfs_probe_wq, &state->verify_work);
+}
+
+/*
+ * Check if a partition can keep its inode (and its cached pages) across a rescan
+ */
+static int partition_unchanged(struct partsfs_state *state,
+                               struct partsfs_partition *old, struct partsfs_partition *new)
+{
+        if (old->from != new->from)
+                return 0;
+        /* A new type of nested table (or none): the old children are wrong */
+        if (old->nested_type != new->nested_type)
+                return 0;
+        if (partition_is_readonly(state, old) != partition_is_readonly(state, new))
+                return 0;
+        if ((old->extents != NULL) || (new->extents != NULL))
+                return (old->extents != NULL) && (new->extents != NULL) &&
+                       (old->nr_extents == new->nr_extents) &&
+                       (old->stripe_columns == new->stripe_columns) &&
+                       (old->stripe_chunk == new->stripe_chunk) &&
+                       (old->mirrors == new->mirrors) &&
+                       !memcmp(old->extents, new->extents,
+                               old->nr_extents * sizeof(struct partsfs_extent));
+        if (old->size == new->size)
+                return 1;
+        /* Resized: fine for a file, not for a directory of nested partitions */
+        return (old->children == NULL) && (new->nested == NULL);
+}
+
+/*
+ * Detach an inode from its partition, after the partition has been
+ * removed or moved: I/O fails, cached pages are dropped and the next
+ * lookup gets a new inode
+ */
+static void invalidate_partition_inode(struct super_block *sb, ino_t inode_number)
+{
+        struct inode *inode = ilookup(sb, inode_number);
+        struct dentry *dentry;
+
+        if (inode == NULL)
+                return;
+        rcu_assign_pointer(inode->i_private, NULL);
+        remove_inode_hash(inode);
+        dentry = d_find_alias(inode);
+        if (dentry) {
+                d_drop(dentry);
+                dput(dentry);
+        }
+        i_size_write(inode, 0);
+        truncate_inode_pages(&inode->i_data, 0);
+        iput(inode);
+}
+
+/*
+ * Forget the negative dentries of the root directory (names looked up
+ * before a rescan, which may exist now), keep the positive ones
+ */
+static void partsfs_drop_negative(struct dentry *root)
+{
+        struct dentry *child;
+
+        spin_lock(&root->d_lock);
+        list_for_each_entry(child, &root->d_subdirs, d_u.d_child) {
+                spin_lock_nested(&child->d_lock, DENTRY_D_LOCK_NESTED);
+                if (child->d_inode == NULL)
+                        __d_drop(child);
+                spin_unlock(&child->d_lock);
+        }
+        spin_unlock(&root->d_lock);
+}
+
+/*
+ * Read the partition table again, and replace the current one
+ * Unchanged partitions keep their inodes and page cache (their inodes are
+ * moved to the new descriptors), resized partitions are resized in place,
+ * removed or moved partitions are detached from their inodes.
+ * The new table is published with RCU, so get_block never waits for a rescan.
+ */
+static int partsfs_rescan(struct super_block *sb)
+{
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct partsfs_table *old;
+        struct partsfs_table *new;
+        int added = 0, removed = 0, resized = 0;
+        int i, j;
+
+        /* Drop the cached partition table sectors, read them from the disk */
+        invalidate_bdev(sb->s_bdev);
+
+        new = read_partitions_table(sb, state, &state->option_check, 1);
+        if (!IS_ERR(new) && new->number_of_partitions == 0) {
+                printk(KERN_WARNING "PARTSFS: rescan: can't find partitions, keeping the old table\n");
+                free_table(new);
+                new = ERR_PTR(-EINVAL);
+        }
+        if (IS_ERR(new)) {
+                state->probe_status = PTR_ERR(new);
+                return PTR_ERR(new);
+        }
+
+        down_write(&state->rescan_sem);
+        old = partsfs_table(sb);
+        state->probe_status = 0;
+
+        /* Move the inodes of unchanged (or resized) partitions to the new table */
+        for (i = 0; i < new->number_of_partitions; i++) {
+                struct partsfs_partition *newp = new->by_number[i];
+                struct partsfs_partition *oldp = find_partition(old, newp->number);
+                struct inode *inode;
+
+                if (oldp == NULL || !partition_unchanged(state, oldp, newp)) {
+                        added++;
+                        continue;
+                }
+                /* Keep the I/O counters (the new ones are freed with the old table) */
+                swap(newp->stats, oldp->stats);
+                if (oldp->size == newp->size) {
+                        /* Keep the nested table, parsed or not */
+                        newp->nested = oldp->nested;
+                        newp->children = oldp->children;
+                        newp->number_of_children = oldp->number_of_children;
+                        oldp->children = NULL;
+                } else {
+                        resized++;
+                }
+
+                inode = ilookup(sb, partition_to_inode_number(newp->number, sb));
+                if (inode == NULL)
+                        continue;
+                rcu_assign_pointer(inode->i_private, newp);
+                if (oldp->size != newp->size) {
+                        loff_t size = (loff_t) newp->size << 9;
+                        i_size_write(inode, size);
+                        if (newp->size < oldp->size)
+                                truncate_inode_pages(&inode->i_data, size);
+                }
+                iput(inode);
+        }
+
+        /* Detach the inodes of removed (or moved) partitions */
+        for (i = 0; i < old->number_of_partitions; i++) {
+                struct partsfs_partition *oldp = old->by_number[i];
+                struct partsfs_partition *newp = find_partition(new, oldp->number);
+
+                if (newp != NULL && partition_unchanged(state, oldp, newp))
+                        continue;
+                removed++;
+                for (j = 0; oldp->children && (j < oldp->number_of_children); j++)
+                        invalidate_partition_inode(sb,
+                                nested_partition_to_inode_number(oldp, oldp->children[j].number));
+                invalidate_partition_inode(sb, partition_to_inode_number(oldp->number, sb));
+        }
+
+        rcu_assign_pointer(state->table, new);
+        sb->s_root->d_inode->i_nlink = new->number_of_partitions + 1;
+        partsfs_queue_verify(state, new);
+        up_write(&state->rescan_sem);
+
+        /*
+         * Forget the cached negative lookups and add the new partitions to
+         * the dcache, the others stay (lookups take the root i_mutex, then
+         * rescan_sem)
+         */
+        mutex_lock(&sb->s_root->d_inode->i_mutex);
+        down_read(&state->rescan_sem);
+        partsfs_drop_negative(sb->s_root);
+        partsfs_populate_root(sb);
+        up_read(&state->rescan_sem);
+        mutex_unlock(&sb->s_root->d_inode->i_mutex);
+
+        /* Wait for get_block callers still using the old descriptors */
+        synchronize_rcu();
+        free_table(old);
+
+        printk(KERN_INFO "PARTSFS: rescan: %d partitions (%d new, %d removed, %d resized)\n",
+               new->number_of_partitions, added, removed, resized);
+        return 0;
+}
+
+/*
+ * Per filesystem sysfs attributes, in /sys/fs/partsfs/<device>
+ */
+struct partsfs_attr {
+        struct attribute attr;
+        ssize_t (*show)(struct partsfs_state *state, char *buf);
+};
+
+static ssize_t verify_show(struct partsfs_state *state, char *buf)
+{
+        static const char * const status[] = {
+                [PARTSFS_VERIFY_NONE]     = "none",
+                [PARTSFS_VERIFY_PENDING]  = "pending",
+                [PARTSFS_VERIFY_OK]       = "ok",
+                [PARTSFS_VERIFY_MISMATCH] = "mismatch",
+                [PARTSFS_VERIFY_ERROR]    = "error",
+        };
+        return snprintf(buf, PAGE_SIZE, "%s\n", status[state->verify_status]);
+}
+
+static struct partsfs_attr partsfs_attr_verify = {
+        .attr = { .name = "verify", .mode = 0444 },
+        .show = verify_show,
+};
+
+/*
+ * State of the partitions probe: pending (scan=async, not done yet), ok,
+ * or the error of the background probe or of the last rescan
  */
-static struct dentry *partsfs_lookup(struct inode *dir, struct dentry *dentry,
-                                 struct nameidata *nd)
+static ssize_t probe_show(struct partsfs_state *state, char *buf)
 {
-        struct super_block *sb = dentry->d_sb;
-        int partition_number = simple_strtol(dentry->d_name.name, NULL, 0);
+        int status = ACCESS_ONCE(state->probe_status);
 
-        if (check_partition_number(partition_number, sb)) {
-            int inode_number = partition_to_inode_number(partition_number, sb);
-                struct inode *inode = partsfs_get_inode(sb, inode_number);
-                d_add(dentry, inode);
-                return ERR_PTR(0);
-        } else {
-                return ERR_PTR(-ENOENT);
-        }
+        if (!completion_done(&state->probe_done))
+                return snprintf(buf, PAGE_SIZE, "pending\n");
+        if (status)
+                return snprintf(buf, PAGE_SIZE, "error %d\n", status);
+        return snprintf(buf, PAGE_SIZE, "ok\n");
 }
 
+static struct partsfs_attr partsfs_attr_probe = {
+        .attr = { .name = "probe", .mode = 0444 },
+        .show = probe_show,
+};
+
 /*
- * Map a file position (iblock) to a disk offset (passed back in bh_result)
+ * Cost of the probe that read the current table, one line per format
+ * tried (see partitions/profile.c), and the total
  */
-static int get_block(struct inode *inode, sector_t iblock,
-                     struct buffer_head *bh_result, int create)
+static ssize_t probe_profile_show(struct partsfs_state *state, char *buf)
 {
-        struct partsfs_state *state = (struct partsfs_state *) inode->i_sb->s_fs_info;
-        loff_t disk_offset;
+        struct partsfs_table *table;
+        struct probe_profile total;
+        ssize_t len = 0;
+        int i;
 
-        /* Get the partition number */
-        int partition_number = inode_number_to_partition(inode->i_ino, inode->i_sb);
-        if (partition_number < 0)
-                return -ENOENT;
+        memset(&total, 0, sizeof(total));
+        down_read(&state->rescan_sem);
+        table = partsfs_table(state->sb);
+        if (table->probe_cached)
+                len += snprintf(buf + len, PAGE_SIZE - len, "cached\n");
+        for (i = 0; i < table->nr_profile; i++) {
+                struct probe_profile *p = &table->profile[i];
+                len += snprintf(buf + len, PAGE_SIZE - len,
+                                "%s res %d us %llu reads %u sectors %u alloc_bytes %lu\n",
+                                probe_profile_name(p->format), p->res,
+                                (unsigned long long)p->ns / NSEC_PER_USEC,
+                                p->reads, p->sectors, p->alloc_bytes);
+                total.ns += p->ns;
+                total.reads += p->reads;
+                total.sectors += p->sectors;
+                total.alloc_bytes += p->alloc_bytes;
+        }
+        up_read(&state->rescan_sem);
+        len += snprintf(buf + len, PAGE_SIZE - len,
+                        "total us %llu reads %u sectors %u alloc_bytes %lu\n",
+                        (unsigned long long)total.ns / NSEC_PER_USEC,
+                        total.reads, total.sectors, total.alloc_bytes);
+        return len;
+}
 
-        /* Check the offset */
-        if (create && (iblock >= state->parts[partition_number].size))
-                return -ENOSPC; /* No space left on device */
+static struct partsfs_attr partsfs_attr_probe_profile = {
+        .attr = { .name = "probe_profile", .mode = 0444 },
+        .show = probe_profile_show,
+};
 
-        if ((iblock < 0) || (iblock >= state->parts[partition_number].size))
-                return -ESPIPE; /* Illegal seek */
+static struct attribute *partsfs_attrs[] = {
+        &partsfs_attr_verify.attr,
+        &partsfs_attr_probe.attr,
+        &partsfs_attr_probe_profile.attr,
+        NULL,
+};
 
-        /* Get the disk offset */
-        disk_offset = state->parts[partition_number].from + iblock;
-        map_bh(bh_result, inode->i_sb, disk_offset);
-        return 0;
+static ssize_t partsfs_attr_show(struct kobject *kobj, struct attribute *attr, char *buf)
+{
+        struct partsfs_state *state = container_of(kobj, struct partsfs_state, kobj);
+        struct partsfs_attr *a = container_of(attr, struct partsfs_attr, attr);
+        return a->show(state, buf);
 }
 
-static int partsfs_writepage(struct page *page, struct writeback_control *wbc)
+static const struct sysfs_ops partsfs_attr_ops = {
+        .show = partsfs_attr_show,
+};
+
+static void partsfs_kobj_release(struct kobject *kobj)
 {
-        return block_write_full_page(page, get_block, wbc);
+        struct partsfs_state *state = container_of(kobj, struct partsfs_state, kobj);
+        complete(&state->kobj_unregister);
 }
 
-static int partsfs_readpage(struct file *file, struct page *page)
+static struct kobj_type partsfs_ktype = {
+        .default_attrs = partsfs_attrs,
+        .sysfs_ops = &partsfs_attr_ops,
+        .release = partsfs_kobj_release,
+};
+
+/*
+ * Add /sys/fs/partsfs/<device>
+ */
+static int partsfs_register_sysfs(struct super_block *sb)
 {
-        return block_read_full_page(page, get_block);
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+
+        state->kobj.kset = partsfs_kset;
+        init_completion(&state->kobj_unregister);
+        return kobject_init_and_add(&state->kobj, &partsfs_ktype, NULL, "%s", sb->s_id);
 }
 
-static sector_t partsfs_bmap(struct address_space *mapping, sector_t block)
+/*
+ * Remove /sys/fs/partsfs/<device>, and wait until nobody uses it
+ */
+static void partsfs_unregister_sysfs(struct partsfs_state *state)
 {
-        return generic_block_bmap(mapping, block, get_block);
+        if (!state->kobj.state_initialized)
+                return;
+        kobject_put(&state->kobj);
+        wait_for_completion(&state->kobj_unregister);
 }
 
-static int partsfs_write_begin(struct file *file, struct address_space *mapping,
-                           loff_t pos, unsigned len, unsigned flags,
-                           struct page **pagep, void **fsdata)
+/*
+ * Print the counters of a partition, summed over the CPUs
+ * (the page cache hits are counted by read(), the misses by readpage)
+ */
+static void partsfs_stats_show_partition(struct seq_file *m, struct partsfs_partition *part)
 {
-        int ret = block_write_begin(mapping, pos, len, flags, pagep, get_block);
-        if (unlikely(ret)) {
-                loff_t isize = mapping->host->i_size;
-                if (pos + len > isize)
-                        vmtruncate(mapping->host, isize);
+        unsigned long long count[PARTSFS_STAT_ITEMS];
+        unsigned long long latency[PARTSFS_LATENCY_BUCKETS];
+        int cpu;
+        int i;
+
+        memset(count, 0, sizeof(count));
+        memset(latency, 0, sizeof(latency));
+        for_each_possible_cpu(cpu) {
+                struct partsfs_stats *stats = per_cpu_ptr(part->stats, cpu);
+                for (i = 0; i < PARTSFS_STAT_ITEMS; i++)
+                        count[i] += stats->count[i];
+                for (i = 0; i < PARTSFS_LATENCY_BUCKETS; i++)
+                        latency[i] += stats->latency[i];
         }
-        return ret;
+        seq_printf(m, " read_ops %llu read_bytes %llu cache_hits %llu cache_misses %llu"
+                   " write_ops %llu write_bytes %llu writeback_pages %llu map_calls %llu"
+                   " latency_us",
+                   count[PARTSFS_STAT_READ_OPS], count[PARTSFS_STAT_READ_BYTES],
+                   count[PARTSFS_STAT_CACHE_HITS], count[PARTSFS_STAT_CACHE_MISSES],
+                   count[PARTSFS_STAT_WRITE_OPS], count[PARTSFS_STAT_WRITE_BYTES],
+                   count[PARTSFS_STAT_WRITEBACK_PAGES], count[PARTSFS_STAT_MAP_CALLS]);
+        for (i = 0; i < PARTSFS_LATENCY_BUCKETS; i++)
+                seq_printf(m, " %llu", latency[i]);
+        seq_putc(m, '\n');
 }
 
-static void partsfs_init_inode(struct inode *inode, struct super_block *sb, ino_t inode_number)
+/*
+ * <debugfs>/partsfs/<device>/stats: one line per partition file,
+ * <partition>/<nested partition> for the nested ones
+ */
+static int partsfs_stats_show(struct seq_file *m, void *v)
 {
-        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
-        inode->i_mtime = inode->i_atime = inode->i_ctime = CURRENT_TIME;
-        inode->i_uid = state->option_uid;
-        inode->i_gid = state->option_gid;
+        struct partsfs_state *state = m->private;
+        struct partsfs_table *table;
+        int i, j;
 
-        if (inode_number == PARTSFS_ROOT_DIR_INODE) { /* root directory */
-                /* set_nlink(inode, state->number_of_partitions + 1); */
-                inode->i_nlink = state->number_of_partitions + 1;
-                inode->i_size = 0;
-                inode->i_mode = S_IFDIR | PARTSFS_DEFAULT_DIR_MODE;
-                inode->i_op = &partsfs_dir_inode_operations;
-                inode->i_fop = &partsfs_dir_operations;
-        } else { /* partition file */
-                int partition_number = inode_number_to_partition(inode_number, sb);
-                /* set_nlink(inode, 1); */
-                inode->i_nlink = 1;
-                inode->i_size = state->parts[partition_number].size * state->sector_size;
-                inode->i_mode = S_IFREG | state->option_mode;
-                inode->i_fop = &partsfs_file_operations;
-                inode->i_data.a_ops = &partsfs_file_aops;
+        down_read(&state->rescan_sem);
+        /* NULL once unmounted (see free_state), the file is then empty */
+        table = rcu_dereference_protected(state->table, 1);
+        for (i = 0; table && i < table->number_of_partitions; i++) {
+                struct partsfs_partition *part = table->by_number[i];
+                struct partsfs_partition *children = ACCESS_ONCE(part->children);
+
+                if (children == NULL) {
+                        seq_printf(m, "%d", part->number);
+                        partsfs_stats_show_partition(m, part);
+                        continue;
+                }
+                smp_rmb(); /* see partsfs_parse_nested */
+                for (j = 0; j < part->number_of_children; j++) {
+                        seq_printf(m, "%d/%d", part->number, children[j].number);
+                        partsfs_stats_show_partition(m, &children[j]);
+                }
         }
+        up_read(&state->rescan_sem);
+        return 0;
+}
 
-        unlock_new_inode(inode);
+/*
+ * Debugfs does not wait for the open files when the stats file is
+ * removed: the open file holds a reference to the state, taken unless
+ * partsfs_unregister_debugfs already cleared i_private
+ */
+static int partsfs_stats_open(struct inode *inode, struct file *file)
+{
+        struct partsfs_state *state;
+        int ret;
+
+        mutex_lock(&partsfs_stats_mutex);
+        state = inode->i_private;
+        if (state)
+                kref_get(&state->kref);
+        mutex_unlock(&partsfs_stats_mutex);
+        if (state == NULL)
+                return -ENODEV;
+        ret = single_open(file, partsfs_stats_show, state);
+        if (ret)
+                kref_put(&state->kref, partsfs_release_state);
+        return ret;
 }
 
-static struct inode *partsfs_get_inode(struct super_block *sb, ino_t inode_number)
+static int partsfs_stats_release(struct inode *inode, struct file *file)
 {
-        struct inode *inode = iget_locked(sb, inode_number);
-        if (inode && (inode->i_state & I_NEW))
-                partsfs_init_inode(inode, sb, inode_number);
-        return inode;
+        struct partsfs_state *state = ((struct seq_file *) file->private_data)->private;
+
+        single_release(inode, file);
+        kref_put(&state->kref, partsfs_release_state);
+        return 0;
 }
 
+static const struct file_operations partsfs_stats_fops = {
+        .owner          = THIS_MODULE,
+        .open           = partsfs_stats_open,
+        .read           = seq_read,
+        .llseek         = seq_lseek,
+        .release        = partsfs_stats_release,
+};
+
 /*
- * Get filesystem statistics
+ * Add <debugfs>/partsfs/<device> (optional, the filesystem works without it)
  */
-static int partsfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+static void partsfs_register_debugfs(struct partsfs_state *state)
 {
-        struct super_block *sb = dentry->d_sb;
-        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
-        u64 id = huge_encode_dev(sb->s_bdev->bd_dev);
-
-        buf->f_type = PARTSFS_MAGIC;
-        buf->f_namelen = PARTSFS_MAX_NAME_LENGTH;
-        buf->f_bsize = state->sector_size;
-        buf->f_bfree = buf->f_bavail = buf->f_ffree = 0;
-        buf->f_blocks = state->capacity;
-        buf->f_files = state->number_of_partitions + 1;
-        buf->f_fsid.val[0] = (u32)id;
-        buf->f_fsid.val[1] = (u32)(id >> 32);
-        return 0;
+        if (IS_ERR_OR_NULL(partsfs_debugfs))
+                return;
+        state->debugfs = debugfs_create_dir(state->sb->s_id, partsfs_debugfs);
+        if (IS_ERR_OR_NULL(state->debugfs)) {
+                state->debugfs = NULL;
+                return;
+        }
+        state->debugfs_stats = debugfs_create_file("stats", 0400, state->debugfs,
+                                                   state, &partsfs_stats_fops);
+        if (IS_ERR(state->debugfs_stats))
+                state->debugfs_stats = NULL;
 }
 
 /*
- * Get partitioning information
+ * Remove <debugfs>/partsfs/<device>: a stats file opened from now on
+ * fails, the ones already open keep the state until they are closed
  */
-static struct partsfs_state *get_partitions_info(struct super_block *sb, int silent) {
-        struct parsed_partitions *partitions;
-        struct gendisk *disk;
-        struct partsfs_state *state;
-        int partno;
-        int p;
+static void partsfs_unregister_debugfs(struct partsfs_state *state)
+{
+        mutex_lock(&partsfs_stats_mutex);
+        if (state->debugfs_stats)
+                state->debugfs_stats->d_inode->i_private = NULL;
+        mutex_unlock(&partsfs_stats_mutex);
+        debugfs_remove_recursive(state->debugfs);
+}
 
-        disk = get_gendisk(sb->s_bdev->bd_dev, &partno);
-        if (!disk) {
-                if (!silent)
-                        printk(KERN_WARNING "PARTSFS: Error getting partition information (get_gendisk failed)\n");
-                return NULL;
-        }
+/*
+ * Background probe (scan=async): replace the primary table
+ * read at mount time with the full one
+ */
+static void partsfs_probe_work(struct work_struct *work)
+{
+        struct partsfs_state *state = container_of(work, struct partsfs_state, probe_work);
+        int ret;
 
-        state = kzalloc(sizeof(struct partsfs_state), GFP_KERNEL);
-        partitions = check_partition(disk, sb->s_bdev);
-        if (IS_ERR(partitions) || partitions == NULL) {
-                if (!silent)
-                        printk(KERN_WARNING "PARTSFS: Error getting partition information (check_partition failed)\n");
-                return NULL;
-        }
+        ret = partsfs_rescan(state->sb);
+        if (ret && partsfs_table(state->sb)->number_of_partitions)
+                printk(KERN_WARNING "PARTSFS: background probe failed (error %d), keeping the primary partitions\n", ret);
+        else if (ret)
+                printk(KERN_WARNING "PARTSFS: background probe failed (error %d), no partitions\n", ret);
+        complete_all(&state->probe_done);
+}
 
-        state->sector_size = bdev_logical_block_size(sb->s_bdev);
-        state->capacity = get_capacity(disk);
-        sb_set_blocksize(sb, state->sector_size);
-        put_disk(disk);
+/*
+ * Quick probe for scan=async: the primary table only, or nothing
+ * (empty table) if the disk has no DOS primary table
+ */
+static struct partsfs_table *read_primary_table(struct super_block *sb, struct partsfs_state *state)
+{
+        struct partition_check_options opts = state->option_check;
+        struct partsfs_table *table;
 
-        /* Count the partitions */
-        state->number_of_partitions = 0;
-        state->last_partition = 0;
-        for (p = 1; p < partitions->limit; p++) {
-                if (partitions->parts[p].size != 0) {
-                        if (!silent)
-                                printk(KERN_WARNING "PARTSFS: Partition %d start: %llu size: %llu\n",
-                                p,
-                                (unsigned long long)partitions->parts[p].from,
-                                (unsigned long long)partitions->parts[p].size * state->sector_size);
-                        state->parts[p].from = partitions->parts[p].from;
-                        state->parts[p].size = partitions->parts[p].size;
-                        state->number_of_partitions++;
-                        state->last_partition = p;
-                }
-        }
-        kfree(partitions);
-        return state;
+        opts.primary_only = true;
+        table = read_partitions_table(sb, state, &opts, 1);
+        if (!IS_ERR(table))
+                return table;
+        table = kzalloc(sizeof(struct partsfs_table), GFP_KERNEL);
+        if (!table)
+                return ERR_PTR(-ENOMEM);
+        table->capacity = get_capacity(sb->s_bdev->bd_disk);
+        return table;
 }
 
 /*
@@ -302,57 +1986,140 @@ static int partsfs_fill_super(struct super_block *sb, void *data, int silent)
 {
         struct inode *root;
         struct partsfs_state *state;
+        struct partsfs_table *table;
 
-        /* Get partitioning information */
-        state = get_partitions_info(sb, silent);
+        state = kzalloc(sizeof(struct partsfs_state), GFP_KERNEL);
         if (state == NULL)
-                return -EINVAL;
+                return -ENOMEM;
+        state->sb = sb;
+        kref_init(&state->kref);
+        init_rwsem(&state->rescan_sem);
+        mutex_init(&state->nested_mutex);
+        INIT_WORK(&state->probe_work, partsfs_probe_work);
+        INIT_WORK(&state->verify_work, partsfs_verify_work);
+        init_completion(&state->probe_done);
 
-        /* Parse mount options */
+        /* Parse mount options (before probing, they can change how partitions are parsed) */
         if (parse_options((char *)data, state)) {
                 printk(KERN_ERR "PARTSFS: unable to parse mount options.\n");
-                kfree(state);
+                free_state(state);
+                return -EINVAL;
+        }
+
+        state->sector_size = bdev_logical_block_size(sb->s_bdev);
+        state->sector_shift = ilog2(state->sector_size) - 9;
+        sb_set_blocksize(sb, state->sector_size);
+
+        /* The other disks of the LDM disk group, before probing */
+        if (open_member_disks(sb, state)) {
+                free_state(state);
                 return -EINVAL;
         }
 
+        /* Get partitioning information (with scan=async, only the primary table for now) */
+        if (state->option_async_scan)
+                table = read_primary_table(sb, state);
+        else
+                table = read_partitions_table(sb, state, &state->option_check, silent);
+        if (IS_ERR(table)) {
+                free_state(state);
+                return -EINVAL;
+        }
+        RCU_INIT_POINTER(state->table, table);
+
         /* Check the partitions number */
-        if (state->number_of_partitions == 0) {
+        if (table->number_of_partitions == 0 && !state->option_async_scan) {
                 if (!silent)
                         printk(KERN_WARNING "PARTSFS: Can't find partitions\n");
-                kfree(state);
+                free_state(state);
                 return -EINVAL;
         }
 
         /* Fill the superblock */
         sb->s_fs_info = state;
-        sb->s_maxbytes = 0xFFFFFFFF;
+        sb->s_maxbytes = MAX_LFS_FILESIZE;
         sb->s_magic = PARTSFS_MAGIC;
         sb->s_flags |= MS_NOATIME; /* Do not update access times */
         sb->s_op = &partsfs_super_ops;
 
         root = partsfs_get_inode(sb, PARTSFS_ROOT_DIR_INODE);
-        if (IS_ERR(root)) {
-                kfree(state);
-                return -EINVAL;
-        }
+        if (IS_ERR_OR_NULL(root))
+                return -EINVAL; /* state is released by partsfs_kill_sb */
 
         sb->s_root = d_alloc_root(root);
         if (!sb->s_root) {
                 iput(root);
-                kfree(state);
                 return -EINVAL;
         }
 
+        /* Prepopulate the dcache (not fatal if it fails, lookup fills the gaps) */
+        partsfs_populate_root(sb);
+
+        /* /sys/fs/partsfs/<device> */
+        if (partsfs_register_sysfs(sb)) {
+                printk(KERN_ERR "PARTSFS: can't register %s in sysfs\n", sb->s_id);
+                return -ENOMEM;
+        }
+
+        /* <debugfs>/partsfs/<device> */
+        partsfs_register_debugfs(state);
+
+        /* Start the background probe, or mark the table as complete */
+        if (state->option_async_scan) {
+                queue_work(partsfs_probe_wq, &state->probe_work);
+        } else {
+                complete_all(&state->probe_done);
+                partsfs_queue_verify(state, table);
+        }
         return 0;
 }
 
+/*
+ * Remount: read the partition table again
+ * Mount options can't be changed, a remount with different ones fails.
+ * A remount that only switches between read-only and read-write (such as
+ * the emergency remount) does not read the table.
+ */
+static int partsfs_remount(struct super_block *sb, int *flags, char *data)
+{
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct partsfs_state *options;
+        int ret;
+
+        if (data != NULL && *data != '\0') {
+                options = kzalloc(sizeof(struct partsfs_state), GFP_KERNEL);
+                if (options == NULL)
+                        return -ENOMEM;
+                ret = parse_options(data, options);
+                if (!ret && !same_options(state, options)) {
+                        printk(KERN_ERR "PARTSFS: mount options can't be changed on remount\n");
+                        ret = -EINVAL;
+                }
+                kfree(options->option_members);
+                kfree(options);
+                if (ret)
+                        return ret;
+        }
+
+        if ((*flags ^ sb->s_flags) & MS_RDONLY)
+                return 0;
+        if (partsfs_wait_probe(sb))
+                return -EINTR;
+        return partsfs_rescan(sb);
+}
+
 /*
  * Get a superblock for mounting
  */
 static struct dentry *partsfs_mount(struct file_system_type *fs_type,
                                 int flags, const char *dev_name, void *data)
 {
-        return mount_bdev(fs_type, flags, dev_name, data, partsfs_fill_super);
+        struct dentry *root;
+
+        trace_partsfs_mount_start(dev_name);
+        root = mount_bdev(fs_type, flags, dev_name, data, partsfs_fill_super);
+        trace_partsfs_mount_end(dev_name, IS_ERR(root) ? PTR_ERR(root) : 0);
+        return root;
 }
 
 /*
@@ -360,8 +2127,17 @@ static struct dentry *partsfs_mount(struct file_system_type *fs_type,
  */
 static void partsfs_kill_sb(struct super_block *sb)
 {
-        kfree(sb->s_fs_info);
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        /* Stop the background probe and verification before the superblock goes away */
+        if (state) {
+                cancel_work_sync(&state->probe_work);
+                cancel_work_sync(&state->verify_work);
+                partsfs_unregister_debugfs(state);
+                partsfs_unregister_sysfs(state);
+        }
+        /* Pages are written back by kill_block_super, free the state after */
         kill_block_super(sb);
+        free_state(state);
 }
 
 /*
@@ -369,9 +2145,35 @@ static void partsfs_kill_sb(struct super_block *sb)
  */
 static int __init init_partsfs_fs(void)
 {
-        int ret = register_filesystem(&partsfs_fs_type);
+        int ret;
+
+#ifdef CONFIG_PARTSFS_SELFTEST
+        if (selftest) {
+                ret = partitions_selftest(selftest_bench);
+                if (ret)
+                        return ret;
+        }
+#endif
+        /* Unbound: the probes of many filesystems run in parallel */
+        partsfs_probe_wq = alloc_workqueue("partsfs_probe", WQ_UNBOUND, 0);
+        if (!partsfs_probe_wq)
+                return -ENOMEM;
+        partsfs_kset = kset_create_and_add("partsfs", NULL, fs_kobj);
+        if (!partsfs_kset) {
+                destroy_workqueue(partsfs_probe_wq);
+                return -ENOMEM;
+        }
+        partsfs_debugfs = debugfs_create_dir("partsfs", NULL); /* optional */
+        probe_cache_init(partsfs_debugfs);
+        probe_profile_init(partsfs_debugfs);
+        ret = register_filesystem(&partsfs_fs_type);
         if (ret) {
                 printk(KERN_ERR "PARTSFS: Cannot register file system (error %d)\n", ret);
+                probe_profile_exit();
+                probe_cache_exit();
+                debugfs_remove_recursive(partsfs_debugfs);
+                kset_unregister(partsfs_kset);
+                destroy_workqueue(partsfs_probe_wq);
                 return ret;
         }
         return 0;
@@ -383,6 +2185,11 @@ static int __init init_partsfs_fs(void)
 static void __exit exit_partsfs_fs(void)
 {
         unregister_filesystem(&partsfs_fs_type);
+        probe_profile_exit();
+        probe_cache_exit();
+        debugfs_remove_recursive(partsfs_debugfs);
+        kset_unregister(partsfs_kset);
+        destroy_workqueue(partsfs_probe_wq);
 }
 
 
@@ -390,6 +2197,28 @@ enum {
         opt_uid,
         opt_gid,
         opt_mode,
+        opt_overlap_allow,
+        opt_overlap_readonly,
+        opt_overlap_hide,
+        opt_overlap_reject,
+        opt_nested_lazy,
+        opt_nested_flat,
+        opt_scan_sync,
+        opt_scan_async,
+        opt_verify_sync,
+        opt_verify_deferred,
+        opt_cache_off,
+        opt_cache_on,
+        opt_probe,
+        opt_probe_sectors,
+        opt_probe_time,
+        opt_ldm_partitions,
+        opt_ldm_volumes,
+        opt_ldm_members,
+        opt_md_off,
+        opt_md_arrays,
+        opt_recover_off,
+        opt_recover_scan,
         opt_err
 };
 
@@ -397,21 +2226,98 @@ static const match_table_t tokens = {
         { opt_uid, "uid=%u" },
         { opt_gid, "gid=%u" },
         { opt_mode, "mode=%o" },
+        { opt_overlap_allow, "overlap=allow" },
+        { opt_overlap_readonly, "overlap=ro" },
+        { opt_overlap_hide, "overlap=hide" },
+        { opt_overlap_reject, "overlap=reject" },
+        { opt_nested_lazy, "nested=lazy" },
+        { opt_nested_flat, "nested=flat" },
+        { opt_scan_sync, "scan=sync" },
+        { opt_scan_async, "scan=async" },
+        { opt_verify_sync, "verify=sync" },
+        { opt_verify_deferred, "verify=deferred" },
+        { opt_cache_off, "cache=off" },
+        { opt_cache_on, "cache=on" },
+        { opt_probe, "probe=%s" },
+        { opt_probe_sectors, "probe_sectors=%u" },
+        { opt_probe_time, "probe_time=%u" },
+        { opt_ldm_partitions, "ldm=partitions" },
+        { opt_ldm_volumes, "ldm=volumes" },
+        { opt_ldm_members, "ldm_members=%s" },
+        { opt_md_off, "md=off" },
+        { opt_md_arrays, "md=arrays" },
+        { opt_recover_off, "recover=off" },
+        { opt_recover_scan, "recover=scan" },
         { opt_err, NULL }
 };
 
 /*
- * Parse the mount options (uid, gid and mode)
+ * Add a format to the probe= list ("fast" enables the fast path)
+ */
+static int add_probe_format(struct partition_check_options *opts, const char *name)
+{
+        int format;
+        int i;
+
+        if (!strcmp(name, "fast")) {
+                opts->probe_fast = true;
+                return 0;
+        }
+        format = partition_format_find(name);
+        if (format < 0) {
+                printk(KERN_ERR "PARTSFS: unknown partition format %s\n", name);
+                return -EINVAL;
+        }
+        for (i = 0; i < opts->nr_probes; i++)
+                if (opts->probes[i] == format)
+                        return 0;
+        if (opts->nr_probes == PARTITION_FORMATS_MAX)
+                return -EINVAL;
+        opts->probes[opts->nr_probes++] = format;
+        return 0;
+}
+
+/*
+ * Parse the probe= list: formats separated by ':'
+ * (or by ',', see parse_options)
+ */
+static int parse_probe_list(struct partition_check_options *opts, char *list)
+{
+        char *name;
+
+        opts->probe_fast = false;
+        opts->nr_probes = 0;
+        while ((name = strsep(&list, ":")) != NULL)
+                if (*name != '\0' && add_probe_format(opts, name))
+                        return -EINVAL;
+        return 0;
+}
+
+/*
+ * Parse the mount options
  */
 static int parse_options(char *options, struct partsfs_state *state)
 {
         char *p;
         substring_t args[MAX_OPT_ARGS];
+        int in_probe_list = 0;
 
         /* Initialize the options defaults values */
         state->option_uid = current_uid();
         state->option_gid = current_gid();
         state->option_mode = PARTSFS_DEFAULT_FILE_MODE;
+        state->option_overlap = PARTSFS_OVERLAP_ALLOW;
+        state->option_check.flat_nested = false;
+        state->option_async_scan = false;
+        state->option_check.defer_verify = false;
+        state->option_check.use_cache = false;
+        state->option_check.probe_fast = false;
+        state->option_check.nr_probes = 0;
+        state->option_check.max_sectors = 0;
+        state->option_check.max_msecs = 0;
+        state->option_check.ldm_volumes = false;
+        state->option_check.md_arrays = false;
+        state->option_check.recover_scan = false;
 
         if (!options)
                 return 0;
@@ -424,6 +2330,15 @@ static int parse_options(char *options, struct partsfs_state *state)
                         continue;
 
                 token = match_token(p, tokens, args);
+
+                /* probe=gpt,msdos: the names after probe= continue the list */
+                if (token == opt_err && in_probe_list) {
+                        if (add_probe_format(&state->option_check, p))
+                                return -EINVAL;
+                        continue;
+                }
+                in_probe_list = 0;
+
                 switch (token) {
                 case opt_uid:
                         if (match_int(&args[0], &value)) {
@@ -446,14 +2361,130 @@ static int parse_options(char *options, struct partsfs_state *state)
                         }
                         state->option_mode = (umode_t)value & 0666;
                         break;
+                case opt_overlap_allow:
+                        state->option_overlap = PARTSFS_OVERLAP_ALLOW;
+                        break;
+                case opt_overlap_readonly:
+                        state->option_overlap = PARTSFS_OVERLAP_READONLY;
+                        break;
+                case opt_overlap_hide:
+                        state->option_overlap = PARTSFS_OVERLAP_HIDE;
+                        break;
+                case opt_overlap_reject:
+                        state->option_overlap = PARTSFS_OVERLAP_REJECT;
+                        break;
+                case opt_nested_lazy:
+                        state->option_check.flat_nested = false;
+                        break;
+                case opt_nested_flat:
+                        state->option_check.flat_nested = true;
+                        break;
+                case opt_scan_sync:
+                        state->option_async_scan = false;
+                        break;
+                case opt_scan_async:
+                        state->option_async_scan = true;
+                        break;
+                case opt_verify_sync:
+                        state->option_check.defer_verify = false;
+                        break;
+                case opt_verify_deferred:
+                        state->option_check.defer_verify = true;
+                        break;
+                case opt_cache_off:
+                        state->option_check.use_cache = false;
+                        break;
+                case opt_cache_on:
+                        state->option_check.use_cache = true;
+                        break;
+                case opt_probe:
+                        if (parse_probe_list(&state->option_check, args[0].from))
+                                return -EINVAL;
+                        in_probe_list = 1;
+                        break;
+                case opt_probe_sectors:
+                        if (match_int(&args[0], &value) || value < 0) {
+                                printk(KERN_ERR "PARTSFS: probe_sectors mount option requires an argument\n");
+                                return -EINVAL;
+                        }
+                        state->option_check.max_sectors = value;
+                        break;
+                case opt_probe_time:
+                        if (match_int(&args[0], &value) || value < 0) {
+                                printk(KERN_ERR "PARTSFS: probe_time mount option requires an argument\n");
+                                return -EINVAL;
+                        }
+                        state->option_check.max_msecs = value;
+                        break;
+                case opt_ldm_partitions:
+                        state->option_check.ldm_volumes = false;
+                        break;
+                case opt_ldm_volumes:
+                        state->option_check.ldm_volumes = true;
+                        break;
+                case opt_ldm_members:
+                        kfree(state->option_members);
+                        state->option_members = match_strdup(&args[0]);
+                        if (state->option_members == NULL)
+                                return -ENOMEM;
+                        break;
+                case opt_md_off:
+                        state->option_check.md_arrays = false;
+                        break;
+                case opt_md_arrays:
+                        state->option_check.md_arrays = true;
+                        break;
+                case opt_recover_off:
+                        state->option_check.recover_scan = false;
+                        break;
+                case opt_recover_scan:
+                        state->option_check.recover_scan = true;
+                        break;
                 default:
                         return -EINVAL;
                 }
         }
 
+        /* Volumes on other disks only make sense with ldm=volumes */
+        if (state->option_members && !state->option_check.ldm_volumes) {
+                printk(KERN_ERR "PARTSFS: ldm_members= requires ldm=volumes\n");
+                return -EINVAL;
+        }
+        state->option_check.ldm_all_disks = (state->option_members != NULL);
         return 0;
 }
 
+/*
+ * Compare the mount options of two states (remount)
+ */
+static bool same_options(const struct partsfs_state *a, const struct partsfs_state *b)
+{
+        const struct partition_check_options *ca = &a->option_check;
+        const struct partition_check_options *cb = &b->option_check;
+
+        if (a->option_uid != b->option_uid ||
+            a->option_gid != b->option_gid ||
+            a->option_mode != b->option_mode ||
+            a->option_overlap != b->option_overlap ||
+            a->option_async_scan != b->option_async_scan)
+                return false;
+        if ((a->option_members == NULL) != (b->option_members == NULL) ||
+            (a->option_members && strcmp(a->option_members, b->option_members)))
+                return false;
+        if (ca->flat_nested != cb->flat_nested ||
+            ca->defer_verify != cb->defer_verify ||
+            ca->use_cache != cb->use_cache ||
+            ca->probe_fast != cb->probe_fast ||
+            ca->ldm_volumes != cb->ldm_volumes ||
+            ca->md_arrays != cb->md_arrays ||
+            ca->recover_scan != cb->recover_scan ||
+            ca->max_sectors != cb->max_sectors ||
+            ca->max_msecs != cb->max_msecs ||
+            ca->nr_probes != cb->nr_probes)
+                return false;
+        return !memcmp(ca->probes, cb->probes, ca->nr_probes * sizeof(ca->probes[0]));
+}
+
 /**
  * Returns the mounted filesystem options
  */
@@ -463,9 +2494,108 @@ static int partsfs_show_options(struct seq_file *seq, struct vfsmount *mnt)
         seq_printf(seq, ",uid=%u", state->option_uid);
         seq_printf(seq, ",gid=%u", state->option_gid);
         seq_printf(seq, ",mode=%o", state->option_mode);
+        switch (state->option_overlap) {
+                case PARTSFS_OVERLAP_READONLY:
+                        seq_puts(seq, ",overlap=ro");
+                        break;
+                case PARTSFS_OVERLAP_HIDE:
+                        seq_puts(seq, ",overlap=hide");
+                        break;
+                case PARTSFS_OVERLAP_REJECT:
+                        seq_puts(seq, ",overlap=reject");
+                        break;
+        }
+        if (state->option_check.flat_nested)
+                seq_puts(seq, ",nested=flat");
+        if (state->option_async_scan)
+                seq_puts(seq, ",scan=async");
+        if (state->option_check.defer_verify)
+                seq_puts(seq, ",verify=deferred");
+        if (state->option_check.use_cache)
+                seq_puts(seq, ",cache=on");
+        if (state->option_check.probe_fast || state->option_check.nr_probes) {
+                int i;
+                seq_puts(seq, ",probe=");
+                if (state->option_check.probe_fast)
+                        seq_puts(seq, state->option_check.nr_probes ? "fast:" : "fast");
+                for (i = 0; i < state->option_check.nr_probes; i++)
+                        seq_printf(seq, "%s%s", i ? ":" : "",
+                                   partition_format_name(state->option_check.probes[i]));
+        }
+        if (state->option_check.max_sectors)
+                seq_printf(seq, ",probe_sectors=%u", state->option_check.max_sectors);
+        if (state->option_check.max_msecs)
+                seq_printf(seq, ",probe_time=%u", state->option_check.max_msecs);
+        if (state->option_check.ldm_volumes)
+                seq_puts(seq, ",ldm=volumes");
+        if (state->option_members)
+                seq_printf(seq, ",ldm_members=%s", state->option_members);
+        if (state->option_check.md_arrays)
+                seq_puts(seq, ",md=arrays");
+        if (state->option_check.recover_scan)
+                seq_puts(seq, ",recover=scan");
         return 0;
 }
 
+/*
+ * Partitions information for the userspace tools (see partsfs_ioctl.h)
+ */
+static long partsfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+        struct inode *inode = filp->f_path.dentry->d_inode;
+        struct super_block *sb = inode->i_sb;
+        struct partsfs_state *state = (struct partsfs_state *) sb->s_fs_info;
+        struct partsfs_ioc_partition __user *argp = (struct partsfs_ioc_partition __user *) arg;
+        struct partsfs_ioc_partition info;
+        struct partsfs_partition *part;
+        long ret = 0;
+
+        if (cmd == PARTSFS_IOC_RESCAN) {
+                if (inode->i_ino != PARTSFS_ROOT_DIR_INODE)
+                        return -ENOTTY;
+                if (!capable(CAP_SYS_ADMIN))
+                        return -EACCES;
+                if (partsfs_wait_probe(sb))
+                        return -EINTR;
+                return partsfs_rescan(sb);
+        }
+
+        if (cmd == PARTSFS_IOC_FIND_SECTOR) {
+                if (copy_from_user(&info, argp, sizeof(info)))
+                        return -EFAULT;
+                if (partsfs_wait_probe(sb))
+                        return -EINTR;
+        }
+
+        down_read(&state->rescan_sem);
+        switch (cmd) {
+                case PARTSFS_IOC_GET_PARTITION:
+                        part = inode->i_private;
+                        if (part == NULL)
+                                ret = -ENOTTY; /* Not a partition file (or removed by a rescan) */
+                        break;
+                case PARTSFS_IOC_FIND_SECTOR:
+                        part = find_sector_owner(partsfs_table(sb), info.from);
+                        if (part == NULL)
+                                ret = -ENOENT;
+                        break;
+                default:
+                        ret = -ENOTTY;
+        }
+        if (ret == 0) {
+                memset(&info, 0, sizeof(info));
+                info.from = part->from;
+                info.size = part->size;
+                info.number = part->number;
+                info.overlap_group = part->overlap_group;
+        }
+        up_read(&state->rescan_sem);
+
+        if (ret == 0 && copy_to_user(argp, &info, sizeof(info)))
+                ret = -EFAULT;
+        return ret;
+}
+
 module_init(init_partsfs_fs);
 module_exit(exit_partsfs_fs);
 
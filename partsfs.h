@@ -21,17 +21,51 @@
 
 #include <linux/types.h>
 #include <linux/fs.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/kobject.h>
+#include <linux/kref.h>
 
 
 #define PARTSFS_MAGIC                 0x1979
 #define PARTSFS_ROOT_DIR_INODE             1
 #define PARTSFS_FIRST_PARTITION_INODE    100
+#define PARTSFS_FIRST_NESTED_INODE  0x1000000 /* + (parent partition << 8) + nested partition */
+#define PARTSFS_NESTED_INODE_SHIFT         8
 #define PARTSFS_MAX_NAME_LENGTH           16
 #define PARTSFS_DEFAULT_DIR_MODE        0555
 #define PARTSFS_DEFAULT_FILE_MODE       0600
+#define PARTSFS_MAX_MEMBERS               32 /* Other disks of an LDM disk group (ldm_members= option) */
+#define PARTSFS_MIRROR_SHIFT               8 /* Mirrored arrays: read 2^8 blocks from a copy, then the next one */
+
+/* Overlapping partitions policy (overlap= mount option) */
+#define PARTSFS_OVERLAP_ALLOW              0 /* expose them as usual */
+#define PARTSFS_OVERLAP_READONLY           1 /* expose them read-only */
+#define PARTSFS_OVERLAP_HIDE               2 /* do not expose them */
+#define PARTSFS_OVERLAP_REJECT             3 /* refuse to mount */
+
+/* Backup metadata verification status (/sys/fs/partsfs/<device>/verify) */
+#define PARTSFS_VERIFY_NONE                0 /* nothing to verify (or verified while probing) */
+#define PARTSFS_VERIFY_PENDING             1 /* deferred, not done yet */
+#define PARTSFS_VERIFY_OK                  2 /* the backups match */
+#define PARTSFS_VERIFY_MISMATCH            3 /* the backups don't match, or are unreadable */
+#define PARTSFS_VERIFY_ERROR               4 /* the verification could not run */
+
+/* Per partition I/O counters (<debugfs>/partsfs/<device>/stats) */
+#define PARTSFS_STAT_READ_OPS              0 /* read() calls */
+#define PARTSFS_STAT_READ_BYTES            1 /* bytes returned by read() */
+#define PARTSFS_STAT_CACHE_HITS            2 /* cached pages read() found */
+#define PARTSFS_STAT_CACHE_MISSES          3 /* pages read from the disk (readpage) */
+#define PARTSFS_STAT_WRITE_OPS             4 /* write() calls */
+#define PARTSFS_STAT_WRITE_BYTES           5 /* bytes written by write() */
+#define PARTSFS_STAT_WRITEBACK_PAGES       6 /* pages written to the disk (writepage) */
+#define PARTSFS_STAT_MAP_CALLS             7 /* get_block calls */
+#define PARTSFS_STAT_ITEMS                 8
+#define PARTSFS_LATENCY_BUCKETS           20 /* read()/write() latency: < 1 us, < 2 us, ... < 2^18 us, more */
 
 extern struct parsed_partitions *check_partition(struct gendisk *hd,
-                        struct block_device *bdev);
+                        struct block_device *bdev,
+                        const struct partition_check_options *opts);
 
 static struct inode *partsfs_get_inode(struct super_block *sb, ino_t s_ino);
 
@@ -40,10 +74,21 @@ static int partsfs_readdir(struct file *filp, void *dirent, filldir_t filldir);
 static struct dentry *partsfs_lookup(struct inode *dir, struct dentry *dentry,
                         struct nameidata *nd);
 
+static int partsfs_nested_readdir(struct file *filp, void *dirent, filldir_t filldir);
+
+static struct dentry *partsfs_nested_lookup(struct inode *dir, struct dentry *dentry,
+                        struct nameidata *nd);
+
 static int partsfs_writepage(struct page *page, struct writeback_control *wbc);
 
 static int partsfs_readpage(struct file *file, struct page *page);
 
+static ssize_t partsfs_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
+                        unsigned long nr_segs, loff_t pos);
+
+static ssize_t partsfs_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
+                        unsigned long nr_segs, loff_t pos);
+
 static int partsfs_write_begin(struct file *file, struct address_space *mapping,
                         loff_t pos, unsigned len, unsigned flags,
                         struct page **pagep, void **fsdata);
@@ -57,28 +102,46 @@ static struct dentry *partsfs_mount(struct file_system_type *fs_type,
 
 static void partsfs_kill_sb(struct super_block *sb);
 
+static int partsfs_remount(struct super_block *sb, int *flags, char *data);
+
 static int partsfs_show_options(struct seq_file *seq, struct vfsmount *mnt);
 
+static long partsfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+
 
 static const struct file_operations partsfs_dir_operations = {
         .read             = generic_read_dir,
         .readdir          = partsfs_readdir,
         .fsync            = generic_file_fsync,
         .llseek           = generic_file_llseek,
+        .unlocked_ioctl   = partsfs_ioctl,
 };
 
 static const struct inode_operations partsfs_dir_inode_operations = {
         .lookup           = partsfs_lookup,
 };
 
+static const struct file_operations partsfs_nested_dir_operations = {
+        .read             = generic_read_dir,
+        .readdir          = partsfs_nested_readdir,
+        .fsync            = generic_file_fsync,
+        .llseek           = generic_file_llseek,
+        .unlocked_ioctl   = partsfs_ioctl,
+};
+
+static const struct inode_operations partsfs_nested_dir_inode_operations = {
+        .lookup           = partsfs_nested_lookup,
+};
+
 static const struct file_operations partsfs_file_operations = {
         .llseek           = generic_file_llseek,
         .read             = do_sync_read,
         .write            = do_sync_write,
-        .aio_read         = generic_file_aio_read,
-        .aio_write        = generic_file_aio_write,
+        .aio_read         = partsfs_file_aio_read,
+        .aio_write        = partsfs_file_aio_write,
         .mmap             = generic_file_mmap,
-        .splice_read      = generic_file_splice_read
+        .splice_read      = generic_file_splice_read,
+        .unlocked_ioctl   = partsfs_ioctl,
 };
 
 static const struct address_space_operations partsfs_file_aops = {
@@ -92,6 +155,7 @@ static const struct address_space_operations partsfs_file_aops = {
 static const struct super_operations partsfs_super_ops = {
         .statfs           = partsfs_statfs,
         .show_options     = partsfs_show_options,
+        .remount_fs       = partsfs_remount,
 };
 
 static struct file_system_type partsfs_fs_type = {
@@ -103,21 +167,123 @@ static struct file_system_type partsfs_fs_type = {
 };
 
 /*
- * Partitions Filesystem Info
+ * Piece of a multi-extent partition (LDM volume)
  */
-struct partsfs_state {
-        struct {
-                sector_t from;    /* Partition starting position */
-                sector_t size;    /* Partition size, in sectors */
-        } parts[DISK_MAX_PARTS];
-        int number_of_partitions; /* Number of partitions */
+struct partsfs_extent {
+        sector_t offset;          /* Position in the partition (in the column, if striped) */
+        sector_t from;            /* Position on the disk */
+        sector_t size;            /* Size, in sectors */
+        int column;               /* Stripe column, 0 if not striped */
+        struct block_device *bdev; /* The disk: the mounted one, or a member */
+};
+
+/*
+ * I/O counters of a partition, one copy per CPU (summed when read)
+ */
+struct partsfs_stats {
+        u64 count[PARTSFS_STAT_ITEMS];             /* PARTSFS_STAT_* */
+        u64 latency[PARTSFS_LATENCY_BUCKETS];      /* read()/write() calls by duration */
+};
+
+/*
+ * Partition descriptor
+ */
+struct partsfs_partition {
+        sector_t from;            /* Partition starting position */
+        sector_t size;            /* Partition size, in sectors */
+        sector_t max_end;         /* Highest end of this and all the preceding partitions */
+        int number;               /* Partition number (file name) */
+        int overlap_group;        /* Overlapping partitions group, 0 if none */
+        nested_parser_t nested;   /* Nested table parser, until the nested table is parsed */
+        nested_parser_t nested_type; /* Nested table parser, kept (compared by a rescan) */
+        struct partsfs_partition *children; /* Nested partitions, sorted by number, NULL if none */
+        int number_of_children;   /* Number of nested partitions (0 is the whole partition) */
+        struct partsfs_extent *extents; /* Pieces of a multi-extent partition (LDM volume), NULL if contiguous */
+        int nr_extents;           /* Number of pieces */
+        int stripe_columns;       /* Number of stripe columns, 0 if not striped */
+        sector_t stripe_chunk;    /* Stripe chunk size, in sectors */
+        int mirrors;              /* Copies of a RAID-1 array (extent columns), 0 if not mirrored */
+        int recovered;            /* Found by the signature scan (recover=scan), not in a table */
+        int md_array;             /* An md array (md=arrays), its members are other partitions */
+        struct partsfs_stats __percpu *stats; /* I/O counters, kept across rescans */
+};
+
+/*
+ * Sector interval of a partition, a node of the sector index
+ * (an interval tree laid out in an array sorted by starting sector:
+ * the node of a range of the array is its middle entry)
+ */
+struct partsfs_interval {
+        sector_t from;            /* Starting sector */
+        sector_t end;             /* First sector after the interval */
+        sector_t max_end;         /* Highest end in the range this node is the middle of */
+        struct partsfs_partition *part; /* The partition */
+};
+
+/*
+ * Partitions table
+ * Replaced as a whole on rescan (published with RCU, see partsfs_rescan)
+ */
+struct partsfs_table {
+        struct partsfs_partition *parts;       /* Partitions, sorted by starting sector */
+        struct partsfs_partition **by_number;  /* The exposed partitions, sorted by number */
+        int number_of_extents;    /* Number of entries in parts */
+        int number_of_partitions; /* Number of exposed partitions (entries in by_number) */
+        int number_of_overlap_groups; /* Number of overlapping partitions groups */
+        struct partsfs_interval *index; /* Sector index of the contiguous partitions */
+        int index_size;           /* Number of entries in index */
+        struct partsfs_interval *extents_index; /* Sector index of the pieces on this disk of multi-extent partitions */
+        int extents_index_size;   /* Number of entries in extents_index */
         int last_partition;       /* Last partition */
-        sector_t sector_size;     /* Sector size */
         sector_t capacity;        /* The capacity of this drive, in 512-byte sectors */
+        backup_verifier_t verify; /* Deferred backup metadata check (verify=deferred), or NULL */
+        struct probe_profile profile[PARTITION_FORMATS_MAX + 1]; /* Cost of each format tried by the probe */
+        int nr_profile;           /* Number of entries in profile */
+        bool probe_cached;        /* The probe found the table in the probe cache */
+};
+
+/*
+ * Partitions Filesystem Info
+ */
+struct partsfs_state {
+        struct super_block *sb;   /* The superblock */
+        struct partsfs_table __rcu *table; /* Current partitions table */
+        struct rw_semaphore rescan_sem; /* Held for writing while the table is replaced */
+        struct mutex nested_mutex; /* Serializes the parsing of nested tables */
+        struct work_struct probe_work; /* Background probe (scan=async) */
+        struct completion probe_done; /* Completed when the full table is available */
+        int probe_status;         /* 0, or the error of the last background probe or rescan */
+        struct work_struct verify_work; /* Deferred backup metadata check (verify=deferred) */
+        int verify_status;        /* Backup metadata verification status */
+        struct kobject kobj;      /* /sys/fs/partsfs/<device> */
+        struct completion kobj_unregister; /* Completed when kobj is released */
+        struct dentry *debugfs;   /* <debugfs>/partsfs/<device>, or NULL */
+        struct dentry *debugfs_stats; /* Its stats file, or NULL */
+        struct kref kref;         /* Held by the superblock and the open stats files */
+        sector_t sector_size;     /* Sector size (logical block size of the disk) */
+        unsigned int sector_shift; /* log2(sector_size / 512), partitions are in 512-byte sectors */
         /* Mount options */
         uid_t option_uid;         /* The uid of all files */
         gid_t option_gid;         /* The gid of all files */
         umode_t option_mode;      /* The mode of all files */
+        int option_overlap;       /* Overlapping partitions policy */
+        bool option_async_scan;   /* Mount after the primary table, probe in background */
+        char *option_members;     /* Other disks of the LDM disk group (ldm_members=), or NULL */
+        struct partition_check_options option_check; /* Partitions probing options */
+        /* LDM disk group members (ldm_members=) */
+        struct block_device *members[PARTSFS_MAX_MEMBERS]; /* The open member disks */
+        u8 member_guid[PARTSFS_MAX_MEMBERS][16]; /* Their disk GUIDs */
+        sector_t member_start[PARTSFS_MAX_MEMBERS]; /* The start of their data area */
+        int number_of_members;    /* Number of open member disks */
+        fmode_t member_mode;      /* The mode they are open with */
 };
 
 static int parse_options(char *options, struct partsfs_state *state);
+static bool same_options(const struct partsfs_state *a, const struct partsfs_state *b);
+
+static void free_children(struct partsfs_partition *children, int number_of_children);
+static int mark_overlap_groups(struct partsfs_partition **sorted, int n, int groups);
+static int cmp_partition_from_ref(const void *a, const void *b);
+
+static int map_partition_extents(struct partsfs_state *state, struct partsfs_partition *part,
+                        const struct parsed_partition *parsed);
@@ -0,0 +1,58 @@
+/**
+ * Partitions Filesystem - ioctl interface
+ *
+ * Copyright (c) 2012 Andrea Bonomi (andrea.bonomi@gmail.com)
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the Linux-NTFS
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _PARTSFS_IOCTL_H
+#define _PARTSFS_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PARTSFS_IOC_MAGIC       0x79
+
+/*
+ * Partition extent, in 512-byte sectors
+ */
+struct partsfs_ioc_partition {
+        __u64 from;               /* Partition starting position */
+        __u64 size;               /* Partition size */
+        __s32 number;             /* Partition number (file name) */
+        __s32 overlap_group;      /* 0 if the partition does not overlap others */
+};
+
+/*
+ * On a partition file: describe the partition
+ */
+#define PARTSFS_IOC_GET_PARTITION  _IOR(PARTSFS_IOC_MAGIC, 1, struct partsfs_ioc_partition)
+
+/*
+ * On the root directory: find the partition owning the sector passed in
+ * 'from' (the one with the highest starting sector, if they overlap).
+ * Fails with ENOENT if no partition contains the sector.
+ */
+#define PARTSFS_IOC_FIND_SECTOR    _IOWR(PARTSFS_IOC_MAGIC, 2, struct partsfs_ioc_partition)
+
+/*
+ * On the root directory: read the partition table again (like a remount).
+ * Unchanged partitions keep their inodes and cached pages.
+ */
+#define PARTSFS_IOC_RESCAN         _IO(PARTSFS_IOC_MAGIC, 3)
+
+#endif /* _PARTSFS_IOCTL_H */
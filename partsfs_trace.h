@@ -0,0 +1,260 @@
+/**
+ * Partitions Filesystem tracepoints (events/partsfs)
+ *
+ * Copyright (c) 2012 Andrea Bonomi (andrea.bonomi@gmail.com)
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * The events are defined (CREATE_TRACE_POINTS) in partsfs.c,
+ * see the tools/partsfs_*.bt scripts for examples.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM partsfs
+
+#if !defined(_PARTSFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PARTSFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+
+/*
+ * Mount (mount_bdev, the probe included)
+ */
+TRACE_EVENT(partsfs_mount_start,
+        TP_PROTO(const char *dev_name),
+        TP_ARGS(dev_name),
+        TP_STRUCT__entry(
+                __string(dev_name, dev_name)
+        ),
+        TP_fast_assign(
+                __assign_str(dev_name, dev_name);
+        ),
+        TP_printk("%s", __get_str(dev_name))
+);
+
+TRACE_EVENT(partsfs_mount_end,
+        TP_PROTO(const char *dev_name, int ret),
+        TP_ARGS(dev_name, ret),
+        TP_STRUCT__entry(
+                __string(dev_name, dev_name)
+                __field(int, ret)
+        ),
+        TP_fast_assign(
+                __assign_str(dev_name, dev_name);
+                __entry->ret = ret;
+        ),
+        TP_printk("%s ret %d", __get_str(dev_name), __entry->ret)
+);
+
+/*
+ * Partition table probe (check_partition), and each format tried:
+ * probe_end has the 512-byte sectors charged to the probe budget,
+ * probe_format the profile of the format (see partitions/profile.c)
+ */
+TRACE_EVENT(partsfs_probe_start,
+        TP_PROTO(dev_t dev),
+        TP_ARGS(dev),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+        ),
+        TP_fast_assign(
+                __entry->dev = dev;
+        ),
+        TP_printk("dev %d:%d", MAJOR(__entry->dev), MINOR(__entry->dev))
+);
+
+TRACE_EVENT(partsfs_probe_format,
+        TP_PROTO(dev_t dev, const char *name, int res, u64 ns, unsigned int reads,
+                 unsigned int sectors, unsigned long alloc_bytes),
+        TP_ARGS(dev, name, res, ns, reads, sectors, alloc_bytes),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __string(name, name)
+                __field(int, res)
+                __field(u64, ns)
+                __field(unsigned int, reads)
+                __field(unsigned int, sectors)
+                __field(unsigned long, alloc_bytes)
+        ),
+        TP_fast_assign(
+                __entry->dev = dev;
+                __assign_str(name, name);
+                __entry->res = res;
+                __entry->ns = ns;
+                __entry->reads = reads;
+                __entry->sectors = sectors;
+                __entry->alloc_bytes = alloc_bytes;
+        ),
+        TP_printk("dev %d:%d %s res %d ns %llu reads %u sectors %u alloc_bytes %lu",
+                  MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(name),
+                  __entry->res, (unsigned long long)__entry->ns, __entry->reads,
+                  __entry->sectors, __entry->alloc_bytes)
+);
+
+TRACE_EVENT(partsfs_probe_end,
+        TP_PROTO(dev_t dev, int res, unsigned int sectors, int cached),
+        TP_ARGS(dev, res, sectors, cached),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(int, res)
+                __field(unsigned int, sectors)
+                __field(int, cached)
+        ),
+        TP_fast_assign(
+                __entry->dev = dev;
+                __entry->res = res;
+                __entry->sectors = sectors;
+                __entry->cached = cached;
+        ),
+        TP_printk("dev %d:%d res %d sectors %u%s",
+                  MAJOR(__entry->dev), MINOR(__entry->dev),
+                  __entry->res, __entry->sectors, __entry->cached ? " cached" : "")
+);
+
+/*
+ * A partition of the table read at mount or rescan, in 512-byte sectors
+ */
+TRACE_EVENT(partsfs_partition,
+        TP_PROTO(struct super_block *sb, int number, sector_t from, sector_t size),
+        TP_ARGS(sb, number, from, size),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(int, number)
+                __field(sector_t, from)
+                __field(sector_t, size)
+        ),
+        TP_fast_assign(
+                __entry->dev = sb->s_dev;
+                __entry->number = number;
+                __entry->from = from;
+                __entry->size = size;
+        ),
+        TP_printk("dev %d:%d partition %d start %llu size %llu",
+                  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->number,
+                  (unsigned long long)__entry->from, (unsigned long long)__entry->size)
+);
+
+/*
+ * Lookup of a partition name, ino 0 if not found
+ */
+TRACE_EVENT(partsfs_lookup,
+        TP_PROTO(struct inode *dir, struct dentry *dentry, struct inode *inode),
+        TP_ARGS(dir, dentry, inode),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(ino_t, dir)
+                __string(name, dentry->d_name.name)
+                __field(ino_t, ino)
+        ),
+        TP_fast_assign(
+                __entry->dev = dir->i_sb->s_dev;
+                __entry->dir = dir->i_ino;
+                __assign_str(name, dentry->d_name.name);
+                __entry->ino = inode ? inode->i_ino : 0;
+        ),
+        TP_printk("dev %d:%d dir %lu name %s ino %lu",
+                  MAJOR(__entry->dev), MINOR(__entry->dev),
+                  (unsigned long)__entry->dir, __get_str(name),
+                  (unsigned long)__entry->ino)
+);
+
+/*
+ * Mapping of a block of a partition file to the disk
+ * (iblock in logical blocks, sector in 512-byte sectors)
+ */
+TRACE_EVENT(partsfs_get_block,
+        TP_PROTO(struct inode *inode, sector_t iblock, sector_t sector, int create, int ret),
+        TP_ARGS(inode, iblock, sector, create, ret),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(ino_t, ino)
+                __field(sector_t, iblock)
+                __field(sector_t, sector)
+                __field(int, create)
+                __field(int, ret)
+        ),
+        TP_fast_assign(
+                __entry->dev = inode->i_sb->s_dev;
+                __entry->ino = inode->i_ino;
+                __entry->iblock = iblock;
+                __entry->sector = sector;
+                __entry->create = create;
+                __entry->ret = ret;
+        ),
+        TP_printk("dev %d:%d ino %lu iblock %llu sector %llu create %d ret %d",
+                  MAJOR(__entry->dev), MINOR(__entry->dev),
+                  (unsigned long)__entry->ino, (unsigned long long)__entry->iblock,
+                  (unsigned long long)__entry->sector, __entry->create, __entry->ret)
+);
+
+/*
+ * Page cache I/O of a partition file
+ */
+DECLARE_EVENT_CLASS(partsfs_page,
+        TP_PROTO(struct page *page),
+        TP_ARGS(page),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(ino_t, ino)
+                __field(pgoff_t, index)
+        ),
+        TP_fast_assign(
+                __entry->dev = page->mapping->host->i_sb->s_dev;
+                __entry->ino = page->mapping->host->i_ino;
+                __entry->index = page->index;
+        ),
+        TP_printk("dev %d:%d ino %lu index %lu",
+                  MAJOR(__entry->dev), MINOR(__entry->dev),
+                  (unsigned long)__entry->ino, (unsigned long)__entry->index)
+);
+
+DEFINE_EVENT(partsfs_page, partsfs_readpage,
+        TP_PROTO(struct page *page),
+        TP_ARGS(page)
+);
+
+DEFINE_EVENT(partsfs_page, partsfs_writepage,
+        TP_PROTO(struct page *page),
+        TP_ARGS(page)
+);
+
+TRACE_EVENT(partsfs_write_begin,
+        TP_PROTO(struct inode *inode, loff_t pos, unsigned int len, int ret),
+        TP_ARGS(inode, pos, len, ret),
+        TP_STRUCT__entry(
+                __field(dev_t, dev)
+                __field(ino_t, ino)
+                __field(loff_t, pos)
+                __field(unsigned int, len)
+                __field(int, ret)
+        ),
+        TP_fast_assign(
+                __entry->dev = inode->i_sb->s_dev;
+                __entry->ino = inode->i_ino;
+                __entry->pos = pos;
+                __entry->len = len;
+                __entry->ret = ret;
+        ),
+        TP_printk("dev %d:%d ino %lu pos %lld len %u ret %d",
+                  MAJOR(__entry->dev), MINOR(__entry->dev),
+                  (unsigned long)__entry->ino, (long long)__entry->pos,
+                  __entry->len, __entry->ret)
+);
+
+#endif /* _PARTSFS_TRACE_H */
+
+/* Out of the kernel tree: found with -I$(src), see the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE partsfs_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,84 @@
+#!/bin/sh -
+# Wall time of mounting many disks with scan=sync and with scan=async.
+# Each image is a DOS disk with PARTITIONS partitions (see mkimages.py),
+# most of them logical ones in the extended partition, which scan=async
+# reads in the background.  For each mode: the total time to mount all
+# the images one after the other, and the total time until all of them
+# are listed (the listing waits for the background probe).  The page
+# cache is dropped before each run and the probe cache is off.
+#
+# Usage: tools/async_bench.sh [IMAGES]
+IMAGES=${1:-16}
+PARTITIONS=${PARTITIONS:-128}
+SECTORS=${SECTORS:-64}
+TOOLS=$(dirname "$0")
+MNT=async-bench.mnt
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+WORK=$(mktemp -d)
+
+# Nanoseconds in ms
+ms() {
+  printf "%d.%03d" $(($1 / 1000000)) $(($1 / 1000 % 1000))
+}
+
+python3 "$TOOLS/mkimages.py" -f msdos -n "$PARTITIONS" -s "$SECTORS" \
+  "$WORK" > /dev/null || exit 1
+read -r image format files < "$WORK/MANIFEST"
+LOOPS=""
+i=0
+while [ $i -lt "$IMAGES" ]; do
+  cp --sparse=always "$image" "$WORK/$i.img"
+  LOOPS="$LOOPS $(losetup -f --show -r "$WORK/$i.img")" || break
+  mkdir -p $MNT/$i
+  i=$((i + 1))
+done
+rm -f "$image"
+
+printf "%-6s %7s %7s %16s %16s\n" scan images files "mount all (ms)" "listed (ms)"
+for scan in sync async; do
+  sync; echo 3 > /proc/sys/vm/drop_caches
+  start=$(date +%s%N)
+  i=0
+  for loop in $LOOPS; do
+    mount -t partsfs -o ro,cache=off,scan=$scan "$loop" $MNT/$i || break
+    i=$((i + 1))
+  done
+  mounted=$(date +%s%N)
+  found=0
+  i=0
+  for loop in $LOOPS; do
+    found=$((found + $(ls $MNT/$i | wc -l)))
+    i=$((i + 1))
+  done
+  end=$(date +%s%N)
+  i=0
+  for loop in $LOOPS; do
+    umount $MNT/$i
+    i=$((i + 1))
+  done
+
+  if [ "$found" -ne $((files * IMAGES)) ]; then
+    echo "scan=$scan: found $found partitions, expected $((files * IMAGES))" 1>&2
+  fi
+  printf "%-6s %7d %7d %16s %16s\n" $scan "$IMAGES" "$files" \
+    "$(ms $((mounted - start)))" "$(ms $((end - start)))"
+done
+
+for loop in $LOOPS; do
+  losetup -d "$loop"
+done
+rm -rf "$WORK" $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
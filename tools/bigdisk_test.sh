@@ -0,0 +1,96 @@
+#!/bin/sh -
+# Check partsfs on multi-terabyte disks: sparse images (16 TiB for GPT,
+# 2 TiB for the 32-bit labels) with partitions bigger than 4 GiB and
+# beyond 2 TiB. Each partition file must have the size of the matching
+# /dev/loopNpM device, and the same data at its start, past 4 GiB and at
+# its end (random 1 MiB chunks written through the kernel's partitions).
+#
+# Usage: tools/bigdisk_test.sh [LABELS...]
+LABELS=${*:-"gpt msdos mac amiga sun"}
+IMAGE=bigdisk-test.dsk
+MNT=bigdisk-test.mnt
+CHUNK=tmp.bigdisk-chunk
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+
+# Compare the 1 MiB chunk at MiB offset $3 of partition file $1 and device $2
+same_chunk() {
+  dd if="$1" of=$CHUNK bs=1M skip="$3" count=1 2> /dev/null &&
+    dd if="$2" bs=1M skip="$3" count=1 2> /dev/null | cmp -s - $CHUNK
+}
+
+FAILED=0
+for label in $LABELS; do
+  # Disk size in MiB: GPT has 64-bit LBAs, the others end at 2^32 sectors
+  case $label in
+    gpt) DISK=$((16 * 1024 * 1024)) ;;
+    *) DISK=$((2 * 1024 * 1024)) ;;
+  esac
+  rm -f $IMAGE
+  truncate -s ${DISK}M $IMAGE
+  LOOP=$(losetup -f --show -P $IMAGE) || exit 1
+  parted -s "$LOOP" unit MiB mklabel "$label" \
+    mkpart primary 1 5121 \
+    mkpart primary $((DISK / 2)) $((DISK / 2 + 6144)) \
+    mkpart primary $((DISK - 6145)) $((DISK - 1))
+  partprobe "$LOOP" 2> /dev/null
+
+  PARTS=""
+  for dev in "${LOOP}"p*; do
+    p=${dev##*p}
+    PARTS="$PARTS $p"
+    mib=$(($(blockdev --getsize64 "$dev") / 1048576))
+    for off in 0 4100 $((mib - 1)); do
+      dd if=/dev/urandom of="$dev" bs=1M seek=$off count=1 \
+        conv=notrunc 2> /dev/null
+    done
+  done
+  sync
+  echo 3 > /proc/sys/vm/drop_caches
+
+  if ! mount -t partsfs -o ro,cache=off "$LOOP" $MNT; then
+    echo "$label: mount failed" 1>&2
+    FAILED=$((FAILED + 1))
+  else
+    for p in $PARTS; do
+      size=$(blockdev --getsize64 "${LOOP}p$p")
+      if [ "$(stat -c %s $MNT/$p 2> /dev/null)" != "$size" ]; then
+        echo "$label: partition $p is not $size bytes" 1>&2
+        FAILED=$((FAILED + 1))
+        continue
+      fi
+      mib=$((size / 1048576))
+      for off in 0 4100 $((mib - 1)); do
+        if ! same_chunk $MNT/$p "${LOOP}p$p" $off; then
+          echo "$label: partition $p differs at $off MiB" 1>&2
+          FAILED=$((FAILED + 1))
+        fi
+      done
+    done
+    echo "$label: $(($DISK / 1024)) GiB disk,$PARTS"
+    umount $MNT
+  fi
+  losetup -d "$LOOP"
+done
+
+rm -f $IMAGE $CHUNK
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
+if [ "$FAILED" != "0" ]; then
+  echo "$FAILED failures" 1>&2
+  exit 1
+fi
+echo "All OK"
@@ -0,0 +1,298 @@
+#!/bin/sh -
+# Throughput and latency of the partsfs data path, with fio: the same
+# workloads on the partition files of partsfs, on the kernel's partitions
+# of a loop device (losetup -P) and on loop devices at the partition
+# offsets (losetup -o), over a RAM disk (brd), a memory backed null_blk
+# device and a file backed loop device.  The disk has three partitions
+# of PART_MIB MiB; every run uses partition 1 (jobs 1) or one job per
+# partition (jobs all).  The page cache is dropped before each run.
+#
+# The results of all the runs are printed as one JSON document, with the
+# bandwidth of partsfs relative to the two loop targets ("overhead_pct").
+# With BASELINE=FILE (an earlier output), the runs whose bandwidth is more
+# than THRESHOLD percent lower than in FILE are listed on stderr, and the
+# script exits with 2.
+#
+# Usage: tools/fio_bench.sh [BACKENDS...] > results.json
+#
+#   BACKENDS   brd, nullb, file (default: all three)
+#   PART_MIB   size of each partition (default 256)
+#   RUNTIME    seconds of each run, after RAMP seconds (default 5, 1)
+#   TARGETS    partsfs, loop_part, loop_offset (default: all three)
+#   WORKLOADS  NAME:RW:BS... (default below)
+#   MODES      buffered (psync), direct (libaio, O_DIRECT, IODEPTH 16),
+#              mmap (default: all three)
+#   JOBS       1, all (default: both)
+#   DIR        directory of the file backend image (default .)
+#
+# partsfs has no direct_IO: its O_DIRECT runs are listed with an error.
+BACKENDS=${*:-"brd nullb file"}
+PART_MIB=${PART_MIB:-256}
+RUNTIME=${RUNTIME:-5}
+RAMP=${RAMP:-1}
+TARGETS=${TARGETS:-"partsfs loop_part loop_offset"}
+WORKLOADS=${WORKLOADS:-"seqread:read:1M seqwrite:write:1M randread:randread:4k
+  randread64k:randread:64k randwrite:randwrite:4k randrw:randrw:4k"}
+MODES=${MODES:-"buffered direct mmap"}
+JOBS=${JOBS:-"1 all"}
+IODEPTH=${IODEPTH:-16}
+THRESHOLD=${THRESHOLD:-10}
+DIR=${DIR:-.}
+IMAGE=$DIR/fio-bench.dsk
+MNT=fio-bench.mnt
+NULLB=/sys/kernel/config/nullb/partsfs-bench
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+if ! command -v fio > /dev/null; then
+   echo "fio not found" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+WORK=$(mktemp -d)
+: > "$WORK/index"
+DISK_MIB=$((3 * PART_MIB + 2))
+
+# Create the disk of backend $1: sets DEV (the disk partsfs mounts) and
+# BACKING (what the loop targets are set up on)
+setup_backend() {
+  case $1 in
+    brd)
+      if [ -e /sys/module/brd ]; then
+        echo "brd: already loaded, skipped" 1>&2
+        return 1
+      fi
+      modprobe brd rd_nr=1 rd_size=$((DISK_MIB * 1024)) max_part=0 || return 1
+      DEV=/dev/ram0
+      BACKING=$DEV
+      ;;
+    nullb)
+      modprobe null_blk nr_devices=0 2> /dev/null
+      mkdir $NULLB 2> /dev/null || {
+        echo "nullb: no null_blk configfs, skipped" 1>&2
+        return 1
+      }
+      echo $DISK_MIB > $NULLB/size
+      echo 1 > $NULLB/memory_backed
+      echo 512 > $NULLB/blocksize
+      echo 1 > $NULLB/power
+      DEV=/dev/nullb$(cat $NULLB/index)
+      BACKING=$DEV
+      ;;
+    file)
+      rm -f "$IMAGE"
+      truncate -s ${DISK_MIB}M "$IMAGE" || return 1
+      DEV=$(losetup -f --show "$IMAGE") || return 1
+      BACKING=$IMAGE
+      ;;
+    *)
+      echo "$1: unknown backend" 1>&2
+      return 1
+      ;;
+  esac
+  udevadm settle 2> /dev/null
+}
+
+cleanup_backend() {
+  case $1 in
+    brd) rmmod brd ;;
+    nullb) echo 0 > $NULLB/power; rmdir $NULLB ;;
+    file) losetup -d "$DEV"; rm -f "$IMAGE" ;;
+  esac
+}
+
+# Run workload $3 ($4, $5), mode $6, jobs $7 of backend $1, target $2, on
+# the files $8
+run_fio() {
+  out=$WORK/$(wc -l < "$WORK/index").json
+  case $6 in
+    buffered) engine=psync; direct=0; depth=1 ;;
+    direct) engine=libaio; direct=1; depth=$IODEPTH ;;
+    mmap) engine=mmap; direct=0; depth=1 ;;
+  esac
+  {
+    printf "[global]\nioengine=%s\ndirect=%s\niodepth=%s\n" $engine $direct $depth
+    printf "rw=%s\nbs=%s\ntime_based=1\nruntime=%s\nramp_time=%s\n" \
+      "$4" "$5" "$RUNTIME" "$RAMP"
+    printf "group_reporting=1\nnorandommap=1\nrandrepeat=0\ninvalidate=1\n"
+    n=0
+    for f in $8; do
+      n=$((n + 1))
+      printf "[p%d]\nfilename=%s\n" $n "$f"
+    done
+  } > "$WORK/job.fio"
+  sync; echo 3 > /proc/sys/vm/drop_caches
+  if fio --output-format=json --output="$out" "$WORK/job.fio" 2> "$out.err"; then
+    status=ok
+  else
+    status=error
+  fi
+  echo "$1 $2 $3 $4 $5 $6 $7 $status $out" >> "$WORK/index"
+  echo "$1 $2 $3 $6 jobs $7: $status" 1>&2
+}
+
+for backend in $BACKENDS; do
+  setup_backend "$backend" || continue
+  parted -s "$BACKING" unit MiB mklabel msdos \
+    mkpart primary 1 $((1 + PART_MIB)) \
+    mkpart primary $((1 + PART_MIB)) $((1 + 2 * PART_MIB)) \
+    mkpart primary $((1 + 2 * PART_MIB)) $((1 + 3 * PART_MIB))
+  PLOOP=$(losetup -f --show -P "$BACKING")
+  partprobe "$PLOOP" 2> /dev/null
+  udevadm settle 2> /dev/null
+
+  # The three targets: the partition files, the partitions of the loop
+  # device and loop devices over the same byte ranges
+  T_partsfs=""
+  T_loop_part=""
+  T_loop_offset=""
+  for p in 1 2 3; do
+    sysfs=/sys/class/block/$(basename "$PLOOP")p$p
+    start=$(($(cat "$sysfs/start") * 512))
+    size=$(($(cat "$sysfs/size") * 512))
+    T_partsfs="$T_partsfs $MNT/$p"
+    T_loop_part="$T_loop_part ${PLOOP}p$p"
+    T_loop_offset="$T_loop_offset $(losetup -f --show -o $start --sizelimit $size "$BACKING")"
+  done
+
+  if mount -t partsfs -o cache=off "$DEV" $MNT; then
+    for target in $TARGETS; do
+      eval files=\$T_$target
+      first=${files# }
+      first=${first%% *}
+      for w in $WORKLOADS; do
+        name=${w%%:*}
+        rw=${w#*:}
+        bs=${rw#*:}
+        rw=${rw%%:*}
+        for mode in $MODES; do
+          for jobs in $JOBS; do
+            if [ "$jobs" = "1" ]; then
+              run_fio "$backend" "$target" "$name" "$rw" "$bs" "$mode" 1 "$first"
+            else
+              run_fio "$backend" "$target" "$name" "$rw" "$bs" "$mode" "$jobs" "$files"
+            fi
+          done
+        done
+      done
+    done
+    umount $MNT
+  else
+    echo "$backend: mount failed" 1>&2
+  fi
+
+  for l in $T_loop_offset $PLOOP; do
+    losetup -d "$l"
+  done
+  cleanup_backend "$backend"
+done
+
+# Merge the fio outputs: bandwidth (KiB/s), IOPS and completion latency
+# percentiles (us) of each direction, for the whole group of jobs
+python3 - "$WORK/index" "$PART_MIB" "$RUNTIME" "$THRESHOLD" "${BASELINE:-}" << 'EOF'
+import json, os, platform, sys
+
+index, part_mib, runtime, threshold, baseline = sys.argv[1:]
+KEYS = ("backend", "target", "workload", "rw", "bs", "mode", "jobs")
+
+def direction(d):
+    if not d or not d.get("io_bytes"):
+        return None
+    clat = d.get("clat_ns")
+    scale = 1000.0
+    if clat is None:                    # fio 2.x: usec
+        clat, scale = d.get("clat", {}), 1.0
+    pct = clat.get("percentile", {})
+    return {
+        "bw_kib": d.get("bw", 0),
+        "iops": round(d.get("iops", 0), 1),
+        "lat_mean_us": round(clat.get("mean", 0) / scale, 2),
+        "lat_p50_us": round(pct.get("50.000000", 0) / scale, 2),
+        "lat_p99_us": round(pct.get("99.000000", 0) / scale, 2),
+        "lat_p999_us": round(pct.get("99.900000", 0) / scale, 2),
+    }
+
+def bandwidth(r):
+    return sum(r[d]["bw_kib"] for d in ("read", "write") if r.get(d))
+
+results = []
+for line in open(index):
+    f = line.split()
+    r = dict(zip(KEYS, f[:7]))
+    r["status"] = f[7]
+    try:
+        job = json.load(open(f[8]))["jobs"][0]
+        for d in ("read", "write"):
+            v = direction(job.get(d))
+            if v:
+                r[d] = v
+        if job.get("error"):
+            r["status"] = "error"
+    except (OSError, ValueError, IndexError, KeyError):
+        r["status"] = "error"
+    if r["status"] != "ok":
+        try:
+            r["error"] = open(f[8] + ".err").read().strip().splitlines()[-1]
+        except (OSError, IndexError):
+            r["error"] = "no output"
+    results.append(r)
+
+# partsfs against the loop targets of the same backend and workload
+ref = {}
+for r in results:
+    if r["status"] == "ok":
+        ref[tuple(r[k] for k in KEYS if k != "target") + (r["target"],)] = bandwidth(r)
+for r in results:
+    if r["target"] != "partsfs" or r["status"] != "ok":
+        continue
+    key = tuple(r[k] for k in KEYS if k != "target")
+    r["overhead_pct"] = {}
+    for t in ("loop_part", "loop_offset"):
+        b = ref.get(key + (t,))
+        if b:
+            r["overhead_pct"][t] = round((b - bandwidth(r)) * 100.0 / b, 1)
+
+doc = {
+    "kernel": platform.release(),
+    "fio": os.popen("fio --version").read().strip(),
+    "part_mib": int(part_mib),
+    "runtime": int(runtime),
+    "results": results,
+}
+json.dump(doc, sys.stdout, indent=1, sort_keys=True)
+print()
+
+regressions = 0
+if baseline:
+    old = {}
+    for r in json.load(open(baseline))["results"]:
+        if r["status"] == "ok":
+            old[tuple(r[k] for k in KEYS)] = bandwidth(r)
+    for r in results:
+        b = old.get(tuple(r[k] for k in KEYS))
+        if not b or r["status"] != "ok":
+            continue
+        change = (bandwidth(r) - b) * 100.0 / b
+        if change < -float(threshold):
+            regressions += 1
+            sys.stderr.write("regression: %s: %d KiB/s, was %d (%.1f%%)\n" %
+                             (" ".join(r[k] for k in KEYS), bandwidth(r), b, change))
+sys.exit(2 if regressions else 0)
+EOF
+RESULT=$?
+
+rm -rf "$WORK"
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
+exit $RESULT
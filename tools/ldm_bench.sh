@@ -0,0 +1,53 @@
+#!/bin/sh -
+# Mount time of partsfs on synthetic LDM databases of growing size
+# (see mkldm.py), with the probe cache off so every mount parses the
+# whole database.
+#
+# Usage: tools/ldm_bench.sh [PARTITIONS...]
+SIZES=${*:-"100 500 1000 2000 2400"}
+ROUNDS=${ROUNDS:-20}
+TOOLS=$(dirname "$0")
+IMAGE=ldm-bench.dsk
+MNT=ldm-bench.mnt
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+
+printf "%10s %8s %12s\n" partitions vblks "mount (ms)"
+for n in $SIZES; do
+  python3 "$TOOLS/mkldm.py" -n "$n" -f 8 $IMAGE > /dev/null || break
+  LOOP=$(losetup -f --show $IMAGE)
+  start=$(date +%s%N)
+  i=0
+  while [ $i -lt "$ROUNDS" ]; do
+    mount -t partsfs -o ro,cache=off,probe=ldm "$LOOP" $MNT || break
+    umount $MNT
+    i=$((i + 1))
+  done
+  end=$(date +%s%N)
+  found=$(mount -t partsfs -o ro,cache=off,probe=ldm "$LOOP" $MNT &&
+          ls $MNT | wc -l; umount $MNT)
+  losetup -d "$LOOP"
+  if [ "${found:-0}" -ne "$n" ]; then
+    echo "$n partitions: found $found" 1>&2
+  fi
+  printf "%10d %8d %12d.%03d\n" "$n" $((3 * n + 1)) \
+    $(((end - start) / ROUNDS / 1000000)) \
+    $(((end - start) / ROUNDS / 1000 % 1000))
+done
+
+rm -f $IMAGE
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+#
+# mkimages.py - Create synthetic disk images of every partition format
+#
+# One sparse image per format, with N partitions of S sectors each, for
+# the mount and probe benchmark (mount_bench.sh) and for checking changes
+# to the parsers on many-partition disks.  The partitions are written one
+# after the other from sector 2048; the formats that chain their tables
+# (DOS extended partitions, Atari XGM) put each table two sectors before
+# its partition.  N is cut to what the format can hold:
+#
+#   gpt      N (128 entries, more if needed)   msdos   N, logicals past 3
+#   ldm      about 2400 (see mkldm.py)         lvm2    1000 (whole disk PV)
+#   amiga    16 (RDB)                          mac     N, plus the partition map
+#   atari    N, XGM past 3
+#   sun      8        sgi      16              osf     18
+#   ultrix   8        karma    2               sysv68  63
+#   ics      62 (Acorn ICS)
+#
+# Usage: mkimages.py [-f FORMATS] [-n PARTITIONS] [-s SECTORS] DIR
+#
+#   -f  comma separated formats (default: all of the above)
+#   -n  partitions per image (default 4)
+#   -s  size of each partition, in sectors (default 2048)
+#
+# The images are DIR/FORMAT-N.img.  DIR/MANIFEST has a line per image:
+# the image, its format and the number of partition files partsfs shows
+# for it (the DOS extended partition and the Mac partition map count).
+#
+
+import argparse
+import os
+import random
+import string
+import struct
+import subprocess
+import sys
+import uuid
+import zlib
+
+SECTOR = 512
+FIRST = 2048                    # First partition
+CHAIN_GAP = 2                   # Table sector and a spare one
+
+
+class Image:
+    """Sparse image file of @sectors sectors, written a sector at a time"""
+
+    def __init__(self, path, sectors):
+        self.f = open(path, 'wb')
+        self.f.truncate(sectors * SECTOR)
+        self.sectors = sectors
+
+    def put(self, sector, data):
+        self.f.seek(sector * SECTOR)
+        self.f.write(data)
+
+    def close(self):
+        self.f.close()
+
+
+def layout(n, size, gap=0):
+    """Start sectors of @n partitions of @size, @gap sectors apart"""
+    return [FIRST + gap + i * (size + gap) for i in range(n)]
+
+
+def disk_size(n, size, gap=0, tail=0):
+    return FIRST + n * (size + gap) + 2048 + tail
+
+
+def be32_sum_fix(buf, off):
+    """Store at @off the big endian word that makes the words sum to 0"""
+    total = sum(struct.unpack('>%dI' % (len(buf) // 4), buf)) & 0xffffffff
+    struct.pack_into('>I', buf, off, -total & 0xffffffff)
+
+
+def mk_gpt(path, n, size):
+    entries = max(128, -(-n // 4) * 4)
+    ent_sectors = entries * 128 // SECTOR
+    total = disk_size(n, size, tail=ent_sectors + 1)
+    last = total - 1
+    img = Image(path, total)
+    ents = bytearray(entries * 128)
+    linux = uuid.UUID('0fc63daf-8483-4772-8e79-3d69d8477de4').bytes_le
+    for i, start in enumerate(layout(n, size)):
+        name = ('part%d' % (i + 1)).encode('utf-16-le')
+        struct.pack_into('<16s16sQQQ72s', ents, i * 128, linux,
+                         uuid.uuid4().bytes_le, start, start + size - 1, 0,
+                         name)
+    disk_guid = uuid.uuid4().bytes_le
+
+    def header(my, alt, entries_lba):
+        h = bytearray(92)
+        struct.pack_into('<8sIIIIQQQQ16sQIII', h, 0, b'EFI PART', 0x10000,
+                         92, 0, 0, my, alt, 2 + ent_sectors,
+                         last - 1 - ent_sectors, disk_guid, entries_lba,
+                         entries, 128, zlib.crc32(bytes(ents)))
+        struct.pack_into('<I', h, 16, zlib.crc32(bytes(h)))
+        return bytes(h)
+
+    mbr = bytearray(SECTOR)
+    struct.pack_into('<B3xB3xII', mbr, 0x1BE, 0, 0xEE, 1,
+                     min(last, 0xffffffff))
+    mbr[0x1FE:0x200] = b'\x55\xaa'
+    img.put(0, mbr)
+    img.put(1, header(1, last, 2))
+    img.put(2, ents)
+    img.put(last - ent_sectors, ents)
+    img.put(last, header(last, 1, last - ent_sectors))
+    img.close()
+    return n
+
+
+def dos_entry(type, start, count):
+    return struct.pack('<B3xB3xII', 0, type, start, count)
+
+
+def mk_msdos(path, n, size):
+    primaries = n if n <= 4 else 3
+    logicals = n - primaries
+    img = Image(path, disk_size(n, size, CHAIN_GAP))
+    starts = layout(n, size, CHAIN_GAP)
+    mbr = bytearray(SECTOR)
+    for i in range(primaries):
+        mbr[0x1BE + 16 * i:0x1CE + 16 * i] = dos_entry(0x83, starts[i], size)
+    if logicals:
+        # Extended partition from the first EBR to the end of the last
+        # logical; each EBR has its logical and the link to the next EBR
+        ext = starts[primaries] - CHAIN_GAP
+        ext_size = logicals * (size + CHAIN_GAP)
+        mbr[0x1EE:0x1FE] = dos_entry(0x05, ext, ext_size)
+        for k in range(logicals):
+            ebr_sector = ext + k * (size + CHAIN_GAP)
+            ebr = bytearray(SECTOR)
+            ebr[0x1BE:0x1CE] = dos_entry(0x83, CHAIN_GAP, size)
+            if k + 1 < logicals:
+                ebr[0x1CE:0x1DE] = dos_entry(0x05, (k + 1) * (size + CHAIN_GAP),
+                                             size + CHAIN_GAP)
+            ebr[0x1FE:0x200] = b'\x55\xaa'
+            img.put(ebr_sector, ebr)
+    mbr[0x1FE:0x200] = b'\x55\xaa'
+    img.put(0, mbr)
+    img.close()
+    return n + 1 if logicals else n
+
+
+def mk_ldm(path, n, size):
+    mkldm = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         'mkldm.py')
+    subprocess.check_call([sys.executable, mkldm, '-n', str(n), '-s',
+                           str(size), path], stdout=subprocess.DEVNULL)
+    return n
+
+
+def lvm_crc(data):
+    """LVM2 checksum: CRC-32 from 0xf597a6cf, without the final inversion"""
+    return zlib.crc32(data, 0xf597a6cf ^ 0xffffffff) ^ 0xffffffff
+
+
+def lvm_id():
+    """Random LVM2 id: 32 characters, shown with dashes in the metadata"""
+    id = ''.join(random.choice(string.ascii_letters + string.digits)
+                 for i in range(32))
+    return id, '-'.join(id[a:b] for a, b in
+                        ((0, 6), (6, 10), (10, 14), (14, 18), (18, 22),
+                         (22, 26), (26, 32)))
+
+
+def mk_lvm2(path, n, size):
+    # A whole disk PV: label in sector 1, metadata area from 4 KiB to the
+    # first extent at FIRST, one extent of @size sectors per linear volume
+    total = disk_size(n, size)
+    img = Image(path, total)
+    mda_start = 4096
+    mda_size = FIRST * SECTOR - mda_start
+    pv_id, pv_text_id = lvm_id()
+    lvs = []
+    for i in range(n):
+        lvs.append('lv%d {\nid = "%s"\nstatus = ["READ", "WRITE", "VISIBLE"]\n'
+                   'segment_count = 1\nsegment1 {\nstart_extent = 0\n'
+                   'extent_count = 1\ntype = "striped"\nstripe_count = 1\n'
+                   'stripes = ["pv0", %d]\n}\n}\n' % (i + 1, lvm_id()[1], i))
+    text = ('bench {\nid = "%s"\nseqno = 1\nformat = "lvm2"\n'
+            'status = ["RESIZEABLE", "READ", "WRITE"]\nextent_size = %d\n'
+            'physical_volumes {\npv0 {\nid = "%s"\n'
+            'status = ["ALLOCATABLE"]\ndev_size = %d\npe_start = %d\n'
+            'pe_count = %d\n}\n}\nlogical_volumes {\n%s}\n}\n'
+            % (lvm_id()[1], size, pv_text_id, total, FIRST,
+               (total - FIRST) // size, ''.join(lvs))).encode('ascii')
+    if len(text) > 256 * 1024:
+        sys.exit('mkimages: lvm2: metadata too big, use fewer partitions')
+
+    label = bytearray(SECTOR)
+    struct.pack_into('<8sQII8s32sQQQQQQQQQ', label, 0, b'LABELONE', 1, 0, 32,
+                     b'LVM2 001', pv_id.encode('ascii'), total * SECTOR,
+                     FIRST * SECTOR, 0, 0, 0, mda_start, mda_size, 0, 0)
+    struct.pack_into('<I', label, 16, lvm_crc(bytes(label[20:])))
+    img.put(1, label)
+    mdah = bytearray(SECTOR)
+    struct.pack_into('<I16sIQQQQII', mdah, 0, 0, b' LVM2 x[5A%r0N*>', 1,
+                     mda_start, mda_size, SECTOR, len(text), lvm_crc(text), 0)
+    struct.pack_into('<I', mdah, 0, lvm_crc(bytes(mdah[4:])))
+    img.put(mda_start // SECTOR, mdah)
+    img.put(mda_start // SECTOR + 1, text)
+    img.close()
+    return n
+
+
+def rdb_checksum(block):
+    """RDB blocks: the first 64 (SummedLongs) longs sum to 0"""
+    struct.pack_into('>I', block, 8, 0)
+    total = sum(struct.unpack_from('>64I', block)) & 0xffffffff
+    struct.pack_into('>I', block, 8, -total & 0xffffffff)
+
+
+def mk_amiga(path, n, size):
+    img = Image(path, disk_size(n, size))
+    rdb = bytearray(SECTOR)
+    # 64 summed longs; partition blocks at 1..n; one sector "cylinders"
+    struct.pack_into('>4sIIIIIIII', rdb, 0, b'RDSK', 64, 0, 7, SECTOR,
+                     0, 0xffffffff, 1, 0xffffffff)
+    rdb_checksum(rdb)
+    img.put(0, rdb)
+    for i, start in enumerate(layout(n, size)):
+        pb = bytearray(SECTOR)
+        struct.pack_into('>4sIIII', pb, 0, b'PART', 64, 0, 7,
+                         i + 2 if i + 1 < n else 0xffffffff)
+        name = ('DH%d' % i).encode('ascii')
+        pb[36:37 + len(name)] = bytes([len(name)]) + name
+        env = [0] * 17
+        env[0] = 16                     # table size
+        env[1] = 128                    # longs per block
+        env[3] = 1                      # heads
+        env[4] = 1                      # sectors per block
+        env[5] = 1                      # blocks per track
+        env[9] = start                  # low cylinder
+        env[10] = start + size - 1      # high cylinder
+        env[16] = 0x444f5303            # DOS\3
+        struct.pack_into('>17I', pb, 128, *env)
+        rdb_checksum(pb)
+        img.put(1 + i, pb)
+    img.close()
+    return n
+
+
+def mk_mac(path, n, size):
+    entries = n + 1
+    img = Image(path, disk_size(n, size, tail=entries))
+    ddm = bytearray(SECTOR)
+    struct.pack_into('>HHI', ddm, 0, 0x4552, SECTOR, img.sectors)
+    img.put(0, ddm)
+
+    def entry(start, count, name, type):
+        e = bytearray(SECTOR)
+        struct.pack_into('>HHIII32s32sII', e, 0, 0x504D, 0, entries, start,
+                         count, name.encode('ascii'), type.encode('ascii'),
+                         0, count)
+        return e
+
+    img.put(1, entry(1, entries, 'Apple', 'Apple_partition_map'))
+    for i, start in enumerate(layout(n, size)):
+        img.put(2 + i, entry(start, size, 'part%d' % (i + 1), 'Apple_UNIX_SVR2'))
+    img.close()
+    return entries
+
+
+def atari_entry(id, start, count):
+    return struct.pack('>B3sII', 1, id, start, count)
+
+
+def mk_atari(path, n, size):
+    primaries = n if n <= 4 else 3
+    logicals = n - primaries
+    img = Image(path, disk_size(n, size, CHAIN_GAP))
+    starts = layout(n, size, CHAIN_GAP)
+    root = bytearray(SECTOR)
+    struct.pack_into('>I', root, 0x1C2, img.sectors)
+    for i in range(primaries):
+        root[0x1C6 + 12 * i:0x1D2 + 12 * i] = atari_entry(b'LNX', starts[i], size)
+    if logicals:
+        # XGM chain: each root sector has its partition, relative to
+        # itself, and the link to the next one, relative to the first
+        ext = starts[primaries] - CHAIN_GAP
+        root[0x1C6 + 12 * primaries:0x1D2 + 12 * primaries] = \
+            atari_entry(b'XGM', ext, logicals * (size + CHAIN_GAP))
+        for k in range(logicals):
+            xrs = bytearray(SECTOR)
+            xrs[0x1C6:0x1D2] = atari_entry(b'LNX', CHAIN_GAP, size)
+            if k + 1 < logicals:
+                xrs[0x1D2:0x1DE] = atari_entry(b'XGM', (k + 1) * (size + CHAIN_GAP),
+                                               size + CHAIN_GAP)
+            img.put(ext + k * (size + CHAIN_GAP), xrs)
+    img.put(0, root)
+    img.close()
+    return n
+
+
+def mk_sun(path, n, size):
+    img = Image(path, disk_size(n, size))
+    label = bytearray(SECTOR)
+    label[0:16] = b'partsfs bench'.ljust(16, b'\x00')
+    struct.pack_into('>I8sH', label, 128, 1, b'bench', 8)       # VTOC
+    for i in range(n):
+        struct.pack_into('>HH', label, 142 + 4 * i, 0x83, 0)
+    struct.pack_into('>I', label, 188, 0x600DDEEE)
+    # One sector per cylinder: the start cylinders are sectors
+    struct.pack_into('>HHHHHHHHHHHH', label, 420, 3600,
+                     min(img.sectors, 0xffff), 0, 0, 0, 1,
+                     min(img.sectors, 0xffff), 0, 1, 1, 0, 0)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('>II', label, 444 + 8 * i, start, size)
+    struct.pack_into('>H', label, 508, 0xDABE)
+    csum = 0
+    for (w,) in struct.iter_unpack('>H', bytes(label[:510])):
+        csum ^= w
+    struct.pack_into('>H', label, 510, csum)
+    img.put(0, label)
+    img.close()
+    return n
+
+
+def mk_sgi(path, n, size):
+    img = Image(path, disk_size(n, size))
+    label = bytearray(SECTOR)
+    struct.pack_into('>IHH', label, 0, 0x0be5a941, 0, 1)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('>III', label, 312 + 12 * i, size, start, 0x83)
+    be32_sum_fix(label, 504)
+    img.put(0, label)
+    img.close()
+    return n
+
+
+def mk_osf(path, n, size):
+    img = Image(path, disk_size(n, size))
+    sector = bytearray(SECTOR)
+    label = 64
+    struct.pack_into('<IHH16s16s', sector, label, 0x82564557, 0, 0,
+                     b'bench', b'partsfs')
+    struct.pack_into('<IIIIII', sector, label + 40, SECTOR, 1, 1,
+                     img.sectors, 1, img.sectors)
+    struct.pack_into('<IHH', sector, label + 132, 0x82564557, 0, n)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('<IIIBBH', sector, label + 148 + 16 * i, size, start,
+                         0, 8, 0, 0)
+    img.put(0, sector)
+    img.close()
+    return n
+
+
+def mk_ultrix(path, n, size):
+    img = Image(path, disk_size(n, size))
+    # struct ultrix_disklabel (72 bytes) ends at byte 16384, in host order
+    label = bytearray(72)
+    struct.pack_into('<ii', label, 0, 0x032957, 1)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('<iI', label, 8 + 8 * i, size, start)
+    img.f.seek(16384 - len(label))
+    img.f.write(label)
+    img.close()
+    return n
+
+
+def mk_karma(path, n, size):
+    img = Image(path, disk_size(n, size))
+    label = bytearray(SECTOR)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('<IB3xII', label, 270 + 16 * i, 0, 0x4d, start, size)
+    struct.pack_into('<H', label, 510, 0xAB56)
+    img.put(0, label)
+    img.close()
+    return n
+
+
+def mk_sysv68(path, n, size):
+    img = Image(path, disk_size(n, size))
+    blk0 = bytearray(SECTOR)
+    blk0[248:256] = b'MOTOROLA'
+    struct.pack_into('>IH', blk0, 384, 1, n + 1)
+    img.put(0, blk0)
+    slices = bytearray(SECTOR)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('>II', slices, 8 * i, size, start)
+    struct.pack_into('>II', slices, 8 * n, img.sectors, 0)     # whole disk
+    img.put(1, slices)
+    img.close()
+    return n
+
+
+def mk_ics(path, n, size):
+    img = Image(path, disk_size(n, size))
+    table = bytearray(SECTOR)
+    for i, start in enumerate(layout(n, size)):
+        struct.pack_into('<Ii', table, 8 * i, start, size)
+    struct.pack_into('<I', table, 508, (0x50617274 + sum(table[:508])) & 0xffffffff)
+    img.put(0, table)
+    img.close()
+    return n
+
+
+FORMATS = {
+    'gpt': (mk_gpt, 1 << 16),
+    'msdos': (mk_msdos, 1 << 16),
+    'ldm': (mk_ldm, 2400),
+    'lvm2': (mk_lvm2, 1000),
+    'amiga': (mk_amiga, 16),
+    'mac': (mk_mac, (1 << 16) - 2),
+    'atari': (mk_atari, 1 << 16),
+    'sun': (mk_sun, 8),
+    'sgi': (mk_sgi, 16),
+    'osf': (mk_osf, 18),
+    'ultrix': (mk_ultrix, 8),
+    'karma': (mk_karma, 2),
+    'sysv68': (mk_sysv68, 63),
+    'ics': (mk_ics, 62),
+}
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Create synthetic disk images')
+    ap.add_argument('-f', default=','.join(FORMATS), help='formats')
+    ap.add_argument('-n', type=int, default=4, help='partitions')
+    ap.add_argument('-s', type=int, default=2048, help='sectors per partition')
+    ap.add_argument('dir')
+    args = ap.parse_args()
+    if args.n < 1 or args.s < 1:
+        sys.exit('mkimages: -n and -s must be positive')
+
+    os.makedirs(args.dir, exist_ok=True)
+    with open(os.path.join(args.dir, 'MANIFEST'), 'a') as manifest:
+        for name in args.f.split(','):
+            if name not in FORMATS:
+                sys.exit('mkimages: unknown format %s' % name)
+            make, limit = FORMATS[name]
+            n = min(args.n, limit)
+            if n < args.n:
+                print('%s: %d partitions at most' % (name, limit),
+                      file=sys.stderr)
+            path = os.path.join(args.dir, '%s-%d.img' % (name, n))
+            files = make(path, n, args.s)
+            manifest.write('%s %s %d\n' % (path, name, files))
+            print('%s: %d partitions of %d sectors, %d files'
+                  % (path, n, args.s, files))
+
+
+if __name__ == '__main__':
+    main()
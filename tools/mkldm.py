@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# mkldm.py - Create a synthetic Windows dynamic disk (LDM) image
+#
+# The image has an MBR with a single 0x42 partition, the three PRIVHEADs,
+# the four TOCBLOCKs, a VMDB and N simple volumes (VOL5 -> CMP3 -> PRT3),
+# so the database holds 3 * N + 1 VBLKs, or more with -e or -d.  It is
+# meant to benchmark the LDM parser on large databases, the partitions are
+# tiny and the file is sparse.
+#
+# Usage: mkldm.py [-n VOLUMES] [-s SECTORS] [-e EXTENTS] [-f EVERY]
+#                 [-d DISKS [-c CHUNK]] IMAGE
+#
+#   -n  number of volumes (default 1000)
+#   -s  size of each partition, in sectors (default 8)
+#   -e  partitions per volume (default 1), as left by extending a volume:
+#       extent k of every volume comes after extent k-1 of all of them
+#   -f  store every EVERY-th volume as a fragmented VBLK (two records),
+#       0 for none (default 0)
+#   -d  number of disks in the disk group (default 1): every volume has
+#       its partitions on each disk, spanned in disk order.  The other
+#       disks are written to IMAGE.1, IMAGE.2, ... with the same database
+#   -c  stripe the volumes across the disks, in chunks of CHUNK sectors
+#       (a divisor of the partitions size), one column per disk
+#
+# The VMDB must fit before the backup PRIVHEAD of the 1 MiB database:
+# about 2400 partitions with 128-byte VBLKs.
+#
+
+import argparse
+import struct
+import sys
+import uuid
+
+SECTOR = 512
+DB_SIZE = 2048                  # LDM_DB_SIZE
+OFF_PRIV1 = 6
+OFF_PRIV2 = 1856
+OFF_PRIV3 = 2047
+OFF_TOCB = (1, 2, 2045, 2046)
+OFF_VMDB = 17
+VBLK_SIZE = 128
+VBLK_OFFSET = 512               # The first VBLKs are the VMDB itself
+
+VBLK_VOL5 = 0x51
+VBLK_CMP3 = 0x32
+VBLK_PRT3 = 0x33
+VBLK_DSK4 = 0x44
+COMP_STRIPE = 0x01
+COMP_BASIC = 0x02
+VBLK_FLAG_COMP_STRIPE = 0x10
+VBLK_FLAG_PART_INDEX = 0x08
+
+
+def vnum(n):
+    """Variable-width big endian number, with a length byte"""
+    b = n.to_bytes(max(1, (n.bit_length() + 7) // 8), 'big')
+    return bytes([len(b)]) + b
+
+
+def vstr(s):
+    """String with a length byte"""
+    b = s.encode('ascii')
+    return bytes([len(b)]) + b
+
+
+def vblk_body(type, flags, fields, length):
+    """Body of a VBLK, from offset 0x10: status, flags, type, length
+
+    The variable-width fields start at 0x18.  The length is the offset
+    of the end of the last field relative to a type-specific base, plus
+    a type-specific constant: both are folded into @length.
+    """
+    return struct.pack('>HBBI', 0, flags, type, length) + fields
+
+
+def dsk4(obj_id, name, guid):
+    head = vnum(obj_id) + vstr(name)
+    return vblk_body(VBLK_DSK4, 0, head + guid.bytes, len(head) + 45)
+
+
+def vol5(obj_id, name, size, guid):
+    head = vnum(obj_id) + vstr(name) + vstr('gen')
+    ddl = b'\x00'                               # disable drive letter
+    child = vnum(1)
+    state = b'ACTIVE'.ljust(16, b'\x00') + bytes(5)
+    fields = head + ddl + state + child + bytes(16) + vnum(size)
+    r_size = len(fields) + 0x18 - 0x3D
+    fields += bytes(4) + b'\x07' + guid.bytes   # partition type, GUID
+    return vblk_body(VBLK_VOL5, 0, fields, r_size + 58)
+
+
+def cmp3(obj_id, name, parent, children=1, chunk=0):
+    head = vnum(obj_id) + vstr(name) + vstr('ACTIVE')
+    type = COMP_STRIPE if chunk else COMP_BASIC
+    fields = head + bytes([type]) + bytes(4) + vnum(children) + bytes(16)
+    fields += vnum(parent)
+    if not chunk:
+        return vblk_body(VBLK_CMP3, 0, fields,
+                         len(fields) + 0x18 - 0x2D + 22)
+    fields += b'\x00' + vnum(chunk) + vnum(children)
+    return vblk_body(VBLK_CMP3, VBLK_FLAG_COMP_STRIPE, fields,
+                     len(fields) + 0x18 - 0x2E + 22)
+
+
+def prt3(obj_id, name, start, offset, size, parent, disk, index=None):
+    head = vnum(obj_id) + vstr(name)
+    fields = head + bytes(12) + struct.pack('>QQ', start, offset)
+    fields += vnum(size) + vnum(parent) + vnum(disk)
+    flags = 0
+    if index is not None:
+        fields += vnum(index)
+        flags = VBLK_FLAG_PART_INDEX
+    return vblk_body(VBLK_PRT3, flags, fields,
+                     len(fields) + 0x18 - 0x34 + 28)
+
+
+def records(group, body, nrec=1):
+    """Split a VBLK body into nrec on-disk records
+
+    The parser copies record n at 16 + n * (VBLK_SIZE - 32) of the
+    reassembled VBLK, so consecutive records overlap by 16 bytes.
+    """
+    stride = VBLK_SIZE - 32
+    data = body.ljust(stride * nrec + 16, b'\x00')
+    out = []
+    for rec in range(nrec):
+        chunk = data[rec * stride:rec * stride + VBLK_SIZE - 16]
+        head = struct.pack('>4sIIHH', b'VBLK', 0, group, rec, nrec)
+        assert len(chunk) == VBLK_SIZE - 16
+        out.append(head + chunk)
+    return out
+
+
+def privhead(guid, disk_start, disk_size, config_start):
+    ph = bytearray(SECTOR)
+    ph[0:8] = b'PRIVHEAD'
+    struct.pack_into('>HH', ph, 0x0C, 2, 11)
+    ph[0x30:0x30 + 36] = str(guid).encode('ascii')
+    struct.pack_into('>QQQQ', ph, 0x11B, disk_start, disk_size,
+                     config_start, DB_SIZE)
+    return bytes(ph)
+
+
+def tocblock(vmdb_sectors):
+    toc = bytearray(SECTOR)
+    toc[0:8] = b'TOCBLOCK'
+    toc[0x24:0x24 + 6] = b'config'
+    struct.pack_into('>QQ', toc, 0x2E, OFF_VMDB, vmdb_sectors)
+    toc[0x46:0x46 + 3] = b'log'
+    struct.pack_into('>QQ', toc, 0x50, OFF_PRIV2 + 1, 8)
+    return bytes(toc)
+
+
+def write_disk(image, guid, disk_size, db, vmdb_sectors):
+    disk_start = 63
+    config_start = disk_start + disk_size
+    total = config_start + DB_SIZE
+
+    mbr = bytearray(SECTOR)
+    struct.pack_into('<B3xB3xII', mbr, 0x1BE, 0, 0x42, 1, total - 1)
+    mbr[0x1FE:0x200] = b'\x55\xaa'
+
+    ph = privhead(guid, disk_start, disk_size, config_start)
+    with open(image, 'wb') as f:
+        f.truncate(total * SECTOR)
+
+        def put(sector, data):
+            f.seek(sector * SECTOR)
+            f.write(data)
+
+        put(0, mbr)
+        put(OFF_PRIV1, ph)
+        put(config_start + OFF_PRIV2, ph)
+        put(config_start + OFF_PRIV3, ph)
+        for off in OFF_TOCB:
+            put(config_start + off, tocblock(vmdb_sectors))
+        put(config_start + OFF_VMDB, db)
+    return total
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Create a synthetic LDM image')
+    ap.add_argument('-n', type=int, default=1000, help='volumes')
+    ap.add_argument('-s', type=int, default=8, help='sectors per partition')
+    ap.add_argument('-e', type=int, default=1, help='partitions per volume')
+    ap.add_argument('-f', type=int, default=0,
+                    help='fragment every F-th volume VBLK')
+    ap.add_argument('-d', type=int, default=1, help='disks')
+    ap.add_argument('-c', type=int, default=0, help='stripe chunk, sectors')
+    ap.add_argument('image')
+    args = ap.parse_args()
+    if args.c and (args.d < 2 or args.s % args.c):
+        sys.exit('mkldm: -c needs -d 2 or more, and to divide -s')
+
+    disk_guids = [uuid.uuid4() for d in range(args.d)]
+    disk_size = args.n * args.e * args.s
+
+    # VBLKs: obj ids 1 to DISKS (disks), then per volume: volume,
+    # component, partitions
+    vblks = [records(0, dsk4(d + 1, 'Disk%d' % (d + 1), disk_guids[d]))
+             for d in range(args.d)]
+    group = 1
+    obj_id = args.d + 1
+    nr_parts = 0
+    for i in range(args.n):
+        vol, comp = obj_id, obj_id + 1
+        obj_id += 2
+        body = vol5(vol, 'Volume%d' % (i + 1), args.d * args.e * args.s,
+                    uuid.uuid4())
+        nrec = 2 if args.f and i % args.f == 0 else 1
+        vblks.append(records(group, body, nrec))
+        group += 1
+        vblks.append(records(0, cmp3(comp, 'Volume%d-01' % (i + 1), vol,
+                                     args.d if args.c else 1, args.c)))
+        for d in range(args.d):
+            for k in range(args.e):
+                start = (k * args.n + i) * args.s
+                if args.c:
+                    offset, index = k * args.s, d
+                else:
+                    offset, index = (d * args.e + k) * args.s, None
+                vblks.append(records(0, prt3(obj_id, 'Disk%d-%02d'
+                                             % (d + 1, k * args.n + i + 1),
+                                             start, offset, args.s, comp,
+                                             d + 1, index)))
+                obj_id += 1
+                nr_parts += 1
+
+    first = VBLK_OFFSET // VBLK_SIZE
+    nr_records = sum(len(v) for v in vblks)
+    per_sector = SECTOR // VBLK_SIZE
+    last_seq = -(-(first + nr_records) // per_sector) * per_sector
+    vmdb_sectors = last_seq * VBLK_SIZE // SECTOR
+    if OFF_VMDB + vmdb_sectors > OFF_PRIV2:
+        sys.exit('mkldm: too many partitions for a %d sector database'
+                 % DB_SIZE)
+
+    # Unused records still have the VBLK magic
+    db = bytearray(struct.pack('>4s12x', b'VBLK').ljust(VBLK_SIZE, b'\x00')
+                   * last_seq)
+    vmdb = bytearray(VBLK_OFFSET)
+    vmdb[0:4] = b'VMDB'
+    struct.pack_into('>IIIHHH', vmdb, 4, last_seq, VBLK_SIZE, VBLK_OFFSET,
+                     1, 4, 10)
+    db[0:VBLK_OFFSET] = vmdb
+    seq = first
+    for v in vblks:
+        for rec in v:
+            rec = bytearray(rec)
+            struct.pack_into('>I', rec, 4, seq)
+            db[seq * VBLK_SIZE:(seq + 1) * VBLK_SIZE] = rec
+            seq += 1
+
+    for d in range(args.d):
+        image = args.image if d == 0 else '%s.%d' % (args.image, d)
+        total = write_disk(image, disk_guids[d], disk_size, db, vmdb_sectors)
+    print('%s: %d volumes, %d partitions, %d VBLKs, %d disks of %d sectors'
+          % (args.image, args.n, nr_parts, len(vblks), args.d, total))
+
+
+if __name__ == '__main__':
+    main()
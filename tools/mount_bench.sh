@@ -0,0 +1,115 @@
+#!/bin/sh -
+# Mount time and probe cost of partsfs on synthetic images of every
+# partition format (see mkimages.py), for growing numbers of partitions.
+# For each image: the mean mount and umount time over ROUNDS cycles, the
+# partition files found (and expected), the mean time of a full listing
+# of the mounted directory (ls -f, getdents with no stat, over ROUNDS
+# runs once the dentries are cached), the probe's sector reads, distinct
+# sectors and allocated bytes (from probe_profile, an upper bound of its
+# peak memory) and the slab memory held while mounted.
+# The probe cache is off; with PROBE=own only the image's format is
+# tried, otherwise all of them in the usual order.
+#
+# Usage: tools/mount_bench.sh [PARTITIONS...]
+SIZES=${*:-"4 16 128 1024"}
+ROUNDS=${ROUNDS:-20}
+FORMATS=${FORMATS:-"gpt,msdos,ldm,lvm2,amiga,mac,atari,sun,sgi,osf,ultrix,karma,sysv68,ics"}
+SECTORS=${SECTORS:-64}
+TOOLS=$(dirname "$0")
+MNT=mount-bench.mnt
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+WORK=$(mktemp -d)
+
+slab_kib() {
+  awk '/^Slab:/ { print $2 }' /proc/meminfo
+}
+
+# Mean of a total of nanoseconds over ROUNDS, in ms
+ms() {
+  printf "%d.%03d" $(($1 / ROUNDS / 1000000)) $(($1 / ROUNDS / 1000 % 1000))
+}
+
+printf "%-16s %6s %6s %10s %10s %12s %7s %7s %11s %8s\n" image files found \
+  "mount (ms)" "umount(ms)" "readdir (ms)" reads sectors alloc_bytes "slab KiB"
+DONE=" "
+for n in $SIZES; do
+  python3 "$TOOLS/mkimages.py" -f "$FORMATS" -n "$n" -s "$SECTORS" \
+    "$WORK/$n" > /dev/null || break
+  while read -r image format files; do
+    name=$(basename "$image" .img)
+    case "$DONE" in
+      *" $name "*) rm -f "$image"; continue ;;   # capped at a smaller count
+    esac
+    DONE="$DONE$name "
+    OPTS=ro,cache=off
+    if [ "$PROBE" = "own" ]; then
+      OPTS=$OPTS,probe=$format
+    fi
+    LOOP=$(losetup -f --show -r "$image") || break
+
+    mount_ns=0
+    umount_ns=0
+    i=0
+    while [ $i -lt "$ROUNDS" ]; do
+      start=$(date +%s%N)
+      mount -t partsfs -o $OPTS "$LOOP" $MNT || break
+      mid=$(date +%s%N)
+      umount $MNT
+      end=$(date +%s%N)
+      mount_ns=$((mount_ns + mid - start))
+      umount_ns=$((umount_ns + end - mid))
+      i=$((i + 1))
+    done
+
+    sync; echo 2 > /proc/sys/vm/drop_caches
+    before=$(slab_kib)
+    found=0
+    readdir_ns=0
+    total="- - -"
+    if mount -t partsfs -o $OPTS "$LOOP" $MNT; then
+      slab=$(($(slab_kib) - before))
+      found=$(ls $MNT | wc -l)
+      i=0
+      while [ $i -lt "$ROUNDS" ]; do
+        start=$(date +%s%N)
+        ls -f $MNT > /dev/null
+        end=$(date +%s%N)
+        readdir_ns=$((readdir_ns + end - start))
+        i=$((i + 1))
+      done
+      total=$(awk '$1 == "total" { print $5, $7, $9 }' \
+              /sys/fs/partsfs/"$(basename "$LOOP")"/probe_profile)
+      umount $MNT
+    else
+      slab=-
+    fi
+    losetup -d "$LOOP"
+    rm -f "$image"
+
+    if [ "$found" -ne "$files" ]; then
+      echo "$name: found $found partitions, expected $files" 1>&2
+    fi
+    set -- $total
+    printf "%-16s %6d %6d %10s %10s %12s %7s %7s %11s %8s\n" "$name" "$files" \
+      "$found" "$(ms $mount_ns)" "$(ms $umount_ns)" "$(ms $readdir_ns)" \
+      "$1" "$2" "$3" "$slab"
+  done < "$WORK/$n/MANIFEST"
+done
+
+rm -rf "$WORK"
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
@@ -0,0 +1,65 @@
+#!/bin/sh -
+# Throughput of the signature scan (recover=scan) on sparse images of
+# growing size, without a partition table and with two ext4 filesystems
+# (at the start and at the end), against a plain sequential read of the
+# same loop device.  The page cache is dropped before each run.
+#
+# Usage: tools/scan_bench.sh [SIZES_IN_GIB...]
+SIZES=${*:-"1 16 256 2048"}
+IMAGE=scan-bench.dsk
+MNT=scan-bench.mnt
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+
+# MB/s for $1 GiB in $2 nanoseconds
+rate() {
+  echo $(($1 * 1073741824 / ($2 / 1000)))
+}
+
+printf "%8s %10s %10s %12s %12s\n" GiB "scan (s)" "read (s)" "scan MB/s" "read MB/s"
+for g in $SIZES; do
+  rm -f $IMAGE
+  truncate -s "${g}G" $IMAGE || break
+  mkfs.ext4 -q -F -E offset=1048576 $IMAGE 64M || break
+  mkfs.ext4 -q -F -E offset=$((g * 1073741824 - 65 * 1048576)) $IMAGE 64M || break
+  LOOP=$(losetup -f --show $IMAGE)
+
+  sync; echo 3 > /proc/sys/vm/drop_caches
+  start=$(date +%s%N)
+  found=$(mount -t partsfs -o ro,cache=off,probe=msdos,recover=scan "$LOOP" $MNT &&
+          ls $MNT | wc -l; umount $MNT)
+  end=$(date +%s%N)
+  scan=$((end - start))
+
+  sync; echo 3 > /proc/sys/vm/drop_caches
+  start=$(date +%s%N)
+  dd if="$LOOP" of=/dev/null bs=4M 2> /dev/null
+  end=$(date +%s%N)
+  read=$((end - start))
+
+  losetup -d "$LOOP"
+  if [ "${found:-0}" -ne 2 ]; then
+    echo "${g} GiB: found ${found:-0} filesystems" 1>&2
+  fi
+  printf "%8d %6d.%03d %6d.%03d %12d %12d\n" "$g" \
+    $((scan / 1000000000)) $((scan / 1000000 % 1000)) \
+    $((read / 1000000000)) $((read / 1000000 % 1000)) \
+    "$(rate "$g" "$scan")" "$(rate "$g" "$read")"
+done
+
+rm -f $IMAGE
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
@@ -0,0 +1,68 @@
+#!/bin/sh -
+# Check partsfs against the kernel's own partitions on disks with 512 and
+# 4096-byte logical sectors (loop devices with --sector-size): for each
+# label type, every partition file must have the size and the content of
+# the matching /dev/loopNpM device.
+#
+# Usage: tools/sector_test.sh [LABELS...]
+LABELS=${*:-"msdos gpt"}
+IMAGE=sector-test.dsk
+MNT=sector-test.mnt
+
+# Make sure only root can run this script
+if [ "$(id -u)" != "0" ]; then
+   echo "Please run this script as root" 1>&2
+   exit 1
+fi
+
+LOADED=0
+if ! grep -q partsfs /proc/filesystems; then
+  insmod pfs.ko || exit 1
+  LOADED=1
+fi
+mkdir -p $MNT
+
+FAILED=0
+for ss in 512 4096; do
+  for label in $LABELS; do
+    rm -f $IMAGE
+    truncate -s 64M $IMAGE
+    LOOP=$(losetup -f --show -P --sector-size $ss $IMAGE) || exit 1
+    parted -s "$LOOP" mklabel "$label" \
+      mkpart primary 1MiB 9MiB \
+      mkpart primary 9MiB 33MiB \
+      mkpart primary 40MiB 63MiB
+    partprobe "$LOOP" 2> /dev/null
+    for p in 1 2 3; do
+      dd if=/dev/urandom of="${LOOP}p$p" bs=1M 2> /dev/null
+    done
+    sync
+    echo 3 > /proc/sys/vm/drop_caches
+
+    if ! mount -t partsfs -o ro,cache=off "$LOOP" $MNT; then
+      echo "$label/$ss: mount failed" 1>&2
+      FAILED=$((FAILED + 1))
+    else
+      for p in 1 2 3; do
+        if ! cmp -s $MNT/$p "${LOOP}p$p"; then
+          echo "$label/$ss: partition $p differs" 1>&2
+          FAILED=$((FAILED + 1))
+        fi
+      done
+      echo "$label/$ss: $(ls $MNT | wc -l) partitions"
+      umount $MNT
+    fi
+    losetup -d "$LOOP"
+  done
+done
+
+rm -f $IMAGE
+rmdir $MNT
+if [ "$LOADED" = "1" ]; then
+  rmmod pfs.ko
+fi
+if [ "$FAILED" != "0" ]; then
+  echo "$FAILED failures" 1>&2
+  exit 1
+fi
+echo "All OK"